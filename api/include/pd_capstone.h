@@ -53,6 +53,43 @@ typedef struct PDCapstoneFuncs {
 
 } PDCapstoneFuncs;
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Capstone Service 2 adds a way to decode many instructions without any allocations per call. Instructions are decoded
+// (using cs_disasm_iter) into a caller owned struct-of-arrays batch. Decoding reuses a single cs_insn that is allocated
+// with insn_alloc (and freed with free(insn, 1)). Notice that the insn has to be allocated after CS_OPT_DETAIL has been
+// set as the detail data is only allocated if detail is on.
+
+#define PDCAPSTONEFUNCS2_GLOBAL "Capstone Service 2"
+
+typedef struct PDCapstoneBatch {
+	// Arrays with room for (at least) capacity instructions
+	uint64_t* addresses;
+	uint16_t* sizes;
+	uint32_t* ids;
+	// Offset into text for each instruction. The text is "mnemonic op_str" and zero terminated
+	uint32_t* text_offsets;
+	char* text;
+	size_t capacity;
+	size_t text_capacity;
+	// Number of instructions/text bytes written
+	size_t count;
+	size_t text_size;
+} PDCapstoneBatch;
+
+typedef struct PDCapstoneFuncs2 {
+	// Same as Service 1 so it's possible to use this struct as PDCapstoneFuncs as well
+	PDCapstoneFuncs funcs;
+
+	cs_insn* (*insn_alloc)(csh handle);
+
+	// Decodes up to count instructions (0 = until the batch or the code is full) and appends them to the batch.
+	// Returns the number of decoded instructions. code, size and address are updated to point past the
+	// last decoded instruction so decoding can be continued with another call.
+	size_t (*disasm_batch)(csh handle, const uint8_t** code, size_t* size, uint64_t* address, size_t count,
+						   cs_insn* insn, PDCapstoneBatch* batch);
+
+} PDCapstoneFuncs2;
+
 #ifdef __cplusplus
 }
 #endif
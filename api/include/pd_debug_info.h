@@ -0,0 +1,56 @@
+#ifndef PD_DEBUG_INFO_SERVICE_
+#define PD_DEBUG_INFO_SERVICE_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Debug Info Service 1 reads the symbols and line tables of ELF files in the host. The file is memory mapped, the
+// .debug_line programs are parsed on all cores and the result is cached on disk by build-id so loading the same
+// binary again is quick. The symbols are added to the Symbols Service (see pd_symbols.h) with the file name as module.
+//
+// Addresses passed in and returned are target addresses, that is file addresses + the load bias.
+//
+// Loading is done on a background thread. Call poll (once per update is fine) until the state is no longer
+// PDDebugInfoState_Loading. Until the file is loaded the other functions behave as if there is no info.
+
+#define PDDEBUGINFOFUNCS_GLOBAL "Debug Info Service 1"
+
+typedef enum PDDebugInfoState {
+	PDDebugInfoState_Loading,
+	PDDebugInfoState_Loaded,
+	PDDebugInfoState_Failed,
+} PDDebugInfoState;
+
+typedef struct PDDebugInfoFuncs {
+	// Starts loading the file and returns a handle to it. The handle has to be unloaded even if loading fails
+	uint32_t (*load)(const char* filename, uint64_t loadBias);
+
+	// Returns a PDDebugInfoState
+	int (*poll)(uint32_t handle);
+
+	void (*unload)(uint32_t handle);
+
+	// Update when the target has been launched and the file relocated (PIE executables)
+	void (*set_load_bias)(uint32_t handle, uint64_t loadBias);
+
+	// Returns 1 and writes the file (zero terminated, truncated if needed) and line of the address
+	int (*resolve_address)(uint32_t handle, uint64_t address, char* filename, int filenameSize, uint32_t* line);
+
+	// Returns 1 and the address of the first code on the line (or the next line with code). The filename can be
+	// a full path or the end of one such as "src/main.c"
+	int (*resolve_file_line)(uint32_t handle, const char* filename, uint32_t line, uint64_t* address);
+
+	// Source files used by the line tables, returns NULL when index is past the end
+	const char* (*source_file)(uint32_t handle, uint32_t index);
+
+} PDDebugInfoFuncs;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
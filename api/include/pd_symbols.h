@@ -0,0 +1,48 @@
+#ifndef PD_SYMBOLS_SERVICE_
+#define PD_SYMBOLS_SERVICE_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Symbols Service 1 holds the symbols of everything the backends have loaded so any plugin can map an address to
+// symbol+offset. Backends add a module per loaded file/segment and its symbols, views look addresses up. Lookups are
+// a binary search over a pre-built index and don't allocate. The strings returned in PDSymbolInfo are owned by the
+// service and are only valid until symbols are added or removed so copy them if they need to be kept.
+
+#define PDSYMBOLFUNCS_GLOBAL "Symbols Service 1"
+
+typedef struct PDSymbolInfo {
+	const char* name;
+	const char* module;
+	uint64_t start;
+	uint64_t size;
+	uint64_t offset;	// address - start
+} PDSymbolInfo;
+
+typedef struct PDSymbolFuncs {
+	// Adds a module covering base..base + size (size 0 = no limit) and returns the id used when adding symbols to it.
+	// A module with the same name is replaced
+	uint32_t (*add_module)(const char* name, uint64_t base, uint64_t size);
+	void (*remove_module)(uint32_t module);
+
+	// A size of 0 makes the symbol end where the next symbol in the module starts (or at the end of the module)
+	void (*add_symbol)(uint32_t module, const char* name, uint64_t address, uint64_t size);
+
+	// Returns 1 and fills in info if the address is in a symbol. If symbols overlap the innermost one is returned
+	int (*lookup)(uint64_t address, PDSymbolInfo* info);
+
+	// Writes "name" or "name+0x10" to buffer (zero terminated, truncated if needed). Returns the length or 0 if
+	// the address isn't in a symbol
+	int (*format_address)(uint64_t address, char* buffer, int bufferSize);
+
+} PDSymbolFuncs;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -314,6 +314,7 @@ typedef struct PDUI {
     void (*fill_circle)(PDVec2 pos, float radius, PDColor color, unsigned int num_seg, int aa);
     void* (*image_create_rgba)(unsigned int width, unsigned int height);
     void (*image_update)(void* dest, const void* src, unsigned int size);
+    void (*image_update_rows)(void* dest, const void* src, unsigned int firstRow, unsigned int rowCount);
 } PDUI;
 
 // !!! End of autogenerated data. !!!
@@ -4,6 +4,7 @@ use std::ffi::CStr;
 use std::mem::transmute;
 use std::slice;
 use std::ptr;
+use std::marker::PhantomData;
 use std::str::from_utf8;
 use capstone_m68k::cs_detail;
 
@@ -42,7 +43,38 @@ pub struct CCapstone1 {
     regname: extern "C" fn(handle: *const c_void, id: u16) -> *const i8,
 }
 
-#[derive(Clone, Copy, Debug)]
+///
+/// Struct-of-arrays output of Capstone Service 2 batch decoding (matches PDCapstoneBatch)
+///
+#[repr(C)]
+pub struct CCapstoneBatch {
+    addresses: *mut u64,
+    sizes: *mut u16,
+    ids: *mut u32,
+    text_offsets: *mut u32,
+    text: *mut u8,
+    capacity: usize,
+    text_capacity: usize,
+    count: usize,
+    text_size: usize,
+}
+
+#[repr(C)]
+pub struct CCapstone2 {
+    // PDCapstoneFuncs (Capstone Service 1) which CCapstone1 only maps the start of
+    funcs: [*const c_void; 16],
+    insn_alloc: extern "C" fn(handle: *const c_void) -> *mut Insn,
+    disasm_batch: extern "C" fn(handle: *const c_void,
+                                code: *mut *const u8,
+                                code_size: *mut usize,
+                                address: *mut u64,
+                                count: usize,
+                                insn: *mut Insn,
+                                batch: *mut CCapstoneBatch)
+                                -> usize,
+}
+
+#[derive(Clone, Copy, Debug, PartialEq)]
 pub enum Arch {
     Arm = 0,
     Arm64,
@@ -126,22 +158,53 @@ pub enum Error {
 
 pub struct Capstone {
     pub api: *mut CCapstone1,
+    /// Capstone Service 2 (null if the host doesn't provide it)
+    pub api2: *mut CCapstone2,
     pub handle: *const c_void,
+    // All handles opened so far. Switching between arch/mode pairs picks up the already opened
+    // handle instead of going through cs_open/cs_close again.
+    handles: Vec<(Arch, Mode, *const c_void)>,
 }
 
+// The service is a table of plain C functions and Capstone handles aren't tied to the thread that
+// opened them so an instance can be moved to a worker thread (as long as it's only used there)
+unsafe impl Send for Capstone {}
+
 impl Capstone {
-    pub fn open(&mut self, arch: Arch, mode: Mode) -> Result<(), Error> {
-        // If handle is already setup we just return from here
-        if self.handle != ptr::null_mut() {
-            return Ok(());
+    pub fn new(api: *mut CCapstone1) -> Capstone {
+        Capstone {
+            api: api,
+            api2: ptr::null_mut(),
+            handle: ptr::null(),
+            handles: Vec::new(),
         }
+    }
 
+    ///
+    /// Creates a new instance (without any open handles) using the same service. Use this to
+    /// get one instance per thread when decoding on multiple threads.
+    ///
+    pub fn new_instance(&self) -> Capstone {
+        let mut capstone = Capstone::new(self.api);
+        capstone.api2 = self.api2;
+        capstone
+    }
+
+    pub fn open(&mut self, arch: Arch, mode: Mode) -> Result<(), Error> {
+        // If a handle for this arch/mode is already setup we just switch to it
+        for &(a, m, handle) in &self.handles {
+            if a == arch && m == mode {
+                self.handle = handle;
+                return Ok(());
+            }
+        }
 
         let mut handle: *const c_void = 0 as *const c_void;
         unsafe {
             match ((*self.api).open)(arch as c_int, mode.bits as c_int, &mut handle) {
                 0 => {
                     self.handle = handle;
+                    self.handles.push((arch, mode, handle));
                     Ok(())
                 }
                 e => {
@@ -164,6 +227,39 @@ impl Capstone {
         }
     }
 
+    ///
+    /// Turn detail (registers read/written, operands, groups) on or off for the current handle.
+    /// Decoding is a lot cheaper with detail off.
+    ///
+    pub fn set_detail(&self, enable: bool) -> Result<(), Error> {
+        self.set_option(Opt::Detail, if enable { 3 } else { 0 })
+    }
+
+    ///
+    /// Creates a decoder that decodes into caller owned batches without allocating per call. Needs
+    /// Capstone Service 2 and an open handle. The decoder is bound to the current handle and its
+    /// detail setting so set_detail has to be called before this.
+    ///
+    pub fn batch_decoder<'a>(&'a self) -> Option<BatchDecoder<'a>> {
+        if self.api2.is_null() || self.handle.is_null() {
+            return None;
+        }
+
+        let insn = unsafe { ((*self.api2).insn_alloc)(self.handle) };
+
+        if insn.is_null() {
+            return None;
+        }
+
+        Some(BatchDecoder {
+            api: self.api,
+            api2: self.api2,
+            handle: self.handle,
+            insn: insn,
+            capstone: PhantomData,
+        })
+    }
+
     pub fn disasm(&self, code: &[u8], addr: u64, count: usize) -> Result<Instructions, Error> {
         let mut ptr: *const Insn = ptr::null();
         let insn_count;
@@ -208,6 +304,143 @@ impl Capstone {
     }
 }
 
+impl Drop for Capstone {
+    fn drop(&mut self) {
+        for &mut (_, _, ref mut handle) in &mut self.handles {
+            unsafe {
+                ((*self.api).close)(handle);
+            }
+        }
+    }
+}
+
+///
+/// Caller owned struct-of-arrays storage for decoded instructions. Allocate once with the max
+/// number of instructions needed and reuse it (by calling clear) between decodes.
+///
+pub struct InsnBatch {
+    pub addresses: Vec<u64>,
+    pub sizes: Vec<u16>,
+    pub ids: Vec<u32>,
+    text_offsets: Vec<u32>,
+    text: Vec<u8>,
+    count: usize,
+    text_size: usize,
+}
+
+// Room for mnemonic (32) + ' ' + op_str (160) including terminator per instruction. The decoder
+// checks that this much is free before decoding each instruction.
+const BATCH_TEXT_PER_INSN: usize = 193;
+
+impl InsnBatch {
+    pub fn with_capacity(capacity: usize) -> InsnBatch {
+        InsnBatch {
+            addresses: vec![0; capacity],
+            sizes: vec![0; capacity],
+            ids: vec![0; capacity],
+            text_offsets: vec![0; capacity],
+            text: vec![0; capacity * BATCH_TEXT_PER_INSN],
+            count: 0,
+            text_size: 0,
+        }
+    }
+
+    #[inline]
+    pub fn len(&self) -> usize {
+        self.count
+    }
+
+    #[inline]
+    pub fn is_full(&self) -> bool {
+        self.count == self.addresses.len()
+    }
+
+    pub fn clear(&mut self) {
+        self.count = 0;
+        self.text_size = 0;
+    }
+
+    ///
+    /// "mnemonic op_str" for instruction at index
+    ///
+    pub fn text(&self, index: usize) -> &str {
+        let start = self.text_offsets[index] as usize;
+        let len = self.text[start..].iter().position(|c| *c == 0).unwrap_or(0);
+        from_utf8(&self.text[start..start + len]).unwrap_or("")
+    }
+
+    pub fn mnemonic(&self, index: usize) -> &str {
+        let text = self.text(index);
+        text.split(' ').next().unwrap_or(text)
+    }
+
+    pub fn op_str(&self, index: usize) -> &str {
+        let text = self.text(index);
+        text.find(' ').map(|pos| &text[pos + 1..]).unwrap_or("")
+    }
+}
+
+///
+/// Reusable decode context on top of cs_disasm_iter. Holds a single cs_insn that is used for all
+/// decoding so there are no allocations when decoding. It uses the handle of the Capstone
+/// instance it was created from and can't outlive it.
+///
+pub struct BatchDecoder<'a> {
+    api: *mut CCapstone1,
+    api2: *mut CCapstone2,
+    handle: *const c_void,
+    insn: *mut Insn,
+    capstone: PhantomData<&'a Capstone>,
+}
+
+impl<'a> BatchDecoder<'a> {
+    ///
+    /// Decode up to count (0 = as many as fits) instructions from code and append them to batch.
+    /// Returns the number of decoded instructions and the number of bytes of code used. Decoding
+    /// stops early when the batch is full or at the first invalid instruction.
+    ///
+    pub fn decode(&mut self, code: &[u8], address: u64, count: usize, batch: &mut InsnBatch) -> (usize, usize) {
+        let mut code_ptr = code.as_ptr();
+        let mut code_size = code.len();
+        let mut addr = address;
+
+        let mut c_batch = CCapstoneBatch {
+            addresses: batch.addresses.as_mut_ptr(),
+            sizes: batch.sizes.as_mut_ptr(),
+            ids: batch.ids.as_mut_ptr(),
+            text_offsets: batch.text_offsets.as_mut_ptr(),
+            text: batch.text.as_mut_ptr(),
+            capacity: batch.addresses.len(),
+            text_capacity: batch.text.len(),
+            count: batch.count,
+            text_size: batch.text_size,
+        };
+
+        let decoded = unsafe {
+            ((*self.api2).disasm_batch)(self.handle,
+                                        &mut code_ptr,
+                                        &mut code_size,
+                                        &mut addr,
+                                        count,
+                                        self.insn,
+                                        &mut c_batch)
+        };
+
+        batch.count = c_batch.count;
+        batch.text_size = c_batch.text_size;
+
+        (decoded, code.len() - code_size)
+    }
+}
+
+impl<'a> Drop for BatchDecoder<'a> {
+    fn drop(&mut self) {
+        unsafe {
+            ((*self.api).free)(self.insn, 1);
+        }
+    }
+}
+
 // Using an actual slice is causing issues with auto deref, instead implement a custom iterator and
 // drop trait
 pub struct Instructions {
@@ -323,3 +556,119 @@ impl Debug for Insn {
             .finish()
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::mem;
+
+    extern "C" fn fake_open(_arch: c_int, _mode: c_int, handle: *mut *const c_void) -> c_int {
+        unsafe { *handle = 1 as *const c_void };
+        0
+    }
+
+    extern "C" fn fake_close(_handle: *mut *const c_void) -> c_int {
+        0
+    }
+
+    extern "C" fn fake_insn_alloc(_handle: *const c_void) -> *mut Insn {
+        Box::into_raw(Box::new(unsafe { mem::zeroed::<Insn>() }))
+    }
+
+    extern "C" fn fake_free(insn: *const Insn, count: usize) {
+        assert_eq!(count, 1);
+        unsafe { drop(Box::from_raw(insn as *mut Insn)) };
+    }
+
+    // Follows disasm_batch in cs_service.c but only knows nop (0x4e71) and a movem (0x48e7) with
+    // a long operand string
+    extern "C" fn fake_disasm_batch(_handle: *const c_void,
+                                    code: *mut *const u8,
+                                    size: *mut usize,
+                                    address: *mut u64,
+                                    count: usize,
+                                    _insn: *mut Insn,
+                                    batch: *mut CCapstoneBatch)
+                                    -> usize {
+        let mut decoded = 0;
+
+        unsafe {
+            let batch = &mut *batch;
+
+            while batch.count < batch.capacity && (count == 0 || decoded < count) {
+                if batch.text_size + 32 + 160 + 1 > batch.text_capacity || *size < 2 {
+                    break;
+                }
+
+                let text: &[u8] = match (*(*code), *(*code).offset(1)) {
+                    (0x4e, 0x71) => b"nop\0",
+                    (0x48, 0xe7) => b"movem.l d0-d7/a0-a6, $7fff(a6,d7.l)\0",
+                    _ => break,
+                };
+
+                ptr::copy_nonoverlapping(text.as_ptr(), batch.text.offset(batch.text_size as isize), text.len());
+
+                *batch.addresses.offset(batch.count as isize) = *address;
+                *batch.sizes.offset(batch.count as isize) = 2;
+                *batch.ids.offset(batch.count as isize) = 1;
+                *batch.text_offsets.offset(batch.count as isize) = batch.text_size as u32;
+                batch.text_size += text.len();
+                batch.count += 1;
+
+                *code = (*code).offset(2);
+                *size -= 2;
+                *address += 2;
+                decoded += 1;
+            }
+        }
+
+        decoded
+    }
+
+    #[test]
+    fn test_batch_decode() {
+        let mut service = CCapstone2 {
+            funcs: [ptr::null(); 16],
+            insn_alloc: fake_insn_alloc,
+            disasm_batch: fake_disasm_batch,
+        };
+
+        service.funcs[2] = fake_open as *const c_void;
+        service.funcs[3] = fake_close as *const c_void;
+        service.funcs[7] = fake_free as *const c_void;
+
+        let service_ptr = &mut service as *mut CCapstone2;
+        let mut capstone = Capstone::new(service_ptr as *mut CCapstone1);
+        capstone.api2 = service_ptr;
+        capstone.open(Arch::M68K, CS_MODE_M68K_000).ok().unwrap();
+
+        let mut code = Vec::new();
+        for _ in 0..70 {
+            code.extend_from_slice(&[0x48, 0xe7]);
+        }
+        code.extend_from_slice(&[0x4e, 0x71, 0xff, 0xff]);
+
+        let mut decoder = capstone.batch_decoder().unwrap();
+        let mut batch = InsnBatch::with_capacity(64);
+
+        // The whole batch has to be filled before decode returns even with long operands
+        assert_eq!(decoder.decode(&code, 0x1000, 0, &mut batch), (64, 128));
+        assert!(batch.is_full());
+        assert_eq!(batch.addresses[1], 0x1002);
+        assert_eq!(batch.addresses[63], 0x1000 + 126);
+        assert_eq!(batch.sizes[1], 2);
+        assert_eq!(batch.mnemonic(0), "movem.l");
+        assert_eq!(batch.op_str(63), "d0-d7/a0-a6, $7fff(a6,d7.l)");
+
+        batch.clear();
+
+        // Stops at the invalid instruction
+        assert_eq!(decoder.decode(&code[128..], 0x1000 + 128, 0, &mut batch), (7, 14));
+        assert_eq!(batch.text(6), "nop");
+        assert_eq!(batch.op_str(6), "");
+
+        batch.clear();
+
+        assert_eq!(decoder.decode(&code, 0x1000, 3, &mut batch), (3, 6));
+    }
+}
@@ -0,0 +1,462 @@
+use std::collections::BTreeMap;
+use capstone_service::Capstone;
+
+// Longest instruction Capstone can decode (size of cs_insn.bytes)
+const MAX_INSN_SIZE: u64 = 16;
+
+// Default limit of cached instructions
+const DEFAULT_MAX_ENTRIES: usize = 64 * 1024;
+
+///
+/// A decoded instruction as stored in the cache
+///
+pub struct CachedInsn {
+    pub address: u64,
+    pub size: u16,
+    pub bytes: [u8; 16],
+    pub mnemonic: String,
+    pub op_str: String,
+    pub regs_read: String,
+    pub regs_write: String,
+}
+
+///
+/// Cache of decoded instructions keyed by address. Backends can use this to avoid fetching
+/// memory and running Capstone again for ranges that has already been disassembled (such as when
+/// the user scrolls a few lines in the disassembly view). Only one decoding is kept for each byte
+/// so if code is decoded at another alignment the overlapping instructions are replaced.
+///
+/// The cache is tagged with a code version. Whenever the backend knows that code may have changed
+/// (new executable loaded, target restarted, memory written) it should bump the version which
+/// drops all instructions. Memory that is fetched for other reasons can be passed to `verify` to
+/// evict instructions whose bytes no longer match.
+///
+/// Code can also change while the target runs (self-modifying code, overlays) so backends should
+/// call `mark_unverified` each time the target stops. Cached instructions are then only trusted
+/// again after the bytes under them have been passed to `verify`.
+///
+/// The number of instructions is capped. When the limit is reached the instructions furthest away
+/// from the inserted one are dropped.
+///
+pub struct DisassemblyCache {
+    version: u64,
+    insns: BTreeMap<u64, CachedInsn>,
+    /// Sorted, non-overlapping ranges that have been verified since the target last stopped
+    verified: Vec<(u64, u64)>,
+    max_entries: usize,
+}
+
+pub struct CachedInsnIterator<'a> {
+    cache: &'a DisassemblyCache,
+    address: u64,
+    count: usize,
+}
+
+impl<'a> Iterator for CachedInsnIterator<'a> {
+    type Item = &'a CachedInsn;
+
+    fn next(&mut self) -> Option<&'a CachedInsn> {
+        if self.count == 0 {
+            return None;
+        }
+
+        self.cache.insns.get(&self.address).map(|insn| {
+            self.address += insn.size as u64;
+            self.count -= 1;
+            insn
+        })
+    }
+}
+
+impl DisassemblyCache {
+    pub fn new() -> DisassemblyCache {
+        DisassemblyCache {
+            version: 0,
+            insns: BTreeMap::new(),
+            verified: Vec::new(),
+            max_entries: DEFAULT_MAX_ENTRIES,
+        }
+    }
+
+    pub fn version(&self) -> u64 {
+        self.version
+    }
+
+    pub fn len(&self) -> usize {
+        self.insns.len()
+    }
+
+    pub fn set_max_entries(&mut self, max_entries: usize) {
+        self.max_entries = max_entries.max(1);
+        self.evict_around(0);
+    }
+
+    ///
+    /// Memory may have changed since the instructions were decoded (the target has been running)
+    ///
+    pub fn mark_unverified(&mut self) {
+        self.verified.clear();
+    }
+
+    ///
+    /// true if [start, end) has been verified since the target last stopped
+    ///
+    pub fn is_verified(&self, start: u64, end: u64) -> bool {
+        start >= end || self.verified.iter().any(|&(s, e)| s <= start && end <= e)
+    }
+
+    ///
+    /// Marks [start, end) as matching target memory. Used for ranges that were just decoded.
+    ///
+    pub fn mark_verified(&mut self, start: u64, end: u64) {
+        if start >= end {
+            return;
+        }
+
+        let mut start = start;
+        let mut end = end;
+
+        // Merge with the ranges it overlaps or touches
+
+        self.verified.retain(|&(s, e)| {
+            if e < start || s > end {
+                return true;
+            }
+
+            start = start.min(s);
+            end = end.max(e);
+            false
+        });
+
+        let index = self.verified.iter().position(|&(s, _)| s > start).unwrap_or(self.verified.len());
+        self.verified.insert(index, (start, end));
+    }
+
+    ///
+    /// Sets the code version. If it differs from the current one all instructions are dropped.
+    ///
+    pub fn set_version(&mut self, version: u64) {
+        if self.version != version {
+            self.version = version;
+            self.insns.clear();
+            self.verified.clear();
+        }
+    }
+
+    pub fn invalidate_all(&mut self) {
+        let version = self.version.wrapping_add(1);
+        self.set_version(version);
+    }
+
+    ///
+    /// Removes all instructions that overlaps [start, end)
+    ///
+    pub fn invalidate_range(&mut self, start: u64, end: u64) {
+        if start >= end {
+            return;
+        }
+
+        let first = start.saturating_sub(MAX_INSN_SIZE - 1);
+
+        let remove: Vec<u64> = self.insns
+            .range(first..end)
+            .filter(|&(addr, insn)| addr + insn.size as u64 > start)
+            .map(|(addr, _)| *addr)
+            .collect();
+
+        for addr in remove {
+            self.insns.remove(&addr);
+        }
+    }
+
+    ///
+    /// Compares instructions that are fully covered by data (read from address) and evicts the ones
+    /// that has changed. Returns the number of evicted instructions.
+    ///
+    pub fn verify(&mut self, address: u64, data: &[u8]) -> usize {
+        let end = address + data.len() as u64;
+
+        self.mark_verified(address, end);
+
+        let stale: Vec<u64> = self.insns
+            .range(address..end)
+            .filter(|&(addr, insn)| {
+                let offset = (addr - address) as usize;
+                let size = insn.size as usize;
+                offset + size <= data.len() && data[offset..offset + size] != insn.bytes[..size]
+            })
+            .map(|(addr, _)| *addr)
+            .collect();
+
+        for addr in &stale {
+            self.insns.remove(addr);
+        }
+
+        stale.len()
+    }
+
+    ///
+    /// Returns how many instructions (up to max_count) that are cached back-to-back starting at
+    /// address together with the address directly after the last of them. The second value is
+    /// where decoding needs to continue to fill the rest of the request.
+    ///
+    pub fn contiguous_count(&self, address: u64, max_count: usize) -> (usize, u64) {
+        let mut count = 0;
+        let mut next = address;
+
+        while count < max_count {
+            match self.insns.get(&next) {
+                Some(insn) => next += insn.size as u64,
+                None => break,
+            }
+            count += 1;
+        }
+
+        (count, next)
+    }
+
+    ///
+    /// Same as contiguous_count but walks backwards. Returns how many instructions (up to
+    /// max_count) that are cached back-to-back directly before address and the address of the
+    /// first one of them.
+    ///
+    pub fn backward_count(&self, address: u64, max_count: usize) -> (usize, u64) {
+        let mut count = 0;
+        let mut first = address;
+
+        while count < max_count {
+            match self.insns.range(..first).next_back() {
+                Some((addr, insn)) if addr + insn.size as u64 == first => first = *addr,
+                _ => break,
+            }
+            count += 1;
+        }
+
+        (count, first)
+    }
+
+    ///
+    /// Iterates over (at most count) back-to-back cached instructions starting at address
+    ///
+    pub fn iter_from(&self, address: u64, count: usize) -> CachedInsnIterator {
+        CachedInsnIterator {
+            cache: self,
+            address: address,
+            count: count,
+        }
+    }
+
+    ///
+    /// Inserts a single instruction, replacing any instructions that overlaps it
+    ///
+    pub fn insert(&mut self, insn: CachedInsn) {
+        let address = insn.address;
+
+        self.invalidate_range(address, address + insn.size as u64);
+        self.insns.insert(address, insn);
+        self.evict_around(address);
+    }
+
+    ///
+    /// Drops the instructions furthest away from address until the cache is within its limit
+    ///
+    fn evict_around(&mut self, address: u64) {
+        while self.insns.len() > self.max_entries {
+            let first = *self.insns.keys().next().unwrap();
+            let last = *self.insns.keys().next_back().unwrap();
+
+            if address.saturating_sub(first) > last.saturating_sub(address) {
+                self.insns.remove(&first);
+            } else {
+                self.insns.remove(&last);
+            }
+        }
+    }
+
+    ///
+    /// Decodes code (located at address) with the currently opened Capstone handle and inserts
+    /// the result. Returns the number of decoded instructions.
+    ///
+    pub fn insert_decoded(&mut self, capstone: &Capstone, code: &[u8], address: u64) -> usize {
+        let insns = match capstone.disasm(code, address, 0) {
+            Ok(insns) => insns,
+            Err(_) => return 0,
+        };
+
+        let mut count = 0;
+
+        for i in insns.iter() {
+            let mut regs_read = String::new();
+            let mut regs_write = String::new();
+
+            for register in i.regs_read().unwrap_or(&[]) {
+                if regs_read.len() > 0 {
+                    regs_read.push(' ');
+                }
+                regs_read.push_str(capstone.reg_name(*register));
+            }
+
+            for register in i.regs_write().unwrap_or(&[]) {
+                if regs_write.len() > 0 {
+                    regs_write.push(' ');
+                }
+                regs_write.push_str(capstone.reg_name(*register));
+            }
+
+            self.insert(CachedInsn {
+                address: i.address,
+                size: i.size,
+                bytes: i.bytes,
+                mnemonic: i.mnemonic().unwrap_or("").to_owned(),
+                op_str: i.op_str().unwrap_or("").to_owned(),
+                regs_read: regs_read,
+                regs_write: regs_write,
+            });
+
+            count += 1;
+        }
+
+        count
+    }
+
+    ///
+    /// Decodes backwards from address. As instructions on variable-length ISAs can't be decoded in
+    /// reverse this tries start offsets within code (located at code_address, ending at address)
+    /// stepping by align bytes until a decoding is found that ends exactly at address. The first
+    /// offset should therefore be a known instruction boundary (such as a segment or symbol start)
+    /// if one is available. Returns the address where the decoded run starts or None if no
+    /// decoding lines up.
+    ///
+    pub fn decode_backward(&mut self,
+                           capstone: &Capstone,
+                           code: &[u8],
+                           code_address: u64,
+                           address: u64,
+                           align: usize)
+                           -> Option<u64> {
+        if address <= code_address || address - code_address > code.len() as u64 {
+            return None;
+        }
+
+        let end = (address - code_address) as usize;
+        let mut offset = 0;
+
+        while offset < end {
+            let start = code_address + offset as u64;
+            let mut pos = start;
+
+            if let Ok(insns) = capstone.disasm(&code[offset..end], start, 0) {
+                for i in insns.iter() {
+                    pos = i.address + i.size as u64;
+                }
+            }
+
+            if pos == address {
+                self.insert_decoded(capstone, &code[offset..end], start);
+                return Some(start);
+            }
+
+            offset += align;
+        }
+
+        None
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn insn(address: u64, bytes: &[u8]) -> CachedInsn {
+        let mut data = [0; 16];
+        data[..bytes.len()].copy_from_slice(bytes);
+        CachedInsn {
+            address: address,
+            size: bytes.len() as u16,
+            bytes: data,
+            mnemonic: "nop".to_owned(),
+            op_str: String::new(),
+            regs_read: String::new(),
+            regs_write: String::new(),
+        }
+    }
+
+    #[test]
+    fn test_contiguous_count() {
+        let mut cache = DisassemblyCache::new();
+        cache.insert(insn(0x1000, &[1, 2]));
+        cache.insert(insn(0x1002, &[3, 4, 5, 6]));
+        cache.insert(insn(0x1008, &[7, 8]));
+
+        assert_eq!(cache.contiguous_count(0x1000, 10), (2, 0x1006));
+        assert_eq!(cache.contiguous_count(0x1000, 1), (1, 0x1002));
+        assert_eq!(cache.contiguous_count(0x1004, 10), (0, 0x1004));
+        assert_eq!(cache.iter_from(0x1000, 10).count(), 2);
+
+        assert_eq!(cache.backward_count(0x1006, 10), (2, 0x1000));
+        assert_eq!(cache.backward_count(0x1006, 1), (1, 0x1002));
+        assert_eq!(cache.backward_count(0x100a, 10), (1, 0x1008));
+    }
+
+    #[test]
+    fn test_overlapping_insert() {
+        let mut cache = DisassemblyCache::new();
+        cache.insert(insn(0x1000, &[1, 2, 3, 4]));
+        cache.insert(insn(0x1002, &[3, 4]));
+
+        assert_eq!(cache.contiguous_count(0x1000, 10), (0, 0x1000));
+        assert_eq!(cache.contiguous_count(0x1002, 10), (1, 0x1004));
+    }
+
+    #[test]
+    fn test_verify_and_version() {
+        let mut cache = DisassemblyCache::new();
+        cache.insert(insn(0x1000, &[1, 2]));
+        cache.insert(insn(0x1002, &[3, 4]));
+
+        assert_eq!(cache.verify(0x1000, &[1, 2, 3, 4]), 0);
+        assert_eq!(cache.verify(0x1000, &[1, 2, 9, 4]), 1);
+        assert_eq!(cache.contiguous_count(0x1000, 10), (1, 0x1002));
+
+        cache.invalidate_all();
+        assert_eq!(cache.version(), 1);
+        assert_eq!(cache.contiguous_count(0x1000, 10), (0, 0x1000));
+    }
+
+    #[test]
+    fn test_verified_ranges() {
+        let mut cache = DisassemblyCache::new();
+        cache.insert(insn(0x1000, &[1, 2]));
+
+        cache.mark_verified(0x1000, 0x1010);
+        cache.verify(0x1020, &[0; 16]);
+        assert!(!cache.is_verified(0x1000, 0x1020));
+
+        // Fills the gap so the ranges are merged
+        cache.mark_verified(0x1010, 0x1020);
+        assert!(cache.is_verified(0x1000, 0x1030));
+
+        cache.mark_unverified();
+        assert!(!cache.is_verified(0x1000, 0x1002));
+        assert_eq!(cache.contiguous_count(0x1000, 10), (1, 0x1002));
+    }
+
+    #[test]
+    fn test_max_entries() {
+        let mut cache = DisassemblyCache::new();
+        cache.set_max_entries(4);
+
+        for i in 0..8 {
+            cache.insert(insn(0x1000 + i * 2, &[1, 2]));
+        }
+
+        // The ones furthest away from the last insert are dropped
+        assert_eq!(cache.len(), 4);
+        assert_eq!(cache.contiguous_count(0x1008, 10), (4, 0x1010));
+
+        cache.insert(insn(0x1000, &[1, 2]));
+        assert_eq!(cache.len(), 4);
+        assert_eq!(cache.contiguous_count(0x1000, 10), (1, 0x1002));
+        assert_eq!(cache.contiguous_count(0x1008, 10), (3, 0x100e));
+    }
+}
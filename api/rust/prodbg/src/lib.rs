@@ -1,5 +1,6 @@
 #[macro_use]
 extern crate bitflags;
+extern crate libc;
 
 pub mod menu_service;
 pub mod read_write;
@@ -9,6 +10,8 @@ pub mod id_register;
 pub mod service;
 pub mod message_service;
 pub mod capstone_service;
+pub mod disassembly_cache;
+pub mod registers;
 pub mod dialogs;
 pub mod ui_ffi;
 pub mod ui;
@@ -19,12 +22,16 @@ pub mod io;
 pub mod events;
 pub mod capstone_m68k;
 pub mod scintilla;
+pub mod symbols;
+pub mod mapped_file;
 
 pub use backend::*;
 pub use read_write::*;
 pub use plugin_handler::*;
 pub use service::*;
 pub use capstone_service::*;
+pub use disassembly_cache::*;
+pub use registers::*;
 pub use message_service::*;
 pub use dialogs::*;
 pub use ui::*;
@@ -48,3 +55,5 @@ pub use io::*;
 pub use menu_service::*;
 pub use events::*;
 pub use id_register::*;
+pub use symbols::*;
+pub use mapped_file::*;
@@ -0,0 +1,94 @@
+//! Read-only view of a whole file. The file is memory mapped on unix so only the pages that are
+//! used are read from disk. That matters for debug binaries of several GB where only a few
+//! sections are parsed and for source files that Scintilla copies straight into its document.
+//! Other platforms fall back to reading the file into memory.
+
+use std::fs::File;
+use std::io;
+use std::path::Path;
+use std::slice;
+
+enum Storage {
+    #[cfg(unix)]
+    Mapped(*mut u8, usize),
+    Owned(Vec<u8>),
+}
+
+pub struct MappedFile {
+    storage: Storage,
+}
+
+// The mapping is read-only and never changes after creation
+unsafe impl Send for MappedFile {}
+unsafe impl Sync for MappedFile {}
+
+impl MappedFile {
+    #[cfg(unix)]
+    pub fn open(path: &Path) -> io::Result<MappedFile> {
+        use std::os::unix::io::AsRawFd;
+        use std::ptr;
+        use libc;
+
+        let file = try!(File::open(path));
+        let len = try!(file.metadata()).len() as usize;
+
+        // mmap doesn't allow zero sized mappings
+        if len == 0 {
+            return Ok(MappedFile::from_vec(Vec::new()));
+        }
+
+        let data = unsafe {
+            libc::mmap(ptr::null_mut(), len, libc::PROT_READ, libc::MAP_PRIVATE, file.as_raw_fd(), 0)
+        };
+
+        if data == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+
+        Ok(MappedFile { storage: Storage::Mapped(data as *mut u8, len) })
+    }
+
+    #[cfg(not(unix))]
+    pub fn open(path: &Path) -> io::Result<MappedFile> {
+        use std::io::Read;
+
+        let mut data = Vec::new();
+        try!(File::open(path).and_then(|mut f| f.read_to_end(&mut data)));
+        Ok(MappedFile::from_vec(data))
+    }
+
+    pub fn from_vec(data: Vec<u8>) -> MappedFile {
+        MappedFile { storage: Storage::Owned(data) }
+    }
+
+    pub fn data(&self) -> &[u8] {
+        match self.storage {
+            #[cfg(unix)]
+            Storage::Mapped(ptr, len) => unsafe { slice::from_raw_parts(ptr, len) },
+            Storage::Owned(ref data) => data,
+        }
+    }
+}
+
+impl Drop for MappedFile {
+    fn drop(&mut self) {
+        #[cfg(unix)]
+        {
+            if let Storage::Mapped(ptr, len) = self.storage {
+                unsafe { ::libc::munmap(ptr as *mut ::libc::c_void, len) };
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::path::Path;
+
+    #[test]
+    fn test_map_file() {
+        let file = MappedFile::open(Path::new(file!())).unwrap();
+        assert!(file.data().starts_with(b"//! Read-only view of a whole file."));
+    }
+}
@@ -0,0 +1,427 @@
+//! Register transfer between backends and views.
+//!
+//! To avoid resending (and reallocating) every register on every stop the backend first sends a
+//! schema: a regular SetRegisters event where the "registers" array has name, read_only and data
+//! for each register together with a "schema_id". After that it only sends the registers that has
+//! changed as a "changed" array with (index, data) pairs where index is the position in the
+//! schema. Views send the schema_id they have in GetRegisters so the backend knows if it needs to
+//! send the full schema again. Backends that doesn't know about schemas keep working as a full
+//! update without schema_id is always accepted.
+
+use read_write::{Reader, Writer, ReadStatus};
+use backend::EventType;
+
+pub struct RegisterInfo {
+    pub name: String,
+    pub read_only: bool,
+    offset: usize,
+    size: usize,
+}
+
+impl RegisterInfo {
+    #[inline]
+    pub fn size(&self) -> usize {
+        self.size
+    }
+}
+
+///
+/// Backend side of the protocol. Describes the registers and keeps track of what was sent last
+/// to be able to only send the changes.
+///
+pub struct RegisterSchema {
+    id: u32,
+    infos: Vec<RegisterInfo>,
+    last_sent: Vec<u8>,
+    has_sent: bool,
+}
+
+impl RegisterSchema {
+    ///
+    /// id should be changed if the set of registers change (such as when switching CPU mode)
+    ///
+    pub fn new(id: u32) -> RegisterSchema {
+        RegisterSchema {
+            id: id,
+            infos: Vec::new(),
+            last_sent: Vec::new(),
+            has_sent: false,
+        }
+    }
+
+    #[inline]
+    pub fn id(&self) -> u32 {
+        self.id
+    }
+
+    ///
+    /// Adds a register to the schema. Values passed to write are expected to have all registers
+    /// packed after each other in the order they were added.
+    ///
+    pub fn add(&mut self, name: &str, size: usize, read_only: bool) -> usize {
+        let offset = self.last_sent.len();
+        self.infos.push(RegisterInfo {
+            name: name.to_owned(),
+            read_only: read_only,
+            offset: offset,
+            size: size,
+        });
+        self.last_sent.resize(offset + size, 0);
+        self.has_sent = false;
+        self.infos.len() - 1
+    }
+
+    ///
+    /// Total size of all registers
+    ///
+    #[inline]
+    pub fn data_size(&self) -> usize {
+        self.last_sent.len()
+    }
+
+    ///
+    /// Forces the next write to send the full schema
+    ///
+    pub fn reset(&mut self) {
+        self.has_sent = false;
+    }
+
+    ///
+    /// Checks a GetRegisters request. If the view doesn't have the current schema the next write
+    /// will send all registers.
+    ///
+    pub fn check_request(&mut self, reader: &Reader) {
+        if reader.find_u32("schema_id").ok() != Some(self.id) {
+            self.has_sent = false;
+        }
+    }
+
+    ///
+    /// Calls f with index and new data for each register in values that differs from what was
+    /// sent last
+    ///
+    pub fn for_each_changed<F: FnMut(usize, &[u8])>(&self, values: &[u8], mut f: F) {
+        for (index, info) in self.infos.iter().enumerate() {
+            let range = info.offset..info.offset + info.size;
+            if values[range.clone()] != self.last_sent[range.clone()] {
+                f(index, &values[range]);
+            }
+        }
+    }
+
+    ///
+    /// Writes a SetRegisters event with either the full schema (first time or when requested) or
+    /// only the registers that has changed.
+    ///
+    pub fn write(&mut self, writer: &mut Writer, values: &[u8]) {
+        writer.event_begin(EventType::SetRegisters as u16);
+        writer.write_u32("schema_id", self.id);
+
+        if !self.has_sent {
+            writer.array_begin("registers");
+
+            for info in &self.infos {
+                writer.array_entry_begin();
+                writer.write_string("name", &info.name);
+
+                if info.read_only {
+                    writer.write_u8("read_only", 1);
+                }
+
+                writer.write_data("register", &values[info.offset..info.offset + info.size]);
+                writer.array_entry_end();
+            }
+
+            writer.array_end();
+        } else {
+            writer.array_begin("changed");
+
+            self.for_each_changed(values, |index, data| {
+                writer.array_entry_begin();
+                writer.write_u16("index", index as u16);
+                writer.write_data("register", data);
+                writer.array_entry_end();
+            });
+
+            writer.array_end();
+        }
+
+        writer.event_end();
+
+        let size = self.last_sent.len();
+        self.last_sent.copy_from_slice(&values[..size]);
+        self.has_sent = true;
+    }
+}
+
+///
+/// View side of the protocol. All values are stored in one buffer that is updated in place and
+/// the previous value is kept for each register to be able to show what changed.
+///
+pub struct RegisterFile {
+    schema_id: Option<u32>,
+    infos: Vec<RegisterInfo>,
+    values: Vec<u8>,
+    prev_values: Vec<u8>,
+    // registers that got new values in the last update
+    changed: Vec<usize>,
+    // set by begin_update until the first register of the update is applied
+    update_pending: bool,
+}
+
+impl RegisterFile {
+    pub fn new() -> RegisterFile {
+        RegisterFile {
+            schema_id: None,
+            infos: Vec::new(),
+            values: Vec::new(),
+            prev_values: Vec::new(),
+            changed: Vec::new(),
+            update_pending: false,
+        }
+    }
+
+    #[inline]
+    pub fn schema_id(&self) -> Option<u32> {
+        self.schema_id
+    }
+
+    #[inline]
+    pub fn len(&self) -> usize {
+        self.infos.len()
+    }
+
+    #[inline]
+    pub fn info(&self, index: usize) -> &RegisterInfo {
+        &self.infos[index]
+    }
+
+    #[inline]
+    pub fn infos(&self) -> &[RegisterInfo] {
+        &self.infos
+    }
+
+    pub fn value(&self, index: usize) -> &[u8] {
+        let info = &self.infos[index];
+        &self.values[info.offset..info.offset + info.size]
+    }
+
+    pub fn prev_value(&self, index: usize) -> &[u8] {
+        let info = &self.infos[index];
+        &self.prev_values[info.offset..info.offset + info.size]
+    }
+
+    ///
+    /// Returns info, current value (for editing) and previous value for a register
+    ///
+    pub fn get_mut(&mut self, index: usize) -> (&RegisterInfo, &mut [u8], &[u8]) {
+        let info = &self.infos[index];
+        let range = info.offset..info.offset + info.size;
+        (info, &mut self.values[range.clone()], &self.prev_values[range])
+    }
+
+    ///
+    /// Replaces all registers. If the names and sizes match the current ones the old values are
+    /// kept as previous values.
+    ///
+    pub fn set_all<'a, I>(&mut self, schema_id: Option<u32>, registers: I)
+        where I: Iterator<Item = (&'a str, bool, &'a [u8])>
+    {
+        let mut index = 0;
+        let mut offset = 0;
+        let mut same_layout = true;
+
+        for (name, read_only, data) in registers {
+            if index < self.infos.len() && self.infos[index].name == name &&
+               self.infos[index].size == data.len() {
+                self.infos[index].read_only = read_only;
+            } else {
+                same_layout = false;
+                self.infos.truncate(index);
+                self.infos.push(RegisterInfo {
+                    name: name.to_owned(),
+                    read_only: read_only,
+                    offset: offset,
+                    size: data.len(),
+                });
+            }
+
+            if self.values.len() < offset + data.len() {
+                self.values.resize(offset + data.len(), 0);
+            }
+
+            if same_layout {
+                self.prev_values[offset..offset + data.len()]
+                    .copy_from_slice(&self.values[offset..offset + data.len()]);
+            }
+
+            self.values[offset..offset + data.len()].copy_from_slice(data);
+
+            offset += data.len();
+            index += 1;
+        }
+
+        same_layout = same_layout && index == self.infos.len();
+
+        self.infos.truncate(index);
+        self.values.truncate(offset);
+
+        if !same_layout {
+            self.prev_values = self.values.clone();
+        }
+
+        self.changed.clear();
+        self.update_pending = false;
+        self.schema_id = schema_id;
+    }
+
+    ///
+    /// Starts a delta update. The backend only sends changes once the target has stopped again so
+    /// the first applied register starts a new stop: registers that changed in the last stop get
+    /// their previous value synced then. A delta without changes keeps the current highlighting.
+    ///
+    pub fn begin_update(&mut self) {
+        self.update_pending = true;
+    }
+
+    fn begin_stop(&mut self) {
+        for &index in &self.changed {
+            let info = &self.infos[index];
+            let range = info.offset..info.offset + info.size;
+            self.prev_values[range.clone()].copy_from_slice(&self.values[range]);
+        }
+
+        self.changed.clear();
+        self.update_pending = false;
+    }
+
+    ///
+    /// Updates a single register in place. Returns false if index or size doesn't match the schema.
+    ///
+    pub fn apply(&mut self, index: usize, data: &[u8]) -> bool {
+        if index >= self.infos.len() || self.infos[index].size != data.len() {
+            return false;
+        }
+
+        if self.update_pending {
+            self.begin_stop();
+        }
+
+        let offset = self.infos[index].offset;
+        self.values[offset..offset + data.len()].copy_from_slice(data);
+        self.changed.push(index);
+        true
+    }
+
+    ///
+    /// Reads a SetRegisters event. Returns Ok(false) if the event was a delta for a schema that
+    /// we don't have in which case the registers should be requested again.
+    ///
+    pub fn read(&mut self, reader: &Reader) -> Result<bool, ReadStatus> {
+        let schema_id = reader.find_u32("schema_id").ok();
+
+        if let Ok(changed) = reader.find_array("changed") {
+            if schema_id.is_none() || schema_id != self.schema_id {
+                return Ok(false);
+            }
+
+            self.begin_update();
+
+            for entry in changed {
+                let index = try!(entry.find_u16("index")) as usize;
+                let data = try!(entry.find_data("register"));
+
+                if !self.apply(index, data) {
+                    self.schema_id = None;
+                    return Ok(false);
+                }
+            }
+
+            return Ok(true);
+        }
+
+        let readers: Vec<Reader> = try!(reader.find_array("registers")).collect();
+        let mut entries = Vec::with_capacity(readers.len());
+
+        for entry in &readers {
+            let name = try!(entry.find_string("name"));
+            let read_only = entry.find_u8("read_only").unwrap_or(0) != 0;
+            let data = try!(entry.find_data("register"));
+            entries.push((name, read_only, data));
+        }
+
+        self.set_all(schema_id, entries.into_iter());
+
+        Ok(true)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_schema_changes() {
+        let mut schema = RegisterSchema::new(1);
+        schema.add("d0", 4, false);
+        schema.add("d1", 4, false);
+        schema.add("pc", 4, true);
+        assert_eq!(schema.data_size(), 12);
+
+        let values = [0, 0, 0, 1, 0, 0, 0, 2, 0, 0, 0, 3];
+        let mut changed = Vec::new();
+        schema.for_each_changed(&values, |index, data| changed.push((index, data[3])));
+        assert_eq!(changed, vec![(0, 1), (1, 2), (2, 3)]);
+    }
+
+    #[test]
+    fn test_register_file_delta() {
+        let mut file = RegisterFile::new();
+        let d0 = [0, 0, 0, 1];
+        let pc = [0, 0, 0x10, 0];
+        file.set_all(Some(1), vec![("d0", false, &d0[..]), ("pc", true, &pc[..])].into_iter());
+
+        assert_eq!(file.len(), 2);
+        assert_eq!(file.value(1), &pc);
+        assert_eq!(file.prev_value(1), &pc);
+
+        file.begin_update();
+        assert!(file.apply(1, &[0, 0, 0x10, 2]));
+        assert!(!file.apply(1, &[0, 2]));
+        assert!(!file.apply(2, &[0, 0, 0, 0]));
+        assert_eq!(file.value(1), &[0, 0, 0x10, 2]);
+        assert_eq!(file.prev_value(1), &pc);
+
+        // An update without changes keeps what changed in the last stop
+        file.begin_update();
+        assert_eq!(file.prev_value(1), &pc);
+
+        // pc didn't change this time so it should no longer show up as changed
+        file.begin_update();
+        assert!(file.apply(0, &[0, 0, 0, 5]));
+        assert_eq!(file.prev_value(1), file.value(1));
+        assert_eq!(file.prev_value(0), &d0);
+
+        // Both registers changed in the same stop stay changed
+        assert!(file.apply(1, &[0, 0, 0x10, 4]));
+        assert_eq!(file.prev_value(0), &d0);
+        assert_eq!(file.prev_value(1), &[0, 0, 0x10, 2]);
+    }
+
+    #[test]
+    fn test_register_file_full_update() {
+        let mut file = RegisterFile::new();
+        let a = [1, 2];
+        let b = [3, 4];
+        file.set_all(None, vec![("a", false, &a[..])].into_iter());
+        file.set_all(None, vec![("a", false, &b[..])].into_iter());
+        assert_eq!(file.prev_value(0), &a);
+        assert_eq!(file.value(0), &b);
+
+        // new layout resets previous values
+        file.set_all(None, vec![("x", false, &a[..]), ("y", false, &b[..])].into_iter());
+        assert_eq!(file.prev_value(0), &a);
+        assert_eq!(file.value(1), &b);
+        assert_eq!(file.schema_id(), None);
+    }
+}
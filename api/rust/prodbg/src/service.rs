@@ -3,6 +3,7 @@ use std::mem::transmute;
 
 use Capstone;
 use CCapstone1;
+use CCapstone2;
 
 use Dialogs;
 use CDialogFuncs1;
@@ -10,6 +11,9 @@ use CDialogFuncs1;
 use IdFuncs;
 use CIdFuncs1;
 
+use Symbols;
+use CSymbolFuncs1;
+
 pub struct Service {
     pub service_func: extern "C" fn(data: *const c_uchar) -> *mut c_void,
 }
@@ -19,10 +23,9 @@ impl Service {
         unsafe {
             let api: &mut CCapstone1 = transmute(((*self).service_func)(b"Capstone Service 1\0"
                 .as_ptr()));
-            Capstone {
-                api: api,
-                handle: ::std::ptr::null(),
-            }
+            let mut capstone = Capstone::new(api);
+            capstone.api2 = ((*self).service_func)(b"Capstone Service 2\0".as_ptr()) as *mut CCapstone2;
+            capstone
         }
     }
 
@@ -40,4 +43,14 @@ impl Service {
             IdFuncs { api: api }
         }
     }
+
+    pub fn get_symbols(&self) -> Option<Symbols> {
+        let api = ((*self).service_func)(b"Symbols Service 1\0".as_ptr()) as *mut CSymbolFuncs1;
+
+        if api.is_null() {
+            None
+        } else {
+            Some(Symbols { api: api })
+        }
+    }
 }
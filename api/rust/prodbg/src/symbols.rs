@@ -0,0 +1,105 @@
+use std::os::raw::{c_char, c_int};
+use std::ffi::{CStr, CString};
+use std::str;
+use std::mem;
+
+#[repr(C)]
+pub struct CSymbolInfo {
+    pub name: *const c_char,
+    pub module: *const c_char,
+    pub start: u64,
+    pub size: u64,
+    pub offset: u64,
+}
+
+#[repr(C)]
+pub struct CSymbolFuncs1 {
+    pub add_module: extern "C" fn(name: *const c_char, base: u64, size: u64) -> u32,
+    pub remove_module: extern "C" fn(module: u32),
+    pub add_symbol: extern "C" fn(module: u32, name: *const c_char, address: u64, size: u64),
+    pub lookup: extern "C" fn(address: u64, info: *mut CSymbolInfo) -> c_int,
+    pub format_address: extern "C" fn(address: u64, buffer: *mut c_char, buffer_size: c_int)
+                                      -> c_int,
+}
+
+///
+/// Symbol an address was found in. The names point into the symbols service and stay valid until
+/// symbols are added or removed.
+///
+pub struct SymbolInfo<'a> {
+    pub name: &'a str,
+    pub module: &'a str,
+    pub start: u64,
+    pub size: u64,
+    pub offset: u64,
+}
+
+///
+/// Symbols shared between all plugins. Backends add the symbols of what they load and views
+/// use them to show addresses as symbol+offset.
+///
+pub struct Symbols {
+    pub api: *mut CSymbolFuncs1,
+}
+
+impl Symbols {
+    ///
+    /// Adds a module covering base..base + size (0 for no limit). A module with the same name is
+    /// replaced.
+    ///
+    pub fn add_module(&self, name: &str, base: u64, size: u64) -> u32 {
+        let name = CString::new(name).unwrap();
+        unsafe { ((*self.api).add_module)(name.as_ptr(), base, size) }
+    }
+
+    pub fn remove_module(&self, module: u32) {
+        unsafe { ((*self.api).remove_module)(module) }
+    }
+
+    ///
+    /// Size 0 makes the symbol end where the next one starts
+    ///
+    pub fn add_symbol(&self, module: u32, name: &str, address: u64, size: u64) {
+        let name = CString::new(name).unwrap();
+        unsafe { ((*self.api).add_symbol)(module, name.as_ptr(), address, size) }
+    }
+
+    ///
+    /// Finds the innermost symbol address is in without allocating
+    ///
+    pub fn lookup<'a>(&'a self, address: u64) -> Option<SymbolInfo<'a>> {
+        unsafe {
+            let mut info: CSymbolInfo = mem::zeroed();
+
+            if ((*self.api).lookup)(address, &mut info) == 0 {
+                return None;
+            }
+
+            Some(SymbolInfo {
+                name: CStr::from_ptr(info.name).to_str().unwrap_or(""),
+                module: CStr::from_ptr(info.module).to_str().unwrap_or(""),
+                start: info.start,
+                size: info.size,
+                offset: info.offset,
+            })
+        }
+    }
+
+    ///
+    /// Writes "name" or "name+0x10" for the address into buffer without allocating. Returns
+    /// None if the address isn't in any symbol.
+    ///
+    pub fn format_address<'a>(&self, address: u64, buffer: &'a mut [u8]) -> Option<&'a str> {
+        let len = unsafe {
+            ((*self.api).format_address)(address,
+                                         buffer.as_mut_ptr() as *mut c_char,
+                                         buffer.len() as c_int)
+        };
+
+        if len <= 0 {
+            return None;
+        }
+
+        str::from_utf8(&buffer[..len as usize]).ok()
+    }
+}
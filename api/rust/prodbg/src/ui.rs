@@ -537,6 +537,38 @@ impl Ui {
         }
     }
 
+    #[inline]
+    pub fn slider_int(&self, label: &str, value: &mut i32, min: i32, max: i32) -> bool {
+        unsafe {
+            let c_label = CFixedString::from_str(label);
+            let c_format = CFixedString::from_str("%.0f");
+            ((*self.api).slider_int)(c_label.as_ptr(), value, min, max, c_format.as_ptr()) != 0
+        }
+    }
+
+    pub fn plot_histogram(&self,
+                          label: &str,
+                          values: &[f32],
+                          overlay: Option<&str>,
+                          scale_min: f32,
+                          scale_max: f32,
+                          size: Vec2) {
+        unsafe {
+            let c_label = CFixedString::from_str(label);
+            let c_overlay = overlay.map(|text| CFixedString::from_str(text));
+            let overlay_ptr = c_overlay.as_ref().map_or(ptr::null(), |text| text.as_ptr());
+            ((*self.api).plot_histogram)(c_label.as_ptr(),
+                                         values.as_ptr(),
+                                         values.len() as i32,
+                                         0,
+                                         overlay_ptr,
+                                         scale_min,
+                                         scale_max,
+                                         size.into(),
+                                         mem::size_of::<f32>())
+        }
+    }
+
     #[inline]
     // callback is not called the same frame as input was created
     pub fn input_text(&self,
@@ -988,6 +1020,27 @@ impl Image {
             ((*self.api).image_update)(self.handle, data.as_ptr() as *const c_void, size as u32);
         }
     }
+
+    ///
+    /// Uploads row_count rows starting at first_row. data is the whole image (width * height
+    /// pixels) and only the rows given are sent to the texture.
+    ///
+    pub fn update_rows<T>(&self, data: &[T], first_row: usize, row_count: usize) {
+        let row_size = self.size.x as usize * 4;
+        let start = row_size * first_row;
+
+        if row_count == 0 || start + row_size * row_count > data.len() * mem::size_of::<T>() {
+            return;
+        }
+
+        unsafe {
+            let src = (data.as_ptr() as *const u8).offset(start as isize);
+            ((*self.api).image_update_rows)(self.handle,
+                                            src as *const c_void,
+                                            first_row as u32,
+                                            row_count as u32);
+        }
+    }
 }
 
 impl<'a> ImageBuilder<'a> {
@@ -322,6 +322,7 @@ pub struct CPdUI {
     pub fill_circle: extern fn(pos: PDVec2, radius: c_float, color: c_uint, num_seg: c_uint, aa: c_int),
     pub image_create_rgba: extern fn(width: c_uint, height: c_uint) -> *mut c_void,
     pub image_update: extern fn(dest: *mut c_void, src: *const c_void, size: c_uint) -> c_void,
+    pub image_update_rows: extern fn(dest: *mut c_void, src: *const c_void, firstRow: c_uint, rowCount: c_uint),
 }
 
 // !!! End of autogenerated data. !!!
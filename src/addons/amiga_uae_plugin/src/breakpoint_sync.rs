@@ -0,0 +1,177 @@
+//! Keeps the breakpoints in UAE in sync with the ones set in the debugger.
+//!
+//! The breakpoints the target has are tracked so only the ones added or removed since the last
+//! sync are sent. The Z/z packets are pipelined (the connection is in no-ack mode) and the
+//! replies read afterwards so a run with hundreds of breakpoints doesn't wait for a round trip
+//! per breakpoint.
+
+use std::collections::{BTreeSet, VecDeque};
+use std::io::{Error, ErrorKind, Result};
+use memory_reader::PacketConnection;
+
+const MAX_IN_FLIGHT: usize = 32;
+
+///
+/// Where a breakpoint is set in the target
+///
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash)]
+pub enum BreakpointLocation {
+    Address(u32),
+    /// Offset into a segment of the executable (used for file:line breakpoints)
+    Segment { segment: u32, offset: u32 },
+}
+
+impl BreakpointLocation {
+    fn command(&self, add: bool) -> String {
+        let c = if add { 'Z' } else { 'z' };
+
+        match *self {
+            BreakpointLocation::Address(address) => format!("{}0,{:x}", c, address),
+            BreakpointLocation::Segment { segment, offset } => format!("{}0,{:x},{}", c, offset, segment),
+        }
+    }
+}
+
+pub struct BreakpointSync {
+    installed: BTreeSet<BreakpointLocation>,
+}
+
+impl BreakpointSync {
+    pub fn new() -> BreakpointSync {
+        BreakpointSync { installed: BTreeSet::new() }
+    }
+
+    ///
+    /// Forget what the target has (such as when connecting or after the target was killed)
+    ///
+    pub fn reset(&mut self) {
+        self.installed.clear();
+    }
+
+    pub fn installed(&self) -> &BTreeSet<BreakpointLocation> {
+        &self.installed
+    }
+
+    ///
+    /// Adds and removes breakpoints in the target so it has the ones in wanted. Breakpoints the
+    /// target failed to add or remove are retried on the next sync.
+    ///
+    pub fn sync<C, I>(&mut self, conn: &mut C, wanted: I) -> Result<()>
+        where C: PacketConnection,
+              I: IntoIterator<Item = BreakpointLocation>
+    {
+        let wanted = wanted.into_iter().collect::<BTreeSet<_>>();
+
+        let changes = self.installed
+            .difference(&wanted)
+            .map(|&location| (location, false))
+            .chain(wanted.difference(&self.installed).map(|&location| (location, true)))
+            .collect::<Vec<_>>();
+
+        let mut reply = [0; 64];
+        let mut in_flight = VecDeque::with_capacity(MAX_IN_FLIGHT);
+        let mut failed = 0;
+        let mut next = 0;
+
+        while next < changes.len() || !in_flight.is_empty() {
+            while next < changes.len() && in_flight.len() < MAX_IN_FLIGHT {
+                let (location, add) = changes[next];
+                try!(conn.send_packet(&location.command(add)));
+                in_flight.push_back((location, add));
+                next += 1;
+            }
+
+            let (location, add) = in_flight.pop_front().unwrap();
+            let len = try!(conn.read_packet(&mut reply));
+
+            if &reply[..len.min(reply.len())] != b"OK" {
+                println!("Unable to {} breakpoint {:?}", if add { "set" } else { "remove" }, location);
+                failed += 1;
+                continue;
+            }
+
+            if add {
+                self.installed.insert(location);
+            } else {
+                self.installed.remove(&location);
+            }
+        }
+
+        if failed > 0 {
+            return Err(Error::new(ErrorKind::Other, format!("{} breakpoint(s) failed to update", failed)));
+        }
+
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::collections::VecDeque;
+    use std::io::Result;
+    use memory_reader::PacketConnection;
+
+    struct FakeStub {
+        pending: VecDeque<String>,
+        sent: Vec<String>,
+        max_pending: usize,
+        fail: Option<String>,
+    }
+
+    impl PacketConnection for FakeStub {
+        fn send_packet(&mut self, command: &str) -> Result<()> {
+            self.pending.push_back(command.to_owned());
+            self.sent.push(command.to_owned());
+            self.max_pending = self.max_pending.max(self.pending.len());
+            Ok(())
+        }
+
+        fn read_packet(&mut self, dest: &mut [u8]) -> Result<usize> {
+            let command = self.pending.pop_front().unwrap();
+            let reply: &[u8] = if Some(&command) == self.fail.as_ref() { b"E01" } else { b"OK" };
+            dest[..reply.len()].copy_from_slice(reply);
+            Ok(reply.len())
+        }
+    }
+
+    #[test]
+    fn test_only_changes_are_sent() {
+        let mut conn = FakeStub {
+            pending: VecDeque::new(),
+            sent: Vec::new(),
+            max_pending: 0,
+            fail: None,
+        };
+
+        let mut sync = BreakpointSync::new();
+        let mut wanted = (0..100).map(|i| BreakpointLocation::Segment { segment: 0, offset: i * 4 }).collect::<Vec<_>>();
+        wanted.push(BreakpointLocation::Address(0x1234));
+
+        sync.sync(&mut conn, wanted.clone()).unwrap();
+        assert_eq!(conn.sent.len(), 101);
+        assert_eq!(conn.max_pending, MAX_IN_FLIGHT);
+        assert!(conn.sent.contains(&"Z0,c,0".to_owned()));
+        assert!(conn.sent.contains(&"Z0,1234".to_owned()));
+
+        // Nothing changed
+        conn.sent.clear();
+        sync.sync(&mut conn, wanted.clone()).unwrap();
+        assert!(conn.sent.is_empty());
+
+        wanted.remove(0);
+        wanted.push(BreakpointLocation::Address(0x10));
+        conn.fail = Some("Z0,10".to_owned());
+
+        assert!(sync.sync(&mut conn, wanted.clone()).is_err());
+        assert_eq!(conn.sent, vec!["z0,0,0".to_owned(), "Z0,10".to_owned()]);
+        assert!(conn.pending.is_empty());
+
+        // The failed one is retried
+        conn.sent.clear();
+        conn.fail = None;
+        sync.sync(&mut conn, wanted).unwrap();
+        assert_eq!(conn.sent, vec!["Z0,10".to_owned()]);
+        assert_eq!(sync.installed().len(), 101);
+    }
+}
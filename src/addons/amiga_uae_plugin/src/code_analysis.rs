@@ -0,0 +1,862 @@
+use std::collections::{BTreeSet, HashMap};
+use std::fs::File;
+use std::io::{self, Read, Write};
+use std::sync::mpsc::{channel, Receiver};
+use std::thread;
+use prodbg_api::{Arch, BatchDecoder, Capstone, InsnBatch, CS_MODE_M68K_000};
+
+// (hunk, offset within hunk)
+pub type Location = (u32, u32);
+
+const CACHE_MAGIC: u32 = 0x41434450; // 'PDCA'
+const CACHE_VERSION: u32 = 2;
+
+const BCC_CONDITIONS: [&'static str; 16] = ["hs", "lo", "hi", "ls", "cc", "cs", "ne", "eq", "vc",
+                                             "vs", "pl", "mi", "ge", "lt", "gt", "le"];
+const DBCC_CONDITIONS: [&'static str; 17] = ["t", "f", "hi", "ls", "cc", "cs", "ne", "eq", "vc",
+                                              "vs", "pl", "mi", "ge", "lt", "gt", "le", "ra"];
+
+// Bytes decoded per Capstone call while following a run of instructions
+const DECODE_WINDOW: usize = 256;
+
+#[derive(Clone, Copy, PartialEq, Debug)]
+pub enum RefKind {
+    Jump,
+    Branch,
+    Call,
+}
+
+#[derive(Clone, Copy, Debug)]
+pub struct XRef {
+    pub from: Location,
+    pub to: Location,
+    pub kind: RefKind,
+}
+
+#[derive(Clone, Copy, Debug)]
+pub struct BasicBlock {
+    pub hunk: u32,
+    pub start: u32,
+    pub end: u32,
+}
+
+///
+/// Code section of the image as input to the analysis
+///
+pub struct Section {
+    pub hunk: u32,
+    pub data: Vec<u8>,
+    /// Known entry points (such as the start of the first hunk and symbols)
+    pub entry_points: Vec<u32>,
+    /// Offsets of 32-bit relocations and the hunk they point into
+    pub relocs: HashMap<u32, u32>,
+}
+
+///
+/// Result of the whole image analysis. All lists are sorted so lookups are binary searches.
+///
+pub struct CodeAnalysis {
+    pub blocks: Vec<BasicBlock>,
+    pub functions: Vec<Location>,
+    /// Sorted by target
+    pub xrefs: Vec<XRef>,
+    /// (caller function, callee function)
+    pub calls: Vec<(Location, Location)>,
+}
+
+#[derive(PartialEq, Debug)]
+enum Flow {
+    Next,
+    Branch(u32),
+    Jump(Option<(u32, u32)>),
+    Call(Option<(u32, u32)>),
+    Return,
+}
+
+///
+/// Decoding state for one section. It's kept between rounds so targets found from other
+/// sections only decode what hasn't been visited yet.
+///
+struct SectionState {
+    section: Section,
+    visited: Vec<bool>,
+    block_starts: BTreeSet<u32>,
+    // (offset, size, ends block)
+    insns: Vec<(u32, u32, bool)>,
+    functions: Vec<u32>,
+    xrefs: Vec<XRef>,
+    // targets in other sections that needs to be handed over
+    external: Vec<(Location, bool)>,
+}
+
+impl SectionState {
+    fn new(section: Section) -> SectionState {
+        let size = section.data.len() / 2 + 1;
+        SectionState {
+            section: section,
+            visited: vec![false; size],
+            block_starts: BTreeSet::new(),
+            insns: Vec::new(),
+            functions: Vec::new(),
+            xrefs: Vec::new(),
+            external: Vec::new(),
+        }
+    }
+
+    #[inline]
+    fn read_u32(&self, offset: usize) -> Option<u32> {
+        let data = &self.section.data;
+        if offset + 4 > data.len() {
+            return None;
+        }
+
+        Some(((data[offset] as u32) << 24) | ((data[offset + 1] as u32) << 16) |
+             ((data[offset + 2] as u32) << 8) | data[offset + 3] as u32)
+    }
+
+    fn parse_hex(text: &str) -> Option<u32> {
+        u32::from_str_radix(text, 16).ok()
+    }
+
+    ///
+    /// Figure out the control flow of an instruction from the Capstone text output. Branch
+    /// targets are printed as absolute addresses (we decode with the hunk offset as address),
+    /// pc-relative jumps as "$disp(pc)" and absolute jumps are resolved through the relocations.
+    ///
+    fn classify(&self, offset: u32, mnemonic: &str, op_str: &str) -> Flow {
+        let name = mnemonic.split('.').next().unwrap_or("");
+        let operand = op_str.rsplit(',').next().unwrap_or("").trim();
+
+        match name {
+            "rts" | "rte" | "rtr" | "rtd" | "illegal" | "dc" => return Flow::Return,
+            "bra" | "bsr" => {
+                let target = operand.trim_left_matches("#$");
+                return match Self::parse_hex(target) {
+                    Some(t) if name == "bra" => Flow::Jump(Some((self.section.hunk, t))),
+                    Some(t) => Flow::Call(Some((self.section.hunk, t))),
+                    None => Flow::Return,
+                };
+            }
+            "jmp" | "jsr" => {
+                let target = if operand.ends_with("(pc)") {
+                    let disp = operand.trim_left_matches('$').trim_right_matches("(pc)");
+                    Self::parse_hex(disp)
+                        .map(|d| (self.section.hunk, (offset + 2).wrapping_add(d as u16 as i16 as u32)))
+                } else if operand.ends_with(".l") {
+                    let hunk = self.section.relocs.get(&(offset + 2));
+                    let value = self.read_u32(offset as usize + 2);
+                    match (hunk, value) {
+                        (Some(hunk), Some(value)) => Some((*hunk, value)),
+                        _ => None,
+                    }
+                } else {
+                    None
+                };
+
+                return if name == "jmp" { Flow::Jump(target) } else { Flow::Call(target) };
+            }
+            _ => (),
+        }
+
+        // Conditional branches (bcc) and loops (dbcc)
+        let is_branch = (name.starts_with("db") && DBCC_CONDITIONS.contains(&&name[2..])) ||
+                        (name.starts_with("b") && BCC_CONDITIONS.contains(&&name[1..]));
+
+        if is_branch && operand.starts_with("#$") {
+            if let Some(target) = Self::parse_hex(&operand[2..]) {
+                return Flow::Branch(target);
+            }
+        }
+
+        Flow::Next
+    }
+
+    fn add_target(&mut self, from: u32, to: Location, kind: RefKind, work: &mut Vec<u32>) {
+        self.xrefs.push(XRef {
+            from: (self.section.hunk, from),
+            to: to,
+            kind: kind,
+        });
+
+        if to.0 != self.section.hunk {
+            self.external.push((to, kind == RefKind::Call));
+            return;
+        }
+
+        if kind == RefKind::Call {
+            self.functions.push(to.1);
+        }
+
+        self.block_starts.insert(to.1);
+        work.push(to.1);
+    }
+
+    ///
+    /// Decode offset..end and classify each instruction. Capstone Service 2 decodes into a batch
+    /// that is reused for the whole walk so no allocations are done per window. If the host
+    /// doesn't provide it the regular disasm call is used instead.
+    ///
+    fn decode_window(&self,
+                     capstone: &Capstone,
+                     decoder: Option<&mut BatchDecoder>,
+                     batch: &mut InsnBatch,
+                     offset: usize,
+                     end: usize,
+                     window: &mut Vec<(u32, u32, Flow)>) {
+        let code = &self.section.data[offset..end];
+
+        match decoder {
+            Some(decoder) => {
+                batch.clear();
+                decoder.decode(code, offset as u64, 0, batch);
+
+                for i in 0..batch.len() {
+                    let insn_offset = batch.addresses[i] as u32;
+                    let flow = self.classify(insn_offset, batch.mnemonic(i), batch.op_str(i));
+                    window.push((insn_offset, batch.sizes[i] as u32, flow));
+                }
+            }
+
+            None => {
+                if let Ok(insns) = capstone.disasm(code, offset as u64, 0) {
+                    for insn in insns.iter() {
+                        let insn_offset = insn.address as u32;
+                        let flow = self.classify(insn_offset,
+                                                 insn.mnemonic().unwrap_or(""),
+                                                 insn.op_str().unwrap_or(""));
+                        window.push((insn_offset, insn.size as u32, flow));
+                    }
+                }
+            }
+        }
+    }
+
+    ///
+    /// Recursive descent from the given offsets
+    ///
+    fn decode(&mut self, capstone: &Capstone, entries: &[u32]) {
+        let mut work: Vec<u32> = entries.to_vec();
+        let mut decoder = capstone.batch_decoder();
+        // 68000 instructions are at least 2 bytes
+        let mut batch = InsnBatch::with_capacity(DECODE_WINDOW / 2);
+        let mut window = Vec::with_capacity(DECODE_WINDOW / 2);
+
+        for entry in entries {
+            self.block_starts.insert(*entry);
+        }
+
+        while let Some(start) = work.pop() {
+            let mut offset = start as usize;
+
+            'run: loop {
+                if offset >= self.section.data.len() || (offset & 1) != 0 {
+                    break;
+                }
+
+                let end = (offset + DECODE_WINDOW).min(self.section.data.len());
+                self.decode_window(capstone, decoder.as_mut(), &mut batch, offset, end, &mut window);
+
+                let mut next = offset;
+
+                for (insn_offset, size, flow) in window.drain(..) {
+                    if self.visited[insn_offset as usize / 2] {
+                        self.block_starts.insert(insn_offset);
+                        break 'run;
+                    }
+
+                    self.visited[insn_offset as usize / 2] = true;
+                    next = insn_offset as usize + size as usize;
+
+                    let ends_block = match flow {
+                        Flow::Next => false,
+                        Flow::Call(target) => {
+                            if let Some(target) = target {
+                                self.add_target(insn_offset, target, RefKind::Call, &mut work);
+                            }
+                            false
+                        }
+                        _ => true,
+                    };
+
+                    self.insns.push((insn_offset, size, ends_block));
+
+                    match flow {
+                        Flow::Branch(target) => {
+                            let hunk = self.section.hunk;
+                            self.add_target(insn_offset, (hunk, target), RefKind::Branch, &mut work);
+                            self.block_starts.insert(next as u32);
+                        }
+                        Flow::Jump(target) => {
+                            if let Some(target) = target {
+                                self.add_target(insn_offset, target, RefKind::Jump, &mut work);
+                            }
+                            break 'run;
+                        }
+                        Flow::Return => break 'run,
+                        _ => (),
+                    }
+                }
+
+                // Nothing could be decoded (invalid data or end of section)
+                if next == offset {
+                    break;
+                }
+
+                offset = next;
+            }
+        }
+    }
+
+    fn build_blocks(&mut self, blocks: &mut Vec<BasicBlock>) {
+        self.insns.sort_by(|a, b| a.0.cmp(&b.0));
+
+        let hunk = self.section.hunk;
+        let mut current: Option<BasicBlock> = None;
+
+        for &(offset, size, ends_block) in &self.insns {
+            if let Some(mut block) = current.take() {
+                if block.end == offset && !self.block_starts.contains(&offset) {
+                    block.end = offset + size;
+                    current = Some(block);
+                } else {
+                    blocks.push(block);
+                }
+            }
+
+            if current.is_none() {
+                current = Some(BasicBlock {
+                    hunk: hunk,
+                    start: offset,
+                    end: offset + size,
+                });
+            }
+
+            if ends_block {
+                blocks.push(current.take().unwrap());
+            }
+        }
+
+        if let Some(block) = current {
+            blocks.push(block);
+        }
+    }
+}
+
+impl CodeAnalysis {
+    ///
+    /// Analyze all sections. Sections with work left are spread over at most one worker per CPU,
+    /// each with its own Capstone handle, and targets that crosses sections are handed over in
+    /// the next round.
+    ///
+    pub fn analyze(capstone: &Capstone, sections: Vec<Section>) -> CodeAnalysis {
+        let mut states: Vec<SectionState> = sections.into_iter().map(SectionState::new).collect();
+        let mut entries: Vec<Vec<u32>> = states.iter().map(|s| s.section.entry_points.clone()).collect();
+        let mut extra_functions = Vec::new();
+        let worker_count = thread::available_parallelism().map(|n| n.get()).unwrap_or(4);
+
+        while entries.iter().any(|e| e.len() > 0) {
+            let count = states.len();
+            let mut done: Vec<Option<SectionState>> = (0..count).map(|_| None).collect();
+            let mut jobs: Vec<Vec<(usize, SectionState, Vec<u32>)>> = (0..worker_count).map(|_| Vec::new()).collect();
+            let mut job_sizes = vec![0usize; worker_count];
+
+            // Give each section to the worker with the least data so far
+
+            for (index, (state, entry)) in states.drain(..).zip(entries.drain(..)).enumerate() {
+                if entry.len() == 0 {
+                    done[index] = Some(state);
+                    continue;
+                }
+
+                let worker = (0..worker_count).min_by_key(|&w| job_sizes[w]).unwrap();
+                job_sizes[worker] += state.section.data.len();
+                jobs[worker].push((index, state, entry));
+            }
+
+            let mut threads = Vec::new();
+
+            for job in jobs.into_iter().filter(|job| job.len() > 0) {
+                let mut worker_capstone = capstone.new_instance();
+
+                threads.push(thread::spawn(move || {
+                    let is_open = worker_capstone.open(Arch::M68K, CS_MODE_M68K_000).is_ok();
+                    if is_open {
+                        // Only the text is used so skip decoding the details
+                        worker_capstone.set_detail(false).ok();
+                    }
+
+                    job.into_iter()
+                        .map(|(index, mut state, entry)| {
+                            if is_open {
+                                state.decode(&worker_capstone, &entry);
+                            }
+                            (index, state)
+                        })
+                        .collect::<Vec<_>>()
+                }));
+            }
+
+            for t in threads {
+                for (index, state) in t.join().unwrap() {
+                    done[index] = Some(state);
+                }
+            }
+
+            states.extend(done.into_iter().map(|state| state.unwrap()));
+            entries.extend((0..count).map(|_| Vec::new()));
+
+            // Hand over targets in other sections
+
+            for i in 0..states.len() {
+                for (target, is_call) in states[i].external.drain(..).collect::<Vec<_>>() {
+                    if let Some(index) = states.iter().position(|s| s.section.hunk == target.0) {
+                        if is_call {
+                            extra_functions.push(target);
+                        }
+
+                        let offset = target.1 as usize;
+                        let state = &mut states[index];
+                        if offset < state.section.data.len() && !state.visited[offset / 2] {
+                            entries[index].push(target.1);
+                        } else {
+                            state.block_starts.insert(target.1);
+                        }
+                    }
+                }
+            }
+        }
+
+        let mut analysis = CodeAnalysis {
+            blocks: Vec::new(),
+            functions: extra_functions,
+            xrefs: Vec::new(),
+            calls: Vec::new(),
+        };
+
+        for state in &mut states {
+            state.build_blocks(&mut analysis.blocks);
+            let hunk = state.section.hunk;
+            analysis.functions.extend(state.functions.iter().map(|offset| (hunk, *offset)));
+            analysis.functions.extend(state.section.entry_points.iter().map(|offset| (hunk, *offset)));
+            analysis.xrefs.extend(state.xrefs.drain(..));
+        }
+
+        analysis.finish();
+        analysis
+    }
+
+    ///
+    /// Sort everything for lookups and build the call graph
+    ///
+    fn finish(&mut self) {
+        self.blocks.sort_by(|a, b| (a.hunk, a.start).cmp(&(b.hunk, b.start)));
+        self.functions.sort();
+        self.functions.dedup();
+        self.xrefs.sort_by(|a, b| (a.to, a.from).cmp(&(b.to, b.from)));
+
+        self.calls.clear();
+
+        for xref in &self.xrefs {
+            if xref.kind != RefKind::Call {
+                continue;
+            }
+
+            if let Some(caller) = self.function_containing(xref.from) {
+                self.calls.push((caller, xref.to));
+            }
+        }
+
+        self.calls.sort();
+        self.calls.dedup();
+    }
+
+    pub fn is_function_start(&self, location: Location) -> bool {
+        self.functions.binary_search(&location).is_ok()
+    }
+
+    pub fn function_containing(&self, location: Location) -> Option<Location> {
+        let index = match self.functions.binary_search(&location) {
+            Ok(index) => return Some(self.functions[index]),
+            Err(0) => return None,
+            Err(index) => index - 1,
+        };
+
+        let func = self.functions[index];
+        if func.0 == location.0 { Some(func) } else { None }
+    }
+
+    ///
+    /// All places that branches, jumps or calls to location
+    ///
+    pub fn references_to(&self, location: Location) -> &[XRef] {
+        // lower bound of location
+        let mut start = 0;
+        let mut end = self.xrefs.len();
+
+        while start < end {
+            let mid = (start + end) / 2;
+            if self.xrefs[mid].to < location {
+                start = mid + 1;
+            } else {
+                end = mid;
+            }
+        }
+
+        while end < self.xrefs.len() && self.xrefs[end].to == location {
+            end += 1;
+        }
+
+        &self.xrefs[start..end]
+    }
+
+    pub fn is_jump_target(&self, location: Location) -> bool {
+        self.references_to(location).iter().any(|x| x.kind != RefKind::Call)
+    }
+
+    ///
+    /// Hash of the sections used to check if a cache file is still valid (FNV-1a). Entry points
+    /// and relocations are included as a relinked executable can have the same code bytes.
+    ///
+    pub fn hash_sections(sections: &[Section]) -> u64 {
+        let mut hash = 0xcbf29ce484222325u64;
+
+        fn hash_bytes(hash: &mut u64, data: &[u8]) {
+            for b in data {
+                *hash ^= *b as u64;
+                *hash = hash.wrapping_mul(0x100000001b3);
+            }
+        }
+
+        fn hash_u32(hash: &mut u64, v: u32) {
+            hash_bytes(hash, &[v as u8, (v >> 8) as u8, (v >> 16) as u8, (v >> 24) as u8]);
+        }
+
+        for section in sections {
+            hash_bytes(&mut hash, &[section.hunk as u8, (section.hunk >> 8) as u8]);
+            hash_bytes(&mut hash, &section.data);
+
+            hash_u32(&mut hash, section.entry_points.len() as u32);
+            for entry in &section.entry_points {
+                hash_u32(&mut hash, *entry);
+            }
+
+            // HashMap iteration order isn't stable so sort the relocations first
+            let mut relocs: Vec<(u32, u32)> = section.relocs.iter().map(|(o, h)| (*o, *h)).collect();
+            relocs.sort();
+
+            hash_u32(&mut hash, relocs.len() as u32);
+            for (offset, hunk) in relocs {
+                hash_u32(&mut hash, offset);
+                hash_u32(&mut hash, hunk);
+            }
+        }
+
+        hash
+    }
+
+    pub fn save(&self, filename: &str, hash: u64) -> io::Result<()> {
+        let mut data = Vec::new();
+
+        fn put(data: &mut Vec<u8>, v: u32) {
+            data.extend_from_slice(&[v as u8, (v >> 8) as u8, (v >> 16) as u8, (v >> 24) as u8]);
+        }
+
+        put(&mut data, CACHE_MAGIC);
+        put(&mut data, CACHE_VERSION);
+        put(&mut data, hash as u32);
+        put(&mut data, (hash >> 32) as u32);
+
+        put(&mut data, self.blocks.len() as u32);
+        for block in &self.blocks {
+            put(&mut data, block.hunk);
+            put(&mut data, block.start);
+            put(&mut data, block.end);
+        }
+
+        put(&mut data, self.functions.len() as u32);
+        for func in &self.functions {
+            put(&mut data, func.0);
+            put(&mut data, func.1);
+        }
+
+        put(&mut data, self.xrefs.len() as u32);
+        for xref in &self.xrefs {
+            put(&mut data, xref.from.0);
+            put(&mut data, xref.from.1);
+            put(&mut data, xref.to.0);
+            put(&mut data, xref.to.1);
+            put(&mut data, xref.kind as u32);
+        }
+
+        let mut file = try!(File::create(filename));
+        file.write_all(&data)
+    }
+
+    ///
+    /// Load the analysis from a cache file. Returns None if the file is missing, broken or was
+    /// saved for another version of the image.
+    ///
+    pub fn load(filename: &str, hash: u64) -> Option<CodeAnalysis> {
+        let mut data = Vec::new();
+
+        if File::open(filename).and_then(|mut f| f.read_to_end(&mut data)).is_err() {
+            return None;
+        }
+
+        Self::read_cache(&data, hash).ok()
+    }
+
+    fn read_cache(data: &[u8], hash: u64) -> io::Result<CodeAnalysis> {
+        let mut reader = CacheReader {
+            data: data,
+            pos: 0,
+        };
+
+        if try!(reader.next()) != CACHE_MAGIC || try!(reader.next()) != CACHE_VERSION {
+            return Err(io::Error::new(io::ErrorKind::InvalidData, "not an analysis cache file"));
+        }
+
+        let lo = try!(reader.next()) as u64;
+        let hi = try!(reader.next()) as u64;
+
+        if (hi << 32 | lo) != hash {
+            return Err(io::Error::new(io::ErrorKind::InvalidData, "analysis cache is out of date"));
+        }
+
+        let mut analysis = CodeAnalysis {
+            blocks: Vec::new(),
+            functions: Vec::new(),
+            xrefs: Vec::new(),
+            calls: Vec::new(),
+        };
+
+        for _ in 0..try!(reader.next()) {
+            analysis.blocks.push(BasicBlock {
+                hunk: try!(reader.next()),
+                start: try!(reader.next()),
+                end: try!(reader.next()),
+            });
+        }
+
+        for _ in 0..try!(reader.next()) {
+            let hunk = try!(reader.next());
+            let offset = try!(reader.next());
+            analysis.functions.push((hunk, offset));
+        }
+
+        for _ in 0..try!(reader.next()) {
+            let from = (try!(reader.next()), try!(reader.next()));
+            let to = (try!(reader.next()), try!(reader.next()));
+            let kind = match try!(reader.next()) {
+                0 => RefKind::Jump,
+                1 => RefKind::Branch,
+                _ => RefKind::Call,
+            };
+            analysis.xrefs.push(XRef {
+                from: from,
+                to: to,
+                kind: kind,
+            });
+        }
+
+        analysis.finish();
+        Ok(analysis)
+    }
+}
+
+struct CacheReader<'a> {
+    data: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> CacheReader<'a> {
+    fn next(&mut self) -> io::Result<u32> {
+        if self.pos + 4 > self.data.len() {
+            return Err(io::Error::new(io::ErrorKind::UnexpectedEof, "analysis cache is truncated"));
+        }
+
+        let c = &self.data[self.pos..self.pos + 4];
+        self.pos += 4;
+
+        Ok((c[0] as u32) | ((c[1] as u32) << 8) | ((c[2] as u32) << 16) | ((c[3] as u32) << 24))
+    }
+}
+
+///
+/// Runs the analysis in the background (or loads it from the cache file next to the executable)
+///
+pub struct AnalysisJob {
+    receiver: Receiver<CodeAnalysis>,
+}
+
+impl AnalysisJob {
+    pub fn start(capstone: &Capstone, sections: Vec<Section>, cache_filename: String) -> AnalysisJob {
+        let (sender, receiver) = channel();
+        let capstone = capstone.new_instance();
+
+        thread::spawn(move || {
+            let hash = CodeAnalysis::hash_sections(&sections);
+
+            let analysis = match CodeAnalysis::load(&cache_filename, hash) {
+                Some(analysis) => analysis,
+                None => {
+                    let analysis = CodeAnalysis::analyze(&capstone, sections);
+                    if let Err(e) = analysis.save(&cache_filename, hash) {
+                        println!("Unable to write analysis cache {} - {:?}", cache_filename, e);
+                    }
+                    analysis
+                }
+            };
+
+            println!("Code analysis done: {} functions, {} blocks, {} xrefs",
+                     analysis.functions.len(),
+                     analysis.blocks.len(),
+                     analysis.xrefs.len());
+
+            sender.send(analysis).ok();
+        });
+
+        AnalysisJob { receiver: receiver }
+    }
+
+    pub fn poll(&self) -> Option<CodeAnalysis> {
+        self.receiver.try_recv().ok()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::env;
+    use fake_services::fake_capstone;
+
+    fn test_analysis() -> CodeAnalysis {
+        let mut analysis = CodeAnalysis {
+            blocks: vec![BasicBlock { hunk: 0, start: 0, end: 8 },
+                         BasicBlock { hunk: 0, start: 8, end: 12 }],
+            functions: vec![(0, 0), (0, 8), (1, 0)],
+            xrefs: vec![XRef { from: (0, 2), to: (0, 8), kind: RefKind::Call },
+                        XRef { from: (0, 10), to: (0, 8), kind: RefKind::Branch },
+                        XRef { from: (0, 4), to: (1, 0), kind: RefKind::Call }],
+            calls: Vec::new(),
+        };
+        analysis.finish();
+        analysis
+    }
+
+    #[test]
+    fn test_lookups() {
+        let analysis = test_analysis();
+
+        assert_eq!(analysis.references_to((0, 8)).len(), 2);
+        assert_eq!(analysis.references_to((1, 0)).len(), 1);
+        assert_eq!(analysis.references_to((0, 4)).len(), 0);
+        assert!(analysis.is_jump_target((0, 8)));
+        assert!(!analysis.is_jump_target((1, 0)));
+        assert_eq!(analysis.function_containing((0, 6)), Some((0, 0)));
+        assert_eq!(analysis.function_containing((0, 10)), Some((0, 8)));
+        assert_eq!(analysis.calls, vec![((0, 0), (0, 8)), ((0, 0), (1, 0))]);
+    }
+
+    #[test]
+    fn test_cache_file() {
+        let path = env::temp_dir().join("prodbg_code_analysis_test.pdanalysis");
+        let filename = path.to_str().unwrap();
+
+        test_analysis().save(filename, 1234).unwrap();
+
+        assert!(CodeAnalysis::load(filename, 4321).is_none());
+
+        let analysis = CodeAnalysis::load(filename, 1234).unwrap();
+        assert_eq!(analysis.blocks.len(), 2);
+        assert_eq!(analysis.functions.len(), 3);
+        assert_eq!(analysis.references_to((0, 8)).len(), 2);
+    }
+
+    fn section_state(hunk: u32, data: Vec<u8>, relocs: &[(u32, u32)]) -> SectionState {
+        SectionState::new(Section {
+            hunk: hunk,
+            data: data,
+            entry_points: Vec::new(),
+            relocs: relocs.iter().cloned().collect(),
+        })
+    }
+
+    #[test]
+    fn test_classify_branches() {
+        let state = section_state(0, vec![0; 32], &[]);
+
+        assert_eq!(state.classify(0, "bra.b", "#$10"), Flow::Jump(Some((0, 0x10))));
+        assert_eq!(state.classify(0, "bsr.w", "#$20"), Flow::Call(Some((0, 0x20))));
+        assert_eq!(state.classify(0, "beq.b", "#$8"), Flow::Branch(8));
+        assert_eq!(state.classify(0, "dbra", "d0, #$4"), Flow::Branch(4));
+        assert_eq!(state.classify(0, "bset", "#$1, d0"), Flow::Next);
+        assert_eq!(state.classify(0, "move.l", "d0, d1"), Flow::Next);
+        assert_eq!(state.classify(0, "rts", ""), Flow::Return);
+    }
+
+    #[test]
+    fn test_classify_jumps() {
+        // jsr $00000010.l with a relocation into hunk 1 followed by jmp $00000020.l without one
+        let data = vec![0x4e, 0xb9, 0x00, 0x00, 0x00, 0x10, 0x4e, 0xf9, 0x00, 0x00, 0x00, 0x20];
+        let state = section_state(0, data, &[(2, 1)]);
+
+        assert_eq!(state.classify(4, "jmp", "$6(pc)"), Flow::Jump(Some((0, 12))));
+        assert_eq!(state.classify(8, "jsr", "$fffe(pc)"), Flow::Call(Some((0, 8))));
+        assert_eq!(state.classify(0, "jsr", "$10.l"), Flow::Call(Some((1, 0x10))));
+        assert_eq!(state.classify(6, "jmp", "$20.l"), Flow::Jump(None));
+        assert_eq!(state.classify(0, "jmp", "(a0)"), Flow::Jump(None));
+    }
+
+    #[test]
+    fn test_analyze() {
+        let capstone = fake_capstone();
+
+        // 0x00: bsr.b $8
+        // 0x02: beq.b $6
+        // 0x04: nop
+        // 0x06: rts
+        // 0x08: jsr $4.l (relocated to hunk 1)
+        // 0x0e: rts
+        // 0x10: nop (never reached)
+        let code = vec![0x61, 0x06, 0x67, 0x02, 0x4e, 0x71, 0x4e, 0x75, 0x4e, 0xb9, 0x00, 0x00,
+                        0x00, 0x04, 0x4e, 0x75, 0x4e, 0x71];
+
+        // 0x00: nop, 0x02: nop, 0x04: nop, 0x06: rts
+        let other = vec![0x4e, 0x71, 0x4e, 0x71, 0x4e, 0x71, 0x4e, 0x75];
+
+        let mut relocs = HashMap::new();
+        relocs.insert(0x0a, 1);
+
+        let sections = vec![Section { hunk: 0, data: code, entry_points: vec![0], relocs: relocs },
+                            Section { hunk: 1, data: other, entry_points: Vec::new(), relocs: HashMap::new() }];
+
+        let analysis = CodeAnalysis::analyze(&capstone, sections);
+
+        let blocks: Vec<(u32, u32, u32)> = analysis.blocks.iter().map(|b| (b.hunk, b.start, b.end)).collect();
+        assert_eq!(blocks, vec![(0, 0, 4), (0, 4, 6), (0, 6, 8), (0, 8, 16), (1, 4, 8)]);
+
+        assert_eq!(analysis.functions, vec![(0, 0), (0, 8), (1, 4)]);
+        assert!(analysis.is_jump_target((0, 6)));
+        assert_eq!(analysis.references_to((1, 4))[0].from, (0, 8));
+        assert_eq!(analysis.calls, vec![((0, 0), (0, 8)), ((0, 8), (1, 4))]);
+    }
+
+    #[test]
+    fn test_hash_includes_relocs() {
+        let section = |entry: u32, relocs: &[(u32, u32)]| {
+            Section {
+                hunk: 0,
+                data: vec![0x4e, 0x75],
+                entry_points: vec![entry],
+                relocs: relocs.iter().cloned().collect(),
+            }
+        };
+
+        let hash = CodeAnalysis::hash_sections(&[section(0, &[])]);
+
+        assert_eq!(hash, CodeAnalysis::hash_sections(&[section(0, &[])]));
+        assert!(hash != CodeAnalysis::hash_sections(&[section(2, &[])]));
+        assert!(hash != CodeAnalysis::hash_sections(&[section(0, &[(0, 1)])]));
+    }
+}
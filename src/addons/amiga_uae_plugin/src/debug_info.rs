@@ -1,14 +1,143 @@
-use std::path::Path;
-use amiga_hunk_parser::{Hunk, HunkParser, SourceLine};
+use std::cmp::Ordering;
+use std::collections::HashMap;
+use std::path::{Path, PathBuf};
+use amiga_hunk_parser::{HunkFile, HunkType, SourceFile};
+use code_analysis::Section;
+
+#[derive(Debug, Clone, Copy)]
+struct LineEntry {
+    offset: u32,
+    file: u32,
+    line: u32,
+}
+
+///
+/// Line info of all hunks indexed for fast lookups in both directions. Built once when the debug
+/// info is loaded so resolving a location on each stop doesn't need to walk all lines.
+///
+struct LineIndex {
+    /// Per hunk: all lines of all files sorted by offset
+    hunk_lines: Vec<Vec<LineEntry>>,
+    /// Size of each hunk. Offsets past the end doesn't belong to the last line.
+    hunk_sizes: Vec<u32>,
+    files: Vec<String>,
+    /// (file, line) -> (hunk, offset) of the first code generated for the line
+    addresses: HashMap<(u32, u32), (u32, u32)>,
+    file_ids: HashMap<String, u32>,
+}
+
+impl LineIndex {
+    fn new() -> LineIndex {
+        LineIndex {
+            hunk_lines: Vec::new(),
+            hunk_sizes: Vec::new(),
+            files: Vec::new(),
+            addresses: HashMap::new(),
+            file_ids: HashMap::new(),
+        }
+    }
+
+    ///
+    /// hunks gives the size and the line info for each hunk
+    ///
+    fn build<I: Iterator<Item = (usize, Vec<SourceFile>)>>(hunks: I) -> LineIndex {
+        let mut index = LineIndex::new();
+
+        for (hunk_id, (data_size, source_files)) in hunks.enumerate() {
+            let mut lines = Vec::new();
+
+            for src_file in &source_files {
+                let file = index.file_id(&src_file.name);
+
+                for line in &src_file.lines {
+                    lines.push(LineEntry {
+                        offset: line.offset,
+                        file: file,
+                        line: line.line,
+                    });
+
+                    index.addresses
+                        .entry((file, line.line))
+                        .or_insert((hunk_id as u32, line.offset));
+                }
+            }
+
+            // Stable sort so the first file/line listed for an offset is found first
+            lines.sort_by_key(|entry| entry.offset);
+
+            index.hunk_lines.push(lines);
+            index.hunk_sizes.push(data_size as u32);
+        }
+
+        index
+    }
+
+    fn file_id(&mut self, name: &str) -> u32 {
+        if let Some(&id) = self.file_ids.get(name) {
+            return id;
+        }
+
+        let id = self.files.len() as u32;
+        self.files.push(name.to_owned());
+        self.file_ids.insert(name.to_owned(), id);
+        id
+    }
+
+    fn find_line(&self, offset: u32, hunk: u32) -> Option<(&str, u32)> {
+        let lines = match self.hunk_lines.get(hunk as usize) {
+            Some(lines) => lines,
+            None => return None,
+        };
+
+        if offset >= self.hunk_sizes[hunk as usize] {
+            return None;
+        }
+
+        // Find the number of entries starting at or before offset
+        let count = match lines.binary_search_by(|entry| {
+            if entry.offset <= offset { Ordering::Less } else { Ordering::Greater }
+        }) {
+            Ok(i) | Err(i) => i,
+        };
+
+        if count == 0 {
+            return None;
+        }
+
+        // Several lines can start at the same offset, the first one listed is used
+        let start = lines[count - 1].offset;
+        let mut i = count - 1;
+
+        while i > 0 && lines[i - 1].offset == start {
+            i -= 1;
+        }
+
+        let entry = &lines[i];
+
+        Some((&self.files[entry.file as usize], entry.line))
+    }
+
+    fn find_address(&self, filename: &str, line: u32) -> Option<(u32, u32)> {
+        self.file_ids
+            .get(filename)
+            .and_then(|file| self.addresses.get(&(*file, line)))
+            .cloned()
+    }
+}
 
 pub struct DebugInfo {
-    pub hunks: Vec<Hunk>,
+    /// Sections of the executable are only decoded when needed
+    pub file: Option<HunkFile>,
+    pub exe_path: PathBuf,
+    line_index: LineIndex,
 }
 
 impl DebugInfo {
     pub fn new() -> DebugInfo {
         DebugInfo {
-            hunks: Vec::new(),
+            file: None,
+            exe_path: PathBuf::new(),
+            line_index: LineIndex::new(),
         }
     }
 
@@ -16,76 +145,123 @@ impl DebugInfo {
         // TODO: Not assume dhx: path
         let path = Path::new(uae_path).join(&amiga_exe[4..]);
         println!("Trying debug data from {:?}", path);
-        if let Ok(hunks) = HunkParser::parse_file(path.to_str().unwrap()) {
+        if let Ok(file) = HunkFile::open(path.to_str().unwrap()) {
             println!("Loading ok!");
-            self.hunks = hunks;
+            self.line_index = LineIndex::build((0..file.len()).map(|i| {
+                (file.data_size(i), file.line_debug_info(i).unwrap_or(Vec::new()))
+            }));
+            self.file = Some(file);
+            self.exe_path = path;
         }
     }
 
-    fn try_find_line(filename: &str, 
-                     lines: &Vec<SourceLine>, 
-                     offset: u32) -> Option<(String, u32)> {
-        let mut source_line = 0u32;
-        let mut was_over = false;
-
-        for line in lines {
-            if line.offset == offset {
-                println!("Matching source {} line {}", filename, line.line);
-                return Some((filename.to_owned(), line.line));
-            } if line.offset <= offset {
-                source_line = line.line;
-            } else if line.offset > offset {
-                was_over = true;
+    ///
+    /// Names of all source files that has line info in any of the hunks
+    ///
+    pub fn source_files(&self) -> Vec<&str> {
+        self.line_index.files.iter().map(|name| name.as_str()).collect()
+    }
+
+    ///
+    /// Code hunks as input for the code analysis. The start of the first hunk and all symbols are
+    /// used as entry points.
+    ///
+    pub fn code_sections(&self) -> Vec<Section> {
+        let mut sections = Vec::new();
+
+        let file = match self.file {
+            Some(ref file) => file,
+            None => return sections,
+        };
+
+        for i in 0..file.len() {
+            if file.hunk_type(i) != HunkType::Code {
+                continue;
             }
-        }
 
-        if was_over {
-            println!("Partial Matching source {} line {}", filename, source_line);
-            Some((filename.to_owned(), source_line))
-        } else {
-            None
-        }
-    }
+            let data = match file.code(i) {
+                Some(data) => data.to_vec(),
+                None => continue,
+            };
 
-    pub fn resolve_file_line(&self, offset: u32, seg_id: u32) -> Option<(String, u32)> {
-        if seg_id >= self.hunks.len() as u32 {
-            return None; 
-        }
+            let mut entry_points = Vec::new();
 
-        let hunk = &self.hunks[seg_id as usize];
+            if i == 0 {
+                entry_points.push(0);
+            }
+
+            if let Some(symbols) = file.symbols(i) {
+                entry_points.extend(symbols.iter().map(|s| s.offset));
+            }
 
-        if let Some(ref source_files) = hunk.line_debug_info {
-            for src_file in source_files {
-                //if offset > src_file.base_offset {
-                //    continue;
-                //}
+            let mut relocs = HashMap::new();
 
-                if let Some(data) = Self::try_find_line(&src_file.name, &src_file.lines, offset) {
-                    return Some(data);
+            if let Some(reloc_32) = file.reloc_32(i) {
+                for reloc in &reloc_32 {
+                    for offset in &reloc.data {
+                        relocs.insert(*offset, reloc.target as u32);
+                    }
                 }
             }
+
+            sections.push(Section {
+                hunk: i as u32,
+                data: data,
+                entry_points: entry_points,
+                relocs: relocs,
+            });
         }
 
-        None
+        sections
+    }
+
+    pub fn resolve_file_line(&self, offset: u32, seg_id: u32) -> Option<(String, u32)> {
+        self.line_index
+            .find_line(offset, seg_id)
+            .map(|(filename, line)| (filename.to_owned(), line))
     }
 
     pub fn get_address_seg(&self, filename: &str, file_line: u32) -> Option<(u32, u32)> {
-        for (i, hunk) in self.hunks.iter().enumerate() {
-            if let Some(ref source_files) = hunk.line_debug_info {
-                for src_file in source_files {
-                    if src_file.name != filename {
-                        continue;
-                    }
+        self.line_index.find_address(filename, file_line)
+    }
+}
 
-                    for line in &src_file.lines {
-                        if line.line == file_line {
-                            return Some((i as u32, line.offset));
-                        }
-                    }
-                }
-            }
-        }
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use amiga_hunk_parser::{SourceFile, SourceLine};
+
+    fn lines(lines: &[(u32, u32)]) -> Vec<SourceLine> {
+        lines.iter().map(|&(line, offset)| SourceLine { line: line, offset: offset }).collect()
+    }
+
+    #[test]
+    fn test_line_index() {
+        let source_files = vec![SourceFile {
+                                    name: "main.c".to_owned(),
+                                    base_offset: 0,
+                                    lines: lines(&[(10, 0x00), (11, 0x08), (12, 0x08), (14, 0x20)]),
+                                },
+                                SourceFile {
+                                    name: "util.c".to_owned(),
+                                    base_offset: 0x40,
+                                    lines: lines(&[(3, 0x40), (4, 0x48)]),
+                                }];
+
+        let mut info = DebugInfo::new();
+        info.line_index = LineIndex::build(vec![(0x100, source_files)].into_iter());
+
+        assert_eq!(info.resolve_file_line(0x00, 0), Some(("main.c".to_owned(), 10)));
+        assert_eq!(info.resolve_file_line(0x08, 0), Some(("main.c".to_owned(), 11)));
+        assert_eq!(info.resolve_file_line(0x0c, 0), Some(("main.c".to_owned(), 11)));
+        assert_eq!(info.resolve_file_line(0x44, 0), Some(("util.c".to_owned(), 3)));
+        assert_eq!(info.resolve_file_line(0x80, 0), Some(("util.c".to_owned(), 4)));
+        assert_eq!(info.resolve_file_line(0x100, 0), None);
+        assert_eq!(info.resolve_file_line(0x00, 1), None);
 
-        None
+        assert_eq!(info.get_address_seg("main.c", 12), Some((0, 0x08)));
+        assert_eq!(info.get_address_seg("util.c", 4), Some((0, 0x48)));
+        assert_eq!(info.get_address_seg("util.c", 5), None);
+        assert_eq!(info.get_address_seg("other.c", 4), None);
     }
 }
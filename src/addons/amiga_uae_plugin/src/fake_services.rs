@@ -0,0 +1,415 @@
+//! Stand-ins for the host side of the plugin API used by the tests: a Capstone service that knows
+//! a handful of 68000 instructions, a service lookup and a reader/writer pair that lets the tests
+//! send events to the backend without the native reader/writer.
+
+use std::ffi::CStr;
+use std::mem;
+use std::ptr;
+use std::slice;
+use std::os::raw::{c_char, c_int, c_uchar, c_uint, c_ulonglong, c_ushort, c_void};
+use prodbg_api::{get_id_register_funcs, Capstone, CCapstone1, CPDReaderAPI, CPDWriterAPI, Insn,
+                 Reader, Service, WriteStatus, Writer};
+
+// Minimal stand-in for Capstone Service 1 (only the part of PDCapstoneFuncs that CCapstone1 maps)
+#[repr(C)]
+struct FakeCapstone {
+    version: usize,
+    support: usize,
+    open: extern "C" fn(arch: c_int, mode: c_int, handle: *mut *const c_void) -> c_int,
+    close: extern "C" fn(handle: *mut *const c_void) -> c_int,
+    option: extern "C" fn(handle: *const c_void, _type: c_int, value: usize) -> c_int,
+    err: extern "C" fn(handle: *const c_void) -> c_int,
+    disasm: extern "C" fn(handle: *const c_void,
+                          code: *const u8,
+                          code_size: usize,
+                          address: u64,
+                          count: usize,
+                          insn: *mut *const Insn)
+                          -> usize,
+    free: extern "C" fn(insn: *const Insn, count: usize),
+    disasm_iter: usize,
+    regname: usize,
+}
+
+extern "C" fn fake_open(_arch: c_int, _mode: c_int, handle: *mut *const c_void) -> c_int {
+    unsafe { *handle = 1 as *const c_void };
+    0
+}
+
+extern "C" fn fake_close(_handle: *mut *const c_void) -> c_int {
+    0
+}
+
+extern "C" fn fake_option(_handle: *const c_void, _type: c_int, _value: usize) -> c_int {
+    0
+}
+
+extern "C" fn fake_err(_handle: *const c_void) -> c_int {
+    1
+}
+
+fn fake_decode(code: &[u8], address: u64) -> Option<(u16, String, String)> {
+    if code.len() < 2 {
+        return None;
+    }
+
+    let target = (address as i64 + 2 + code[1] as i8 as i64) as u64;
+
+    match (code[0], code[1]) {
+        (0x4e, 0x71) => Some((2, "nop".to_owned(), String::new())),
+        (0x4e, 0x75) => Some((2, "rts".to_owned(), String::new())),
+        (0x4e, 0xb9) if code.len() >= 6 => {
+            let value = ((code[2] as u32) << 24) | ((code[3] as u32) << 16) |
+                        ((code[4] as u32) << 8) | code[5] as u32;
+            Some((6, "jsr".to_owned(), format!("${:x}.l", value)))
+        }
+        (0x60, _) => Some((2, "bra.b".to_owned(), format!("#${:x}", target))),
+        (0x61, _) => Some((2, "bsr.b".to_owned(), format!("#${:x}", target))),
+        (0x67, _) => Some((2, "beq.b".to_owned(), format!("#${:x}", target))),
+        _ => None,
+    }
+}
+
+extern "C" fn fake_disasm(_handle: *const c_void,
+                          code: *const u8,
+                          code_size: usize,
+                          address: u64,
+                          count: usize,
+                          insn: *mut *const Insn)
+                          -> usize {
+    let code = unsafe { slice::from_raw_parts(code, code_size) };
+    let mut insns: Vec<Insn> = Vec::new();
+    let mut offset = 0;
+
+    while count == 0 || insns.len() < count {
+        let (size, mnemonic, op_str) = match fake_decode(&code[offset..], address + offset as u64) {
+            Some(decoded) => decoded,
+            None => break,
+        };
+
+        let mut out: Insn = unsafe { mem::zeroed() };
+        out.address = address + offset as u64;
+        out.size = size;
+
+        for (i, c) in mnemonic.bytes().enumerate() {
+            out.mnemonic[i] = c as i8;
+        }
+
+        for (i, c) in op_str.bytes().enumerate() {
+            out.op_str[i] = c as i8;
+        }
+
+        insns.push(out);
+        offset += size as usize;
+    }
+
+    let len = insns.len();
+    unsafe { *insn = Box::into_raw(insns.into_boxed_slice()) as *const Insn };
+    len
+}
+
+extern "C" fn fake_free(insn: *const Insn, count: usize) {
+    unsafe {
+        let insns = slice::from_raw_parts_mut(insn as *mut Insn, count);
+        drop(Box::from_raw(insns as *mut [Insn]));
+    }
+}
+
+static FAKE_CAPSTONE: FakeCapstone = FakeCapstone {
+    version: 0,
+    support: 0,
+    open: fake_open,
+    close: fake_close,
+    option: fake_option,
+    err: fake_err,
+    disasm: fake_disasm,
+    free: fake_free,
+    disasm_iter: 0,
+    regname: 0,
+};
+
+///
+/// Capstone that decodes nop, rts, jsr abs.l, bra.b, bsr.b and beq.b
+///
+pub fn fake_capstone() -> Capstone {
+    Capstone::new(&FAKE_CAPSTONE as *const FakeCapstone as *mut CCapstone1)
+}
+
+extern "C" fn fake_service_func(name: *const c_uchar) -> *mut c_void {
+    let name = unsafe { CStr::from_ptr(name as *const c_char) };
+
+    match name.to_bytes() {
+        b"Capstone Service 1" => &FAKE_CAPSTONE as *const FakeCapstone as *mut c_void,
+        b"IdFuncs 1" => get_id_register_funcs(),
+        _ => ptr::null_mut(),
+    }
+}
+
+///
+/// Services as the host would provide them to Backend::new. Capstone Service 2 and the symbols
+/// service are missing which the backends have to handle anyway.
+///
+pub fn fake_service() -> Service {
+    Service { service_func: fake_service_func }
+}
+
+const READ_OK: c_uint = 1 << 8;
+const READ_NOT_FOUND: c_uint = 4 << 8;
+
+trait FieldValue {
+    fn from_u64(v: u64) -> Self;
+}
+
+macro_rules! field_value {
+    ($($t:ty),*) => {
+        $(impl FieldValue for $t {
+            fn from_u64(v: u64) -> Self {
+                v as $t
+            }
+        })*
+    }
+}
+
+field_value!(i8, u8, i16, u16, i32, u32, i64, u64, f32, f64);
+
+///
+/// Reader with a queue of events that only have numeric fields
+///
+#[repr(C)]
+pub struct FakeReader {
+    api: CPDReaderAPI,
+    events: Vec<(i32, Vec<(&'static str, u64)>)>,
+    next: usize,
+}
+
+extern "C" fn read_get_event(reader: *mut c_void) -> c_uint {
+    let reader = unsafe { &mut *(reader as *mut FakeReader) };
+
+    if reader.next == reader.events.len() {
+        return 0;
+    }
+
+    reader.next += 1;
+    reader.events[reader.next - 1].0 as c_uint
+}
+
+extern "C" fn read_iterator_next_event(_reader: *mut c_void, _it: *mut c_ulonglong) -> c_uint {
+    0
+}
+
+extern "C" fn read_iterator_begin(_reader: *mut c_void,
+                                  _it: *mut c_ulonglong,
+                                  _key_name: *mut *const c_char,
+                                  _parent_it: c_ulonglong)
+                                  -> c_uint {
+    0
+}
+
+extern "C" fn read_iterator_next(_reader: *mut c_void,
+                                 _key_name: *mut *const c_char,
+                                 _it: *mut c_ulonglong)
+                                 -> c_uint {
+    0
+}
+
+extern "C" fn read_next_entry(_reader: *mut c_void, _array_it: *mut c_ulonglong) -> c_int {
+    0
+}
+
+extern "C" fn read_find_value<T: FieldValue>(reader: *mut c_void,
+                                             res: *mut T,
+                                             id: *const c_char,
+                                             _it: c_ulonglong)
+                                             -> c_uint {
+    let reader = unsafe { &*(reader as *const FakeReader) };
+    let id = unsafe { CStr::from_ptr(id) }.to_str().unwrap();
+
+    if reader.next == 0 {
+        return READ_NOT_FOUND;
+    }
+
+    match reader.events[reader.next - 1].1.iter().find(|field| field.0 == id) {
+        Some(field) => {
+            unsafe { *res = T::from_u64(field.1) };
+            READ_OK
+        }
+        None => READ_NOT_FOUND,
+    }
+}
+
+extern "C" fn read_find_string(_reader: *mut c_void,
+                               _res: *mut *const c_char,
+                               _id: *const c_char,
+                               _it: c_ulonglong)
+                               -> c_uint {
+    READ_NOT_FOUND
+}
+
+extern "C" fn read_find_data(_reader: *mut c_void,
+                             data: *mut *mut c_void,
+                             size: *mut c_ulonglong,
+                             _id: *const c_char,
+                             _it: c_ulonglong)
+                             -> c_uint {
+    // Reader::find_data makes a slice even when nothing is found
+    unsafe {
+        *data = ptr::NonNull::<u8>::dangling().as_ptr() as *mut c_void;
+        *size = 0;
+    }
+
+    READ_NOT_FOUND
+}
+
+extern "C" fn read_find_array(_reader: *mut c_void,
+                              _array_it: *mut c_ulonglong,
+                              _id: *const c_char,
+                              _it: c_ulonglong)
+                              -> c_uint {
+    READ_NOT_FOUND
+}
+
+extern "C" fn read_dump_data(_reader: *mut c_void) {}
+
+impl FakeReader {
+    pub fn new() -> Box<FakeReader> {
+        Box::new(FakeReader {
+            api: CPDReaderAPI {
+                data: ptr::null_mut(),
+                read_get_event: read_get_event,
+                read_iterator_next_event: read_iterator_next_event,
+                read_iterator_begin: read_iterator_begin,
+                read_iterator_next: read_iterator_next,
+                read_next_entry: read_next_entry,
+                read_find_s8: read_find_value::<c_char>,
+                read_find_u8: read_find_value::<c_uchar>,
+                read_find_s16: read_find_value::<i16>,
+                read_find_u16: read_find_value::<c_ushort>,
+                read_find_s32: read_find_value::<c_int>,
+                read_find_u32: read_find_value::<c_uint>,
+                read_find_s64: read_find_value::<i64>,
+                read_find_u64: read_find_value::<c_ulonglong>,
+                read_find_float: read_find_value::<f32>,
+                read_find_double: read_find_value::<f64>,
+                read_find_string: read_find_string,
+                read_find_data: read_find_data,
+                read_find_array: read_find_array,
+                read_dump_data: read_dump_data,
+            },
+            events: Vec::new(),
+            next: 0,
+        })
+    }
+
+    ///
+    /// Queues an event. Events that has been read already are dropped first.
+    ///
+    pub fn push(&mut self, event: i32, fields: &[(&'static str, u64)]) {
+        if self.next == self.events.len() {
+            self.events.clear();
+            self.next = 0;
+        }
+
+        self.events.push((event, fields.to_vec()));
+    }
+
+    pub fn reader(&mut self) -> Reader {
+        Reader::new(&mut self.api, 0)
+    }
+}
+
+// Same layout as CPDWriterAPI (which keeps its data pointer private) followed by the counters
+#[repr(C)]
+pub struct NullWriter {
+    private_data: *mut c_void,
+    write_event_begin: extern "C" fn(writer: *mut c_void, event: c_ushort) -> u64,
+    write_event_end: extern "C" fn(writer: *mut c_void) -> WriteStatus,
+    write_header_array_begin: extern "C" fn(writer: *mut c_void, ids: *mut *const c_char) -> WriteStatus,
+    write_header_array_end: extern "C" fn(writer: *mut c_void) -> WriteStatus,
+    write_array_begin: extern "C" fn(writer: *mut c_void, name: *const c_char) -> WriteStatus,
+    write_array_end: extern "C" fn(writer: *mut c_void) -> WriteStatus,
+    write_array_entry_begin: extern "C" fn(writer: *mut c_void) -> WriteStatus,
+    write_array_entry_end: extern "C" fn(writer: *mut c_void) -> WriteStatus,
+    write_s8: extern "C" fn(writer: *mut c_void, id: *const c_char, v: c_char) -> WriteStatus,
+    write_u8: extern "C" fn(writer: *mut c_void, id: *const c_char, v: c_uchar) -> WriteStatus,
+    write_s16: extern "C" fn(writer: *mut c_void, id: *const c_char, v: i16) -> WriteStatus,
+    write_u16: extern "C" fn(writer: *mut c_void, id: *const c_char, v: c_ushort) -> WriteStatus,
+    write_s32: extern "C" fn(writer: *mut c_void, id: *const c_char, v: c_int) -> WriteStatus,
+    write_u32: extern "C" fn(writer: *mut c_void, id: *const c_char, v: c_uint) -> WriteStatus,
+    write_s64: extern "C" fn(writer: *mut c_void, id: *const c_char, v: i64) -> WriteStatus,
+    write_u64: extern "C" fn(writer: *mut c_void, id: *const c_char, v: c_ulonglong) -> WriteStatus,
+    write_float: extern "C" fn(writer: *mut c_void, id: *const c_char, v: f32) -> WriteStatus,
+    write_double: extern "C" fn(writer: *mut c_void, id: *const c_char, v: f64) -> WriteStatus,
+    write_string: extern "C" fn(writer: *mut c_void, id: *const c_char, v: *const c_char) -> WriteStatus,
+    write_data: extern "C" fn(writer: *mut c_void, id: *const c_char, d: *const c_uchar, l: c_uint)
+                              -> WriteStatus,
+    /// Number of events written
+    pub events: usize,
+    /// Bytes written with write_data
+    pub data_size: usize,
+}
+
+extern "C" fn write_event_begin(writer: *mut c_void, _event: c_ushort) -> u64 {
+    let writer = unsafe { &mut *(writer as *mut NullWriter) };
+    writer.events += 1;
+    0
+}
+
+extern "C" fn write_status(_writer: *mut c_void) -> WriteStatus {
+    WriteStatus::Ok
+}
+
+extern "C" fn write_header_array_begin(_writer: *mut c_void, _ids: *mut *const c_char) -> WriteStatus {
+    WriteStatus::Ok
+}
+
+extern "C" fn write_array_begin(_writer: *mut c_void, _name: *const c_char) -> WriteStatus {
+    WriteStatus::Ok
+}
+
+extern "C" fn write_value<T>(_writer: *mut c_void, _id: *const c_char, _v: T) -> WriteStatus {
+    WriteStatus::Ok
+}
+
+extern "C" fn write_data(writer: *mut c_void,
+                         _id: *const c_char,
+                         _data: *const c_uchar,
+                         size: c_uint)
+                         -> WriteStatus {
+    let writer = unsafe { &mut *(writer as *mut NullWriter) };
+    writer.data_size += size as usize;
+    WriteStatus::Ok
+}
+
+impl NullWriter {
+    pub fn new() -> Box<NullWriter> {
+        Box::new(NullWriter {
+            private_data: ptr::null_mut(),
+            write_event_begin: write_event_begin,
+            write_event_end: write_status,
+            write_header_array_begin: write_header_array_begin,
+            write_header_array_end: write_status,
+            write_array_begin: write_array_begin,
+            write_array_end: write_status,
+            write_array_entry_begin: write_status,
+            write_array_entry_end: write_status,
+            write_s8: write_value::<c_char>,
+            write_u8: write_value::<c_uchar>,
+            write_s16: write_value::<i16>,
+            write_u16: write_value::<c_ushort>,
+            write_s32: write_value::<c_int>,
+            write_u32: write_value::<c_uint>,
+            write_s64: write_value::<i64>,
+            write_u64: write_value::<c_ulonglong>,
+            write_float: write_value::<f32>,
+            write_double: write_value::<f64>,
+            write_string: write_value::<*const c_char>,
+            write_data: write_data,
+            events: 0,
+            data_size: 0,
+        })
+    }
+
+    pub fn writer(&mut self) -> Writer {
+        Writer { api: self as *mut NullWriter as *mut CPDWriterAPI }
+    }
+}
@@ -0,0 +1,226 @@
+//! Decoding of memory and DMA data sent by the UAE gdb stub.
+//!
+//! Data is either sent as hex text or, if the stub supports the binary memory read packet ('x'),
+//! as binary data where '#', '$', '}' and '*' are escaped as '}' followed by the byte xor 0x20.
+//! The hex decoder works on 8 characters at a time inside a u64 which is several times faster
+//! than decoding one character at a time and the binary format halves the bytes on the wire.
+
+const ESCAPE: u8 = 0x7d;
+
+///
+/// How the stub replies to binary memory reads. Found by sending an empty read when connecting.
+///
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum BinaryMemory {
+    /// Stub doesn't know about 'x', use hex reads ('m')
+    Unsupported,
+    /// Reply is the data directly (lldb style, "OK" for an empty read)
+    Raw,
+    /// Reply is 'b' followed by the data (gdb style)
+    Prefixed,
+}
+
+impl BinaryMemory {
+    ///
+    /// Checks the reply of "x0,0"
+    ///
+    pub fn from_probe_reply(reply: &[u8]) -> BinaryMemory {
+        match reply {
+            b"OK" => BinaryMemory::Raw,
+            b"b" => BinaryMemory::Prefixed,
+            _ => BinaryMemory::Unsupported,
+        }
+    }
+}
+
+#[inline]
+fn load_u64(data: &[u8]) -> u64 {
+    let mut v = 0u64;
+    for i in 0..8 {
+        v |= (data[i] as u64) << (i * 8);
+    }
+    v
+}
+
+const ONES: u64 = 0x0101010101010101;
+const HIGH: u64 = 0x8080808080808080;
+
+///
+/// High bit set in each byte that is >= lo. Bytes must be < 0x80.
+///
+#[inline]
+fn bytes_ge(v: u64, lo: u8) -> u64 {
+    v.wrapping_add(ONES * (0x80 - lo as u64)) & HIGH
+}
+
+///
+/// High bit set in each byte that is > hi. Bytes must be < 0x80.
+///
+#[inline]
+fn bytes_gt(v: u64, hi: u8) -> u64 {
+    v.wrapping_add(ONES * (0x7f - hi as u64)) & HIGH
+}
+
+///
+/// Decodes 8 hex characters (loaded as a little endian u64) to 4 bytes. Returns None if any of
+/// them isn't a hex digit.
+///
+#[inline]
+fn decode_hex_8(v: u64) -> Option<u32> {
+    if v & HIGH != 0 {
+        return None;
+    }
+
+    let lower = v | (ONES * 0x20);
+    let digits = bytes_ge(v, b'0') & !bytes_gt(v, b'9');
+    let letters = bytes_ge(lower, b'a') & !bytes_gt(lower, b'f');
+
+    if (digits | letters) != HIGH {
+        return None;
+    }
+
+    // '0'-'9' has bit 6 clear and the value in the low nibble, 'a'-'f' / 'A'-'F' has it set and
+    // the value - 9 in the low nibble
+    let letter_bit = (v >> 6) & ONES;
+    let nibbles = (v & (ONES * 0x0f)) + (letter_bit << 3) + letter_bit;
+
+    // Each even byte gets its nibble as the high part and the next nibble as the low part
+    let pairs = (nibbles << 4) | (nibbles >> 8);
+
+    Some(((pairs & 0xff) | ((pairs >> 8) & 0xff00) | ((pairs >> 16) & 0xff0000) |
+          ((pairs >> 24) & 0xff000000)) as u32)
+}
+
+#[inline]
+fn hex_value(c: u8) -> Option<u8> {
+    match c {
+        b'0'...b'9' => Some(c - b'0'),
+        b'a'...b'f' => Some(c - b'a' + 10),
+        b'A'...b'F' => Some(c - b'A' + 10),
+        _ => None,
+    }
+}
+
+///
+/// Decodes hex text into dest (which is cleared first). Returns false if the text has an odd
+/// length or isn't hex in which case dest has the data up to the error.
+///
+pub fn decode_hex(dest: &mut Vec<u8>, src: &[u8]) -> bool {
+    dest.clear();
+    dest.reserve(src.len() / 2);
+
+    let mut chunks = src.chunks(8);
+    let mut rest: &[u8] = &[];
+
+    while let Some(chunk) = chunks.next() {
+        if chunk.len() < 8 {
+            rest = chunk;
+            break;
+        }
+
+        match decode_hex_8(load_u64(chunk)) {
+            Some(v) => dest.extend_from_slice(&[v as u8, (v >> 8) as u8, (v >> 16) as u8, (v >> 24) as u8]),
+            None => {
+                rest = chunk;
+                break;
+            }
+        }
+    }
+
+    for pair in rest.chunks(2) {
+        if pair.len() != 2 {
+            return false;
+        }
+
+        match (hex_value(pair[0]), hex_value(pair[1])) {
+            (Some(hi), Some(lo)) => dest.push((hi << 4) | lo),
+            _ => return false,
+        }
+    }
+
+    // A bad chunk in the middle stops the loop above early
+    chunks.next().is_none()
+}
+
+///
+/// Decodes binary packet data into dest (which is cleared first)
+///
+pub fn decode_binary(dest: &mut Vec<u8>, src: &[u8]) {
+    dest.clear();
+    dest.reserve(src.len());
+
+    let mut iter = src.iter();
+
+    while let Some(&c) = iter.next() {
+        if c == ESCAPE {
+            if let Some(&next) = iter.next() {
+                dest.push(next ^ 0x20);
+            }
+        } else {
+            dest.push(c);
+        }
+    }
+}
+
+///
+/// Decodes the reply of a binary memory read. Returns false if the reply isn't valid data of
+/// the expected size (such as an error reply) in which case a hex read should be used instead.
+///
+pub fn decode_memory_reply(dest: &mut Vec<u8>, reply: &[u8], mode: BinaryMemory, size: usize) -> bool {
+    let data = match mode {
+        BinaryMemory::Raw => reply,
+        BinaryMemory::Prefixed if reply.first() == Some(&b'b') => &reply[1..],
+        _ => return false,
+    };
+
+    decode_binary(dest, data);
+    dest.len() == size
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn decode_scalar(src: &[u8]) -> Vec<u8> {
+        src.chunks(2).map(|p| (hex_value(p[0]).unwrap() << 4) | hex_value(p[1]).unwrap()).collect()
+    }
+
+    #[test]
+    fn test_decode_hex() {
+        let text = b"0123456789abcdefABCDEF00ff10e0";
+        let mut dest = Vec::new();
+
+        for len in 0..text.len() / 2 {
+            assert!(decode_hex(&mut dest, &text[..len * 2]));
+            assert_eq!(dest, decode_scalar(&text[..len * 2]));
+        }
+
+        assert!(!decode_hex(&mut dest, b"012"));
+        assert!(!decode_hex(&mut dest, b"0123456g89"));
+        assert!(!decode_hex(&mut dest, b"0123456789abcdeg"));
+        assert!(!decode_hex(&mut dest, b"01234567:9abcdef00"));
+        assert!(!decode_hex(&mut dest, b"01234567/9abcdef00"));
+        assert!(!decode_hex(&mut dest, b"01234567`9abcdef00"));
+        assert!(!decode_hex(&mut dest, b"01234567G9abcdef00"));
+        assert!(!decode_hex(&mut dest, b"01234567@9abcdef00"));
+        assert!(!decode_hex(&mut dest, "0123456\u{e9}9abcdef0".as_bytes()));
+    }
+
+    #[test]
+    fn test_decode_binary_reply() {
+        let mut dest = Vec::new();
+
+        assert_eq!(BinaryMemory::from_probe_reply(b"OK"), BinaryMemory::Raw);
+        assert_eq!(BinaryMemory::from_probe_reply(b"b"), BinaryMemory::Prefixed);
+        assert_eq!(BinaryMemory::from_probe_reply(b""), BinaryMemory::Unsupported);
+
+        assert!(decode_memory_reply(&mut dest, &[1, 0x7d, 0x03, 0x7d, 0x5d, 2], BinaryMemory::Raw, 4));
+        assert_eq!(dest, vec![1, 0x23, 0x7d, 2]);
+
+        assert!(decode_memory_reply(&mut dest, b"bab", BinaryMemory::Prefixed, 2));
+        assert_eq!(dest, b"ab");
+
+        assert!(!decode_memory_reply(&mut dest, b"E01", BinaryMemory::Raw, 4));
+        assert!(!decode_memory_reply(&mut dest, b"E01", BinaryMemory::Prefixed, 2));
+    }
+}
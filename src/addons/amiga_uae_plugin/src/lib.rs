@@ -5,16 +5,44 @@ extern crate amiga_hunk_parser;
 extern crate nfd;
 
 mod debug_info;
+mod code_analysis;
+mod gdb_data;
+mod memory_reader;
+mod breakpoint_sync;
+#[cfg(test)]
+mod fake_services;
+#[cfg(test)]
+mod stub_tests;
 
 use prodbg_api::*;
+use std::env;
+use std::mem;
 use std::str;
+use std::collections::HashSet;
 use std::io::Result;
 use std::os::raw::c_void;
 use gdb_remote::GdbRemote;
 use debug_info::DebugInfo;
+use code_analysis::{AnalysisJob, CodeAnalysis};
+use gdb_data::BinaryMemory;
+use memory_reader::MemoryReader;
+use breakpoint_sync::{BreakpointLocation, BreakpointSync};
 use nfd::Response;
 use std::path::{Path, PathBuf};
 
+// Where UAE listens. Can be changed with PRODBG_UAE_ADDRESS (to use the uae_gdb_stub for example)
+const UAE_ADDRESS: &'static str = "127.0.0.1:6860";
+
+// Longest 68000 instruction and instruction alignment. Used when decoding backwards
+const M68K_MAX_INSN_SIZE: usize = 10;
+const M68K_INSN_ALIGN: usize = 2;
+// How far back a symbol or segment start is used as the place to start decoding backwards from
+const MAX_ANCHOR_DISTANCE: u64 = 4096;
+
+// Flags sent with disassembly lines
+const DISASM_FLAG_FUNCTION_START: u8 = 1;
+const DISASM_FLAG_JUMP_TARGET: u8 = 2;
+
 struct Breakpoint {
     file_line: Option<(String, u32)>,
     address: Option<u32>,
@@ -27,16 +55,30 @@ struct Segment {
 
 struct AmigaUaeBackend {
     capstone: Capstone,
+    disasm_cache: DisassemblyCache,
+    register_schema: RegisterSchema,
     conn: GdbRemote,
+    address: String,
     exception_location: u32,
     id_amiga_uae_dma_time: u16,
     amiga_exe_file_path: String,
     uae_partition_path: String,
     break_at_start: bool,
     debug_info: DebugInfo,
+    analysis_job: Option<AnalysisJob>,
+    analysis: Option<CodeAnalysis>,
+    /// Source files the host has been sent. After the full list only changes are sent.
+    sent_source_files: HashSet<String>,
     segments: Vec<Segment>,
     status: String,
     breakpoints: Vec<Breakpoint>,
+    breakpoint_sync: BreakpointSync,
+    symbols: Option<Symbols>,
+    /// Modules added to the symbols service for the hunks of the running executable
+    symbol_modules: Vec<u32>,
+    memory_reader: MemoryReader,
+    // Reused between frames to avoid allocating for each packet
+    dma_data: Vec<u8>,
 }
 
 impl AmigaUaeBackend {
@@ -56,47 +98,42 @@ impl AmigaUaeBackend {
         (t0 << 8) | t1
     }
 
-    fn write_register(writer: &mut Writer, name: &str, data: &[u8], read_only: bool) {
-        writer.array_entry_begin();
-        writer.write_string("name", name);
-
-        if read_only {
-            writer.write_u8("read_only", 1);
-        }
-
-        writer.write_data("register", &data[..4]);
-        writer.array_entry_end();
-    }
-
-    fn write_registers(&mut self, writer: &mut Writer, data: &[u8]) {
-        let mut index = 0;
-
-        writer.event_begin(EventType::SetRegisters as u16);
-        writer.array_begin("registers");
+    ///
+    /// Registers in the order UAE sends them: d0-d7, a0-a7, sr and pc
+    ///
+    fn create_register_schema() -> RegisterSchema {
+        let mut schema = RegisterSchema::new(1);
 
-        // d registers
         for i in 0..8 {
-            let name = format!("d{}", i);
-            Self::write_register(writer, &name, &data[index..], false);
-            index += 4;
+            schema.add(&format!("d{}", i), 4, false);
         }
 
-        // a registers
         for i in 0..8 {
-            let name = format!("a{}", i);
-            Self::write_register(writer, &name, &data[index..], false);
-            index += 4;
+            schema.add(&format!("a{}", i), 4, false);
         }
 
-        // Status registers & pc
+        schema.add("sr", 4, true);
+        schema.add("pc", 4, true);
+        schema
+    }
 
-        let pc = Self::get_u32(&data[index + 4..]);
+    fn write_registers(&mut self, writer: &mut Writer, data: &[u8]) {
+        let size = self.register_schema.data_size();
 
-        self.exception_location = pc;
+        // pc is the last register
+        self.exception_location = Self::get_u32(&data[size - 4..]);
 
-        Self::write_register(writer, "sr", &data[index..], true);
-        Self::write_register(writer, "pc", &data[index + 4..], true);
+        // Only registers that changed since last time are sent once the schema has been sent
+        self.register_schema.write(writer, &data[..size]);
+    }
 
+    ///
+    /// The view waits for a reply before it asks for more lines so one is always sent, even when
+    /// nothing could be disassembled
+    ///
+    fn write_empty_disassembly(writer: &mut Writer) {
+        writer.event_begin(EventType::SetDisassembly as u16);
+        writer.array_begin("disassembly");
         writer.array_end();
         writer.event_end();
     }
@@ -105,96 +142,265 @@ impl AmigaUaeBackend {
         match self.capstone.open(Arch::M68K, CS_MODE_M68K_000) {
             Err(e) => {
                 println!("Unable to open Capstone {}", e as i32);
+                Self::write_empty_disassembly(writer);
                 return;
             }
             _ => (),
         }
 
-        let mut scratch_string = String::with_capacity(256);
-
         let address = reader.find_u64("address_start").ok().unwrap();
-        let count = reader.find_u32("instruction_count").ok().unwrap();
+        let count = reader.find_u32("instruction_count").ok().unwrap() as usize;
+        let before = reader.find_u32("instructions_before").unwrap_or(0) as usize;
 
-        let mut data = Vec::<u8>::with_capacity(256 * 1024);
-        let memory_fetch_size = count * 4;
+        self.verify_cached(address, count, before);
+        self.decode_before(address, before);
 
-        if self.conn.get_memory(&mut data, address, memory_fetch_size as u64).is_err() {
-            println!("Unable to fetch memory from {:x} - size {}",
-                     address,
-                     memory_fetch_size);
-            return;
+        // Only fetch and decode the part of the range that isn't in the cache already
+
+        let (cached_count, next_address) = self.disasm_cache.contiguous_count(address, count);
+
+        if cached_count < count {
+            let mut data = Vec::<u8>::with_capacity(256 * 1024);
+            let memory_fetch_size = (count - cached_count) * 4;
+
+            // On failure the lines that are cached (if any) are still sent
+            if self.read_memory(&mut data, next_address, memory_fetch_size as u64).is_err() {
+                println!("Unable to fetch memory from {:x} - size {}",
+                         next_address,
+                         memory_fetch_size);
+            } else {
+                self.disasm_cache.verify(next_address, &data);
+                self.disasm_cache.insert_decoded(&self.capstone, &data, next_address);
+            }
         }
 
-        println!("disasm data address {:x} - len {}", address, data.len());
+        let (before_count, first_address) = self.disasm_cache.backward_count(address, before);
 
-        if let Ok(insns) = self.capstone.disasm(&data, address as u64, 0) {
-            writer.event_begin(EventType::SetDisassembly as u16);
-            writer.array_begin("disassembly");
-            let mut c = 0;
+        writer.event_begin(EventType::SetDisassembly as u16);
+        writer.array_begin("disassembly");
 
-            for i in insns.iter() {
-                let text = format!("{0: <10} {1: <10}",
-                                   i.mnemonic().unwrap(),
-                                   i.op_str().unwrap_or(""));
-                writer.array_entry_begin();
-                writer.write_u32("address", i.address as u32);
-                writer.write_string("line", &text);
+        for i in self.disasm_cache.iter_from(first_address, before_count + count) {
+            let text = format!("{0: <10} {1: <10}", i.mnemonic, i.op_str);
+            writer.array_entry_begin();
+            writer.write_u32("address", i.address as u32);
+            writer.write_string("line", &text);
 
-                scratch_string.clear();
+            let flags = self.get_line_flags(i.address);
 
-                for register in i.regs_read().unwrap() {
-                    let reg_name = self.capstone.reg_name(*register);
-                    scratch_string.push_str(reg_name);
-                    scratch_string.push(' ');
-                }
+            if flags != 0 {
+                writer.write_u8("flags", flags);
+            }
 
-                if scratch_string.len() > 0 {
-                    let t = scratch_string.trim_right();
-                    writer.write_string("registers_read", t);
-                }
+            if i.regs_read.len() > 0 {
+                writer.write_string("registers_read", &i.regs_read);
+            }
 
-                scratch_string.clear();
+            if i.regs_write.len() > 0 {
+                writer.write_string("registers_write", &i.regs_write);
+            }
 
-                for register in i.regs_write().unwrap() {
-                    let reg_name = self.capstone.reg_name(*register);
-                    scratch_string.push_str(reg_name);
-                    scratch_string.push(' ');
-                }
+            writer.array_entry_end();
+        }
 
-                if scratch_string.len() > 0 {
-                    let t = scratch_string.trim_right();
-                    writer.write_string("registers_write", t);
-                }
+        writer.array_end();
+        writer.event_end();
+    }
 
-                writer.array_entry_end();
+    ///
+    /// The target may have changed code since it last stopped. If so the memory under the cached
+    /// instructions that are about to be sent is read again and the ones that changed are evicted
+    /// (and decoded again by the caller).
+    ///
+    fn verify_cached(&mut self, address: u64, count: usize, before: usize) {
+        let (_, first) = self.disasm_cache.backward_count(address, before);
+        let (_, end) = self.disasm_cache.contiguous_count(address, count);
+
+        if self.disasm_cache.is_verified(first, end) {
+            return;
+        }
 
-                c += 1;
+        let mut data = Vec::<u8>::with_capacity((end - first) as usize);
+
+        if self.read_memory(&mut data, first, end - first).is_err() {
+            // Can't tell if the code is still the same
+            self.disasm_cache.invalidate_range(first, end);
+            return;
+        }
+
+        self.disasm_cache.verify(first, &data);
+    }
+
+    ///
+    /// Called when the target stops. Cached disassembly has to be checked against memory again.
+    ///
+    fn target_stopped(&mut self, writer: &mut Writer) {
+        self.disasm_cache.mark_unverified();
+        self.get_registers(writer);
+    }
+
+    ///
+    /// Maps a target address to (hunk, offset) using the segments we got when starting the
+    /// executable
+    ///
+    fn address_to_location(&self, address: u64) -> Option<(u32, u32)> {
+        for (i, seg) in self.segments.iter().enumerate() {
+            let seg_start = seg.address as u64;
+            let seg_end = seg_start + seg.size as u64;
+
+            if address >= seg_start && address < seg_end {
+                return Some((i as u32, (address - seg_start) as u32));
             }
+        }
 
-            println!("reported {} instructions", c);
+        None
+    }
 
-            writer.array_end();
-            writer.event_end();
-        } else {
-            println!("No instructions :(");
+    ///
+    /// Flags for a disassembly line from the code analysis (if it has finished)
+    ///
+    fn get_line_flags(&self, address: u64) -> u8 {
+        let analysis = match self.analysis {
+            Some(ref analysis) => analysis,
+            None => return 0,
+        };
+
+        let location = match self.address_to_location(address) {
+            Some(location) => location,
+            None => return 0,
+        };
+
+        let mut flags = 0;
+
+        if analysis.is_function_start(location) {
+            flags |= DISASM_FLAG_FUNCTION_START;
+        }
+
+        if analysis.is_jump_target(location) {
+            flags |= DISASM_FLAG_JUMP_TARGET;
         }
+
+        flags
     }
 
-    fn get_memory(&mut self, reader: &mut Reader, writer: &mut Writer) {
+    fn start_code_analysis(&mut self) {
+        let sections = self.debug_info.code_sections();
+
+        if sections.len() == 0 {
+            return;
+        }
+
+        let mut cache_path = self.debug_info.exe_path.clone().into_os_string();
+        cache_path.push(".pdanalysis");
+
+        self.analysis = None;
+        self.analysis_job = Some(AnalysisJob::start(&self.capstone,
+                                                    sections,
+                                                    cache_path.to_string_lossy().into_owned()));
+    }
+
+    fn update_code_analysis(&mut self) {
+        let analysis = match self.analysis_job {
+            Some(ref job) => job.poll(),
+            None => return,
+        };
+
+        if analysis.is_some() {
+            self.analysis = analysis;
+            self.analysis_job = None;
+        }
+    }
+
+    ///
+    /// Closest known instruction boundary before address (within MAX_ANCHOR_DISTANCE). Symbols and
+    /// the start of segments are used.
+    ///
+    fn find_decode_anchor(&self, address: u64) -> Option<u64> {
+        let limit = address.saturating_sub(MAX_ANCHOR_DISTANCE);
+        let mut anchor = None;
+
+        for seg in &self.segments {
+            let seg_start = seg.address as u64;
+            let seg_end = seg_start + seg.size as u64;
+
+            if address > seg_start && address <= seg_end && seg_start >= limit {
+                anchor = Some(seg_start);
+            }
+        }
+
+        if let Some(symbol) = self.symbols.as_ref().and_then(|symbols| symbols.lookup(address - 1)) {
+            if symbol.start >= limit && Some(symbol.start) > anchor {
+                anchor = Some(symbol.start);
+            }
+        }
+
+        anchor
+    }
+
+    ///
+    /// Makes sure that (up to) count instructions directly before address are in the disassembly
+    /// cache. Decoding starts at the closest symbol or segment start as those are known instruction
+    /// boundaries. Without one a start that lines up with address is searched for.
+    ///
+    fn decode_before(&mut self, address: u64, count: usize) {
+        let (cached_count, first) = self.disasm_cache.backward_count(address, count);
+
+        if cached_count == count || first == 0 {
+            return;
+        }
+
+        let start = match self.find_decode_anchor(first) {
+            Some(anchor) => anchor,
+            None => first.saturating_sub(((count - cached_count) * M68K_MAX_INSN_SIZE) as u64),
+        };
+
+        if start >= first {
+            return;
+        }
+
         let mut data = Vec::<u8>::with_capacity(256 * 1024);
+        let size = first - start;
+
+        if self.read_memory(&mut data, start, size).is_err() {
+            println!("Unable to fetch memory from {:x} - size {}", start, size);
+            return;
+        }
+
+        self.disasm_cache.verify(start, &data);
+
+        if self.disasm_cache
+            .decode_backward(&self.capstone, &data, start, first, M68K_INSN_ALIGN)
+            .is_none() {
+            println!("Unable to decode backwards from {:x}", first);
+        }
+    }
 
+    ///
+    /// Reads target memory using pipelined requests that fit the packet size of the stub
+    ///
+    fn read_memory(&mut self, dest: &mut Vec<u8>, address: u64, size: u64) -> Result<()> {
+        dest.clear();
+        self.memory_reader.read(&mut self.conn, address, size, |_, data| dest.extend_from_slice(data))
+    }
+
+    fn get_memory(&mut self, reader: &mut Reader, writer: &mut Writer) {
         let address = reader.find_u64("address_start").ok().unwrap();
         let size = reader.find_u32("size").ok().unwrap();
+        let disasm_cache = &mut self.disasm_cache;
+
+        // Each chunk is sent as soon as it arrives so the view can show it directly
+        let result = self.memory_reader.read(&mut self.conn, address, size as u64, |chunk_address, data| {
+            // Evict any cached disassembly for code that has changed since it was decoded
+            disasm_cache.verify(chunk_address, data);
+
+            writer.event_begin(EventType::SetMemory as u16);
+            writer.write_u64("address", chunk_address);
+            writer.write_data("data", data);
+            writer.event_end();
+        });
 
-        if self.conn.get_memory(&mut data, address, size as u64).is_err() {
+        if result.is_err() {
             println!("Unable to fetch memory from {:x} - size {}", address, size);
-            return;
         }
-
-        writer.event_begin(EventType::SetMemory as u16);
-        writer.write_u64("address", address);
-        writer.write_data("data", &data);
-        writer.event_end();
     }
 
     // Write source/line if we can find debug info for it
@@ -228,69 +434,86 @@ impl AmigaUaeBackend {
         writer.event_end();
     }
 
-    fn toggle_breakpoint_fileline(conn: &mut GdbRemote, debug_info: &DebugInfo, filename: &str, line: u32, add: bool) {
-        if let Some((seg, offset)) = debug_info.get_address_seg(filename, line) {
-            let mut res = [0; 64];
-            let command;
-
-            if add {
-                command = format!("Z0,{:x},{}", offset, seg);
-            } else {
-                command = format!("z0,{:x},{}", offset, seg);
-            }
-
-            if let Err(err) = conn.send_command_wait_reply_raw(&mut res, &command) {
-                println!("Unable to send breakpoint to UAE {} - {:?}", command, err) 
-            }
+    ///
+    /// Where a breakpoint goes in the target. file:line breakpoints have no location until there
+    /// is debug info for the file.
+    ///
+    fn breakpoint_location(debug_info: &DebugInfo, breakpoint: &Breakpoint) -> Option<BreakpointLocation> {
+        if let Some((ref file, line)) = breakpoint.file_line {
+            debug_info.get_address_seg(file, line).map(|(segment, offset)| {
+                BreakpointLocation::Segment {
+                    segment: segment,
+                    offset: offset,
+                }
+            })
         } else {
-            println!("No debug info, storing breakpoint and send it later");
+            breakpoint.address.map(BreakpointLocation::Address)
         }
     }
 
-    fn set_breakpoint_file_line(&mut self, filename: &str, line: u32) {
-        Self::toggle_breakpoint_fileline(&mut self.conn, &self.debug_info, filename, line, true);
-
-        self.breakpoints.push(Breakpoint {
-            file_line: Some((filename.to_owned(), line)),
-            address: None
-        });
+    ///
+    /// Absolute address of a breakpoint using the segments of the running executable
+    ///
+    fn breakpoint_address(&self, breakpoint: &Breakpoint) -> Option<u32> {
+        match Self::breakpoint_location(&self.debug_info, breakpoint) {
+            Some(BreakpointLocation::Address(address)) => Some(address),
+            Some(BreakpointLocation::Segment { segment, offset }) => {
+                self.segments.get(segment as usize).map(|seg| seg.address + offset)
+            }
+            None => None,
+        }
     }
 
     fn set_breakpoint(&mut self, reader: &mut Reader, _writer: &mut Writer) {
         if let Ok(filename) = reader.find_string("filename") {
             if let Ok(line) = reader.find_u32("line") {
                 println!("trying to add breakpoint {} - {}", filename, line);
-                self.set_breakpoint_file_line(filename, line);
+
+                if self.debug_info.get_address_seg(filename, line).is_none() {
+                    println!("No debug info, storing breakpoint and send it later");
+                }
+
+                self.breakpoints.push(Breakpoint {
+                    file_line: Some((filename.to_owned(), line)),
+                    address: None,
+                });
             }
         } else if let Some(address) = reader.find_u32("address").ok() {
             self.breakpoints.push(Breakpoint {
                 file_line: None,
                 address: Some(address),
             });
-
-            if self.conn.set_breakpoint_at_address(address as u64).is_err() {
-                println!("Unable to set breakpoint at 0x{:08x}", address);
-            }
         }
+
+        self.send_breakpoints();
     }
 
     fn delete_breakpoint(&mut self, reader: &mut Reader, _writer: &mut Writer) {
         if let Ok(address) = reader.find_u64("address") {
-            if self.conn.remove_breakpoint_at_address(address).is_err() {
-                println!("Unable to remove breakpoint at 0x{:08x}", address);
-            }
+            let breakpoints = mem::replace(&mut self.breakpoints, Vec::new());
+            let kept = breakpoints.into_iter()
+                .filter(|bp| self.breakpoint_address(bp) != Some(address as u32))
+                .collect();
+
+            self.breakpoints = kept;
+
+            self.send_breakpoints();
         }
     }
 
+    ///
+    /// Sends the breakpoints that have been added or removed since the last time
+    ///
     fn send_breakpoints(&mut self) {
-        for breakpoint in &self.breakpoints {
-            if let Some((ref file, line)) = breakpoint.file_line {
-                Self::toggle_breakpoint_fileline(&mut self.conn, &self.debug_info, file, line, true);
-            } else if let Some(address) = breakpoint.address {
-                if self.conn.set_breakpoint_at_address(address as u64).is_err() {
-                    println!("Unable to set breakpoint at 0x{:08x}", address);
-                }
-            }
+        if !self.conn.is_connected() {
+            return;
+        }
+
+        let debug_info = &self.debug_info;
+        let wanted = self.breakpoints.iter().filter_map(|bp| Self::breakpoint_location(debug_info, bp));
+
+        if let Err(err) = self.breakpoint_sync.sync(&mut self.conn, wanted) {
+            println!("Unable to update breakpoints in UAE - {:?}", err);
         }
     }
 
@@ -308,32 +531,86 @@ impl AmigaUaeBackend {
     // TODO: Would be nice to provide some better way to read the data from the gdb
     // backend using iterators or such
 
-    fn process_dma_frame(event_id: u16, gdb_data: &[u8], writer: &mut Writer) {
-        let mut data = [0; 512 * 1024];
-
-        println!("DataLen {}", gdb_data.len());
-
-        GdbRemote::convert_hex_data_to_binary(&mut data, gdb_data);
+    fn process_dma_frame(&mut self, gdb_data: &[u8], writer: &mut Writer) {
+        if !gdb_data::decode_hex(&mut self.dma_data, gdb_data) || self.dma_data.len() < 4 {
+            println!("Invalid dma frame - len {}", gdb_data.len());
+            return;
+        }
 
+        let data = &self.dma_data;
         let line = Self::get_u16(&data[0..]);
         let count = Self::get_u16(&data[2..]);
+        let end = ((line as usize * count as usize) * 2).max(4).min(data.len());
 
-        println!("Dma frame {} - {} - len {}", line, count, gdb_data.len());
-
-        writer.event_begin(event_id);
+        writer.event_begin(self.id_amiga_uae_dma_time);
         writer.write_u16("line", line);
         writer.write_u16("xcount", count);
-        writer.write_data("data", &data[4..((line as usize * count as usize) * 2)]);
+        writer.write_data("data", &data[4..end]);
         writer.event_end();
     }
 
+    fn write_file_array(writer: &mut Writer, name: &str, files: &[&str]) {
+        writer.array_begin(name);
+
+        for file in files {
+            writer.array_entry_begin();
+            writer.write_string("file", file);
+            writer.array_entry_end();
+        }
+
+        writer.array_end();
+    }
+
+    ///
+    /// Sends the full list of source files (used when the host asks for them)
+    ///
+    fn write_source_files(&mut self, writer: &mut Writer) {
+        let files = self.debug_info.source_files();
+
+        writer.event_begin(EVENT_SET_SOURCE_FILES as u16);
+        Self::write_file_array(writer, "files", &files);
+        writer.event_end();
+
+        self.sent_source_files = files.iter().map(|file| (*file).to_owned()).collect();
+    }
+
+    ///
+    /// Sends the files that have been added or removed since the last time files were sent
+    ///
+    fn update_source_files(&mut self, writer: &mut Writer) {
+        let files = self.debug_info.source_files();
+        let current: HashSet<&str> = files.iter().cloned().collect();
+
+        let removed: Vec<&str> = self.sent_source_files
+            .iter()
+            .filter(|file| !current.contains(file.as_str()))
+            .map(|file| file.as_str())
+            .collect();
+
+        let added: Vec<&str> = files.iter()
+            .filter(|file| !self.sent_source_files.contains(**file))
+            .cloned()
+            .collect();
+
+        if added.len() == 0 && removed.len() == 0 {
+            return;
+        }
+
+        writer.event_begin(EVENT_SET_SOURCE_FILES as u16);
+        Self::write_file_array(writer, "removed", &removed);
+        Self::write_file_array(writer, "added", &added);
+        writer.event_end();
+
+        self.sent_source_files = files.iter().map(|file| (*file).to_owned()).collect();
+    }
+
     fn update_conn_incoming(&mut self, writer: &mut Writer) {
         let mut should_break = false;
 
         if self.conn.is_connected() {
             if let Some(ref event) = self.conn.read_incoming_event() {
                 if let Some(ref data) = event.begins_with("QDmaFrame:") {
-                    Self::process_dma_frame(self.id_amiga_uae_dma_time, &data, writer);
+                    self.process_dma_frame(data, writer);
                 } else if let Some(ref _data) = event.begins_with("S") {
                     should_break = true;
                 }
@@ -343,7 +620,7 @@ impl AmigaUaeBackend {
         }
 
         if should_break {
-            self.get_registers(writer);
+            self.target_stopped(writer);
         }
     }
 
@@ -352,12 +629,51 @@ impl AmigaUaeBackend {
             return Ok(());
         }
 
-        try!(self.conn.connect("127.0.0.1:6860"));
+        try!(self.conn.connect(&self.address));
         try!(self.conn.request_no_ack_mode());
 
+        // A new connection has none of our breakpoints
+        self.breakpoint_sync.reset();
+
+        let mut res = [0; 256];
+
+        if let Ok(len) = self.conn.send_command_wait_reply_raw(&mut res, "qSupported") {
+            if let Some(size) = Self::parse_packet_size(&res[..len.min(res.len())]) {
+                self.memory_reader.set_packet_size(size);
+            }
+        }
+
+        // An empty binary read tells if (and how) the stub supports binary transfers
+        let binary_memory = match self.conn.send_command_wait_reply_raw(&mut res, "x0,0") {
+            Ok(len) => BinaryMemory::from_probe_reply(&res[..len.min(res.len())]),
+            Err(_) => BinaryMemory::Unsupported,
+        };
+
+        println!("Binary memory transfers: {:?}", binary_memory);
+
+        self.memory_reader.set_binary_mode(binary_memory);
+
         Ok(())
     }
 
+    ///
+    /// Finds PacketSize (hex) in a qSupported reply
+    ///
+    fn parse_packet_size(reply: &[u8]) -> Option<usize> {
+        let features = match str::from_utf8(reply) {
+            Ok(features) => features,
+            Err(_) => return None,
+        };
+
+        for feature in features.split(';') {
+            if feature.starts_with("PacketSize=") {
+                return usize::from_str_radix(&feature[11..], 16).ok();
+            }
+        }
+
+        None
+    }
+
     fn store_segments(&mut self, segment_reply: &[u8]) {
         let segs_name = str::from_utf8(segment_reply).unwrap();
         let segs: Vec<&str> = segs_name.split(";").collect();
@@ -381,6 +697,44 @@ impl AmigaUaeBackend {
         }
     }
 
+    ///
+    /// Adds the symbols of the executable to the symbols service, one module per hunk at the
+    /// address it was loaded at
+    ///
+    fn register_symbols(&mut self) {
+        self.unregister_symbols();
+
+        let (symbols, file) = match (self.symbols.as_ref(), self.debug_info.file.as_ref()) {
+            (Some(symbols), Some(file)) => (symbols, file),
+            _ => return,
+        };
+
+        let exe_name = self.debug_info.exe_path.file_name().and_then(|n| n.to_str()).unwrap_or("");
+
+        for (i, seg) in self.segments.iter().enumerate().take(file.len()) {
+            let hunk_symbols = match file.symbols(i) {
+                Some(hunk_symbols) => hunk_symbols,
+                None => continue,
+            };
+
+            let module = symbols.add_module(&format!("{}:{}", exe_name, i), seg.address as u64, seg.size as u64);
+
+            for symbol in &hunk_symbols {
+                symbols.add_symbol(module, &symbol.name, (seg.address + symbol.offset) as u64, 0);
+            }
+
+            self.symbol_modules.push(module);
+        }
+    }
+
+    fn unregister_symbols(&mut self) {
+        if let Some(ref symbols) = self.symbols {
+            for module in self.symbol_modules.drain(..) {
+                symbols.remove_module(module);
+            }
+        }
+    }
+
     fn show_file_dir_select(name: &str, temp: &mut [u8], path: &mut String, ui: &Ui) {
         temp[..path.len()].copy_from_slice(path.as_bytes());
 
@@ -436,21 +790,33 @@ impl Backend for AmigaUaeBackend {
     fn new(service: &Service) -> Self {
         AmigaUaeBackend {
             capstone: service.get_capstone(),
+            disasm_cache: DisassemblyCache::new(),
+            register_schema: Self::create_register_schema(),
             id_amiga_uae_dma_time: service.get_id_register().register_id("AmigaUAEDmaTime"),
             conn: GdbRemote::new(),
+            address: env::var("PRODBG_UAE_ADDRESS").unwrap_or(UAE_ADDRESS.to_owned()),
             exception_location: 0,
             amiga_exe_file_path: "".to_owned(),
             uae_partition_path: "".to_owned(),
             break_at_start: false,
             debug_info: DebugInfo::new(),
+            analysis_job: None,
+            analysis: None,
+            sent_source_files: HashSet::new(),
             segments: Vec::new(),
             status: "Not Connected".to_owned(),
             breakpoints: Vec::new(),
+            breakpoint_sync: BreakpointSync::new(),
+            symbols: service.get_symbols(),
+            symbol_modules: Vec::new(),
+            memory_reader: MemoryReader::new(),
+            dma_data: Vec::new(),
         }
     }
 
     fn update(&mut self, action: i32, reader: &mut Reader, writer: &mut Writer) {
         self.update_conn_incoming(writer);
+        self.update_code_analysis();
 
         for event in reader.get_event() {
             println!("getting event {}", event);
@@ -464,6 +830,14 @@ impl Backend for AmigaUaeBackend {
                     self.get_memory(reader, writer);
                 }
 
+                EVENT_GET_REGISTERS => {
+                    self.register_schema.check_request(reader);
+
+                    if self.conn.is_connected() {
+                        self.get_registers(writer);
+                    }
+                }
+
                 EVENT_SET_BREAKPOINT => {
                     println!("Set breakpoint");
                     self.set_breakpoint(reader, writer);
@@ -477,6 +851,10 @@ impl Backend for AmigaUaeBackend {
                     self.write_exception_location(writer);
                 }
 
+                EVENT_GET_SOURCE_FILES => {
+                    self.write_source_files(writer);
+                }
+
                 _ => (),
             }
         }
@@ -495,22 +873,30 @@ impl Backend for AmigaUaeBackend {
                 }
 
                 self.debug_info.load_info(&self.uae_partition_path, &self.amiga_exe_file_path);
+                self.disasm_cache.invalidate_all();
+                self.start_code_analysis();
+                self.update_source_files(writer);
 
                 if let Err(err) = self.connect() {
                     println!("Unable to connect {:?}", err);
                     return;
                 }
 
-                self.send_breakpoints();
+                // The new run starts without any of the breakpoints of the last one (connect()
+                // only resets them for a new connection). They are sent once the segments of
+                // the new load are known.
+                self.breakpoint_sync.reset();
 
                 let run_cmd = format!("vRun;{};", self.amiga_exe_file_path);
 
                 if self.conn.send_command_wait_reply_raw(&mut res, &run_cmd).is_ok() {
                     let null_index = res.iter().position(|c| *c == 0).unwrap_or(res.len());
                     self.store_segments(&res[..null_index]);
+                    self.register_symbols();
+                    self.send_breakpoints();
                 }
 
-                self.status = format!("Connected (127.0.0.1) Running {}", &self.amiga_exe_file_path);
+                self.status = format!("Connected ({}) Running {}", self.address, &self.amiga_exe_file_path);
             }
 
             ACTION_STEP => {
@@ -519,7 +905,7 @@ impl Backend for AmigaUaeBackend {
                     println!("Unable to step!");
                     return;
                 }
-                self.get_registers(writer);
+                self.target_stopped(writer);
             }
 
             ACTION_STEP_OVER => {
@@ -534,9 +920,17 @@ impl Backend for AmigaUaeBackend {
                 if self.conn.send_command("k").is_err() {
                     println!("Unable to send kill command");
                 } else {
+                    // The breakpoints went away with the executable
+                    self.breakpoint_sync.reset();
+                    self.unregister_symbols();
+
                     // clear debug info
                     self.debug_info = DebugInfo::new();
-                    self.status = "Connected (127.0.0.1)".to_owned();
+                    self.disasm_cache.invalidate_all();
+                    self.analysis_job = None;
+                    self.analysis = None;
+                    self.update_source_files(writer);
+                    self.status = format!("Connected ({})", self.address);
                 }
             }
             _ => (),
@@ -0,0 +1,237 @@
+//! Pipelined memory reads over the gdb remote protocol.
+//!
+//! Large reads are split into requests that fit in the stub's max packet size. As the connection
+//! runs in no-ack mode several requests are sent before waiting for the first reply, which hides
+//! most of the round trip time. Replies come back in the order the requests were sent so the
+//! chunks are handed out in address order as soon as each one has been decoded.
+
+use std::cmp;
+use std::collections::VecDeque;
+use std::io::{Error, ErrorKind, Result};
+use gdb_data::{self, BinaryMemory};
+use gdb_remote::GdbRemote;
+
+/// Packet size used if the stub doesn't tell us
+const DEFAULT_PACKET_SIZE: usize = 0x400;
+/// '$', '#' and the two checksum characters
+const PACKET_OVERHEAD: usize = 4;
+const MAX_IN_FLIGHT: usize = 4;
+
+///
+/// The parts of the gdb connection the reader needs. Requests must be answered in order.
+///
+pub trait PacketConnection {
+    fn send_packet(&mut self, command: &str) -> Result<()>;
+    /// Reads the next reply packet into dest and returns the size of it
+    fn read_packet(&mut self, dest: &mut [u8]) -> Result<usize>;
+}
+
+impl PacketConnection for GdbRemote {
+    fn send_packet(&mut self, command: &str) -> Result<()> {
+        self.send_command(command)
+    }
+
+    fn read_packet(&mut self, dest: &mut [u8]) -> Result<usize> {
+        self.read_reply(dest)
+    }
+}
+
+pub struct MemoryReader {
+    packet_size: usize,
+    binary: BinaryMemory,
+    reply: Vec<u8>,
+    data: Vec<u8>,
+}
+
+impl MemoryReader {
+    pub fn new() -> MemoryReader {
+        MemoryReader {
+            packet_size: DEFAULT_PACKET_SIZE,
+            binary: BinaryMemory::Unsupported,
+            reply: Vec::new(),
+            data: Vec::new(),
+        }
+    }
+
+    ///
+    /// Max packet size of the stub (the PacketSize reported by qSupported)
+    ///
+    pub fn set_packet_size(&mut self, size: usize) {
+        self.packet_size = cmp::max(size, PACKET_OVERHEAD + 2);
+    }
+
+    pub fn set_binary_mode(&mut self, mode: BinaryMemory) {
+        self.binary = mode;
+    }
+
+    ///
+    /// Number of bytes asked for in each request. Hex uses two characters per byte and binary
+    /// data may need escaping for every byte so both fit half of the packet.
+    ///
+    pub fn chunk_size(&self) -> usize {
+        (self.packet_size - PACKET_OVERHEAD) / 2
+    }
+
+    fn command(&self, address: u64, size: u64) -> String {
+        match self.binary {
+            BinaryMemory::Unsupported => format!("m{:x},{:x}", address, size),
+            _ => format!("x{:x},{:x}", address, size),
+        }
+    }
+
+    fn decode(&mut self, len: usize, size: usize) -> bool {
+        let reply = &self.reply[..cmp::min(len, self.reply.len())];
+
+        match self.binary {
+            BinaryMemory::Unsupported => gdb_data::decode_hex(&mut self.data, reply) && self.data.len() == size,
+            mode => gdb_data::decode_memory_reply(&mut self.data, reply, mode, size),
+        }
+    }
+
+    ///
+    /// Reads size bytes at address. on_data is called with the address and data of each chunk in
+    /// address order as they arrive. On error the replies still in flight are read (and thrown
+    /// away) so the connection stays in sync.
+    ///
+    pub fn read<C, F>(&mut self, conn: &mut C, address: u64, size: u64, mut on_data: F) -> Result<()>
+        where C: PacketConnection,
+              F: FnMut(u64, &[u8])
+    {
+        let chunk = self.chunk_size() as u64;
+        let mut next = address;
+        let end = address + size;
+        let mut in_flight = VecDeque::with_capacity(MAX_IN_FLIGHT);
+
+        self.reply.resize(self.packet_size, 0);
+
+        while next < end || !in_flight.is_empty() {
+            while next < end && in_flight.len() < MAX_IN_FLIGHT {
+                let len = cmp::min(chunk, end - next);
+
+                if let Err(err) = conn.send_packet(&self.command(next, len)) {
+                    Self::drain(conn, &mut self.reply, in_flight.len());
+                    return Err(err);
+                }
+
+                in_flight.push_back((next, len));
+                next += len;
+            }
+
+            let (chunk_address, len) = in_flight.pop_front().unwrap();
+
+            let reply_len = match conn.read_packet(&mut self.reply) {
+                Ok(reply_len) => reply_len,
+                Err(err) => {
+                    Self::drain(conn, &mut self.reply, in_flight.len());
+                    return Err(err);
+                }
+            };
+
+            if !self.decode(reply_len, len as usize) {
+                Self::drain(conn, &mut self.reply, in_flight.len());
+                return Err(Error::new(ErrorKind::InvalidData,
+                                      format!("Unable to read memory at {:x}", chunk_address)));
+            }
+
+            on_data(chunk_address, &self.data);
+        }
+
+        Ok(())
+    }
+
+    fn drain<C: PacketConnection>(conn: &mut C, reply: &mut [u8], count: usize) {
+        for _ in 0..count {
+            if conn.read_packet(reply).is_err() {
+                return;
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::collections::VecDeque;
+    use std::io::Result;
+
+    // Fake stub that answers memory reads from a buffer
+    struct FakeStub {
+        memory: Vec<u8>,
+        pending: VecDeque<String>,
+        max_pending: usize,
+        fail_at: Option<u64>,
+    }
+
+    impl PacketConnection for FakeStub {
+        fn send_packet(&mut self, command: &str) -> Result<()> {
+            self.pending.push_back(command.to_owned());
+            self.max_pending = cmp::max(self.max_pending, self.pending.len());
+            Ok(())
+        }
+
+        fn read_packet(&mut self, dest: &mut [u8]) -> Result<usize> {
+            let command = self.pending.pop_front().unwrap();
+            let mut args = command[1..].split(',').map(|v| u64::from_str_radix(v, 16).unwrap());
+            let address = args.next().unwrap();
+            let size = args.next().unwrap();
+
+            let reply = if Some(address) == self.fail_at {
+                "E01".to_owned()
+            } else {
+                self.memory[address as usize..(address + size) as usize]
+                    .iter()
+                    .map(|b| format!("{:02x}", b))
+                    .collect::<String>()
+            };
+
+            dest[..reply.len()].copy_from_slice(reply.as_bytes());
+            Ok(reply.len())
+        }
+    }
+
+    fn stub() -> FakeStub {
+        FakeStub {
+            memory: (0..1000).map(|v| v as u8).collect(),
+            pending: VecDeque::new(),
+            max_pending: 0,
+            fail_at: None,
+        }
+    }
+
+    #[test]
+    fn test_chunked_read() {
+        let mut conn = stub();
+        let mut reader = MemoryReader::new();
+        reader.set_packet_size(4 + 2 * 64);
+        assert_eq!(reader.chunk_size(), 64);
+
+        let mut data = Vec::new();
+        let mut chunks = Vec::new();
+
+        reader.read(&mut conn, 10, 600, |address, chunk| {
+                chunks.push(address);
+                data.extend_from_slice(chunk);
+            })
+            .unwrap();
+
+        assert_eq!(data, &conn.memory[10..610]);
+        assert_eq!(chunks.len(), 10);
+        assert_eq!(chunks[1], 74);
+        assert_eq!(conn.max_pending, MAX_IN_FLIGHT);
+        assert!(conn.pending.is_empty());
+    }
+
+    #[test]
+    fn test_error_keeps_connection_in_sync() {
+        let mut conn = stub();
+        conn.fail_at = Some(64);
+
+        let mut reader = MemoryReader::new();
+        reader.set_packet_size(4 + 2 * 64);
+
+        let mut count = 0;
+        assert!(reader.read(&mut conn, 0, 512, |_, _| count += 1).is_err());
+        assert_eq!(count, 1);
+        assert!(conn.pending.is_empty());
+    }
+}
@@ -0,0 +1,195 @@
+//! Tests of the connection to UAE and benchmarks of the backend using the uae_gdb_stub stand-in.
+//!
+//! The benchmarks are ignored by default, run them with
+//! cargo test --release -- --ignored --nocapture
+
+extern crate uae_gdb_stub;
+
+use std::time::{Duration, Instant};
+use gdb_remote::GdbRemote;
+use gdb_data::{self, BinaryMemory};
+use memory_reader::MemoryReader;
+use breakpoint_sync::{BreakpointLocation, BreakpointSync};
+use fake_services::{self, FakeReader, NullWriter};
+use prodbg_api::{Backend, ACTION_NONE, ACTION_RUN, ACTION_STEP, EVENT_GET_DISASSEMBLY, EVENT_GET_MEMORY};
+use AmigaUaeBackend;
+use self::uae_gdb_stub::{StubConfig, StubServer};
+
+fn memory_pattern(size: usize) -> Vec<u8> {
+    (0..size).map(|i| (i * 7 + (i >> 8)) as u8).collect()
+}
+
+fn connect(config: StubConfig) -> (StubServer, GdbRemote, MemoryReader) {
+    let packet_size = config.packet_size;
+    let binary = config.binary_memory;
+    let server = StubServer::start(config).unwrap();
+    let mut conn = GdbRemote::new();
+
+    conn.connect(&server.address().to_string()).unwrap();
+    conn.request_no_ack_mode().unwrap();
+
+    let mut reader = MemoryReader::new();
+    reader.set_packet_size(packet_size);
+
+    if binary {
+        reader.set_binary_mode(BinaryMemory::Prefixed);
+    }
+
+    (server, conn, reader)
+}
+
+fn seconds(duration: Duration) -> f64 {
+    duration.as_secs() as f64 + duration.subsec_nanos() as f64 * 1e-9
+}
+
+#[test]
+fn test_memory_reads() {
+    for &binary in &[false, true] {
+        let mut config = StubConfig::new();
+        config.memory = memory_pattern(0x10000);
+        config.binary_memory = binary;
+        config.packet_size = 0x100;
+
+        let expected = config.memory.clone();
+        let (_server, mut conn, mut reader) = connect(config);
+        let mut data = Vec::new();
+
+        reader.read(&mut conn, 0x123, 0x8000, |_, chunk| data.extend_from_slice(chunk)).unwrap();
+        assert_eq!(&data[..], &expected[0x123..0x8123]);
+
+        // Outside of memory
+        assert!(reader.read(&mut conn, 0xff00, 0x200, |_, _| ()).is_err());
+
+        // The connection is still usable after the error
+        data.clear();
+        reader.read(&mut conn, 0, 16, |_, chunk| data.extend_from_slice(chunk)).unwrap();
+        assert_eq!(&data[..], &expected[..16]);
+    }
+}
+
+#[test]
+fn test_run_and_dma_frames() {
+    let mut config = StubConfig::new();
+    config.dma_interval = Some(Duration::from_millis(5));
+
+    let (server, mut conn, _) = connect(config);
+    let mut res = [0; 256];
+
+    let len = conn.send_command_wait_reply_raw(&mut res, "vRun;dh0:test;").unwrap();
+    assert_eq!(&res[..len], b"AS;4096;32768;65536;16384");
+
+    let start = Instant::now();
+    let mut dma_data = Vec::new();
+
+    while dma_data.is_empty() && start.elapsed() < Duration::from_secs(5) {
+        if let Some(event) = conn.read_incoming_event() {
+            if let Some(data) = event.begins_with("QDmaFrame:") {
+                assert!(gdb_data::decode_hex(&mut dma_data, data));
+            }
+        }
+    }
+
+    // line and xcount of a PAL frame followed by two bytes per slot
+    assert_eq!(&dma_data[..4], &[0x01, 0x39, 0x00, 0xe3]);
+    assert_eq!(dma_data.len(), 4 + 313 * 227 * 2);
+    assert!(server.stats().dma_frames > 0);
+}
+
+#[test]
+fn test_breakpoint_sync() {
+    let (_server, mut conn, _) = connect(StubConfig::new());
+    let mut res = [0; 256];
+    let mut sync = BreakpointSync::new();
+
+    conn.send_command_wait_reply_raw(&mut res, "vRun;dh0:test;").unwrap();
+
+    let wanted = (0..300)
+        .map(|i| BreakpointLocation::Segment { segment: 0, offset: 0x100 + i * 2 })
+        .collect::<Vec<_>>();
+
+    sync.sync(&mut conn, wanted.iter().cloned()).unwrap();
+    sync.sync(&mut conn, wanted[1..].iter().cloned()).unwrap();
+    assert_eq!(sync.installed().len(), 299);
+
+    // Stops at the first breakpoint still set (segment 0 starts at 0x1000)
+    let len = conn.send_command_wait_reply_raw(&mut res, "c").unwrap();
+    assert_eq!(&res[..len], b"S05");
+
+    let len = conn.send_command_wait_reply_raw(&mut res, "g").unwrap();
+    assert_eq!(&res[17 * 8..len], b"00001102");
+}
+
+///
+/// Memory throughput, disassembly requests per second and step latency with the given latency per
+/// reply. Everything goes through the update of the backend (with the events the views send) so
+/// the time spent in the backend is included.
+///
+fn benchmark(latency_ms: u64) {
+    let mut config = StubConfig::new();
+    config.latency = Some(Duration::from_millis(latency_ms));
+
+    let server = StubServer::start(config).unwrap();
+    let mut backend = AmigaUaeBackend::new(&fake_services::fake_service());
+    let mut events = FakeReader::new();
+    let mut output = NullWriter::new();
+
+    backend.address = server.address().to_string();
+    backend.amiga_exe_file_path = "dh0:test".to_owned();
+
+    backend.update(ACTION_RUN, &mut events.reader(), &mut output.writer());
+    assert!(backend.conn.is_connected());
+
+    let start = Instant::now();
+
+    for _ in 0..8 {
+        events.push(EVENT_GET_MEMORY, &[("address_start", 0), ("size", 256 * 1024)]);
+        backend.update(ACTION_NONE, &mut events.reader(), &mut output.writer());
+    }
+
+    let memory_time = seconds(start.elapsed());
+    let total = output.data_size;
+    assert_eq!(total, 8 * 256 * 1024);
+
+    // Pages of 64 instructions the way the disassembly view asks for them. Each page is new to
+    // the disassembly cache so memory is fetched and decoded every time.
+    let requests = 200;
+    let start = Instant::now();
+
+    for i in 0..requests {
+        events.push(EVENT_GET_DISASSEMBLY,
+                    &[("address_start", 0x1000 + i * 256), ("instruction_count", 64)]);
+        backend.update(ACTION_NONE, &mut events.reader(), &mut output.writer());
+    }
+
+    let disasm_time = seconds(start.elapsed());
+
+    let steps = 100;
+    let start = Instant::now();
+
+    for _ in 0..steps {
+        backend.update(ACTION_STEP, &mut events.reader(), &mut output.writer());
+    }
+
+    let step_time = seconds(start.elapsed());
+
+    println!("latency {} ms: memory {:.2} MB/s, disassembly {:.0} requests/s, step {:.2} ms ({} packets)",
+             latency_ms,
+             total as f64 / memory_time / (1024.0 * 1024.0),
+             requests as f64 / disasm_time,
+             step_time * 1000.0 / steps as f64,
+             server.stats().packets);
+
+    // Pipelining has to beat one reply per latency period
+    if latency_ms > 0 {
+        let packets = total as f64 / backend.memory_reader.chunk_size() as f64;
+        assert!(packets / memory_time > 1000.0 / latency_ms as f64);
+    }
+}
+
+#[test]
+#[ignore]
+fn bench_connection() {
+    benchmark(0);
+    benchmark(1);
+    benchmark(5);
+}
@@ -0,0 +1,298 @@
+//! History of the DMA frames sent by UAE.
+//!
+//! Each frame is sent as two bytes per DMA slot with the category of the slot in the second
+//! byte. Only the category is kept and each row is stored as runs of (count, category) which
+//! usually brings a frame down to a few kilobytes so a long history can be kept around.
+
+use std::cmp;
+use std::collections::VecDeque;
+
+pub const CATEGORY_COUNT: usize = 11;
+pub const MAX_WIDTH: usize = 256;
+pub const MAX_LINES: usize = 512;
+
+/// Written to rows that has never been shown so they are always updated the first time
+const UNKNOWN: u8 = 0xff;
+
+pub struct DmaFrame {
+    pub lines: usize,
+    pub width: usize,
+    /// Number of slots used by each category
+    pub usage: [u32; CATEGORY_COUNT],
+    /// (count, category) pairs. Runs never cross rows.
+    runs: Vec<u8>,
+}
+
+impl DmaFrame {
+    ///
+    /// Builds a frame from the data of an AmigaUAEDmaTime event. Categories out of range are
+    /// stored as 0 (no DMA).
+    ///
+    pub fn from_record(lines: usize, xcount: usize, data: &[u8]) -> DmaFrame {
+        let width = cmp::min(xcount, MAX_WIDTH);
+        let stride = xcount * 2;
+        // The last line isn't complete
+        let lines = if stride == 0 {
+            0
+        } else {
+            cmp::min(cmp::min(lines.saturating_sub(1), data.len() / stride), MAX_LINES)
+        };
+
+        let mut usage = [0; CATEGORY_COUNT];
+        let mut runs = Vec::new();
+
+        for line in data.chunks(stride.max(1)).take(lines) {
+            let mut current = UNKNOWN;
+            let mut count = 0u8;
+
+            for slot in line[..width * 2].chunks(2) {
+                let category = if (slot[1] as usize) < CATEGORY_COUNT { slot[1] } else { 0 };
+                usage[category as usize] += 1;
+
+                if category == current && count < 255 {
+                    count += 1;
+                } else {
+                    if count > 0 {
+                        runs.push(count);
+                        runs.push(current);
+                    }
+                    current = category;
+                    count = 1;
+                }
+            }
+
+            runs.push(count);
+            runs.push(current);
+        }
+
+        DmaFrame {
+            lines: lines,
+            width: width,
+            usage: usage,
+            runs: runs,
+        }
+    }
+
+    ///
+    /// Fraction of the slots used by the categories enabled in filter (category 0 is never
+    /// counted)
+    ///
+    pub fn usage(&self, filter: &[bool; CATEGORY_COUNT]) -> f32 {
+        let total = self.lines * self.width;
+
+        if total == 0 {
+            return 0.0;
+        }
+
+        let used: u32 = (1..CATEGORY_COUNT).filter(|&c| filter[c]).map(|c| self.usage[c]).sum();
+        used as f32 / total as f32
+    }
+
+    ///
+    /// Expands the frame into dest which is MAX_WIDTH * MAX_LINES categories. Filtered out
+    /// categories and slots outside of the frame are written as 0.
+    ///
+    pub fn expand(&self, filter: &[bool; CATEGORY_COUNT], dest: &mut [u8]) {
+        for v in dest.iter_mut() {
+            *v = 0;
+        }
+
+        let mut runs = self.runs.chunks(2);
+
+        for line in 0..self.lines {
+            let row = &mut dest[line * MAX_WIDTH..line * MAX_WIDTH + self.width];
+            let mut x = 0;
+
+            while x < self.width {
+                let run = match runs.next() {
+                    Some(run) => run,
+                    None => return,
+                };
+
+                let count = run[0] as usize;
+                let category = if filter[run[1] as usize] { run[1] } else { 0 };
+
+                for v in &mut row[x..x + count] {
+                    *v = category;
+                }
+
+                x += count;
+            }
+        }
+    }
+}
+
+///
+/// The last capacity frames, oldest first
+///
+pub struct DmaHistory {
+    frames: VecDeque<DmaFrame>,
+    capacity: usize,
+}
+
+impl DmaHistory {
+    pub fn new(capacity: usize) -> DmaHistory {
+        DmaHistory {
+            frames: VecDeque::with_capacity(capacity),
+            capacity: cmp::max(capacity, 1),
+        }
+    }
+
+    ///
+    /// Adds a frame. Returns true if the oldest frame was dropped to make room for it in which
+    /// case the index of every remaining frame is one less than before.
+    ///
+    pub fn push(&mut self, frame: DmaFrame) -> bool {
+        let evicted = self.frames.len() == self.capacity;
+
+        if evicted {
+            self.frames.pop_front();
+        }
+
+        self.frames.push_back(frame);
+        evicted
+    }
+
+    pub fn len(&self) -> usize {
+        self.frames.len()
+    }
+
+    pub fn get(&self, index: usize) -> Option<&DmaFrame> {
+        self.frames.get(index)
+    }
+
+    pub fn iter<'a>(&'a self) -> Box<Iterator<Item = &'a DmaFrame> + 'a> {
+        Box::new(self.frames.iter())
+    }
+}
+
+///
+/// Categories currently in the texture. Used to find the rows that needs to be uploaded when
+/// another frame or filter is shown.
+///
+pub struct ShownImage {
+    categories: Vec<u8>,
+    target: Vec<u8>,
+}
+
+impl ShownImage {
+    pub fn new() -> ShownImage {
+        ShownImage {
+            categories: vec![UNKNOWN; MAX_WIDTH * MAX_LINES],
+            target: vec![0; MAX_WIDTH * MAX_LINES],
+        }
+    }
+
+    pub fn categories(&self) -> &[u8] {
+        &self.categories
+    }
+
+    ///
+    /// Makes frame (or an empty image for None) the shown one and returns the changed rows as
+    /// (first row, row count) ranges.
+    ///
+    pub fn show(&mut self, frame: Option<&DmaFrame>, filter: &[bool; CATEGORY_COUNT]) -> Vec<(usize, usize)> {
+        match frame {
+            Some(frame) => frame.expand(filter, &mut self.target),
+            None => {
+                for v in self.target.iter_mut() {
+                    *v = 0;
+                }
+            }
+        }
+
+        let mut ranges: Vec<(usize, usize)> = Vec::new();
+
+        let rows = self.categories.chunks_mut(MAX_WIDTH).zip(self.target.chunks(MAX_WIDTH));
+
+        for (line, (shown, target)) in rows.enumerate() {
+            if shown == target {
+                continue;
+            }
+
+            shown.copy_from_slice(target);
+
+            match ranges.last_mut() {
+                Some(range) if range.0 + range.1 == line => {
+                    range.1 += 1;
+                    continue;
+                }
+                _ => (),
+            }
+
+            ranges.push((line, 1));
+        }
+
+        ranges
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn record(lines: &[&[u8]]) -> Vec<u8> {
+        lines.iter().flat_map(|line| line.iter().flat_map(|&c| vec![0, c])).collect()
+    }
+
+    #[test]
+    fn test_frame_runs() {
+        let data = record(&[&[1, 1, 2, 3], &[0, 0, 0, 12], &[5, 5, 5, 5]]);
+        // Last line isn't complete and is skipped
+        let frame = DmaFrame::from_record(3, 4, &data);
+
+        assert_eq!(frame.lines, 2);
+        assert_eq!(frame.usage[1], 2);
+        assert_eq!(frame.usage[0], 4);
+
+        let mut dest = vec![0xaa; MAX_WIDTH * MAX_LINES];
+        let mut filter = [true; CATEGORY_COUNT];
+        filter[2] = false;
+        frame.expand(&filter, &mut dest);
+
+        assert_eq!(&dest[0..5], &[1, 1, 0, 3, 0]);
+        assert_eq!(&dest[MAX_WIDTH..MAX_WIDTH + 4], &[0, 0, 0, 0]);
+        assert_eq!(frame.usage(&filter), 3.0 / 8.0);
+    }
+
+    #[test]
+    fn test_history_and_changed_rows() {
+        let mut history = DmaHistory::new(2);
+        history.push(DmaFrame::from_record(4, 2, &record(&[&[1, 1], &[2, 2], &[3, 3], &[0, 0]])));
+        history.push(DmaFrame::from_record(4, 2, &record(&[&[1, 1], &[4, 4], &[3, 3], &[0, 0]])));
+        history.push(DmaFrame::from_record(4, 2, &record(&[&[1, 1], &[4, 4], &[3, 6], &[0, 0]])));
+
+        assert_eq!(history.len(), 2);
+
+        let filter = [true; CATEGORY_COUNT];
+        let mut shown = ShownImage::new();
+
+        // Everything is uploaded the first time
+        assert_eq!(shown.show(history.get(0), &filter), vec![(0, MAX_LINES)]);
+        assert_eq!(shown.show(history.get(0), &filter), vec![]);
+        assert_eq!(shown.show(history.get(1), &filter), vec![(2, 1)]);
+
+        let mut filter = filter;
+        filter[1] = false;
+        filter[6] = false;
+        assert_eq!(shown.show(history.get(1), &filter), vec![(0, 1), (2, 1)]);
+        assert_eq!(shown.categories()[2 * MAX_WIDTH + 1], 0);
+    }
+
+    #[test]
+    fn test_push_at_capacity() {
+        let mut history = DmaHistory::new(2);
+        assert!(!history.push(DmaFrame::from_record(2, 1, &record(&[&[1], &[0]]))));
+        assert!(!history.push(DmaFrame::from_record(2, 1, &record(&[&[2], &[0]]))));
+
+        // Scrubbed to the newest frame while another one arrives
+        let mut selected = 1;
+        if history.push(DmaFrame::from_record(2, 1, &record(&[&[3], &[0]]))) {
+            selected -= 1;
+        }
+
+        assert_eq!(history.len(), 2);
+        assert_eq!(history.get(selected).unwrap().usage[2], 1);
+        assert_eq!(history.get(1).unwrap().usage[3], 1);
+    }
+}
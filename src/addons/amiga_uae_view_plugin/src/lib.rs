@@ -1,64 +1,148 @@
 #[macro_use]
 extern crate prodbg_api;
 
+mod dma_history;
+
 use prodbg_api::*;
+use dma_history::{DmaFrame, DmaHistory, ShownImage, CATEGORY_COUNT, MAX_LINES, MAX_WIDTH};
+
+/// Number of frames kept for scrubbing
+const HISTORY_SIZE: usize = 64;
+
+const CATEGORY_NAMES: [&'static str; CATEGORY_COUNT] = ["None", "Refresh", "CPU", "Copper", "Audio",
+                                                        "Blitter", "Blitter Fill", "Blitter Line",
+                                                        "Bitplane", "Sprite", "Disk"];
 
 pub struct DmaView {
     image_data: Box<[Color]>,
     image: Option<Image>,
     id_amiga_uae_dma_time: i32,
+    history: DmaHistory,
+    shown: ShownImage,
+    colors: [Color; CATEGORY_COUNT],
+    filter: [bool; CATEGORY_COUNT],
+    /// Frame selected with the scrub slider
+    selected: i32,
+    /// Show each new frame as it arrives
+    follow: bool,
+    dirty: bool,
 }
 
 impl DmaView {
-    fn update_dma_view(&mut self, ui: &Ui, reader: &mut Reader) {
+    fn add_dma_frame(&mut self, reader: &mut Reader) {
         let lines = reader.find_u16("line").ok().unwrap() as usize;
         let xcount = reader.find_u16("xcount").ok().unwrap() as usize;
         let data = reader.find_data("data").ok().unwrap();
 
-        let colors = [Color::from_u32(0x2222227f),
-                      Color::from_u32(0x4444447f), // DMARECORD_REFRESH
-                      Color::from_u32(0x8888887f), // DMARECORD_CPU
-                      Color::from_u32(0xeeee007f), // DMARECORD_COPPER
-                      Color::from_u32(0xff00007f), // DMARECORD_AUDIO
-                      Color::from_u32(0x0088887f), // DMARECORD_BLITTER
-                      Color::from_u32(0x0088ff7f), // DMARECORD_BLITTER_FILL 6
-                      Color::from_u32(0x00ff007f), // DMARECORD_BLITTER_LINE 7
-                      Color::from_u32(0x0000ff7f), // DMARECORD_BITPLANE 8
-                      Color::from_u32(0xff00ff7f), // DMARECORD_SPRITE 9
-                      Color::from_u32(0xffffff7f) /* DMARECORD_DISK 10 */];
-
-        let mut index = 1;
-
-        for line in 0..lines - 1 {
-            for x in 0..xcount {
-                self.image_data[(line * 256) + x] = colors[data[index] as usize];
-                index += 2;
+        let evicted = self.history.push(DmaFrame::from_record(lines, xcount, data));
+
+        if self.follow {
+            self.selected = self.history.len() as i32 - 1;
+        } else if evicted {
+            // Stay on the frame that was picked as long as it's still in the history
+            self.selected = (self.selected - 1).max(0);
+        }
+
+        self.dirty = true;
+    }
+
+    fn show_controls(&mut self, ui: &mut Ui) {
+        let usage = self.history.iter().map(|frame| frame.usage(&self.filter)).collect::<Vec<f32>>();
+        let overlay = self.history
+            .get(self.selected as usize)
+            .map(|frame| format!("{:.1}% DMA", frame.usage(&self.filter) * 100.0));
+
+        ui.plot_histogram("Usage",
+                          &usage,
+                          overlay.as_ref().map(|s| s.as_str()),
+                          0.0,
+                          1.0,
+                          Vec2::new(MAX_WIDTH as f32, 48.0));
+
+        let last = self.history.len() as i32 - 1;
+
+        if ui.slider_int("Frame", &mut self.selected, 0, last.max(0)) {
+            self.follow = self.selected >= last;
+            self.dirty = true;
+        }
+
+        for category in 1..CATEGORY_COUNT {
+            if category != 1 && category != 6 {
+                ui.same_line(0, -1);
+            }
+
+            if ui.checkbox(CATEGORY_NAMES[category], &mut self.filter[category]) {
+                self.dirty = true;
             }
         }
+    }
 
-        let image = self.image.as_mut().unwrap();
+    ///
+    /// Uploads the rows that differs between the texture and the selected frame
+    ///
+    fn update_image(&mut self) {
+        let ranges = self.shown.show(self.history.get(self.selected as usize), &self.filter);
+        let categories = self.shown.categories();
 
-        image.update(&self.image_data);
-        ui.image(image).show();
+        for &(first, count) in &ranges {
+            let start = first * MAX_WIDTH;
+            let end = start + count * MAX_WIDTH;
+
+            for (color, &category) in self.image_data[start..end].iter_mut().zip(&categories[start..end]) {
+                *color = self.colors[category as usize];
+            }
+
+            if let Some(ref image) = self.image {
+                image.update_rows(&self.image_data, first, count);
+            }
+        }
+
+        self.dirty = false;
     }
 }
 
 impl View for DmaView {
     fn new(ui: &Ui, service: &Service) -> Self {
         DmaView {
-            image: ui.image_create_rgba(256, 512),
-            image_data: vec![Color::from_u32(0); 256*512].into_boxed_slice(),
+            image: ui.image_create_rgba(MAX_WIDTH as u32, MAX_LINES as u32),
+            image_data: vec![Color::from_u32(0); MAX_WIDTH * MAX_LINES].into_boxed_slice(),
             id_amiga_uae_dma_time: service.get_id_register().register_id("AmigaUAEDmaTime") as i32,
+            history: DmaHistory::new(HISTORY_SIZE),
+            shown: ShownImage::new(),
+            colors: [Color::from_u32(0x2222227f),
+                     Color::from_u32(0x4444447f), // DMARECORD_REFRESH
+                     Color::from_u32(0x8888887f), // DMARECORD_CPU
+                     Color::from_u32(0xeeee007f), // DMARECORD_COPPER
+                     Color::from_u32(0xff00007f), // DMARECORD_AUDIO
+                     Color::from_u32(0x0088887f), // DMARECORD_BLITTER
+                     Color::from_u32(0x0088ff7f), // DMARECORD_BLITTER_FILL 6
+                     Color::from_u32(0x00ff007f), // DMARECORD_BLITTER_LINE 7
+                     Color::from_u32(0x0000ff7f), // DMARECORD_BITPLANE 8
+                     Color::from_u32(0xff00ff7f), // DMARECORD_SPRITE 9
+                     Color::from_u32(0xffffff7f) /* DMARECORD_DISK 10 */],
+            filter: [true; CATEGORY_COUNT],
+            selected: 0,
+            follow: true,
+            dirty: true,
         }
     }
 
     fn update(&mut self, ui: &mut Ui, reader: &mut Reader, _: &mut Writer) {
         for event in reader.get_event() {
             if event == self.id_amiga_uae_dma_time {
-                println!("Got dma data");
-                self.update_dma_view(ui, reader);
+                self.add_dma_frame(reader);
             }
         }
+
+        self.show_controls(ui);
+
+        if self.dirty {
+            self.update_image();
+        }
+
+        if let Some(ref image) = self.image {
+            ui.image(image).show();
+        }
     }
 }
 
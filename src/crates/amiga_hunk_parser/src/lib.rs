@@ -2,9 +2,10 @@ extern crate byteorder;
 
 use std::fmt;
 use std::fs::File;
-use byteorder::{BigEndian, ReadBytesExt};
+use std::ops::Range;
+use byteorder::{BigEndian, ByteOrder};
 use std::io;
-use std::io::{Error, ErrorKind, Seek, Read};
+use std::io::{Error, ErrorKind, Read};
 
 const HUNK_HEADER: u32 = 1011;
 // hunk types
@@ -38,8 +39,8 @@ pub struct RelocInfo32 {
 }
 
 pub struct Symbol {
-    name: String,
-    offset: u32,
+    pub name: String,
+    pub offset: u32,
 }
 
 impl fmt::Debug for Symbol {
@@ -85,113 +86,241 @@ pub enum MemoryType {
     Fast,
 }
 
-struct SizesTypes {
+///
+/// Reads big endian longs from the file image
+///
+struct Reader<'a> {
+    data: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> Reader<'a> {
+    fn new(data: &'a [u8], pos: usize) -> Reader<'a> {
+        Reader {
+            data: data,
+            pos: pos,
+        }
+    }
+
+    fn bytes(&mut self, len: usize) -> io::Result<&'a [u8]> {
+        if len > self.data.len() - self.pos {
+            return Err(Error::new(ErrorKind::UnexpectedEof, "Unexpected end of hunk file"));
+        }
+
+        let data = &self.data[self.pos..self.pos + len];
+        self.pos += len;
+        Ok(data)
+    }
+
+    #[inline]
+    fn read_u32(&mut self) -> io::Result<u32> {
+        self.bytes(4).map(|b| BigEndian::read_u32(b))
+    }
+
+    #[inline]
+    fn skip_longs(&mut self, num_longs: u32) -> io::Result<()> {
+        self.bytes(num_longs as usize * 4).map(|_| ())
+    }
+
+    fn read_name(&mut self, num_longs: u32) -> io::Result<String> {
+        let name = try!(self.bytes(num_longs as usize * 4));
+        let end = name.iter().position(|&c| c == 0).unwrap_or(name.len());
+        Ok(String::from_utf8_lossy(&name[..end]).into_owned())
+    }
+}
+
+///
+/// Where the sections of a hunk are in the file image
+///
+struct HunkSections {
     mem_type: MemoryType,
-    size: usize,
+    hunk_type: HunkType,
+    alloc_size: usize,
+    data_size: usize,
+    code: Option<Range<usize>>,
+    reloc_32: Option<Range<usize>>,
+    symbols: Option<Range<usize>>,
+    /// base offset and the range of each HUNK_DEBUG with line info (after the LINE tag)
+    line_debug_info: Vec<(u32, Range<usize>)>,
 }
 
-impl HunkParser {
-    fn skip_hunk(file: &mut File, name: &'static str) -> io::Result<()> {
-        println!("Skipping {}\n", name);
-        let seek_offset = try!(file.read_u32::<BigEndian>());
-        file.seek(io::SeekFrom::Current(seek_offset as i64)).map(|_|())
+///
+/// Amiga executable loaded into memory. Opening it only scans the hunk structure, the sections
+/// (code, relocations, symbols and line info) are decoded when they are asked for.
+///
+pub struct HunkFile {
+    data: Vec<u8>,
+    hunks: Vec<HunkSections>,
+}
+
+impl HunkFile {
+    pub fn open(filename: &str) -> io::Result<HunkFile> {
+        let mut data = Vec::new();
+        let mut file = try!(File::open(filename));
+        try!(file.read_to_end(&mut data));
+        Self::from_data(data)
     }
 
-    fn get_size_type(t: u32) -> (usize, MemoryType) {
-        let size = (t & 0x0fffffff) * 4;
-        let mem_t = t & 0xf0000000;
-        let mem_type = match mem_t {
-            HUNKF_CHIP => MemoryType::Chip,
-            HUNKF_FAST => MemoryType::Fast,
-            _ => MemoryType::Any,
-        };
+    pub fn from_data(data: Vec<u8>) -> io::Result<HunkFile> {
+        let hunks = try!(HunkParser::scan(&data));
 
-        (size as usize, mem_type)
+        Ok(HunkFile {
+            data: data,
+            hunks: hunks,
+        })
+    }
+
+    #[inline]
+    pub fn len(&self) -> usize {
+        self.hunks.len()
+    }
+
+    #[inline]
+    pub fn hunk_type(&self, hunk: usize) -> HunkType {
+        self.hunks[hunk].hunk_type
     }
 
-    fn parse_bss(hunk: &mut Hunk, file: &mut File) -> io::Result<()> {
-        let (size, mem_type) = Self::get_size_type(try!(file.read_u32::<BigEndian>()));
-        hunk.hunk_type = HunkType::Bss;
-        hunk.data_size = size;
-        hunk.mem_type = mem_type;
-        Ok(())
+    #[inline]
+    pub fn mem_type(&self, hunk: usize) -> MemoryType {
+        self.hunks[hunk].mem_type
     }
 
-    fn parse_code_or_data(hunk_type: HunkType, hunk: &mut Hunk, file: &mut File) -> io::Result<()> {
-        let (size, mem_type) = Self::get_size_type(try!(file.read_u32::<BigEndian>()));
-        let mut code_data: Vec<u8> = vec![0; size];
+    #[inline]
+    pub fn alloc_size(&self, hunk: usize) -> usize {
+        self.hunks[hunk].alloc_size
+    }
 
-        hunk.data_size = size;
-        hunk.hunk_type = hunk_type;
-        hunk.mem_type = mem_type;
+    #[inline]
+    pub fn data_size(&self, hunk: usize) -> usize {
+        self.hunks[hunk].data_size
+    }
 
-        try!(file.read(&mut code_data));
+    ///
+    /// Code or data of the hunk directly from the file image
+    ///
+    pub fn code(&self, hunk: usize) -> Option<&[u8]> {
+        self.hunks[hunk].code.clone().map(|range| &self.data[range])
+    }
 
-        hunk.code_data = Some(code_data);
+    pub fn reloc_32(&self, hunk: usize) -> Option<Vec<RelocInfo32>> {
+        self.hunks[hunk].reloc_32.clone().and_then(|range| {
+            HunkParser::parse_reloc32(&mut Reader::new(&self.data[..range.end], range.start)).ok()
+        })
+    }
 
-        Ok(())
+    ///
+    /// Symbols of the hunk sorted by offset
+    ///
+    pub fn symbols(&self, hunk: usize) -> Option<Vec<Symbol>> {
+        self.hunks[hunk].symbols.clone().and_then(|range| {
+            HunkParser::parse_symbols(&mut Reader::new(&self.data[..range.end], range.start)).ok()
+        })
     }
 
-    fn find_string_end(name: &[u8]) -> usize {
-        for (i, val) in name.iter().enumerate() {
-            if *val == 0 {
-                return i;
+    pub fn line_debug_info(&self, hunk: usize) -> Option<Vec<SourceFile>> {
+        let sections = &self.hunks[hunk].line_debug_info;
+
+        if sections.len() == 0 {
+            return None;
+        }
+
+        let mut files = Vec::with_capacity(sections.len());
+
+        for &(base_offset, ref range) in sections {
+            let mut reader = Reader::new(&self.data[..range.end], range.start);
+            let num_longs = ((range.end - range.start) / 4) as u32;
+
+            if let Ok(source_file) = HunkParser::parse_line_info(base_offset, num_longs, &mut reader) {
+                files.push(source_file);
             }
         }
 
-        name.len()
+        Some(files)
     }
 
-    fn read_name_size(file: &mut File, num_longs: u32) -> io::Result<String> {
-        let len = num_longs * 4;
-        let mut temp_buffer: [u8; 512] = [0; 512];
-        let mut dest = &mut temp_buffer[..len as usize];
-        try!(file.read_exact(dest));
-        Ok(String::from_utf8_lossy(&dest[..Self::find_string_end(&dest)]).into_owned())
-        //Ok(String::from_utf8_lossy(&dest).into_owned())
+    ///
+    /// Decodes all sections of a hunk
+    ///
+    pub fn hunk(&self, hunk: usize) -> Hunk {
+        let sections = &self.hunks[hunk];
+
+        Hunk {
+            mem_type: sections.mem_type,
+            hunk_type: sections.hunk_type,
+            alloc_size: sections.alloc_size,
+            data_size: sections.data_size,
+            code_data: self.code(hunk).map(|code| code.to_vec()),
+            reloc_32: self.reloc_32(hunk),
+            symbols: self.symbols(hunk),
+            line_debug_info: self.line_debug_info(hunk),
+        }
     }
+}
 
-    /*
-    fn read_name(file: &mut File) -> Option<io::Result<String>> {
-        let num_longs = try!(file.read_u32::<BigEndian>());
+impl HunkParser {
+    fn get_size_type(t: u32) -> (usize, MemoryType) {
+        let size = (t & 0x0fffffff) * 4;
+        let mem_t = t & 0xf0000000;
+        let mem_type = match mem_t {
+            HUNKF_CHIP => MemoryType::Chip,
+            HUNKF_FAST => MemoryType::Fast,
+            _ => MemoryType::Any,
+        };
+
+        (size as usize, mem_type)
+    }
+
+    fn skip_symbols(reader: &mut Reader) -> io::Result<()> {
+        loop {
+            let num_longs = try!(reader.read_u32());
+
+            if num_longs == 0 {
+                return Ok(());
+            }
+
+            // name and offset
+            try!(reader.skip_longs(num_longs));
+            try!(reader.read_u32());
+        }
     }
-    */
 
-    fn parse_symbols(hunk: &mut Hunk, file: &mut File) -> io::Result<()> {
+    fn parse_symbols(reader: &mut Reader) -> io::Result<Vec<Symbol>> {
         let mut symbols = Vec::new();
 
-        loop { 
-            let num_longs = try!(file.read_u32::<BigEndian>());
+        loop {
+            let num_longs = try!(reader.read_u32());
 
             if num_longs == 0 {
                 break;
             }
 
             let symbol = Symbol {
-                name: try!(Self::read_name_size(file, num_longs)),
-                offset: try!(file.read_u32::<BigEndian>()),
+                name: try!(reader.read_name(num_longs)),
+                offset: try!(reader.read_u32()),
             };
 
             symbols.push(symbol);
         }
 
-        if symbols.len() > 0 {
-            symbols.sort_by(|a, b| a.offset.cmp(&b.offset));
-            hunk.symbols = Some(symbols);
-        }
+        symbols.sort_by(|a, b| a.offset.cmp(&b.offset));
 
-        Ok(())
+        Ok(symbols)
     }
 
-    fn fill_debug_info(base_offset: u32, num_longs: u32, file: &mut File) -> io::Result<SourceFile> {
-        let num_name_longs = try!(file.read_u32::<BigEndian>());
-        let name = try!(Self::read_name_size(file, num_name_longs));
+    fn parse_line_info(base_offset: u32, num_longs: u32, reader: &mut Reader) -> io::Result<SourceFile> {
+        let num_name_longs = try!(reader.read_u32());
+
+        if num_name_longs >= num_longs {
+            return Err(Error::new(ErrorKind::Other, "Invalid name size in line info"));
+        }
+
+        let name = try!(reader.read_name(num_name_longs));
         let num_lines = (num_longs - num_name_longs - 1) / 2;
         let mut lines = Vec::with_capacity(num_lines as usize);
 
         for _ in 0..num_lines {
-            let line_no = try!(file.read_u32::<BigEndian>()) & 0xffffff; // mask for SAS/C extra info
-            let offset = try!(file.read_u32::<BigEndian>());
+            let line_no = try!(reader.read_u32()) & 0xffffff; // mask for SAS/C extra info
+            let offset = try!(reader.read_u32());
             lines.push(SourceLine {
                 line: line_no,
                 offset: base_offset + offset,
@@ -205,41 +334,31 @@ impl HunkParser {
         })
     }
 
-    fn parse_debug(hunk: &mut Hunk, file: &mut File) -> io::Result<()> {
-        let num_longs = try!(file.read_u32::<BigEndian>()) - 2; // skip base offset and tag
-        let base_offset = try!(file.read_u32::<BigEndian>());
-        let debug_tag = try!(file.read_u32::<BigEndian>());
+    fn skip_reloc32(reader: &mut Reader) -> io::Result<()> {
+        loop {
+            let count = try!(reader.read_u32());
 
-        // We only support debug line as debug format currently so skip if not found
-        if debug_tag != DEBUG_LINE {
-            try!(file.seek(io::SeekFrom::Current((num_longs * 4) as i64)).map(|_|()));
-            return Ok(());
-        }
+            if count == 0 {
+                return Ok(());
+            }
 
-        if let Some(ref mut debug_info) = hunk.line_debug_info {
-            let source_file = try!(Self::fill_debug_info(base_offset, num_longs, file));
-            debug_info.push(source_file);
-        } else {
-            let mut debug_info = Vec::new();
-            let source_file = try!(Self::fill_debug_info(base_offset, num_longs, file));
-            debug_info.push(source_file);
-            hunk.line_debug_info = Some(debug_info);
+            // target and offsets
+            try!(reader.read_u32());
+            try!(reader.skip_longs(count));
         }
-
-        return Ok(());
     }
 
-    fn parse_reloc32(hunk: &mut Hunk, file: &mut File) -> io::Result<()> {
-        let mut relocs = Vec::<RelocInfo32>::new();  
+    fn parse_reloc32(reader: &mut Reader) -> io::Result<Vec<RelocInfo32>> {
+        let mut relocs = Vec::<RelocInfo32>::new();
 
         loop {
-            let count = try!(file.read_u32::<BigEndian>()) as usize;
+            let count = try!(reader.read_u32()) as usize;
 
             if count == 0 {
                 break;
             }
 
-            let target = try!(file.read_u32::<BigEndian>()) as usize;
+            let target = try!(reader.read_u32()) as usize;
 
             let mut reloc = RelocInfo32 {
                 target: target,
@@ -247,30 +366,78 @@ impl HunkParser {
             };
 
             for _ in 0..count {
-                reloc.data.push(try!(file.read_u32::<BigEndian>()));
+                reloc.data.push(try!(reader.read_u32()));
             }
 
             relocs.push(reloc);
         }
 
-        hunk.reloc_32 = Some(relocs);
-
-        Ok(())
+        Ok(relocs)
     }
 
-    fn fill_hunk(hunk: &mut Hunk, file: &mut File) -> io::Result<()> {
+    ///
+    /// Finds where the sections of a hunk are without decoding them
+    ///
+    fn scan_hunk(hunk: &mut HunkSections, reader: &mut Reader) -> io::Result<()> {
         loop {
-            let hunk_type = try!(file.read_u32::<BigEndian>());
+            let hunk_type = try!(reader.read_u32());
 
             match hunk_type {
-                HUNK_UNIT => { try!(Self::skip_hunk(file, "HUNK_UNIT")) }
-                HUNK_NAME => { try!(Self::skip_hunk(file, "HUNK_NAME")) }
-                HUNK_DEBUG => { try!(Self::parse_debug(hunk, file)) }
-                HUNK_CODE => { try!(Self::parse_code_or_data(HunkType::Code, hunk, file)) }
-                HUNK_DATA => { try!(Self::parse_code_or_data(HunkType::Data, hunk, file)) }
-                HUNK_BSS => { try!(Self::parse_bss(hunk, file)) }
-                HUNK_RELOC32 => { try!(Self::parse_reloc32(hunk, file)) }
-                HUNK_SYMBOL => { try!(Self::parse_symbols(hunk, file)) }
+                HUNK_UNIT | HUNK_NAME => {
+                    let num_longs = try!(reader.read_u32());
+                    try!(reader.skip_longs(num_longs));
+                }
+
+                HUNK_DEBUG => {
+                    let num_longs = try!(reader.read_u32());
+
+                    if num_longs < 2 {
+                        return Err(Error::new(ErrorKind::Other, "Invalid HUNK_DEBUG size"));
+                    }
+
+                    let base_offset = try!(reader.read_u32());
+                    let debug_tag = try!(reader.read_u32());
+                    let start = reader.pos;
+
+                    try!(reader.skip_longs(num_longs - 2));
+
+                    // We only support debug line as debug format currently
+                    if debug_tag == DEBUG_LINE {
+                        hunk.line_debug_info.push((base_offset, start..reader.pos));
+                    }
+                }
+
+                HUNK_CODE | HUNK_DATA => {
+                    let (size, mem_type) = Self::get_size_type(try!(reader.read_u32()));
+                    let start = reader.pos;
+
+                    try!(reader.bytes(size));
+
+                    hunk.data_size = size;
+                    hunk.mem_type = mem_type;
+                    hunk.code = Some(start..reader.pos);
+                    hunk.hunk_type = if hunk_type == HUNK_CODE { HunkType::Code } else { HunkType::Data };
+                }
+
+                HUNK_BSS => {
+                    let (size, mem_type) = Self::get_size_type(try!(reader.read_u32()));
+                    hunk.hunk_type = HunkType::Bss;
+                    hunk.data_size = size;
+                    hunk.mem_type = mem_type;
+                }
+
+                HUNK_RELOC32 => {
+                    let start = reader.pos;
+                    try!(Self::skip_reloc32(reader));
+                    hunk.reloc_32 = Some(start..reader.pos);
+                }
+
+                HUNK_SYMBOL => {
+                    let start = reader.pos;
+                    try!(Self::skip_symbols(reader));
+                    hunk.symbols = Some(start..reader.pos);
+                }
+
                 HUNK_END => {
                     return Ok(());
                 }
@@ -283,56 +450,111 @@ impl HunkParser {
         }
     }
 
-    pub fn parse_file(filename: &str) -> Result<Vec<Hunk>, io::Error> {
-        let mut file = try!(File::open(filename));
+    fn scan(data: &[u8]) -> io::Result<Vec<HunkSections>> {
+        let mut reader = Reader::new(data, 0);
 
-        let hunk_header = try!(file.read_u32::<BigEndian>());
+        let hunk_header = try!(reader.read_u32());
         if hunk_header != HUNK_HEADER  {
             return Err(Error::new(ErrorKind::Other, "Unable to find correct HUNK_HEADER"));
         };
 
         // Skip header/string section
-        try!(file.read_u32::<BigEndian>());
+        try!(reader.read_u32());
 
-        let table_size = try!(file.read_u32::<BigEndian>()) as i32;
-        let first_hunk = try!(file.read_u32::<BigEndian>()) as i32;
-        let last_hunk = try!(file.read_u32::<BigEndian>()) as i32;
+        let table_size = try!(reader.read_u32()) as i32;
+        let first_hunk = try!(reader.read_u32()) as i32;
+        let last_hunk = try!(reader.read_u32()) as i32;
 
-        if table_size < 0 || first_hunk < 0 || last_hunk < 0 {
+        if table_size < 0 || first_hunk < 0 || last_hunk < first_hunk {
             return Err(Error::new(ErrorKind::Other, "Invalid sizes for hunks"));
         }
 
         let hunk_count = (last_hunk - first_hunk + 1) as usize;
 
-        let mut hunk_table = Vec::with_capacity(hunk_count);
+        let mut hunks = Vec::with_capacity(hunk_count);
 
         for _ in 0..hunk_count {
-            let (size, mem_type) = Self::get_size_type(try!(file.read_u32::<BigEndian>()));
-            hunk_table.push(SizesTypes {
+            let (size, mem_type) = Self::get_size_type(try!(reader.read_u32()));
+            hunks.push(HunkSections {
                 mem_type: mem_type,
-                size: size 
+                hunk_type: HunkType::Bss,
+                alloc_size: size,
+                data_size: 0,
+                code: None,
+                reloc_32: None,
+                symbols: None,
+                line_debug_info: Vec::new(),
             });
         }
 
-        let mut hunks = Vec::with_capacity(hunk_count);
+        for hunk in &mut hunks {
+            try!(Self::scan_hunk(hunk, &mut reader));
+        }
 
-        for i in 0..hunk_count {
-            let mut hunk = Hunk {
-                mem_type: hunk_table[i].mem_type, 
-                    hunk_type: HunkType::Bss,
-                    alloc_size: hunk_table[i].size as usize,
-                    data_size: 0,
-                    code_data: None, 
-                    reloc_32: None, 
-                    symbols: None, 
-                    line_debug_info: None,
-            };
+        Ok(hunks)
+    }
+
+    ///
+    /// Parses all hunks of an executable. Use HunkFile to only decode the parts that are needed.
+    ///
+    pub fn parse_file(filename: &str) -> Result<Vec<Hunk>, io::Error> {
+        let file = try!(HunkFile::open(filename));
+        Ok((0..file.len()).map(|i| file.hunk(i)).collect())
+    }
+}
 
-            try!(Self::fill_hunk(&mut hunk, &mut file));
+#[cfg(test)]
+mod tests {
+    use super::*;
 
-            hunks.push(hunk);
+    fn put(data: &mut Vec<u8>, values: &[u32]) {
+        for v in values {
+            data.extend_from_slice(&[(v >> 24) as u8, (v >> 16) as u8, (v >> 8) as u8, *v as u8]);
         }
+    }
 
-        Ok(hunks)
+    #[test]
+    fn test_lazy_sections() {
+        let mut data = Vec::new();
+        // header with one code and one bss hunk
+        put(&mut data, &[HUNK_HEADER, 0, 2, 0, 1, 2, 4 | HUNKF_CHIP]);
+        // code hunk with 8 bytes, a reloc, a symbol and line info for main.c
+        put(&mut data, &[HUNK_CODE, 2, 0x4e714e71, 0x4e754e75]);
+        put(&mut data, &[HUNK_RELOC32, 1, 1, 4, 0]);
+        put(&mut data, &[HUNK_SYMBOL, 1, 0x6d61696e, 4, 0]);
+        put(&mut data, &[HUNK_DEBUG, 9, 0x10, DEBUG_LINE, 2, 0x6d61696e, 0x2e630000, 3, 0, 4, 4]);
+        put(&mut data, &[HUNK_END]);
+        put(&mut data, &[HUNK_BSS, 4 | HUNKF_CHIP, HUNK_END]);
+
+        let file = HunkFile::from_data(data).unwrap();
+
+        assert_eq!(file.len(), 2);
+        assert_eq!(file.hunk_type(0), HunkType::Code);
+        assert_eq!(file.code(0), Some(&[0x4e, 0x71, 0x4e, 0x71, 0x4e, 0x75, 0x4e, 0x75][..]));
+
+        let relocs = file.reloc_32(0).unwrap();
+        assert_eq!(relocs[0].target, 1);
+        assert_eq!(relocs[0].data, vec![4]);
+
+        let symbols = file.symbols(0).unwrap();
+        assert_eq!(symbols[0].name, "main");
+        assert_eq!(symbols[0].offset, 4);
+
+        let files = file.line_debug_info(0).unwrap();
+        assert_eq!(files[0].name, "main.c");
+        assert_eq!(files[0].lines.len(), 2);
+        assert_eq!(files[0].lines[1].line, 4);
+        assert_eq!(files[0].lines[1].offset, 0x14);
+
+        assert_eq!(file.hunk_type(1), HunkType::Bss);
+        assert_eq!(file.data_size(1), 16);
+        assert!(file.code(1).is_none());
+    }
+
+    #[test]
+    fn test_truncated_file() {
+        let mut data = Vec::new();
+        put(&mut data, &[HUNK_HEADER, 0, 1, 0, 0, 2, HUNK_CODE, 2, 0x4e714e71]);
+        assert!(HunkFile::from_data(data).is_err());
     }
 }
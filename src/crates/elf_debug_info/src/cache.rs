@@ -0,0 +1,166 @@
+//! Parsed debug info saved to disk. The files are named after the build-id so a rebuilt binary
+//! never picks up the data of an old one.
+
+use std::fs::{self, File};
+use std::io::{self, Read, Write};
+use std::path::{Path, PathBuf};
+use elf::ElfSymbol;
+use line_program::LineRow;
+use line_table::LineTable;
+use reader::Reader;
+use DebugInfo;
+
+const CACHE_MAGIC: u32 = 0x494c4450; // PDLI
+const CACHE_VERSION: u32 = 1;
+
+pub fn cache_path(dir: &Path, build_id: &[u8]) -> PathBuf {
+    let mut name = String::with_capacity(build_id.len() * 2 + 8);
+
+    for b in build_id {
+        name.push_str(&format!("{:02x}", b));
+    }
+
+    name.push_str(".pdlines");
+    dir.join(name)
+}
+
+fn put_u32(data: &mut Vec<u8>, v: u32) {
+    data.extend_from_slice(&[v as u8, (v >> 8) as u8, (v >> 16) as u8, (v >> 24) as u8]);
+}
+
+fn put_u64(data: &mut Vec<u8>, v: u64) {
+    put_u32(data, v as u32);
+    put_u32(data, (v >> 32) as u32);
+}
+
+fn put_str(data: &mut Vec<u8>, s: &str) {
+    put_u32(data, s.len() as u32);
+    data.extend_from_slice(s.as_bytes());
+}
+
+pub fn save(filename: &Path, info: &DebugInfo) -> io::Result<()> {
+    let mut data = Vec::new();
+
+    put_u32(&mut data, CACHE_MAGIC);
+    put_u32(&mut data, CACHE_VERSION);
+
+    let build_id = info.build_id.as_ref().map(|id| &id[..]).unwrap_or(&[]);
+    put_u32(&mut data, build_id.len() as u32);
+    data.extend_from_slice(build_id);
+
+    let (start, end) = info.code_range.unwrap_or((0, 0));
+    put_u64(&mut data, start);
+    put_u64(&mut data, end);
+
+    put_u32(&mut data, info.symbols.len() as u32);
+    for symbol in &info.symbols {
+        put_u64(&mut data, symbol.address);
+        put_u64(&mut data, symbol.size);
+        put_str(&mut data, &symbol.name);
+    }
+
+    put_u32(&mut data, info.lines.files().len() as u32);
+    for file in info.lines.files() {
+        put_str(&mut data, file);
+    }
+
+    put_u32(&mut data, info.lines.rows().len() as u32);
+    for row in info.lines.rows() {
+        put_u64(&mut data, row.address);
+        put_u32(&mut data, row.file);
+        put_u32(&mut data, row.line);
+    }
+
+    if let Some(dir) = filename.parent() {
+        try!(fs::create_dir_all(dir));
+    }
+
+    // Written to a temp file first so another process never sees a half written cache
+    let temp_name = filename.with_extension("tmp");
+    try!(File::create(&temp_name).and_then(|mut f| f.write_all(&data)));
+    fs::rename(&temp_name, filename)
+}
+
+///
+/// Load the debug info from a cache file. Returns None if the file is missing, broken or was
+/// saved by another version.
+///
+pub fn load(filename: &Path, build_id: &[u8]) -> Option<DebugInfo> {
+    let mut data = Vec::new();
+
+    if File::open(filename).and_then(|mut f| f.read_to_end(&mut data)).is_err() {
+        return None;
+    }
+
+    read(&data, build_id).ok()
+}
+
+fn read(data: &[u8], build_id: &[u8]) -> io::Result<DebugInfo> {
+    let mut reader = Reader::new(data, false);
+
+    if try!(reader.u32()) != CACHE_MAGIC || try!(reader.u32()) != CACHE_VERSION {
+        return Err(io::Error::new(io::ErrorKind::InvalidData, "Wrong cache version"));
+    }
+
+    let id_len = try!(reader.u32()) as usize;
+
+    if try!(reader.bytes(id_len)) != build_id {
+        return Err(io::Error::new(io::ErrorKind::InvalidData, "Wrong build-id"));
+    }
+
+    let code_range = (try!(reader.u64()), try!(reader.u64()));
+
+    let count = try!(reader.u32()) as usize;
+    let mut symbols = Vec::with_capacity(count.min(data.len() / 20));
+
+    for _ in 0..count {
+        let address = try!(reader.u64());
+        let size = try!(reader.u64());
+        let name = try!(read_str(&mut reader));
+
+        symbols.push(ElfSymbol {
+            name: name,
+            address: address,
+            size: size,
+        });
+    }
+
+    let count = try!(reader.u32()) as usize;
+    let mut files = Vec::with_capacity(count.min(data.len() / 4));
+
+    for _ in 0..count {
+        files.push(try!(read_str(&mut reader)));
+    }
+
+    let count = try!(reader.u32()) as usize;
+    let mut rows = Vec::with_capacity(count.min(data.len() / 16));
+
+    for _ in 0..count {
+        let address = try!(reader.u64());
+        let file = try!(reader.u32());
+        let line = try!(reader.u32());
+
+        if file as usize >= files.len() {
+            return Err(io::Error::new(io::ErrorKind::InvalidData, "Invalid file index"));
+        }
+
+        rows.push(LineRow {
+            address: address,
+            file: file,
+            line: line,
+        });
+    }
+
+    Ok(DebugInfo {
+        build_id: Some(build_id.to_vec()),
+        code_range: if code_range == (0, 0) { None } else { Some(code_range) },
+        symbols: symbols,
+        lines: LineTable::from_parts(files, rows),
+    })
+}
+
+fn read_str(reader: &mut Reader) -> io::Result<String> {
+    let len = try!(reader.u32()) as usize;
+    let bytes = try!(reader.bytes(len));
+    Ok(String::from_utf8_lossy(bytes).into_owned())
+}
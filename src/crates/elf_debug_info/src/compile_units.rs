@@ -0,0 +1,177 @@
+//! Compile directories of the compile units in .debug_info.
+//!
+//! Before DWARF 5 the line tables don't include the directory the unit was compiled in, so
+//! relative paths in them are relative to the DW_AT_comp_dir of the unit. Only the first entry
+//! of each unit is read to find it.
+
+use std::collections::HashMap;
+use std::io::Result;
+use form::{read_form, Encoding, Strings, Value, DW_FORM_IMPLICIT_CONST};
+use reader::Reader;
+
+const DW_AT_STMT_LIST: u64 = 0x10;
+const DW_AT_COMP_DIR: u64 = 0x1b;
+
+const DW_UT_TYPE: u8 = 2;
+const DW_UT_SKELETON: u8 = 4;
+const DW_UT_SPLIT_COMPILE: u8 = 5;
+const DW_UT_SPLIT_TYPE: u8 = 6;
+
+///
+/// Compile dir of each unit keyed on the offset of its line table in .debug_line
+///
+pub fn comp_dirs(info: &[u8], abbrev: &[u8], strings: &Strings, big_endian: bool) -> HashMap<u64, String> {
+    let mut dirs = HashMap::new();
+    let mut reader = Reader::new(info, big_endian);
+
+    while !reader.is_empty() {
+        let mut is_64 = false;
+
+        let len = match reader.u32() {
+            Ok(0xffff_ffff) => {
+                is_64 = true;
+                reader.u64()
+            }
+            Ok(len) => Ok(len as u64),
+            Err(e) => Err(e),
+        };
+
+        let end = match len {
+            Ok(len) if len <= (info.len() - reader.pos()) as u64 => reader.pos() + len as usize,
+            _ => break,
+        };
+
+        let mut unit = Reader::new(&info[..end], big_endian);
+        unit.set_pos(reader.pos());
+
+        if let Ok(Some((stmt_list, comp_dir))) = first_entry(&mut unit, abbrev, strings, big_endian, is_64) {
+            dirs.insert(stmt_list, comp_dir.to_owned());
+        }
+
+        reader.set_pos(end);
+    }
+
+    dirs
+}
+
+///
+/// Reads the unit header and the stmt_list and comp_dir of the first entry
+///
+fn first_entry<'a>(unit: &mut Reader<'a>,
+                   abbrev: &[u8],
+                   strings: &Strings<'a>,
+                   big_endian: bool,
+                   is_64: bool)
+                   -> Result<Option<(u64, &'a str)>> {
+    let version = try!(unit.u16());
+    let (abbrev_offset, address_size);
+
+    if version >= 5 {
+        let unit_type = try!(unit.u8());
+        address_size = try!(unit.u8()) as usize;
+        abbrev_offset = try!(unit.word(is_64));
+
+        match unit_type {
+            DW_UT_SKELETON | DW_UT_SPLIT_COMPILE => try!(unit.skip(8)),
+            DW_UT_TYPE | DW_UT_SPLIT_TYPE => try!(unit.skip(if is_64 { 16 } else { 12 })),
+            _ => (),
+        }
+    } else {
+        abbrev_offset = try!(unit.word(is_64));
+        address_size = try!(unit.u8()) as usize;
+    }
+
+    let encoding = Encoding {
+        version: version,
+        is_64: is_64,
+        address_size: address_size,
+    };
+
+    let code = try!(unit.uleb128());
+
+    // Find the abbreviation used by the entry
+    let mut abbrevs = Reader::new(abbrev, big_endian);
+    abbrevs.set_pos(abbrev_offset as usize);
+
+    loop {
+        let abbrev_code = try!(abbrevs.uleb128());
+
+        if abbrev_code == 0 {
+            return Ok(None);
+        }
+
+        let _tag = try!(abbrevs.uleb128());
+        let _has_children = try!(abbrevs.u8());
+
+        if abbrev_code == code {
+            break;
+        }
+
+        loop {
+            let (attr, form) = (try!(abbrevs.uleb128()), try!(abbrevs.uleb128()));
+
+            if form == DW_FORM_IMPLICIT_CONST {
+                try!(abbrevs.sleb128());
+            }
+
+            if attr == 0 && form == 0 {
+                break;
+            }
+        }
+    }
+
+    let mut stmt_list = None;
+    let mut comp_dir = None;
+
+    loop {
+        let (attr, form) = (try!(abbrevs.uleb128()), try!(abbrevs.uleb128()));
+
+        if attr == 0 && form == 0 {
+            break;
+        }
+
+        if form == DW_FORM_IMPLICIT_CONST {
+            try!(abbrevs.sleb128());
+        }
+
+        match (attr, try!(read_form(unit, strings, form, encoding))) {
+            (DW_AT_STMT_LIST, Value::Num(offset)) => stmt_list = Some(offset),
+            (DW_AT_COMP_DIR, Value::Str(dir)) => comp_dir = Some(dir),
+            _ => (),
+        }
+    }
+
+    match (stmt_list, comp_dir) {
+        (Some(offset), Some(dir)) => Ok(Some((offset, dir))),
+        _ => Ok(None),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use form::{Strings, DW_FORM_STRING, DW_FORM_DATA1, DW_FORM_SEC_OFFSET, DW_FORM_STRP};
+
+    #[test]
+    fn test_comp_dirs() {
+        // abbrev 1: compile unit with a name (string), language (data1), stmt_list and comp_dir
+        let abbrev = [1, 0x11, 1,
+                      0x03, DW_FORM_STRING as u8, 0x13, DW_FORM_DATA1 as u8,
+                      0x10, DW_FORM_SEC_OFFSET as u8, 0x1b, DW_FORM_STRP as u8, 0, 0, 0];
+
+        let mut unit = vec![4, 0, 0, 0, 0, 0, 8, 1];
+        unit.extend_from_slice(b"main.c\0");
+        unit.extend_from_slice(&[0x0c, 0x40, 0, 0, 0, 4, 0, 0, 0]);
+
+        let mut info = vec![unit.len() as u8, 0, 0, 0];
+        info.extend_from_slice(&unit);
+
+        let strings = Strings {
+            str: b"xyz\0/home/src\0",
+            line_str: &[],
+        };
+
+        let dirs = comp_dirs(&info, &abbrev, &strings, false);
+        assert_eq!(dirs.get(&0x40).map(|d| d.as_str()), Some("/home/src"));
+    }
+}
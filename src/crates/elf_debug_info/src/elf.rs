@@ -0,0 +1,282 @@
+//! The parts of ELF files needed for symbols and line info: section headers, the symbol tables
+//! and the GNU build-id note.
+
+use std::io::Result;
+use std::ops::Range;
+use reader::{invalid_data, str_at, Reader};
+
+const SHT_SYMTAB: u32 = 2;
+const SHT_NOTE: u32 = 7;
+const SHT_NOBITS: u32 = 8;
+const SHT_DYNSYM: u32 = 11;
+
+const SHF_ALLOC: u64 = 0x2;
+const SHF_EXECINSTR: u64 = 0x4;
+const SHF_COMPRESSED: u64 = 0x800;
+
+const STT_OBJECT: u8 = 1;
+const STT_FUNC: u8 = 2;
+
+const SHN_LORESERVE: u16 = 0xff00;
+
+const NT_GNU_BUILD_ID: u32 = 3;
+
+pub struct Section<'a> {
+    pub name: &'a str,
+    pub kind: u32,
+    pub flags: u64,
+    pub address: u64,
+    pub size: u64,
+    /// Location of the data in the file (empty for NOBITS)
+    pub range: Range<usize>,
+    pub link: u32,
+}
+
+#[derive(Clone, Debug, PartialEq)]
+pub struct ElfSymbol {
+    pub name: String,
+    pub address: u64,
+    pub size: u64,
+}
+
+pub struct ElfFile<'a> {
+    data: &'a [u8],
+    pub is_64: bool,
+    pub big_endian: bool,
+    pub sections: Vec<Section<'a>>,
+}
+
+impl<'a> ElfFile<'a> {
+    pub fn parse(data: &'a [u8]) -> Result<ElfFile<'a>> {
+        if data.len() < 16 || &data[..4] != b"\x7fELF" {
+            return Err(invalid_data("Not an ELF file"));
+        }
+
+        let is_64 = match data[4] {
+            1 => false,
+            2 => true,
+            _ => return Err(invalid_data("Unknown ELF class")),
+        };
+
+        let big_endian = data[5] == 2;
+        let mut reader = Reader::new(data, big_endian);
+
+        // e_shoff and the section counts
+        reader.set_pos(if is_64 { 40 } else { 32 });
+        let section_offset = try!(reader.word(is_64)) as usize;
+        // e_flags, e_ehsize, e_phentsize and e_phnum
+        try!(reader.skip(10));
+        let entry_size = try!(reader.u16()) as usize;
+        let mut count = try!(reader.u16()) as usize;
+        let mut names_index = try!(reader.u16()) as usize;
+
+        let mut elf = ElfFile {
+            data: data,
+            is_64: is_64,
+            big_endian: big_endian,
+            sections: Vec::new(),
+        };
+
+        if section_offset == 0 {
+            return Ok(elf);
+        }
+
+        // Section 0 holds the real values when they don't fit in the header
+        let (first, _) = try!(elf.section_header(section_offset));
+
+        if count == 0 {
+            count = first.size as usize;
+        }
+
+        if names_index == 0xffff {
+            names_index = first.link as usize;
+        }
+
+        if entry_size < (if is_64 { 64 } else { 40 }) || count > data.len() / entry_size {
+            return Err(invalid_data("Invalid section headers"));
+        }
+
+        let mut headers = Vec::with_capacity(count);
+
+        for i in 0..count {
+            headers.push(try!(elf.section_header(section_offset + i * entry_size)));
+        }
+
+        let names = headers.get(names_index).map(|h| &data[h.0.range.clone()]).unwrap_or(&[]);
+
+        elf.sections = headers.into_iter()
+            .map(|(mut section, name_offset)| {
+                section.name = str_at(names, name_offset as u64);
+                section
+            })
+            .collect();
+
+        Ok(elf)
+    }
+
+    ///
+    /// Section at offset in the section headers and the offset of its name
+    ///
+    fn section_header(&self, offset: usize) -> Result<(Section<'a>, u32)> {
+        let mut reader = Reader::new(self.data, self.big_endian);
+        reader.set_pos(offset);
+
+        let is_64 = self.is_64;
+        let name_offset = try!(reader.u32());
+        let kind = try!(reader.u32());
+        let flags = try!(reader.word(is_64));
+        let address = try!(reader.word(is_64));
+        let file_offset = try!(reader.word(is_64)) as usize;
+        let size = try!(reader.word(is_64));
+        let link = try!(reader.u32());
+
+        let range = if kind == SHT_NOBITS {
+            0..0
+        } else if file_offset > self.data.len() || size as usize > self.data.len() - file_offset {
+            return Err(invalid_data("Section outside of file"));
+        } else {
+            file_offset..file_offset + size as usize
+        };
+
+        let section = Section {
+            name: "",
+            kind: kind,
+            flags: flags,
+            address: address,
+            size: size,
+            range: range,
+            link: link,
+        };
+
+        Ok((section, name_offset))
+    }
+
+    pub fn section(&self, name: &str) -> Option<&Section<'a>> {
+        self.sections.iter().find(|s| s.name == name)
+    }
+
+    ///
+    /// Location of the data of a section in the file. Compressed sections aren't supported so
+    /// they are treated as missing.
+    ///
+    pub fn section_range(&self, name: &str) -> Option<Range<usize>> {
+        self.section(name)
+            .and_then(|s| if (s.flags & SHF_COMPRESSED) != 0 { None } else { Some(s.range.clone()) })
+    }
+
+    pub fn section_data(&self, name: &str) -> &'a [u8] {
+        let data = self.data;
+        self.section_range(name).map(|r| &data[r]).unwrap_or(&[])
+    }
+
+    ///
+    /// Function and data symbols from .symtab (or .dynsym if the file is stripped)
+    ///
+    pub fn symbols(&self) -> Vec<ElfSymbol> {
+        let mut symbols = Vec::new();
+
+        let table = self.sections
+            .iter()
+            .find(|s| s.kind == SHT_SYMTAB)
+            .or_else(|| self.sections.iter().find(|s| s.kind == SHT_DYNSYM));
+
+        let table = match table {
+            Some(table) => table,
+            None => return symbols,
+        };
+
+        let names = self.sections.get(table.link as usize).map(|s| &self.data[s.range.clone()]).unwrap_or(&[]);
+        let entry_size = if self.is_64 { 24 } else { 16 };
+        let count = table.range.len() / entry_size;
+
+        symbols.reserve(count);
+
+        let mut reader = Reader::new(&self.data[table.range.clone()], self.big_endian);
+
+        for _ in 0..count {
+            // The symbol table is inside the file (checked when parsing the header)
+            let (name, info, index, address, size) = if self.is_64 {
+                let name = reader.u32().unwrap();
+                let info = reader.u8().unwrap();
+                let _other = reader.u8().unwrap();
+                let index = reader.u16().unwrap();
+                (name, info, index, reader.u64().unwrap(), reader.u64().unwrap())
+            } else {
+                let name = reader.u32().unwrap();
+                let address = reader.u32().unwrap() as u64;
+                let size = reader.u32().unwrap() as u64;
+                let info = reader.u8().unwrap();
+                let _other = reader.u8().unwrap();
+                (name, info, reader.u16().unwrap(), address, size)
+            };
+
+            let kind = info & 0xf;
+
+            if (kind != STT_FUNC && kind != STT_OBJECT) || index == 0 || index >= SHN_LORESERVE {
+                continue;
+            }
+
+            let name = str_at(names, name as u64);
+
+            if name.is_empty() {
+                continue;
+            }
+
+            symbols.push(ElfSymbol {
+                name: name.to_owned(),
+                address: address,
+                size: size,
+            });
+        }
+
+        symbols
+    }
+
+    ///
+    /// Contents of the GNU build-id note which identifies the build the file came from
+    ///
+    pub fn build_id(&self) -> Option<Vec<u8>> {
+        for section in self.sections.iter().filter(|s| s.kind == SHT_NOTE) {
+            let mut reader = Reader::new(&self.data[section.range.clone()], self.big_endian);
+
+            while !reader.is_empty() {
+                let note = (reader.u32(), reader.u32(), reader.u32());
+
+                let (name_size, desc_size, kind) = match note {
+                    (Ok(n), Ok(d), Ok(k)) => (n as usize, d as usize, k),
+                    _ => break,
+                };
+
+                let name = reader.bytes((name_size + 3) & !3);
+                let desc = reader.bytes((desc_size + 3) & !3);
+
+                match (name, desc) {
+                    (Ok(name), Ok(desc)) => {
+                        if kind == NT_GNU_BUILD_ID && name.starts_with(b"GNU\0") {
+                            return Some(desc[..desc_size].to_vec());
+                        }
+                    }
+                    _ => break,
+                }
+            }
+        }
+
+        None
+    }
+
+    ///
+    /// Start and end of the executable sections
+    ///
+    pub fn code_range(&self) -> Option<(u64, u64)> {
+        self.sections
+            .iter()
+            .filter(|s| (s.flags & (SHF_ALLOC | SHF_EXECINSTR)) == (SHF_ALLOC | SHF_EXECINSTR))
+            .fold(None, |range, s| {
+                let end = s.address + s.size;
+                match range {
+                    Some((start, e)) => Some((start.min(s.address), end.max(e))),
+                    None => Some((s.address, end)),
+                }
+            })
+    }
+}
@@ -0,0 +1,142 @@
+//! Reading DWARF attribute values
+
+use std::io::Result;
+use reader::{invalid_data, str_at, Reader};
+
+pub const DW_FORM_ADDR: u64 = 0x01;
+pub const DW_FORM_BLOCK2: u64 = 0x03;
+pub const DW_FORM_BLOCK4: u64 = 0x04;
+pub const DW_FORM_DATA2: u64 = 0x05;
+pub const DW_FORM_DATA4: u64 = 0x06;
+pub const DW_FORM_DATA8: u64 = 0x07;
+pub const DW_FORM_STRING: u64 = 0x08;
+pub const DW_FORM_BLOCK: u64 = 0x09;
+pub const DW_FORM_BLOCK1: u64 = 0x0a;
+pub const DW_FORM_DATA1: u64 = 0x0b;
+pub const DW_FORM_FLAG: u64 = 0x0c;
+pub const DW_FORM_SDATA: u64 = 0x0d;
+pub const DW_FORM_STRP: u64 = 0x0e;
+pub const DW_FORM_UDATA: u64 = 0x0f;
+pub const DW_FORM_REF_ADDR: u64 = 0x10;
+pub const DW_FORM_REF1: u64 = 0x11;
+pub const DW_FORM_REF2: u64 = 0x12;
+pub const DW_FORM_REF4: u64 = 0x13;
+pub const DW_FORM_REF8: u64 = 0x14;
+pub const DW_FORM_REF_UDATA: u64 = 0x15;
+pub const DW_FORM_INDIRECT: u64 = 0x16;
+pub const DW_FORM_SEC_OFFSET: u64 = 0x17;
+pub const DW_FORM_EXPRLOC: u64 = 0x18;
+pub const DW_FORM_FLAG_PRESENT: u64 = 0x19;
+pub const DW_FORM_STRX: u64 = 0x1a;
+pub const DW_FORM_ADDRX: u64 = 0x1b;
+pub const DW_FORM_REF_SUP4: u64 = 0x1c;
+pub const DW_FORM_STRP_SUP: u64 = 0x1d;
+pub const DW_FORM_DATA16: u64 = 0x1e;
+pub const DW_FORM_LINE_STRP: u64 = 0x1f;
+pub const DW_FORM_REF_SIG8: u64 = 0x20;
+pub const DW_FORM_IMPLICIT_CONST: u64 = 0x21;
+pub const DW_FORM_LOCLISTX: u64 = 0x22;
+pub const DW_FORM_RNGLISTX: u64 = 0x23;
+pub const DW_FORM_REF_SUP8: u64 = 0x24;
+pub const DW_FORM_STRX1: u64 = 0x25;
+pub const DW_FORM_STRX4: u64 = 0x28;
+pub const DW_FORM_ADDRX1: u64 = 0x29;
+pub const DW_FORM_ADDRX4: u64 = 0x2c;
+pub const DW_FORM_GNU_ADDR_INDEX: u64 = 0x1f01;
+pub const DW_FORM_GNU_STR_INDEX: u64 = 0x1f02;
+pub const DW_FORM_GNU_REF_ALT: u64 = 0x1f20;
+pub const DW_FORM_GNU_STRP_ALT: u64 = 0x1f21;
+
+///
+/// String sections values can point into
+///
+#[derive(Clone, Copy)]
+pub struct Strings<'a> {
+    pub str: &'a [u8],
+    pub line_str: &'a [u8],
+}
+
+pub enum Value<'a> {
+    Str(&'a str),
+    Num(u64),
+    /// Blocks and values that need data we don't have (such as string indices)
+    Other,
+}
+
+///
+/// Size of the unit values are read from
+///
+#[derive(Clone, Copy)]
+pub struct Encoding {
+    pub version: u16,
+    pub is_64: bool,
+    pub address_size: usize,
+}
+
+pub fn read_form<'a>(reader: &mut Reader<'a>,
+                     strings: &Strings<'a>,
+                     form: u64,
+                     encoding: Encoding)
+                     -> Result<Value<'a>> {
+    let is_64 = encoding.is_64;
+
+    let value = match form {
+        DW_FORM_STRING => Value::Str(try!(reader.cstr())),
+        DW_FORM_STRP => Value::Str(str_at(strings.str, try!(reader.word(is_64)))),
+        DW_FORM_LINE_STRP => Value::Str(str_at(strings.line_str, try!(reader.word(is_64)))),
+        DW_FORM_DATA1 | DW_FORM_REF1 | DW_FORM_FLAG => Value::Num(try!(reader.u8()) as u64),
+        DW_FORM_DATA2 | DW_FORM_REF2 => Value::Num(try!(reader.u16()) as u64),
+        DW_FORM_DATA4 | DW_FORM_REF4 | DW_FORM_REF_SUP4 => Value::Num(try!(reader.u32()) as u64),
+        DW_FORM_DATA8 | DW_FORM_REF8 | DW_FORM_REF_SIG8 | DW_FORM_REF_SUP8 => Value::Num(try!(reader.u64())),
+        DW_FORM_UDATA | DW_FORM_REF_UDATA => Value::Num(try!(reader.uleb128())),
+        DW_FORM_SDATA => Value::Num(try!(reader.sleb128()) as u64),
+        DW_FORM_ADDR => Value::Num(try!(reader.sized(encoding.address_size))),
+        DW_FORM_SEC_OFFSET | DW_FORM_STRP_SUP | DW_FORM_GNU_REF_ALT | DW_FORM_GNU_STRP_ALT => {
+            Value::Num(try!(reader.word(is_64)))
+        }
+        DW_FORM_REF_ADDR => {
+            // Address sized in DWARF 2
+            if encoding.version <= 2 {
+                Value::Num(try!(reader.sized(encoding.address_size)))
+            } else {
+                Value::Num(try!(reader.word(is_64)))
+            }
+        }
+        DW_FORM_FLAG_PRESENT | DW_FORM_IMPLICIT_CONST => Value::Other,
+        DW_FORM_DATA16 => {
+            try!(reader.skip(16));
+            Value::Other
+        }
+        DW_FORM_BLOCK1 | DW_FORM_BLOCK2 | DW_FORM_BLOCK4 | DW_FORM_BLOCK | DW_FORM_EXPRLOC => {
+            let len = match form {
+                DW_FORM_BLOCK1 => try!(reader.u8()) as u64,
+                DW_FORM_BLOCK2 => try!(reader.u16()) as u64,
+                DW_FORM_BLOCK4 => try!(reader.u32()) as u64,
+                _ => try!(reader.uleb128()),
+            };
+            try!(reader.skip(len as usize));
+            Value::Other
+        }
+        // Indices into tables that need the base offsets of the unit
+        DW_FORM_STRX | DW_FORM_ADDRX | DW_FORM_LOCLISTX | DW_FORM_RNGLISTX | DW_FORM_GNU_ADDR_INDEX |
+        DW_FORM_GNU_STR_INDEX => {
+            try!(reader.uleb128());
+            Value::Other
+        }
+        DW_FORM_STRX1...DW_FORM_STRX4 => {
+            try!(reader.skip((form - DW_FORM_STRX1 + 1) as usize));
+            Value::Other
+        }
+        DW_FORM_ADDRX1...DW_FORM_ADDRX4 => {
+            try!(reader.skip((form - DW_FORM_ADDRX1 + 1) as usize));
+            Value::Other
+        }
+        DW_FORM_INDIRECT => {
+            let form = try!(reader.uleb128());
+            return read_form(reader, strings, form, encoding);
+        }
+        _ => return Err(invalid_data("Unsupported attribute form")),
+    };
+
+    Ok(value)
+}
@@ -0,0 +1,267 @@
+//! Symbols and source line info of ELF files with DWARF debug info.
+//!
+//! The file is memory mapped and only the symbol tables, the build-id note, the line number
+//! programs (.debug_line) and the first entry of each compile unit (for the compile dir) are
+//! read. The line number programs of the compile units are
+//! independent of each other so they are split up over worker threads. The result is cached
+//! on disk keyed on the build-id so loading the same build again only reads the cache.
+//!
+//! Compressed debug sections (SHF_COMPRESSED) aren't supported and are treated as missing.
+
+extern crate libc;
+extern crate prodbg_api;
+
+mod reader;
+mod elf;
+mod form;
+mod compile_units;
+mod line_program;
+mod line_table;
+mod cache;
+
+use std::collections::HashMap;
+use std::io::{self, Result};
+use std::ops::Range;
+use std::path::Path;
+use std::sync::Arc;
+use std::thread;
+use elf::ElfFile;
+use form::Strings;
+use line_program::{LineSections, UnitLines};
+
+pub use elf::ElfSymbol;
+pub use line_program::LineRow;
+pub use line_table::LineTable;
+pub use prodbg_api::MappedFile;
+
+/// Below this size the line programs are parsed on the calling thread
+const PARALLEL_MIN_SIZE: usize = 256 * 1024;
+
+pub struct DebugInfo {
+    pub build_id: Option<Vec<u8>>,
+    /// Start and end of the executable sections
+    pub code_range: Option<(u64, u64)>,
+    pub symbols: Vec<ElfSymbol>,
+    pub lines: LineTable,
+}
+
+impl DebugInfo {
+    ///
+    /// Loads the debug info of an ELF file. If cache_dir is given the cached data for the
+    /// build-id of the file is used if there is any, otherwise the parsed data is saved there.
+    ///
+    pub fn load(path: &Path, cache_dir: Option<&Path>) -> Result<DebugInfo> {
+        let file = Arc::new(try!(MappedFile::open(path)));
+        let build_id = try!(ElfFile::parse(file.data())).build_id();
+
+        let cache_path = match (cache_dir, build_id.as_ref()) {
+            (Some(dir), Some(id)) => Some(cache::cache_path(dir, id)),
+            _ => None,
+        };
+
+        if let (Some(path), Some(id)) = (cache_path.as_ref(), build_id.as_ref()) {
+            if let Some(info) = cache::load(path, id) {
+                return Ok(info);
+            }
+        }
+
+        let info = try!(DebugInfo::parse(file));
+
+        if let Some(path) = cache_path {
+            if let Err(e) = cache::save(&path, &info) {
+                println!("Unable to write debug info cache {:?} - {:?}", path, e);
+            }
+        }
+
+        Ok(info)
+    }
+
+    ///
+    /// Parses the symbols and line info. Line programs are parsed on worker threads while the
+    /// symbols are read on this one.
+    ///
+    pub fn parse(file: Arc<MappedFile>) -> Result<DebugInfo> {
+        let (ranges, big_endian, comp_dirs) = {
+            let elf = try!(ElfFile::parse(file.data()));
+            let ranges = [elf.section_range(".debug_line"),
+                          elf.section_range(".debug_line_str"),
+                          elf.section_range(".debug_str")];
+
+            let strings = Strings {
+                str: elf.section_data(".debug_str"),
+                line_str: elf.section_data(".debug_line_str"),
+            };
+
+            let comp_dirs = compile_units::comp_dirs(elf.section_data(".debug_info"),
+                                                     elf.section_data(".debug_abbrev"),
+                                                     &strings,
+                                                     elf.big_endian);
+
+            (ranges, elf.big_endian, Arc::new(comp_dirs))
+        };
+
+        let line_range = ranges[0].clone().unwrap_or(0..0);
+        let units = line_program::split_units(&file.data()[line_range], big_endian);
+
+        let workers = if file.data().len() < PARALLEL_MIN_SIZE { 1 } else { cpu_count() };
+        let mut groups = split_work(&units, workers).into_iter();
+
+        // The first group is parsed on this thread
+        let first = groups.next().unwrap();
+
+        let handles = groups.map(|group| {
+                let file = file.clone();
+                let comp_dirs = comp_dirs.clone();
+                let ranges = ranges.clone();
+                let units = units[group].to_vec();
+                thread::spawn(move || parse_units(&file, &ranges, &comp_dirs, big_endian, &units))
+            })
+            .collect::<Vec<_>>();
+
+        let elf = try!(ElfFile::parse(file.data()));
+        let symbols = elf.symbols();
+        let build_id = elf.build_id();
+        let code_range = elf.code_range();
+
+        let mut unit_lines = parse_units(&file, &ranges, &comp_dirs, big_endian, &units[first]);
+
+        for handle in handles {
+            match handle.join() {
+                Ok(lines) => unit_lines.extend(lines),
+                Err(_) => return Err(io::Error::new(io::ErrorKind::Other, "Line info worker failed")),
+            }
+        }
+
+        Ok(DebugInfo {
+            build_id: build_id,
+            code_range: code_range,
+            symbols: symbols,
+            lines: LineTable::from_units(unit_lines),
+        })
+    }
+}
+
+fn parse_units(file: &MappedFile,
+               ranges: &[Option<Range<usize>>; 3],
+               comp_dirs: &HashMap<u64, String>,
+               big_endian: bool,
+               units: &[Range<usize>])
+               -> Vec<UnitLines> {
+    let data = file.data();
+    let section = |index: usize| ranges[index].clone().map(|r| &data[r]).unwrap_or(&[]);
+
+    let sections = LineSections {
+        line: section(0),
+        strings: Strings {
+            line_str: section(1),
+            str: section(2),
+        },
+        big_endian: big_endian,
+    };
+
+    let mut lines = Vec::with_capacity(units.len());
+
+    for unit in units {
+        let comp_dir = comp_dirs.get(&(unit.start as u64)).map(|d| d.as_str());
+
+        match line_program::parse_unit(&sections, unit.clone(), comp_dir) {
+            Ok(unit_lines) => lines.push(unit_lines),
+            Err(e) => println!("Skipping line info at 0x{:x} - {}", unit.start, e),
+        }
+    }
+
+    lines
+}
+
+///
+/// Splits the units into groups of about the same size in bytes
+///
+fn split_work(units: &[Range<usize>], workers: usize) -> Vec<Range<usize>> {
+    let total = units.iter().map(|u| u.len()).sum::<usize>();
+    let per_worker = total / workers.max(1) + 1;
+
+    let mut groups = Vec::new();
+    let mut start = 0;
+    let mut size = 0;
+
+    for (i, unit) in units.iter().enumerate() {
+        size += unit.len();
+
+        if size >= per_worker {
+            groups.push(start..i + 1);
+            start = i + 1;
+            size = 0;
+        }
+    }
+
+    if start < units.len() || groups.is_empty() {
+        groups.push(start..units.len());
+    }
+
+    groups
+}
+
+#[cfg(unix)]
+fn cpu_count() -> usize {
+    let count = unsafe { libc::sysconf(libc::_SC_NPROCESSORS_ONLN) };
+    if count < 1 { 1 } else { count as usize }
+}
+
+#[cfg(not(unix))]
+fn cpu_count() -> usize {
+    4
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use super::split_work;
+    use std::env;
+    use std::fs;
+
+    #[test]
+    fn test_split_work() {
+        let units = vec![0..10, 10..20, 20..100, 100..110, 110..120];
+        let groups = split_work(&units, 3);
+
+        assert_eq!(groups.first().unwrap().start, 0);
+        assert_eq!(groups.last().unwrap().end, 5);
+        assert!(groups.windows(2).all(|g| g[0].end == g[1].start));
+        assert_eq!(split_work(&[], 4), vec![0..0]);
+    }
+
+    const MARKER_LINE: u32 = line!();
+
+    #[inline(never)]
+    fn line_marker() -> u32 {
+        MARKER_LINE
+    }
+
+    ///
+    /// Loads the test executable itself, which is built with debug info
+    ///
+    #[test]
+    #[cfg(target_os = "linux")]
+    fn test_load_self() {
+        let exe = env::current_exe().unwrap();
+        let cache_dir = env::temp_dir().join("prodbg_elf_debug_info_test");
+        let _ = fs::remove_dir_all(&cache_dir);
+
+        assert_eq!(line_marker(), MARKER_LINE);
+
+        for _ in 0..2 {
+            let info = DebugInfo::load(&exe, Some(&cache_dir)).unwrap();
+            assert!(info.build_id.is_some());
+
+            let symbol = info.symbols.iter().find(|s| s.name.contains("line_marker")).unwrap();
+            let (file, line) = info.lines.resolve_address(symbol.address).unwrap();
+            assert!(file.ends_with("lib.rs"));
+            assert!(line > MARKER_LINE && line <= MARKER_LINE + 5);
+
+            let address = info.lines.find_address(file, line).unwrap();
+            assert!(address >= symbol.address && address < symbol.address + symbol.size);
+        }
+
+        assert_eq!(fs::read_dir(&cache_dir).unwrap().count(), 1);
+    }
+}
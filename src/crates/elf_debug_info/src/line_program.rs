@@ -0,0 +1,522 @@
+//! DWARF .debug_line parsing (version 2 to 5).
+//!
+//! Each unit in .debug_line is self-contained (header, file table and line program) so the
+//! units can be found by only reading their lengths and then be parsed independently of each
+//! other, without looking at .debug_info at all.
+
+use std::io::Result;
+use std::ops::Range;
+use form::{read_form, Encoding, Strings, Value};
+use reader::{invalid_data, Reader};
+
+// Standard opcodes
+const DW_LNS_COPY: u8 = 1;
+const DW_LNS_ADVANCE_PC: u8 = 2;
+const DW_LNS_ADVANCE_LINE: u8 = 3;
+const DW_LNS_SET_FILE: u8 = 4;
+const DW_LNS_NEGATE_STMT: u8 = 6;
+const DW_LNS_CONST_ADD_PC: u8 = 8;
+const DW_LNS_FIXED_ADVANCE_PC: u8 = 9;
+
+// Extended opcodes
+const DW_LNE_END_SEQUENCE: u8 = 1;
+const DW_LNE_SET_ADDRESS: u8 = 2;
+const DW_LNE_DEFINE_FILE: u8 = 3;
+
+// Line number header entry content (DWARF 5)
+const DW_LNCT_PATH: u64 = 1;
+const DW_LNCT_DIRECTORY_INDEX: u64 = 2;
+
+///
+/// The sections needed to parse line programs
+///
+#[derive(Clone, Copy)]
+pub struct LineSections<'a> {
+    pub line: &'a [u8],
+    pub strings: Strings<'a>,
+    pub big_endian: bool,
+}
+
+///
+/// Address where the code for a line starts. Line 0 is used both for code without a line and
+/// for the end of a sequence.
+///
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct LineRow {
+    pub address: u64,
+    pub file: u32,
+    pub line: u32,
+}
+
+pub struct UnitLines {
+    /// Indexed by the file numbers used in the line program
+    pub files: Vec<String>,
+    pub rows: Vec<LineRow>,
+}
+
+///
+/// Ranges of all units in .debug_line. Stops at the first broken unit.
+///
+pub fn split_units(data: &[u8], big_endian: bool) -> Vec<Range<usize>> {
+    let mut units = Vec::new();
+    let mut reader = Reader::new(data, big_endian);
+
+    while !reader.is_empty() {
+        let start = reader.pos();
+
+        let len = match reader.u32() {
+            Ok(0xffff_ffff) => reader.u64(),
+            Ok(len) => Ok(len as u64),
+            Err(e) => Err(e),
+        };
+
+        let end = match len {
+            Ok(len) if len <= (data.len() - reader.pos()) as u64 => reader.pos() + len as usize,
+            _ => break,
+        };
+
+        units.push(start..end);
+        reader.set_pos(end);
+    }
+
+    units
+}
+
+///
+/// DWARF 5 directory and file tables: a list of (content type, form) followed by the entries.
+/// Returns (path, directory index) for each entry.
+///
+fn read_entry_table<'a>(reader: &mut Reader<'a>,
+                        sections: &LineSections<'a>,
+                        encoding: Encoding)
+                        -> Result<Vec<(&'a str, u64)>> {
+    let format_count = try!(reader.u8());
+    let mut format = Vec::with_capacity(format_count as usize);
+
+    for _ in 0..format_count {
+        format.push((try!(reader.uleb128()), try!(reader.uleb128())));
+    }
+
+    let count = try!(reader.uleb128());
+    let mut entries = Vec::new();
+
+    for _ in 0..count {
+        let mut path = "";
+        let mut dir = 0;
+
+        for &(content, form) in &format {
+            match (content, try!(read_form(reader, &sections.strings, form, encoding))) {
+                (DW_LNCT_PATH, Value::Str(s)) => path = s,
+                (DW_LNCT_DIRECTORY_INDEX, Value::Num(n)) => dir = n,
+                _ => (),
+            }
+        }
+
+        entries.push((path, dir));
+    }
+
+    Ok(entries)
+}
+
+fn join_path(dir: Option<&str>, name: &str) -> String {
+    match dir {
+        Some(dir) if !dir.is_empty() && !name.starts_with('/') && !name.is_empty() => {
+            if dir.ends_with('/') {
+                format!("{}{}", dir, name)
+            } else {
+                format!("{}/{}", dir, name)
+            }
+        }
+        _ => name.to_owned(),
+    }
+}
+
+struct Header {
+    version: u16,
+    address_size: usize,
+    min_inst_length: u64,
+    default_is_stmt: bool,
+    line_base: i8,
+    line_range: u8,
+    opcode_base: u8,
+    standard_opcode_lengths: Vec<u8>,
+}
+
+///
+/// Parses the unit at range in .debug_line. comp_dir is the directory the unit was compiled in
+/// (from .debug_info) which relative paths are relative to before DWARF 5.
+///
+pub fn parse_unit(sections: &LineSections, range: Range<usize>, comp_dir: Option<&str>) -> Result<UnitLines> {
+    let mut reader = Reader::new(&sections.line[..range.end], sections.big_endian);
+    reader.set_pos(range.start);
+
+    let mut is_64 = false;
+
+    if try!(reader.u32()) == 0xffff_ffff {
+        try!(reader.u64());
+        is_64 = true;
+    }
+
+    let version = try!(reader.u16());
+
+    if version < 2 || version > 5 {
+        return Err(invalid_data("Unsupported line table version"));
+    }
+
+    let mut address_size = 0;
+
+    if version >= 5 {
+        address_size = try!(reader.u8()) as usize;
+        let _segment_selector_size = try!(reader.u8());
+    }
+
+    let header_length = try!(reader.word(is_64)) as usize;
+    let program_start = reader.pos() + header_length;
+
+    let min_inst_length = try!(reader.u8()) as u64;
+
+    if version >= 4 {
+        let _max_ops_per_inst = try!(reader.u8());
+    }
+
+    let mut header = Header {
+        version: version,
+        address_size: address_size,
+        min_inst_length: min_inst_length,
+        default_is_stmt: try!(reader.u8()) != 0,
+        line_base: try!(reader.u8()) as i8,
+        line_range: try!(reader.u8()),
+        opcode_base: try!(reader.u8()),
+        standard_opcode_lengths: Vec::new(),
+    };
+
+    if header.line_range == 0 {
+        return Err(invalid_data("Invalid line range"));
+    }
+
+    for _ in 1..header.opcode_base {
+        header.standard_opcode_lengths.push(try!(reader.u8()));
+    }
+
+    let mut files = Vec::new();
+
+    let encoding = Encoding {
+        version: version,
+        is_64: is_64,
+        address_size: address_size,
+    };
+
+    if version >= 5 {
+        let dir_entries = try!(read_entry_table(&mut reader, sections, encoding));
+        let file_entries = try!(read_entry_table(&mut reader, sections, encoding));
+
+        // Directory 0 is the compile dir and the others can be relative to it
+        let comp_dir = dir_entries.first().map(|d| d.0);
+        let dirs = dir_entries.iter().map(|d| join_path(comp_dir, d.0)).collect::<Vec<_>>();
+
+        for (name, dir) in file_entries {
+            files.push(join_path(dirs.get(dir as usize).map(|d| d.as_str()), name));
+        }
+    } else {
+        // Directory 0 is the compile dir which is only in .debug_info
+        let mut dirs = vec![comp_dir.unwrap_or("").to_owned()];
+
+        loop {
+            let dir = try!(reader.cstr());
+            if dir.is_empty() {
+                break;
+            }
+            dirs.push(join_path(comp_dir, dir));
+        }
+
+        // File numbers start at 1
+        files.push(String::new());
+
+        loop {
+            let name = try!(reader.cstr());
+            if name.is_empty() {
+                break;
+            }
+
+            let dir = try!(reader.uleb128());
+            let _time = try!(reader.uleb128());
+            let _size = try!(reader.uleb128());
+
+            files.push(join_path(dirs.get(dir as usize).map(|d| d.as_str()), name));
+        }
+    }
+
+    reader.set_pos(program_start);
+
+    let rows = try!(run_program(&mut reader, &header, &mut files));
+
+    Ok(UnitLines {
+        files: files,
+        rows: rows,
+    })
+}
+
+///
+/// Address gc:ed functions get in linked files
+///
+fn is_tombstone(address: u64, address_size: usize) -> bool {
+    let max = if address_size == 4 { 0xffff_ffff } else { u64::max_value() };
+    address == 0 || address >= max - 1
+}
+
+///
+/// Runs the line number program and returns the rows where a statement starts
+///
+fn run_program(reader: &mut Reader, header: &Header, files: &mut Vec<String>) -> Result<Vec<LineRow>> {
+    let mut rows = Vec::new();
+
+    let mut address = 0u64;
+    let mut file = 1u64;
+    let mut line = 1i64;
+    let mut is_stmt = header.default_is_stmt;
+    let mut address_size = header.address_size;
+
+    // Start of the rows of the current sequence
+    let mut sequence_start = 0;
+
+    if header.version >= 5 {
+        file = 0;
+    }
+
+    macro_rules! emit {
+        () => {
+            if is_stmt {
+                rows.push(LineRow {
+                    address: address,
+                    file: file as u32,
+                    line: if line > 0 && line <= u32::max_value() as i64 { line as u32 } else { 0 },
+                });
+            }
+        }
+    }
+
+    let const_add_pc = ((255 - header.opcode_base) / header.line_range) as u64 * header.min_inst_length;
+
+    while !reader.is_empty() {
+        let opcode = try!(reader.u8());
+
+        if opcode >= header.opcode_base {
+            let adjusted = opcode - header.opcode_base;
+            address = address.wrapping_add((adjusted / header.line_range) as u64 * header.min_inst_length);
+            line += header.line_base as i64 + (adjusted % header.line_range) as i64;
+            emit!();
+            continue;
+        }
+
+        match opcode {
+            0 => {
+                let len = try!(reader.uleb128()) as usize;
+
+                if len == 0 {
+                    continue;
+                }
+
+                let end = reader.pos() + len;
+                let sub_opcode = try!(reader.u8());
+
+                match sub_opcode {
+                    DW_LNE_END_SEQUENCE => {
+                        let start_address = rows.get(sequence_start).map(|r: &LineRow| r.address);
+
+                        if start_address.map(|a| is_tombstone(a, address_size)).unwrap_or(false) {
+                            rows.truncate(sequence_start);
+                        } else {
+                            rows.push(LineRow {
+                                address: address,
+                                file: file as u32,
+                                line: 0,
+                            });
+                        }
+
+                        sequence_start = rows.len();
+                        address = 0;
+                        file = if header.version >= 5 { 0 } else { 1 };
+                        line = 1;
+                        is_stmt = header.default_is_stmt;
+                    }
+                    DW_LNE_SET_ADDRESS => {
+                        address_size = len - 1;
+                        address = try!(reader.sized(address_size));
+                    }
+                    DW_LNE_DEFINE_FILE => {
+                        let name = try!(reader.cstr());
+                        files.push(name.to_owned());
+                    }
+                    _ => (),
+                }
+
+                reader.set_pos(end);
+            }
+            DW_LNS_COPY => emit!(),
+            DW_LNS_ADVANCE_PC => {
+                address = address.wrapping_add(try!(reader.uleb128()).wrapping_mul(header.min_inst_length))
+            }
+            DW_LNS_ADVANCE_LINE => line += try!(reader.sleb128()),
+            DW_LNS_SET_FILE => file = try!(reader.uleb128()),
+            DW_LNS_NEGATE_STMT => is_stmt = !is_stmt,
+            DW_LNS_CONST_ADD_PC => address = address.wrapping_add(const_add_pc),
+            DW_LNS_FIXED_ADVANCE_PC => address = address.wrapping_add(try!(reader.u16()) as u64),
+            _ => {
+                // Set column, basic block, prologue end, etc. Skip the arguments.
+                for _ in 0..header.standard_opcode_lengths[opcode as usize - 1] {
+                    try!(reader.uleb128());
+                }
+            }
+        }
+    }
+
+    // Rows without an end of sequence aren't valid
+    rows.truncate(sequence_start);
+
+    Ok(rows)
+}
+
+#[cfg(test)]
+pub mod tests {
+    use super::*;
+    use form::{self, Strings};
+
+    ///
+    /// Builds a .debug_line unit with the given header fields after the header length
+    ///
+    pub fn unit(version: u16, before_header: &[u8], header: &[u8], program: &[u8]) -> Vec<u8> {
+        let mut body = Vec::new();
+        body.extend_from_slice(&[version as u8, (version >> 8) as u8]);
+        body.extend_from_slice(before_header);
+        let len = header.len() as u32;
+        body.extend_from_slice(&[len as u8, (len >> 8) as u8, 0, 0]);
+        body.extend_from_slice(header);
+        body.extend_from_slice(program);
+
+        let len = body.len() as u32;
+        let mut data = vec![len as u8, (len >> 8) as u8, 0, 0];
+        data.extend_from_slice(&body);
+        data
+    }
+
+    ///
+    /// Program for main.c: line 3 at 0x1000, line 4 at 0x1004, line 6 at 0x1010 and the end
+    /// at 0x1020
+    ///
+    pub fn program() -> Vec<u8> {
+        vec![// set address 0x1000
+             0, 9, DW_LNE_SET_ADDRESS, 0x00, 0x10, 0, 0, 0, 0, 0, 0,
+             // advance line by 2, copy
+             DW_LNS_ADVANCE_LINE, 2, DW_LNS_COPY,
+             // special opcode: address += 4, line += 1 (opcode_base + (1 - line_base) + 4 * line_range)
+             75,
+             // not a statement
+             DW_LNS_NEGATE_STMT, DW_LNS_ADVANCE_PC, 4, DW_LNS_COPY, DW_LNS_NEGATE_STMT,
+             // address += 8 and line += 2
+             DW_LNS_ADVANCE_PC, 8, DW_LNS_ADVANCE_LINE, 2, DW_LNS_COPY,
+             DW_LNS_ADVANCE_PC, 0x10,
+             0, 1, DW_LNE_END_SEQUENCE]
+    }
+
+    /// min_inst_length, (max ops), default_is_stmt, line_base, line_range, opcode_base and the
+    /// standard opcode lengths
+    pub const LINE_PARAMS: [u8; 18] = [1, 1, 1, 0xfb, 14, 13, 0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1];
+
+    pub fn v4_unit() -> Vec<u8> {
+        let mut header = LINE_PARAMS[..].to_vec();
+        header.extend_from_slice(b"/src\0\0main.c\0\x01\0\0util.h\0\0\0\0\0");
+        unit(4, &[], &header, &program())
+    }
+
+    fn check_rows(lines: &UnitLines, file: u32) {
+        assert_eq!(lines.rows,
+                   vec![LineRow { address: 0x1000, file: file, line: 3 },
+                        LineRow { address: 0x1004, file: file, line: 4 },
+                        LineRow { address: 0x1010, file: file, line: 6 },
+                        LineRow { address: 0x1020, file: file, line: 0 }]);
+    }
+
+    #[test]
+    fn test_v4_unit() {
+        let mut data = v4_unit();
+        data.extend_from_slice(&v4_unit());
+
+        let units = split_units(&data, false);
+        assert_eq!(units.len(), 2);
+
+        let sections = LineSections {
+            line: &data,
+            strings: Strings {
+                str: &[],
+                line_str: &[],
+            },
+            big_endian: false,
+        };
+
+        let lines = parse_unit(&sections, units[1].clone(), None).unwrap();
+        assert_eq!(lines.files, vec!["".to_owned(), "/src/main.c".to_owned(), "util.h".to_owned()]);
+        check_rows(&lines, 1);
+
+        let lines = parse_unit(&sections, units[0].clone(), Some("/build")).unwrap();
+        assert_eq!(lines.files[2], "/build/util.h");
+    }
+
+    #[test]
+    fn test_v5_unit() {
+        let line_str = b"/work\0main.c\0";
+
+        let mut header = LINE_PARAMS[..].to_vec();
+        // directories: path as line_strp, one entry
+        header.extend_from_slice(&[1, DW_LNCT_PATH as u8, form::DW_FORM_LINE_STRP as u8, 1, 0, 0, 0, 0]);
+        // files: path as line_strp, directory as udata and an MD5
+        header.extend_from_slice(&[3,
+                                   DW_LNCT_PATH as u8, form::DW_FORM_LINE_STRP as u8,
+                                   DW_LNCT_DIRECTORY_INDEX as u8, form::DW_FORM_UDATA as u8,
+                                   5, form::DW_FORM_DATA16 as u8,
+                                   1, 6, 0, 0, 0, 0]);
+        header.extend_from_slice(&[0xaa; 16]);
+
+        let mut program = program();
+        // File 0 is the main file in DWARF 5
+        program.insert(0, 0);
+        program.insert(0, DW_LNS_SET_FILE);
+
+        let data = unit(5, &[8, 0], &header, &program);
+
+        let sections = LineSections {
+            line: &data,
+            strings: Strings {
+                str: &[],
+                line_str: line_str,
+            },
+            big_endian: false,
+        };
+
+        let lines = parse_unit(&sections, 0..data.len(), None).unwrap();
+        assert_eq!(lines.files, vec!["/work/main.c".to_owned()]);
+        check_rows(&lines, 0);
+    }
+
+    #[test]
+    fn test_gc_sequence_dropped() {
+        let mut program = program();
+        // set address 0
+        program[3] = 0;
+        program[4] = 0;
+
+        let mut header = LINE_PARAMS[..].to_vec();
+        header.extend_from_slice(b"\0main.c\0\0\0\0\0");
+        let data = unit(4, &[], &header, &program);
+
+        let sections = LineSections {
+            line: &data,
+            strings: Strings {
+                str: &[],
+                line_str: &[],
+            },
+            big_endian: false,
+        };
+
+        assert!(parse_unit(&sections, 0..data.len(), None).unwrap().rows.is_empty());
+    }
+}
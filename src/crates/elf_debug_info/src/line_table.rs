@@ -0,0 +1,202 @@
+use std::collections::HashMap;
+use line_program::{LineRow, UnitLines};
+
+///
+/// Line info of all units merged into one table. Addresses are resolved with a binary search
+/// over the rows and file:line with a binary search over the (file, line) sorted copy.
+///
+pub struct LineTable {
+    files: Vec<String>,
+    /// Sorted on address. A row is valid until the next one, rows with line 0 have no line.
+    rows: Vec<LineRow>,
+    /// (file, line, address) of the first address of each line
+    by_line: Vec<(u32, u32, u64)>,
+}
+
+impl LineTable {
+    pub fn new() -> LineTable {
+        LineTable {
+            files: Vec::new(),
+            rows: Vec::new(),
+            by_line: Vec::new(),
+        }
+    }
+
+    ///
+    /// Merges the units. Files with the same name in different units get the same id.
+    ///
+    pub fn from_units(units: Vec<UnitLines>) -> LineTable {
+        let mut files = Vec::new();
+        let mut file_ids = HashMap::new();
+        let mut rows = Vec::with_capacity(units.iter().map(|u| u.rows.len()).sum());
+
+        for unit in units {
+            let ids = unit.files
+                .into_iter()
+                .map(|name| {
+                    let next_id = files.len() as u32;
+                    *file_ids.entry(name.clone()).or_insert_with(|| {
+                        files.push(name);
+                        next_id
+                    })
+                })
+                .collect::<Vec<u32>>();
+
+            for row in unit.rows {
+                match ids.get(row.file as usize) {
+                    Some(&file) => {
+                        rows.push(LineRow {
+                            address: row.address,
+                            file: file,
+                            line: row.line,
+                        })
+                    }
+                    // Broken file index, keep the row so the previous line ends here
+                    None => rows.push(LineRow { line: 0, ..row }),
+                }
+            }
+        }
+
+        LineTable::from_parts(files, rows)
+    }
+
+    pub fn from_parts(files: Vec<String>, mut rows: Vec<LineRow>) -> LineTable {
+        // Sequences ending where the next one starts give two rows at the same address, the
+        // end has to come first
+        rows.sort_by(|a, b| a.address.cmp(&b.address).then((a.line != 0).cmp(&(b.line != 0))));
+
+        let mut by_line = rows.iter()
+            .filter(|r| r.line != 0)
+            .map(|r| (r.file, r.line, r.address))
+            .collect::<Vec<_>>();
+
+        by_line.sort();
+        by_line.dedup_by_key(|e| (e.0, e.1));
+
+        LineTable {
+            files: files,
+            rows: rows,
+            by_line: by_line,
+        }
+    }
+
+    pub fn files(&self) -> &[String] {
+        &self.files
+    }
+
+    pub fn rows(&self) -> &[LineRow] {
+        &self.rows
+    }
+
+    ///
+    /// File and line of the code at address
+    ///
+    pub fn resolve_address(&self, address: u64) -> Option<(&str, u32)> {
+        let index = match self.rows.binary_search_by(|r| r.address.cmp(&address)) {
+            // Several rows can have the same address, the last one is used
+            Ok(index) => {
+                let mut index = index;
+                while index + 1 < self.rows.len() && self.rows[index + 1].address == address {
+                    index += 1;
+                }
+                index
+            }
+            Err(0) => return None,
+            Err(index) => index - 1,
+        };
+
+        let row = self.rows[index];
+
+        if row.line == 0 {
+            None
+        } else {
+            Some((&self.files[row.file as usize], row.line))
+        }
+    }
+
+    ///
+    /// Address of the first code of a line. If the line has no code the next line in the file
+    /// that has is used (like when setting a breakpoint on a comment). The filename can be the
+    /// full path or the end of it ("main.c" or "src/main.c")
+    ///
+    pub fn find_address(&self, filename: &str, line: u32) -> Option<u64> {
+        let mut best: Option<(u32, u64)> = None;
+
+        for (id, name) in self.files.iter().enumerate() {
+            if !path_matches(name, filename) {
+                continue;
+            }
+
+            let id = id as u32;
+            let start = match self.by_line.binary_search(&(id, line, 0)) {
+                Ok(index) | Err(index) => index,
+            };
+
+            if let Some(&(file, found_line, address)) = self.by_line.get(start) {
+                if file == id && best.map(|b| (found_line, address) < b).unwrap_or(true) {
+                    best = Some((found_line, address));
+                }
+            }
+        }
+
+        best.map(|b| b.1)
+    }
+}
+
+///
+/// Full paths have to be the same, otherwise one has to be the end of the other
+///
+fn path_matches(path: &str, filename: &str) -> bool {
+    if path.len() == filename.len() || (path.starts_with('/') && filename.starts_with('/')) {
+        return path == filename;
+    }
+
+    let (long, short) = if path.len() > filename.len() { (path, filename) } else { (filename, path) };
+
+    !short.is_empty() && long.ends_with(short) &&
+    (short.starts_with('/') || long.as_bytes()[long.len() - short.len() - 1] == b'/')
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use line_program::{LineRow, UnitLines};
+
+    fn row(address: u64, file: u32, line: u32) -> LineRow {
+        LineRow {
+            address: address,
+            file: file,
+            line: line,
+        }
+    }
+
+    #[test]
+    fn test_lookups() {
+        let units = vec![UnitLines {
+                             files: vec!["".to_owned(), "/src/main.c".to_owned(), "/inc/util.h".to_owned()],
+                             rows: vec![row(0x1000, 1, 3), row(0x1004, 2, 10), row(0x1008, 1, 5), row(0x1010, 1, 0)],
+                         },
+                         UnitLines {
+                             files: vec!["".to_owned(), "/inc/util.h".to_owned()],
+                             rows: vec![row(0x1010, 1, 12), row(0x1014, 1, 10), row(0x1020, 1, 0)],
+                         }];
+
+        let table = LineTable::from_units(units);
+        assert_eq!(table.files().len(), 3);
+
+        assert_eq!(table.resolve_address(0xfff), None);
+        assert_eq!(table.resolve_address(0x1002), Some(("/src/main.c", 3)));
+        assert_eq!(table.resolve_address(0x1004), Some(("/inc/util.h", 10)));
+        // The second sequence starts where the first ends
+        assert_eq!(table.resolve_address(0x1010), Some(("/inc/util.h", 12)));
+        assert_eq!(table.resolve_address(0x1020), None);
+
+        assert_eq!(table.find_address("main.c", 3), Some(0x1000));
+        assert_eq!(table.find_address("src/main.c", 4), Some(0x1008));
+        assert_eq!(table.find_address("/home/src/main.c", 5), None);
+        assert_eq!(table.find_address("ain.c", 3), None);
+        assert_eq!(table.find_address("main.c", 6), None);
+        // Lowest address of the line from both units
+        assert_eq!(table.find_address("util.h", 10), Some(0x1004));
+    }
+}
@@ -0,0 +1,198 @@
+use std::io::{Error, ErrorKind, Result};
+use std::str;
+
+pub fn invalid_data(text: &str) -> Error {
+    Error::new(ErrorKind::InvalidData, text)
+}
+
+///
+/// Reads values of the file's endianness from a byte slice. Reading past the end is an error.
+///
+#[derive(Clone)]
+pub struct Reader<'a> {
+    data: &'a [u8],
+    pos: usize,
+    big_endian: bool,
+}
+
+impl<'a> Reader<'a> {
+    pub fn new(data: &'a [u8], big_endian: bool) -> Reader<'a> {
+        Reader {
+            data: data,
+            pos: 0,
+            big_endian: big_endian,
+        }
+    }
+
+    pub fn pos(&self) -> usize {
+        self.pos
+    }
+
+    pub fn set_pos(&mut self, pos: usize) {
+        self.pos = pos;
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.pos >= self.data.len()
+    }
+
+    pub fn bytes(&mut self, len: usize) -> Result<&'a [u8]> {
+        if len > self.data.len() - self.pos.min(self.data.len()) {
+            return Err(invalid_data("Unexpected end of data"));
+        }
+
+        let bytes = &self.data[self.pos..self.pos + len];
+        self.pos += len;
+        Ok(bytes)
+    }
+
+    pub fn skip(&mut self, len: usize) -> Result<()> {
+        self.bytes(len).map(|_| ())
+    }
+
+    fn uint(&mut self, len: usize) -> Result<u64> {
+        let bytes = try!(self.bytes(len));
+        let mut value = 0u64;
+
+        if self.big_endian {
+            for &b in bytes {
+                value = (value << 8) | b as u64;
+            }
+        } else {
+            for &b in bytes.iter().rev() {
+                value = (value << 8) | b as u64;
+            }
+        }
+
+        Ok(value)
+    }
+
+    pub fn u8(&mut self) -> Result<u8> {
+        self.uint(1).map(|v| v as u8)
+    }
+
+    pub fn u16(&mut self) -> Result<u16> {
+        self.uint(2).map(|v| v as u16)
+    }
+
+    pub fn u32(&mut self) -> Result<u32> {
+        self.uint(4).map(|v| v as u32)
+    }
+
+    pub fn u64(&mut self) -> Result<u64> {
+        self.uint(8)
+    }
+
+    ///
+    /// 4 or 8 byte value depending on if the data is 64-bit or not
+    ///
+    pub fn word(&mut self, is_64: bool) -> Result<u64> {
+        self.uint(if is_64 { 8 } else { 4 })
+    }
+
+    ///
+    /// Unsigned value of any size up to 8 bytes (such as target addresses)
+    ///
+    pub fn sized(&mut self, size: usize) -> Result<u64> {
+        match size {
+            1 | 2 | 4 | 8 => self.uint(size),
+            _ => Err(invalid_data("Unsupported value size")),
+        }
+    }
+
+    pub fn uleb128(&mut self) -> Result<u64> {
+        let mut value = 0u64;
+        let mut shift = 0;
+
+        loop {
+            let b = try!(self.u8());
+
+            if shift < 64 {
+                value |= ((b & 0x7f) as u64) << shift;
+            }
+
+            shift += 7;
+
+            if (b & 0x80) == 0 {
+                return Ok(value);
+            }
+        }
+    }
+
+    pub fn sleb128(&mut self) -> Result<i64> {
+        let mut value = 0i64;
+        let mut shift = 0;
+
+        loop {
+            let b = try!(self.u8());
+
+            if shift < 64 {
+                value |= ((b & 0x7f) as i64) << shift;
+            }
+
+            shift += 7;
+
+            if (b & 0x80) == 0 {
+                if shift < 64 && (b & 0x40) != 0 {
+                    value |= -1i64 << shift;
+                }
+
+                return Ok(value);
+            }
+        }
+    }
+
+    ///
+    /// Zero terminated string. Invalid UTF-8 gives an empty string.
+    ///
+    pub fn cstr(&mut self) -> Result<&'a str> {
+        let rest = &self.data[self.pos.min(self.data.len())..];
+
+        match rest.iter().position(|&c| c == 0) {
+            Some(len) => {
+                self.pos += len + 1;
+                Ok(str::from_utf8(&rest[..len]).unwrap_or(""))
+            }
+            None => Err(invalid_data("Unterminated string")),
+        }
+    }
+}
+
+///
+/// Zero terminated string at offset in a string table
+///
+pub fn str_at(table: &[u8], offset: u64) -> &str {
+    if offset as usize >= table.len() {
+        return "";
+    }
+
+    let mut reader = Reader::new(table, false);
+    reader.set_pos(offset as usize);
+    reader.cstr().unwrap_or("")
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_leb128() {
+        let data = [0xe5, 0x8e, 0x26, 0x7f, 0x80, 0x7f, 0x02];
+        let mut reader = Reader::new(&data, false);
+
+        assert_eq!(reader.uleb128().unwrap(), 624485);
+        assert_eq!(reader.sleb128().unwrap(), -1);
+        assert_eq!(reader.sleb128().unwrap(), -128);
+        assert_eq!(reader.sleb128().unwrap(), 2);
+        assert!(reader.u8().is_err());
+    }
+
+    #[test]
+    fn test_endian() {
+        let data = [0x12, 0x34, 0x56, 0x78];
+
+        assert_eq!(Reader::new(&data, false).u32().unwrap(), 0x78563412);
+        assert_eq!(Reader::new(&data, true).u32().unwrap(), 0x12345678);
+        assert!(Reader::new(&data, true).u64().is_err());
+    }
+}
@@ -0,0 +1,217 @@
+//! Stand-in for the gdb remote stub in UAE.
+//!
+//! Serves memory, registers, breakpoints, vRun segment replies and synthetic QDmaFrame events
+//! so the Amiga UAE backend can be tested and benchmarked without running UAE. Latency and
+//! bandwidth can be limited to get numbers closer to a real connection.
+//!
+//! Connections are served one at a time on a background thread. The target state (memory,
+//! breakpoints and so on) is kept between connections like it is in UAE.
+
+mod session;
+pub mod target;
+
+use std::io;
+use std::mem;
+use std::net::{SocketAddr, TcpListener, TcpStream};
+use std::sync::{Arc, Mutex};
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::thread::{self, JoinHandle};
+use std::time::Duration;
+use session::Session;
+use target::{Segment, Target};
+
+/// Address UAE listens on
+pub const UAE_ADDRESS: &'static str = "127.0.0.1:6860";
+
+/// 68000 nop, used to fill memory by default
+const NOP: [u8; 2] = [0x4e, 0x71];
+
+#[derive(Debug, Clone)]
+pub struct StubConfig {
+    /// Address to listen on. Port 0 picks a free port (see StubServer::address)
+    pub address: String,
+    /// Added before each reply
+    pub latency: Option<Duration>,
+    /// Bytes per second
+    pub bandwidth: Option<u64>,
+    /// Reported in the qSupported reply
+    pub packet_size: usize,
+    /// Answer binary memory reads ('x')
+    pub binary_memory: bool,
+    /// Time between QDmaFrame events while the target is running. None to not send any.
+    pub dma_interval: Option<Duration>,
+    /// Target memory starting at address 0
+    pub memory: Vec<u8>,
+    /// Segments reported when an executable is run
+    pub segments: Vec<Segment>,
+}
+
+impl StubConfig {
+    pub fn new() -> StubConfig {
+        StubConfig {
+            address: "127.0.0.1:0".to_owned(),
+            latency: None,
+            bandwidth: None,
+            packet_size: 0x4000,
+            binary_memory: true,
+            dma_interval: None,
+            memory: NOP.iter().cloned().cycle().take(512 * 1024).collect(),
+            segments: vec![Segment {
+                               address: 0x1000,
+                               size: 0x8000,
+                           },
+                           Segment {
+                               address: 0x10000,
+                               size: 0x4000,
+                           }],
+        }
+    }
+}
+
+///
+/// Counters for what has been sent and received
+///
+#[derive(Debug, Clone, Copy, Default)]
+pub struct StubStats {
+    pub connections: u64,
+    pub packets: u64,
+    pub memory_reads: u64,
+    pub dma_frames: u64,
+    pub bytes_sent: u64,
+    pub bytes_received: u64,
+}
+
+pub struct StubServer {
+    address: SocketAddr,
+    stats: Arc<Mutex<StubStats>>,
+    shutdown: Arc<AtomicBool>,
+    thread: Option<JoinHandle<()>>,
+}
+
+impl StubServer {
+    ///
+    /// Starts listening and serving connections on a background thread
+    ///
+    pub fn start(mut config: StubConfig) -> io::Result<StubServer> {
+        let listener = try!(TcpListener::bind(config.address.as_str()));
+        let address = try!(listener.local_addr());
+        let stats = Arc::new(Mutex::new(StubStats::default()));
+        let shutdown = Arc::new(AtomicBool::new(false));
+
+        let thread_stats = stats.clone();
+        let thread_shutdown = shutdown.clone();
+
+        let thread = thread::spawn(move || {
+            let memory = mem::replace(&mut config.memory, Vec::new());
+            let mut target = Target::new(memory, config.segments.clone());
+
+            for stream in listener.incoming() {
+                if thread_shutdown.load(Ordering::Relaxed) {
+                    break;
+                }
+
+                let stream = match stream {
+                    Ok(stream) => stream,
+                    Err(_) => continue,
+                };
+
+                thread_stats.lock().unwrap().connections += 1;
+
+                let mut session = Session::new(stream, &config, &mut target, thread_stats.clone());
+
+                if let Err(err) = session.run(&thread_shutdown) {
+                    println!("uae_gdb_stub: connection closed ({})", err);
+                }
+            }
+        });
+
+        Ok(StubServer {
+            address: address,
+            stats: stats,
+            shutdown: shutdown,
+            thread: Some(thread),
+        })
+    }
+
+    pub fn address(&self) -> SocketAddr {
+        self.address
+    }
+
+    pub fn stats(&self) -> StubStats {
+        *self.stats.lock().unwrap()
+    }
+
+    ///
+    /// Blocks until the server thread exits (which only happens after shutdown)
+    ///
+    pub fn wait(mut self) {
+        if let Some(thread) = self.thread.take() {
+            let _ = thread.join();
+        }
+    }
+}
+
+impl Drop for StubServer {
+    fn drop(&mut self) {
+        if let Some(thread) = self.thread.take() {
+            self.shutdown.store(true, Ordering::Relaxed);
+            // Wake up accept
+            let _ = TcpStream::connect(self.address);
+            let _ = thread.join();
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::io::{Read, Write};
+    use std::net::TcpStream;
+
+    fn command(stream: &mut TcpStream, command: &str) -> String {
+        let sum = command.bytes().fold(0u8, |sum, c| sum.wrapping_add(c));
+        write!(stream, "${}#{:02x}", command, sum).unwrap();
+
+        let mut reply = Vec::new();
+        let mut byte = [0];
+
+        // Skip the ack and read up to and including the checksum
+        while reply.len() < 3 || reply[reply.len() - 3] != b'#' {
+            stream.read_exact(&mut byte).unwrap();
+            if reply.is_empty() && byte[0] != b'$' {
+                continue;
+            }
+            reply.push(byte[0]);
+        }
+
+        String::from_utf8_lossy(&reply[1..reply.len() - 3]).into_owned()
+    }
+
+    #[test]
+    fn test_commands() {
+        let mut config = StubConfig::new();
+        config.memory = (0..256).map(|v| v as u8).collect();
+        config.segments = vec![Segment { address: 0x40, size: 0x20 }];
+
+        let server = StubServer::start(config).unwrap();
+        let mut stream = TcpStream::connect(server.address()).unwrap();
+
+        assert_eq!(command(&mut stream, "qSupported"), "PacketSize=4000;QStartNoAckMode+");
+        assert_eq!(command(&mut stream, "QStartNoAckMode"), "OK");
+        assert_eq!(command(&mut stream, "m10,4"), "10111213");
+        assert_eq!(command(&mut stream, "x20,3"), "b !\"");
+        assert_eq!(command(&mut stream, "x0,0"), "b");
+        assert_eq!(command(&mut stream, "m100,1"), "E01");
+        assert_eq!(command(&mut stream, "M10,2:abcd"), "OK");
+        assert_eq!(command(&mut stream, "m10,2"), "abcd");
+        assert_eq!(command(&mut stream, "vRun;dh0:test;"), "AS;64;32");
+        assert_eq!(command(&mut stream, "Z0,8,0"), "OK");
+        assert_eq!(command(&mut stream, "c"), "S05");
+        assert_eq!(&command(&mut stream, "g")[17 * 8..], "00000048");
+        assert_eq!(command(&mut stream, "s"), "S05");
+        assert_eq!(&command(&mut stream, "g")[17 * 8..], "0000004a");
+        assert_eq!(command(&mut stream, "vUnknown"), "");
+
+        assert!(server.stats().memory_reads >= 5);
+    }
+}
@@ -0,0 +1,56 @@
+extern crate uae_gdb_stub;
+
+use std::env;
+use std::process;
+use std::time::Duration;
+use uae_gdb_stub::{StubConfig, StubServer, UAE_ADDRESS};
+
+fn usage() -> ! {
+    println!("Usage: uae_gdb_stub [options]");
+    println!("");
+    println!("  --address <addr>      Address to listen on (default {})", UAE_ADDRESS);
+    println!("  --latency <ms>        Delay before each reply");
+    println!("  --bandwidth <kb/s>    Limit the data sent");
+    println!("  --packet-size <n>     Max packet size reported to the client");
+    println!("  --dma <ms>            Send a QDmaFrame event every <ms> while running");
+    println!("  --hex-only            Don't support binary memory reads");
+    process::exit(1);
+}
+
+fn parse_value(value: Option<String>) -> u64 {
+    match value.and_then(|v| v.parse::<u64>().ok()) {
+        Some(v) => v,
+        None => usage(),
+    }
+}
+
+fn main() {
+    let mut config = StubConfig::new();
+    config.address = UAE_ADDRESS.to_owned();
+
+    let mut args = env::args().skip(1);
+
+    while let Some(arg) = args.next() {
+        match arg.as_str() {
+            "--address" => config.address = args.next().unwrap_or_else(|| usage()),
+            "--latency" => config.latency = Some(Duration::from_millis(parse_value(args.next()))),
+            "--bandwidth" => config.bandwidth = Some(parse_value(args.next()) * 1024),
+            "--packet-size" => config.packet_size = parse_value(args.next()) as usize,
+            "--dma" => config.dma_interval = Some(Duration::from_millis(parse_value(args.next()))),
+            "--hex-only" => config.binary_memory = false,
+            _ => usage(),
+        }
+    }
+
+    let server = match StubServer::start(config) {
+        Ok(server) => server,
+        Err(err) => {
+            println!("Unable to start stub: {}", err);
+            process::exit(1);
+        }
+    };
+
+    println!("Listening on {}", server.address());
+
+    server.wait();
+}
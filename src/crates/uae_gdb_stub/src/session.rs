@@ -0,0 +1,384 @@
+//! One gdb remote connection.
+//!
+//! Handles the packet framing, acks and the commands the UAE backend sends. Replies are held
+//! back until the latency has passed since the request arrived, so pipelined requests overlap
+//! like they would on a slow link. The bandwidth limit is applied by sleeping for the time the
+//! written bytes would take on a link of that speed.
+
+use std::io::{self, Read, Write, ErrorKind};
+use std::net::TcpStream;
+use std::str;
+use std::sync::{Arc, Mutex};
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::thread;
+use std::time::{Duration, Instant};
+use target::Target;
+use {StubConfig, StubStats};
+
+/// How often the session wakes up to check for shutdown and DMA frames
+const POLL_INTERVAL_MS: u64 = 10;
+
+const INTERRUPT: u8 = 0x03;
+
+pub struct Session<'a> {
+    stream: TcpStream,
+    config: &'a StubConfig,
+    target: &'a mut Target,
+    stats: Arc<Mutex<StubStats>>,
+    no_ack: bool,
+    input: Vec<u8>,
+    /// When the data being processed was received
+    received: Instant,
+    last_dma_frame: Instant,
+}
+
+fn checksum(data: &[u8]) -> u8 {
+    data.iter().fold(0u8, |sum, &c| sum.wrapping_add(c))
+}
+
+fn to_hex(data: &[u8]) -> String {
+    let mut text = String::with_capacity(data.len() * 2);
+
+    for b in data {
+        text.push_str(&format!("{:02x}", b));
+    }
+
+    text
+}
+
+fn from_hex(text: &str) -> Option<Vec<u8>> {
+    if text.len() % 2 != 0 {
+        return None;
+    }
+
+    let mut data = Vec::with_capacity(text.len() / 2);
+
+    for i in 0..text.len() / 2 {
+        match u8::from_str_radix(&text[i * 2..i * 2 + 2], 16) {
+            Ok(v) => data.push(v),
+            Err(_) => return None,
+        }
+    }
+
+    Some(data)
+}
+
+///
+/// Splits "addr,len" (hex) into its values
+///
+fn parse_address_size(args: &str) -> Option<(u64, u64)> {
+    let mut parts = args.splitn(2, ',');
+    let address = parts.next().and_then(|v| u64::from_str_radix(v, 16).ok());
+    let size = parts.next().and_then(|v| u64::from_str_radix(v, 16).ok());
+
+    match (address, size) {
+        (Some(address), Some(size)) => Some((address, size)),
+        _ => None,
+    }
+}
+
+///
+/// Escapes the bytes that can't be sent as is in binary packets
+///
+fn escape_binary(dest: &mut Vec<u8>, data: &[u8]) {
+    for &c in data {
+        match c {
+            b'#' | b'$' | b'}' | b'*' => {
+                dest.push(b'}');
+                dest.push(c ^ 0x20);
+            }
+            _ => dest.push(c),
+        }
+    }
+}
+
+impl<'a> Session<'a> {
+    pub fn new(stream: TcpStream,
+               config: &'a StubConfig,
+               target: &'a mut Target,
+               stats: Arc<Mutex<StubStats>>)
+               -> Session<'a> {
+        Session {
+            stream: stream,
+            config: config,
+            target: target,
+            stats: stats,
+            no_ack: false,
+            input: Vec::new(),
+            received: Instant::now(),
+            last_dma_frame: Instant::now(),
+        }
+    }
+
+    ///
+    /// Serves the connection until the client disconnects or shutdown is set
+    ///
+    pub fn run(&mut self, shutdown: &AtomicBool) -> io::Result<()> {
+        try!(self.stream.set_read_timeout(Some(Duration::from_millis(POLL_INTERVAL_MS))));
+        try!(self.stream.set_nodelay(true));
+
+        let mut buffer = [0; 64 * 1024];
+
+        while !shutdown.load(Ordering::Relaxed) {
+            match self.stream.read(&mut buffer) {
+                Ok(0) => return Ok(()),
+                Ok(len) => {
+                    self.stats.lock().unwrap().bytes_received += len as u64;
+                    self.input.extend_from_slice(&buffer[..len]);
+                    self.received = Instant::now();
+                    if !try!(self.process_input()) {
+                        return Ok(());
+                    }
+                }
+                Err(ref e) if e.kind() == ErrorKind::WouldBlock || e.kind() == ErrorKind::TimedOut => (),
+                Err(e) => return Err(e),
+            }
+
+            try!(self.send_dma_frame_if_due());
+        }
+
+        Ok(())
+    }
+
+    fn send_dma_frame_if_due(&mut self) -> io::Result<()> {
+        let interval = match self.config.dma_interval {
+            Some(interval) if self.target.running => interval,
+            _ => return Ok(()),
+        };
+
+        if self.last_dma_frame.elapsed() < interval {
+            return Ok(());
+        }
+
+        self.last_dma_frame = Instant::now();
+
+        let frame = self.target.next_dma_frame();
+        let packet = format!("QDmaFrame:{}", to_hex(&frame));
+        try!(self.write_packet(packet.as_bytes()));
+
+        self.stats.lock().unwrap().dma_frames += 1;
+        Ok(())
+    }
+
+    ///
+    /// Handles all complete packets in the input. Returns false when the session should end.
+    ///
+    fn process_input(&mut self) -> io::Result<bool> {
+        loop {
+            let start = match self.input.iter().position(|&c| c == b'$' || c == INTERRUPT) {
+                Some(start) => start,
+                None => {
+                    // Only acks ('+' / '-') left
+                    self.input.clear();
+                    return Ok(true);
+                }
+            };
+
+            if self.input[start] == INTERRUPT {
+                self.input.drain(..start + 1);
+
+                if self.target.running {
+                    self.target.running = false;
+                    try!(self.reply(b"S02"));
+                }
+
+                continue;
+            }
+
+            let end = match self.input[start..].iter().position(|&c| c == b'#') {
+                Some(end) if start + end + 3 <= self.input.len() => start + end,
+                _ => {
+                    self.input.drain(..start);
+                    return Ok(true);
+                }
+            };
+
+            let packet = self.input[start + 1..end].to_vec();
+            self.input.drain(..end + 3);
+
+            if !self.no_ack {
+                try!(self.write_raw(b"+"));
+            }
+
+            self.stats.lock().unwrap().packets += 1;
+
+            if !try!(self.handle_packet(&packet)) {
+                return Ok(false);
+            }
+        }
+    }
+
+    fn handle_packet(&mut self, packet: &[u8]) -> io::Result<bool> {
+        let command = String::from_utf8_lossy(packet).into_owned();
+
+        if command.starts_with("qSupported") {
+            let features = format!("PacketSize={:x};QStartNoAckMode+", self.config.packet_size);
+            try!(self.reply(features.as_bytes()));
+        } else if command == "QStartNoAckMode" {
+            try!(self.reply(b"OK"));
+            self.no_ack = true;
+        } else if command == "?" {
+            try!(self.reply(b"S05"));
+        } else if command == "g" {
+            let data = to_hex(&self.target.register_data());
+            try!(self.reply(data.as_bytes()));
+        } else if command.starts_with('G') {
+            match from_hex(&command[1..]) {
+                Some(data) => {
+                    self.target.set_register_data(&data);
+                    try!(self.reply(b"OK"));
+                }
+                None => try!(self.reply(b"E01")),
+            }
+        } else if command.starts_with('m') {
+            try!(self.read_memory(&command[1..], false));
+        } else if command.starts_with('x') && self.config.binary_memory {
+            try!(self.read_memory(&command[1..], true));
+        } else if command.starts_with('M') {
+            try!(self.write_memory(&command[1..]));
+        } else if command.starts_with('Z') || command.starts_with('z') {
+            try!(self.breakpoint(&command));
+        } else if command.starts_with("vRun;") {
+            try!(self.run_executable());
+        } else if command == "s" || command == "n" {
+            self.target.step();
+            try!(self.reply(b"S05"));
+        } else if command == "c" {
+            if self.target.continue_to_breakpoint() {
+                try!(self.reply(b"S05"));
+            }
+        } else if command == "k" {
+            // No reply for kill
+            self.target.running = false;
+        } else if command == "D" {
+            try!(self.reply(b"OK"));
+            return Ok(false);
+        } else {
+            // Empty reply means unsupported
+            try!(self.reply(b""));
+        }
+
+        Ok(true)
+    }
+
+    fn read_memory(&mut self, args: &str, binary: bool) -> io::Result<()> {
+        let reply = match parse_address_size(args).and_then(|(a, s)| self.target.read_memory(a, s)) {
+            Some(data) if binary => {
+                let mut reply = Vec::with_capacity(data.len() + 1);
+                reply.push(b'b');
+                escape_binary(&mut reply, data);
+                reply
+            }
+            Some(data) => to_hex(data).into_bytes(),
+            None => b"E01".to_vec(),
+        };
+
+        self.stats.lock().unwrap().memory_reads += 1;
+        self.reply(&reply)
+    }
+
+    fn write_memory(&mut self, args: &str) -> io::Result<()> {
+        let mut parts = args.splitn(2, ':');
+        let range = parts.next().and_then(parse_address_size);
+        let data = parts.next().and_then(from_hex);
+
+        let ok = match (range, data) {
+            (Some((address, size)), Some(data)) => {
+                data.len() as u64 == size && self.target.write_memory(address, &data)
+            }
+            _ => false,
+        };
+
+        self.reply(if ok { b"OK" } else { b"E01" })
+    }
+
+    ///
+    /// "Z0,addr" or "Z0,offset,segment" (and 'z' to remove)
+    ///
+    fn breakpoint(&mut self, command: &str) -> io::Result<()> {
+        let add = command.starts_with('Z');
+        let args = command[1..].split(',').collect::<Vec<&str>>();
+
+        let address = args.get(1).and_then(|v| u32::from_str_radix(v, 16).ok());
+        let segment = args.get(2).and_then(|v| v.parse::<usize>().ok());
+
+        match address.and_then(|address| self.target.breakpoint_address(address, segment)) {
+            Some(address) => {
+                if add {
+                    self.target.breakpoints.insert(address);
+                } else {
+                    self.target.breakpoints.remove(&address);
+                }
+
+                self.reply(b"OK")
+            }
+            None => self.reply(b"E01"),
+        }
+    }
+
+    ///
+    /// Replies with the segments of the "loaded" executable like UAE does
+    ///
+    fn run_executable(&mut self) -> io::Result<()> {
+        self.target.start();
+
+        let mut reply = "AS".to_owned();
+
+        for seg in &self.target.segments {
+            reply.push_str(&format!(";{};{}", seg.address, seg.size));
+        }
+
+        self.reply(reply.as_bytes())
+    }
+
+    fn reply(&mut self, data: &[u8]) -> io::Result<()> {
+        if let Some(latency) = self.config.latency {
+            let elapsed = self.received.elapsed();
+
+            if elapsed < latency {
+                thread::sleep(latency - elapsed);
+            }
+        }
+
+        self.write_packet(data)
+    }
+
+    fn write_packet(&mut self, data: &[u8]) -> io::Result<()> {
+        let mut packet = Vec::with_capacity(data.len() + 4);
+        packet.push(b'$');
+        packet.extend_from_slice(data);
+        packet.extend_from_slice(format!("#{:02x}", checksum(data)).as_bytes());
+
+        self.write_raw(&packet)
+    }
+
+    fn write_raw(&mut self, data: &[u8]) -> io::Result<()> {
+        try!(self.stream.write_all(data));
+
+        self.stats.lock().unwrap().bytes_sent += data.len() as u64;
+
+        if let Some(bandwidth) = self.config.bandwidth {
+            let nanos = data.len() as u64 * 1_000_000_000 / bandwidth.max(1);
+            thread::sleep(Duration::new(nanos / 1_000_000_000, (nanos % 1_000_000_000) as u32));
+        }
+
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{escape_binary, from_hex, parse_address_size, to_hex};
+
+    #[test]
+    fn test_helpers() {
+        assert_eq!(parse_address_size("1f,20"), Some((0x1f, 0x20)));
+        assert_eq!(parse_address_size("1f"), None);
+        assert_eq!(from_hex(&to_hex(&[0, 0x7f, 0xff])), Some(vec![0, 0x7f, 0xff]));
+        assert_eq!(from_hex("0"), None);
+
+        let mut escaped = Vec::new();
+        escape_binary(&mut escaped, b"a#}");
+        assert_eq!(escaped, vec![b'a', b'}', b'#' ^ 0x20, b'}', b'}' ^ 0x20]);
+    }
+}
@@ -0,0 +1,211 @@
+//! The simulated Amiga the stub answers for.
+//!
+//! There is no CPU emulation. Memory is a flat buffer starting at address 0, stepping moves pc
+//! to the next word and continuing stops at the next breakpoint. That is enough for the backend
+//! to fetch memory, disassemble, step and hit breakpoints the same way it does with UAE.
+
+use std::collections::BTreeSet;
+
+/// d0-d7, a0-a7, sr and pc as UAE sends them
+pub const REGISTER_COUNT: usize = 18;
+const REG_SR: usize = 16;
+const REG_PC: usize = 17;
+
+/// PAL frame size UAE uses for DMA records
+pub const DMA_LINES: u16 = 313;
+pub const DMA_XCOUNT: u16 = 227;
+
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct Segment {
+    pub address: u32,
+    pub size: u32,
+}
+
+pub struct Target {
+    pub memory: Vec<u8>,
+    pub registers: [u32; REGISTER_COUNT],
+    pub segments: Vec<Segment>,
+    pub breakpoints: BTreeSet<u32>,
+    pub running: bool,
+    dma_frame: u32,
+}
+
+impl Target {
+    pub fn new(memory: Vec<u8>, segments: Vec<Segment>) -> Target {
+        let mut registers = [0; REGISTER_COUNT];
+        registers[REG_SR] = 0x2700;
+        registers[REG_PC] = segments.first().map(|seg| seg.address).unwrap_or(0);
+
+        Target {
+            memory: memory,
+            registers: registers,
+            segments: segments,
+            breakpoints: BTreeSet::new(),
+            running: false,
+            dma_frame: 0,
+        }
+    }
+
+    pub fn pc(&self) -> u32 {
+        self.registers[REG_PC]
+    }
+
+    pub fn read_memory(&self, address: u64, size: u64) -> Option<&[u8]> {
+        let end = address + size;
+
+        if end > self.memory.len() as u64 {
+            return None;
+        }
+
+        Some(&self.memory[address as usize..end as usize])
+    }
+
+    pub fn write_memory(&mut self, address: u64, data: &[u8]) -> bool {
+        let end = address + data.len() as u64;
+
+        if end > self.memory.len() as u64 {
+            return false;
+        }
+
+        self.memory[address as usize..end as usize].copy_from_slice(data);
+        true
+    }
+
+    ///
+    /// Registers as big endian data
+    ///
+    pub fn register_data(&self) -> Vec<u8> {
+        let mut data = Vec::with_capacity(REGISTER_COUNT * 4);
+
+        for reg in self.registers.iter() {
+            data.extend_from_slice(&[(reg >> 24) as u8, (reg >> 16) as u8, (reg >> 8) as u8, *reg as u8]);
+        }
+
+        data
+    }
+
+    pub fn set_register_data(&mut self, data: &[u8]) {
+        for (reg, value) in self.registers.iter_mut().zip(data.chunks(4)) {
+            if value.len() == 4 {
+                *reg = ((value[0] as u32) << 24) | ((value[1] as u32) << 16) |
+                       ((value[2] as u32) << 8) | value[3] as u32;
+            }
+        }
+    }
+
+    ///
+    /// Breakpoints are either absolute or an offset into a segment (as sent for file:line
+    /// breakpoints)
+    ///
+    pub fn breakpoint_address(&self, address: u32, segment: Option<usize>) -> Option<u32> {
+        match segment {
+            Some(index) => self.segments.get(index).map(|seg| seg.address + address),
+            None => Some(address),
+        }
+    }
+
+    pub fn start(&mut self) {
+        self.registers[REG_PC] = self.segments.first().map(|seg| seg.address).unwrap_or(0);
+        self.running = true;
+    }
+
+    pub fn step(&mut self) {
+        self.registers[REG_PC] = self.registers[REG_PC].wrapping_add(2);
+    }
+
+    ///
+    /// Moves pc to the next breakpoint after it (wrapping around). Returns false if there are
+    /// no breakpoints in which case the target keeps running until interrupted.
+    ///
+    pub fn continue_to_breakpoint(&mut self) -> bool {
+        let pc = self.registers[REG_PC];
+        let next = self.breakpoints
+            .iter()
+            .find(|&&address| address > pc)
+            .or_else(|| self.breakpoints.iter().next())
+            .cloned();
+
+        match next {
+            Some(address) => {
+                self.registers[REG_PC] = address;
+                self.running = false;
+                true
+            }
+            None => {
+                self.running = true;
+                false
+            }
+        }
+    }
+
+    ///
+    /// Next synthetic DMA frame: line and xcount (big endian u16) followed by two bytes per slot
+    /// with the DMA category in the second byte. The pattern moves a bit each frame so views
+    /// see the data change.
+    ///
+    pub fn next_dma_frame(&mut self) -> Vec<u8> {
+        let frame = self.dma_frame;
+        let mut data = Vec::with_capacity(4 + DMA_LINES as usize * DMA_XCOUNT as usize * 2);
+
+        data.extend_from_slice(&[(DMA_LINES >> 8) as u8, DMA_LINES as u8, (DMA_XCOUNT >> 8) as u8,
+                                 DMA_XCOUNT as u8]);
+
+        for line in 0..DMA_LINES as u32 {
+            for x in 0..DMA_XCOUNT as u32 {
+                let category = match x {
+                    0...3 => 1, // refresh
+                    4...11 => 10, // disk
+                    12...19 => 4, // audio
+                    20...35 => 9, // sprites
+                    _ if (x + line + frame) % 4 == 0 => 8, // bitplanes
+                    _ if (line + frame) % 64 < 8 => 5, // blitter
+                    _ if x % 2 == 0 => 2, // cpu
+                    _ => 0,
+                };
+
+                data.push(0);
+                data.push(category);
+            }
+        }
+
+        self.dma_frame = frame.wrapping_add(1);
+        data
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_continue_to_breakpoint() {
+        let mut target = Target::new(vec![0; 0x100],
+                                     vec![Segment { address: 0x20, size: 0x40 }]);
+
+        assert!(!target.continue_to_breakpoint());
+        assert!(target.running);
+
+        let bp = target.breakpoint_address(0x10, Some(0)).unwrap();
+        target.breakpoints.insert(bp);
+        target.breakpoints.insert(0x24);
+
+        assert!(target.continue_to_breakpoint());
+        assert_eq!(target.pc(), 0x24);
+        assert!(target.continue_to_breakpoint());
+        assert_eq!(target.pc(), 0x30);
+        // Wraps around to the first one
+        assert!(target.continue_to_breakpoint());
+        assert_eq!(target.pc(), 0x24);
+    }
+
+    #[test]
+    fn test_registers_round_trip() {
+        let mut target = Target::new(vec![0; 16], Vec::new());
+        let mut data = target.register_data();
+        data[3] = 0x42;
+        target.set_register_data(&data);
+
+        assert_eq!(target.registers[0], 0x42);
+        assert_eq!(target.register_data().len(), REGISTER_COUNT * 4);
+    }
+}
@@ -1,5 +1,6 @@
 #include "capstone/capstone.h"
 #include "api/include/pd_capstone.h"
+#include <string.h>
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -32,7 +33,96 @@ static PDCapstoneFuncs s_funcs[] = {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+static size_t disasm_batch(csh handle, const uint8_t** code, size_t* size, uint64_t* address, size_t count,
+						   cs_insn* insn, PDCapstoneBatch* batch) {
+	size_t decoded = 0;
+
+	while (batch->count < batch->capacity && (count == 0 || decoded < count)) {
+		size_t mnemonic_len, op_len, text_size;
+		char* text;
+
+		// Make sure that the text (mnemonic + ' ' + op_str + 0) will fit before decoding
+		if (batch->text_size + sizeof(insn->mnemonic) + sizeof(insn->op_str) + 1 > batch->text_capacity)
+			break;
+
+		// The M68K decoder doesn't fail on empty input so check for it here
+
+		if (*size == 0 || !cs_disasm_iter(handle, code, size, address, insn) || insn->size == 0)
+			break;
+
+		mnemonic_len = strlen(insn->mnemonic);
+		op_len = strlen(insn->op_str);
+		text = batch->text + batch->text_size;
+		text_size = mnemonic_len;
+
+		memcpy(text, insn->mnemonic, mnemonic_len);
+
+		if (op_len != 0) {
+			text[text_size++] = ' ';
+			memcpy(text + text_size, insn->op_str, op_len);
+			text_size += op_len;
+		}
+
+		text[text_size++] = 0;
+
+		batch->addresses[batch->count] = insn->address;
+		batch->sizes[batch->count] = insn->size;
+		batch->ids[batch->count] = insn->id;
+		batch->text_offsets[batch->count] = (uint32_t)batch->text_size;
+		batch->text_size += text_size;
+		batch->count++;
+
+		decoded++;
+	}
+
+	return decoded;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static PDCapstoneFuncs2 s_funcs2[] = {
+	{
+		{
+			cs_version,
+			cs_support,
+
+			cs_open,
+			cs_close,
+
+			cs_option,
+			cs_errno,
+
+			cs_disasm,
+			cs_free,
+
+			cs_disasm_iter,
+
+			cs_reg_name,
+			cs_insn_name,
+			cs_group_name,
+
+			cs_reg_read,
+			cs_op_count,
+
+			cs_op_index,
+
+			cs_regs_access
+		},
+
+		cs_malloc,
+		disasm_batch,
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 void* get_capstone_service_1() {
 	return s_funcs;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void* get_capstone_service_2() {
+	return s_funcs2;
+}
+
@@ -1705,6 +1705,7 @@ extern "C" void* image_create_rgba(unsigned int width, unsigned int height) {
     // Update with cleared data section to not have "empty" texture
 
     bgfx::updateTexture2D(tex, 0, 0, 0, (uint16_t)width, (uint16_t)height, mem);
+    ImGui::MarkTexturesChanged();
 
     return data;
 }
@@ -1722,6 +1723,30 @@ extern "C" void image_update(void* imageData, const void* src, unsigned int size
     memcpy(mem->data, src, size);
 
     bgfx::updateTexture2D(data->tex, 0, 0, 0, data->width, data->height, mem);
+    ImGui::MarkTexturesChanged();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Updates rowCount rows starting at firstRow. src points to the first row to update
+
+extern "C" void image_update_rows(void* imageData, const void* src, unsigned int firstRow, unsigned int rowCount) {
+    ImageData* data = (ImageData*)imageData;
+
+    if (firstRow >= data->height)
+        return;
+
+    if (rowCount > data->height - firstRow)
+        rowCount = data->height - firstRow;
+
+    if (rowCount == 0)
+        return;
+
+    const uint32_t size = (uint32_t)data->width * 4 * rowCount;
+    const bgfx::Memory* mem = bgfx::alloc(size);
+    memcpy(mem->data, src, size);
+
+    bgfx::updateTexture2D(data->tex, 0, 0, (uint16_t)firstRow, data->width, (uint16_t)rowCount, mem);
+    ImGui::MarkTexturesChanged();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -2018,6 +2043,7 @@ static PDUI s_uiFuncs[] =
 
     image_create_rgba,
     image_update,
+    image_update_rows,
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -2193,6 +2219,12 @@ extern "C" void* imgui_get_draw_data() {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+extern "C" unsigned int imgui_get_texture_change_count() {
+    return ImGui::GetTextureChangeCount();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 #if 0
 
     /*
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <map>
 #include <vector>
@@ -56,6 +57,25 @@ extern "C" __declspec(dllimport) void __stdcall OutputDebugStringA(const char* _
 
 extern struct WindowImpl* AllocateWindowImpl();
 
+// ProDBG specific messages (next to SCN_TOGGLE_BREAKPOINT and SCN_GETCURRENT_LINE)
+
+// wParam = microseconds per frame used for background lexing. 0 lexes everything up to the view directly
+#define SCN_SETLEXTIMESLICE 4433
+// lParam = ScLexStats*
+#define SCN_GETLEXSTATS 4434
+
+// Lines lexed at a time when styling in the background
+static const int s_lexChunkLines = 256;
+// Extra lines around the view that are styled when jumping ahead of the styled range
+static const int s_lexMarginLines = 100;
+
+struct ScLexStats {
+    uint64_t frameMicros;   // time spent lexing during the last update + render
+    uint64_t totalMicros;   // time spent lexing the current document
+    int endStyled;          // everything before this position is styled
+    int length;
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 bool htmlToColour(ColourDesired& colour, const char* html) {
@@ -248,14 +268,36 @@ private:
     int m_wheelVRotation;
     int m_wheelHRotation;
 
+    int m_lexTimeSlice;
+
+    // Range styled around the view while the background lexing hasn't reached it yet
+    Document* m_viewStyledDoc;
+    int m_viewStyledStart;
+    int m_viewStyledEnd;
+    int m_viewStyledLength;
+
+    ScLexStats m_lexStats;
+
+    // Font version the cached layout (position cache, line layouts) was measured with
+    unsigned int m_fontVersion;
+
+    typedef std::chrono::high_resolution_clock LexClock;
+
 public:
 
     ScEditor()
         : m_width(0)
         , m_height(0)
         , m_wheelVRotation(0)
-        , m_wheelHRotation(0) {
+        , m_wheelHRotation(0)
+        , m_lexTimeSlice(2000)
+        , m_viewStyledDoc(nullptr)
+        , m_viewStyledStart(0)
+        , m_viewStyledEnd(0)
+        , m_viewStyledLength(0)
+        , m_fontVersion(0) {
         memset(&interface, 0, sizeof(interface));
+        memset(&m_lexStats, 0, sizeof(m_lexStats));
     }
 
     virtual ~ScEditor() {
@@ -265,11 +307,88 @@ public:
 
     void Update() {
         //HandleInput();
+        m_lexStats.frameMicros = 0;
+        StyleInBackground();
         Tick();
     }
 
     ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+    void AddLexTime(LexClock::time_point start) {
+        uint64_t micros = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(LexClock::now() - start).count();
+        m_lexStats.frameMicros += micros;
+        m_lexStats.totalMicros += micros;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    // Continues styling the document from the end of the styled range in chunks until the time slice for this
+    // frame is used up
+
+    void StyleInBackground() {
+        int length = pdoc->Length();
+
+        if (m_lexTimeSlice == 0 || pdoc->GetEndStyled() >= length)
+            return;
+
+        LexClock::time_point start = LexClock::now();
+        LexClock::time_point end = start + std::chrono::microseconds(m_lexTimeSlice);
+
+        while (pdoc->GetEndStyled() < length && LexClock::now() < end) {
+            int endStyled = pdoc->GetEndStyled();
+            int line = pdoc->LineFromPosition(endStyled);
+
+            WndProc(SCI_COLOURISE, (uptr_t)pdoc->LineStart(line), pdoc->LineStart(line + s_lexChunkLines));
+
+            // No lexer (or container lexing) so there is nothing we can do
+            if (pdoc->GetEndStyled() <= endStyled)
+                break;
+        }
+
+        AddLexTime(start);
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    // Called by Scintilla when painting needs styles up to endStyleNeeded. Small gaps (regular scrolling) are styled
+    // directly but if the view is far ahead of the styled range (such as when jumping to the end of a large file)
+    // only the visible lines plus a margin are styled and the background styling takes care of the rest.
+
+    virtual void NotifyStyleToNeeded(int endStyleNeeded) override {
+        LexClock::time_point start = LexClock::now();
+
+        int endStyled = pdoc->GetEndStyled();
+        int lineEndStyled = pdoc->LineFromPosition(endStyled);
+        int lineNeeded = pdoc->LineFromPosition(endStyleNeeded);
+        int linesOnScreen = LinesOnScreen();
+
+        if (m_lexTimeSlice == 0 || lineNeeded - lineEndStyled <= linesOnScreen + s_lexMarginLines) {
+            ScintillaBase::NotifyStyleToNeeded(endStyleNeeded);
+            AddLexTime(start);
+            return;
+        }
+
+        int viewStart = pdoc->LineStart(std::max(lineEndStyled, lineNeeded - linesOnScreen - s_lexMarginLines));
+        int viewEnd = pdoc->LineStart(lineNeeded + s_lexMarginLines);
+
+        if (m_viewStyledDoc == pdoc && m_viewStyledLength == pdoc->Length() &&
+            viewStart >= m_viewStyledStart && viewEnd <= m_viewStyledEnd) {
+            return;
+        }
+
+        WndProc(SCI_COLOURISE, (uptr_t)viewStart, viewEnd);
+
+        // Lexing moves the end of the styled range to viewEnd so move it back to where the background styling is
+        WndProc(SCI_STARTSTYLING, (uptr_t)endStyled, 0xff);
+
+        m_viewStyledDoc = pdoc;
+        m_viewStyledStart = viewStart;
+        m_viewStyledEnd = viewEnd;
+        m_viewStyledLength = pdoc->Length();
+
+        AddLexTime(start);
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
     void ToggleBreakpoint() {
         Point caretPosition = PointMainCaret();
         unsigned int lineNumber = (unsigned int)LineFromLocation(caretPosition);
@@ -441,6 +560,12 @@ public:
     void Render() {
         PRectangle rcPaint = GetClientRectangle();
 
+        // Widths in the position cache are only valid for the font they were measured with
+        if (m_fontVersion != ScEditor_getFontVersion()) {
+            m_fontVersion = ScEditor_getFontVersion();
+            InvalidateStyleRedraw();
+        }
+
         AutoSurface surfaceWindow(this);
         if (surfaceWindow) {
             Paint(surfaceWindow, rcPaint);
@@ -461,6 +586,17 @@ public:
 
     ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+    // Lexer and style bits are stored in the document so this needs to be done for each new document
+
+    void SetupLexer() {
+        SendCommand(SCI_SETLEXER, SCLEX_CPP);
+        SendCommand(SCI_SETSTYLEBITS, 7);
+
+        SendCommand(SCI_SETKEYWORDS, 0, reinterpret_cast<sptr_t>(cppKeyWords));
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
     void Initialise() {
         wMain = AllocateWindowImpl();
 
@@ -469,10 +605,12 @@ public:
         // single draw list for efficiency.
         view.bufferedDraw = false;
 
-        SendCommand(SCI_SETLEXER, SCLEX_CPP);
-        SendCommand(SCI_SETSTYLEBITS, 7);
+        // Text is measured as UTF-8 by the surface. A larger position cache keeps measurements of
+        // long lines around while scrolling.
+        SendCommand(SCI_SETCODEPAGE, SC_CP_UTF8);
+        SendCommand(SCI_SETPOSITIONCACHE, 4096);
 
-        SendCommand(SCI_SETKEYWORDS, 0, reinterpret_cast<sptr_t>(cppKeyWords));
+        SetupLexer();
 
         ScEclipseTheme scTheme;
         //bool result = scTheme.Load("data/themes/theme-1.xml");    // Oblivion
@@ -680,6 +818,34 @@ public:
                 Point caretPosition = PointMainCaret();
                 return (sptr_t)LineFromLocation(caretPosition);
             }
+
+            case SCN_SETLEXTIMESLICE:
+            {
+                m_lexTimeSlice = (int)wParam;
+                return 0;
+            }
+
+            case SCN_GETLEXSTATS:
+            {
+                ScLexStats* stats = reinterpret_cast<ScLexStats*>(lParam);
+                *stats = m_lexStats;
+                stats->endStyled = pdoc->GetEndStyled();
+                stats->length = pdoc->Length();
+                return 0;
+            }
+
+            case SCI_SETDOCPOINTER:
+            {
+                sptr_t result = WndProc(iMessage, wParam, lParam);
+
+                m_lexStats.totalMicros = 0;
+
+                // Documents created with SCI_CREATEDOCUMENT have no lexer yet
+                if (WndProc(SCI_GETLEXER, 0, 0) != SCLEX_CPP)
+                    SetupLexer();
+
+                return result;
+            }
         }
 
         return WndProc(iMessage, wParam, lParam);
@@ -8,6 +8,7 @@ struct ImScEditor;
 
 void ScEditor_setDrawList(ImDrawList* drawList);
 void ScEditor_setFont(ImFont* drawList);
+unsigned int ScEditor_getFontVersion();
 
 ScEditor* ScEditor_create(int width, int height);
 
@@ -5,6 +5,7 @@
 #include <stdarg.h>
 #include <math.h>
 #include <assert.h>
+#include <unordered_map>
 #include "file.h"
 
 #include "scintilla/include/Platform.h"
@@ -23,20 +24,41 @@ static Vec2 s_pos;
 static struct ImFont* s_imFont;
 static struct ImDrawList* s_drawList;
 
+// Scintilla sets a new clip rect for each line and margin it paints. Pushing those to the draw list
+// would end the current draw command every time so instead primitives are clipped on the CPU against
+// this rect (in screen space). That way everything the editor draws ends up in the same draw command
+// as long as the texture doesn't change.
+
+static ImVec4 s_clipRect;
+static bool s_hasClip;
+
+// Bumped when the font changes so the editor knows that its cached text layout is stale
+static unsigned int s_fontVersion;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void ScEditor_setDrawList(ImDrawList* drawList) {
     s_drawList = drawList;
+    s_hasClip = false;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void ScEditor_setFont(ImFont* font) {
+    if (font != s_imFont)
+        s_fontVersion++;
+
     s_imFont = font;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+unsigned int ScEditor_getFontVersion() {
+    return s_fontVersion;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 void ScEditor_setPos(float x, float y) {
     s_pos.x = x;
     s_pos.y = y;
@@ -160,6 +182,7 @@ public:
 private:
 
     ColourDesired m_penColour;
+    bool m_unicodeMode;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -179,33 +202,132 @@ void Font::Create(const FontParameters& fp) {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-struct ImageData {
+// RGBA images drawn by Scintilla (margin markers, XPMs) are packed into a single texture. Images are
+// looked up by a hash of their size and pixels so each distinct image is only uploaded once and after
+// that drawing it is just a textured rect.
+
+struct ImageAtlasEntry {
+    ImVec2 uv0;
+    ImVec2 uv1;
+    // Used to tell apart images that end up with the same hash
+    int width;
+    int height;
+};
+
+struct ImageAtlas {
+    enum {
+        Size = 512,
+    };
+
     bgfx::TextureHandle tex;
-    float scalex, scaley;
     bool initialised;
+
+    // Images are packed in rows (shelves) from top to bottom
+    int shelfX;
+    int shelfY;
+    int shelfHeight;
+
+    // Set when an image didn't fit. Images drawn earlier in the frame still use the current
+    // content so the atlas is only cleared at the start of the next frame.
+    bool full;
+    int fullFrame;
+
+    std::unordered_map<uint64_t, ImageAtlasEntry> entries;
 };
 
+static ImageAtlas s_imageAtlas;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint64_t hashImage(int width, int height, const unsigned char* pixels) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    const size_t size = (size_t)(width * height * 4);
+
+    hash = (hash ^ (uint64_t)width) * 1099511628211ULL;
+    hash = (hash ^ (uint64_t)height) * 1099511628211ULL;
+
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ pixels[i]) * 1099511628211ULL;
+
+    return hash;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void UpdateImageData(ImageData& image, int w, int h, const unsigned char* data) {
-    const int byteSize = w * h * (int)sizeof(unsigned char) * 4; // RGBA image
+static const ImageAtlasEntry* findOrAddImage(int width, int height, const unsigned char* pixels) {
+    ImageAtlas& atlas = s_imageAtlas;
+
+    if (width <= 0 || height <= 0 || width > ImageAtlas::Size || height > ImageAtlas::Size)
+        return nullptr;
+
+    const int frame = ImGui::GetFrameCount();
 
-    if (!image.initialised)
-        image.tex = bgfx::createTexture2D((uint16_t)w, (uint16_t)h, 1, bgfx::TextureFormat::BGRA8, BGFX_TEXTURE_NONE, 0);
+    // Start over once the frame that filled the atlas is done. Images still in use are uploaded
+    // again the next time they are drawn.
+    if (atlas.full && frame != atlas.fullFrame) {
+        atlas.entries.clear();
+        atlas.shelfX = 0;
+        atlas.shelfY = 0;
+        atlas.shelfHeight = 0;
+        atlas.full = false;
+    }
+
+    const uint64_t hash = hashImage(width, height, pixels);
+
+    auto it = atlas.entries.find(hash);
+
+    // On a hash collision the new image is added and replaces the entry (the texels of the old
+    // one are left as is for anything that already uses them)
+    if (it != atlas.entries.end() && it->second.width == width && it->second.height == height)
+        return &it->second;
+
+    if (!atlas.initialised) {
+        atlas.tex = bgfx::createTexture2D(ImageAtlas::Size, ImageAtlas::Size, 1, bgfx::TextureFormat::RGBA8, BGFX_TEXTURE_NONE, 0);
+        atlas.initialised = true;
+    }
+
+    if (atlas.shelfX + width > ImageAtlas::Size) {
+        atlas.shelfX = 0;
+        atlas.shelfY += atlas.shelfHeight;
+        atlas.shelfHeight = 0;
+    }
+
+    // Overwriting texels now would change images that have already been drawn this frame so the
+    // image is skipped until the atlas is cleared at the start of the next frame
+    if (atlas.shelfY + height > ImageAtlas::Size) {
+        if (!atlas.full) {
+            atlas.full = true;
+            atlas.fullFrame = frame;
+        }
+
+        return nullptr;
+    }
+
+    const uint32_t byteSize = (uint32_t)(width * height * 4);
+    const bgfx::Memory* mem = bgfx::alloc(byteSize);
+    memcpy(mem->data, pixels, byteSize);
+
+    bgfx::updateTexture2D(atlas.tex, 0, (uint16_t)atlas.shelfX, (uint16_t)atlas.shelfY, (uint16_t)width, (uint16_t)height, mem);
+    ImGui::MarkTexturesChanged();
 
-    const bgfx::Memory* mem = bgfx::alloc((uint32_t)byteSize);
-    memcpy(mem->data, data, (uint32_t)byteSize);
+    const float scale = 1.0f / (float)ImageAtlas::Size;
 
-    image.initialised = true;
-    image.scalex = 1.0f / (float)w;
-    image.scaley = 1.0f / (float)h;
+    ImageAtlasEntry entry;
+    entry.uv0 = ImVec2(atlas.shelfX * scale, atlas.shelfY * scale);
+    entry.uv1 = ImVec2((atlas.shelfX + width) * scale, (atlas.shelfY + height) * scale);
+    entry.width = width;
+    entry.height = height;
 
-    bgfx::updateTexture2D(image.tex, 0, 0, 0, (uint16_t)w, (uint16_t)h, mem);
+    atlas.shelfX += width;
+    atlas.shelfHeight = height > atlas.shelfHeight ? height : atlas.shelfHeight;
+
+    return &(atlas.entries[hash] = entry);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-SurfaceImpl::SurfaceImpl() {
+SurfaceImpl::SurfaceImpl() : m_unicodeMode(false) {
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -298,101 +420,74 @@ void SurfaceImpl::InitPixMap(int width, int height, Surface* surface_, WindowID
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void SurfaceImpl::DrawRGBAImage(PRectangle rc, int width, int height, const unsigned char* pixelsImage) {
-    // For some reason using bgfx dircetly doesn't work anymore.
-    // This is a temporary work-around to show something at least.
-
-    s_drawList->AddDrawCmd();
-    s_drawList->AddRectFilled(ImVec2(rc.left + s_pos.x, rc.top + s_pos.y),
-                              ImVec2(rc.right + s_pos.x, rc.bottom + s_pos.y - 2), 0xaa889900);
-
-    return;
-/*
-    ImageData image;
-    memset(&image, 0x0, sizeof(image));
-
-    // GW-TODO: Cache this!
-    UpdateImageData(image, width, height, pixelsImage);
-
-    bgfx::TransientVertexBuffer tvb;
+// Adds a solid rect to the current draw command. Rects are clipped against the current Scintilla
+// clip rect here instead of changing the scissor rect of the draw list.
 
-    float offsetx = 0.0f;
-    float offsety = 0.0f;
+static void addRect(ImVec2 a, ImVec2 b, ImU32 col) {
+    if ((col >> 24) == 0)
+        return;
 
-    float w = (rc.right - rc.left) * image.scalex, h = (rc.bottom - rc.top) * image.scaley;
-    float u1 = offsetx * image.scalex, v1 = offsety * image.scaley, u2 = u1 + w, v2 = v1 + h;
-
-    // TODO: Use program that doesn't set color
+    if (s_hasClip) {
+        a.x = fmaxf(a.x, s_clipRect.x);
+        a.y = fmaxf(a.y, s_clipRect.y);
+        b.x = fminf(b.x, s_clipRect.z);
+        b.y = fminf(b.y, s_clipRect.w);
+    }
 
-    UIRender_allocPosColorTb(&tvb, 6);
-    PosColorVertex* vb = (PosColorVertex*)tvb.data;
+    if (a.x >= b.x || a.y >= b.y)
+        return;
 
-    //UIRender_allocPosTexColorTb(&tvb, 6);
-    //PosTexColorVertex* vb = (PosTexColorVertex*)tvb.data;
+    s_drawList->PrimReserve(6, 4);
+    s_drawList->PrimRect(a, b, col);
+}
 
-    // First triangle
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    vb[0].x = rc.left;
-    vb[0].y = rc.top;
-    //vb[0].u = u1;
-    //vb[0].v = v1;
-    vb[0].color = 0x7f7f7f7f;
+void SurfaceImpl::DrawRGBAImage(PRectangle rc, int width, int height, const unsigned char* pixelsImage) {
+    const ImageAtlasEntry* image = findOrAddImage(width, height, pixelsImage);
 
-    vb[1].x = rc.right;
-    vb[1].y = rc.top;
-    //vb[1].u = u2;
-    //vb[1].v = v1;
-    vb[1].color = 0x7f7f7f7f;
+    ImVec2 a(rc.left + s_pos.x, rc.top + s_pos.y);
+    ImVec2 b(rc.right + s_pos.x, rc.bottom + s_pos.y);
 
-    vb[2].x = rc.right;
-    vb[2].y = rc.bottom;
-    //vb[2].u = u2;
-    //vb[2].v = v2;
-    vb[2].color = 0x7f7f7f7f;
+    if (!image) {
+        addRect(a, b, 0xaa889900);
+        return;
+    }
 
-    // Second triangle
+    ImVec2 uv0 = image->uv0;
+    ImVec2 uv1 = image->uv1;
 
-    vb[3].x = rc.left;
-    vb[3].y = rc.top;
-    //vb[3].u = u1;
-    //vb[3].v = v1;
-    vb[3].color = 0xffffffff;
+    // Clip on the CPU (see s_clipRect) and adjust the UVs to match
 
-    vb[4].x = rc.right;
-    vb[4].y = rc.bottom;
-    //vb[4].u = u2;
-    //vb[4].v = v2;
-    vb[4].color = 0xffffffff;
+    if (s_hasClip) {
+        const float du = (uv1.x - uv0.x) / (b.x - a.x);
+        const float dv = (uv1.y - uv0.y) / (b.y - a.y);
 
-    vb[5].x = rc.left;
-    vb[5].y = rc.bottom;
-    //vb[5].u = u1;
-    //vb[5].v = v2;
-    vb[5].color = 0xffffffff;
+        if (a.x < s_clipRect.x) { uv0.x += (s_clipRect.x - a.x) * du; a.x = s_clipRect.x; }
+        if (a.y < s_clipRect.y) { uv0.y += (s_clipRect.y - a.y) * dv; a.y = s_clipRect.y; }
+        if (b.x > s_clipRect.z) { uv1.x -= (b.x - s_clipRect.z) * du; b.x = s_clipRect.z; }
+        if (b.y > s_clipRect.w) { uv1.y -= (b.y - s_clipRect.w) * dv; b.y = s_clipRect.w; }
+    }
 
-    bgfx::setState(0
- | BGFX_STATE_RGB_WRITE
- | BGFX_STATE_ALPHA_WRITE
-                   // | BGFX_STATE_BLEND_FUNC(BGFX_STATE_BLEND_SRC_ALPHA, BGFX_STATE_BLEND_INV_SRC_ALPHA)
- | BGFX_STATE_MSAA);
+    if (a.x >= b.x || a.y >= b.y)
+        return;
 
-    //UIRender_posTexColor(&tvb, 0, 6, image.tex);
-    UIRender_posColor(&tvb, 0, 6);
+    // Switching texture ends the current draw command so this is the only place where the editor
+    // drawing is split up. The texture id is the bgfx handle (as the renderer expects it)
 
-    bgfx::destroyTexture(image.tex); // GW-TODO: Lol
- */
+    s_drawList->PushTextureID((ImTextureID)(uintptr_t)s_imageAtlas.tex.idx);
+    s_drawList->PrimReserve(6, 4);
+    s_drawList->PrimRectUV(a, b, uv0, uv1, 0xffffffff);
+    s_drawList->PopTextureID();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static void fillRectangle(PRectangle rc, ColourDesired b) {
-    (void)rc;
-    (void)b;
     const uint32_t back = (uint32_t)b.AsLong();
 
-    s_drawList->AddDrawCmd();
-    s_drawList->AddRectFilled(ImVec2(rc.left + s_pos.x, rc.top + s_pos.y),
-                              ImVec2(rc.right + s_pos.x, rc.bottom + s_pos.y), back);
+    addRect(ImVec2(rc.left + s_pos.x, rc.top + s_pos.y),
+            ImVec2(rc.right + s_pos.x, rc.bottom + s_pos.y), back);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -460,7 +555,8 @@ void SurfaceImpl::DrawTextBase(PRectangle rc, Font& font_, float ybase, const ch
     assert(s_drawList);
     assert(s_imFont);
 
-    s_drawList->AddText(s_imFont, s_imFont->FontSize, ImVec2(xt + s_pos.x, yt + s_pos.y), fore, s, s + len);
+    s_drawList->AddText(s_imFont, s_imFont->FontSize, ImVec2(xt + s_pos.x, yt + s_pos.y), fore, s, s + len,
+                        0.0f, s_hasClip ? &s_clipRect : nullptr);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -484,34 +580,148 @@ void SurfaceImpl::DrawTextTransparent(PRectangle rc, Font& font_, float ybase, c
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// Glyph advances for the editor font. Scintilla measures text all the time (through its position cache)
+// so ASCII advances are kept in a flat table and other code points are cached on first use. ImFont has
+// no kerning pairs so advances are simply summed, which also matches how AddText places the glyphs.
+
+struct FontMetrics {
+    const ImFont* font;
+    float ascii[128];
+    std::unordered_map<uint32_t, float> advances;
+};
+
+static FontMetrics s_fontMetrics;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static float glyphAdvance(uint32_t c) {
+    FontMetrics& metrics = s_fontMetrics;
+    const ImFont* font = s_imFont;
+
+    if (metrics.font != font) {
+        metrics.font = font;
+        metrics.advances.clear();
+
+        for (uint32_t i = 0; i < 128; ++i)
+            metrics.ascii[i] = i < (uint32_t)font->IndexXAdvance.Size ? font->IndexXAdvance[i] : font->FallbackXAdvance;
+    }
+
+    if (c < 128)
+        return metrics.ascii[c];
+
+    auto it = metrics.advances.find(c);
+
+    if (it != metrics.advances.end())
+        return it->second;
+
+    // ImWchar is 16 bit so anything above that is drawn as the fallback glyph
+    float advance = font->FallbackXAdvance;
+
+    if (c <= 0xffff && c < (uint32_t)font->IndexXAdvance.Size)
+        advance = font->IndexXAdvance[c];
+
+    metrics.advances[c] = advance;
+
+    return advance;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Decodes one UTF-8 character and returns the number of bytes used. Invalid and truncated sequences
+// use a single byte (shown as the fallback glyph) so the text is always consumed.
+
+static int decodeUTF8(const unsigned char* s, int len, uint32_t* c) {
+    const unsigned char lead = s[0];
+    int count;
+
+    if (lead < 0x80) {
+        *c = lead;
+        return 1;
+    } else if (lead >= 0xc2 && lead < 0xe0) {
+        *c = lead & 0x1f;
+        count = 2;
+    } else if (lead >= 0xe0 && lead < 0xf0) {
+        *c = lead & 0x0f;
+        count = 3;
+    } else if (lead >= 0xf0 && lead < 0xf5) {
+        *c = lead & 0x07;
+        count = 4;
+    } else {
+        *c = 0xfffd;
+        return 1;
+    }
+
+    if (count > len) {
+        *c = 0xfffd;
+        return 1;
+    }
+
+    for (int i = 1; i < count; ++i) {
+        if ((s[i] & 0xc0) != 0x80) {
+            *c = 0xfffd;
+            return 1;
+        }
+
+        *c = (*c << 6) | (s[i] & 0x3f);
+    }
+
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 void SurfaceImpl::MeasureWidths(Font& font_, const char* s, int len, float* positions) {
+    const unsigned char* text = (const unsigned char*)s;
     float position = 0;
+    int i = 0;
+
     (void)font_;
 
-    while (len--) {
-        float advance;
+    if (!m_unicodeMode) {
+        for (i = 0; i < len; ++i) {
+            position += glyphAdvance(text[i]);
+            positions[i] = position;
+        }
+
+        return;
+    }
+
+    // Scintilla expects every byte of a multi-byte character to have the position after the character
 
-        const char c = *s++;
+    while (i < len) {
+        uint32_t c;
+        const int count = decodeUTF8(text + i, len - i, &c);
 
-        advance = s_imFont->IndexXAdvance[c];
+        position += glyphAdvance(c);
 
-        position += advance;//TODO: +Kerning
-        *positions++ = position;
+        for (int b = 0; b < count; ++b)
+            positions[i++] = position;
     }
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 float SurfaceImpl::WidthText(Font& font_, const char* s, int len) {
+    const unsigned char* text = (const unsigned char*)s;
+    float width = 0;
+    int i = 0;
+
     (void)font_;
-    ImVec2 t = ImGui::CalcTextSize(s, s + len);
-    return t.x;
+
+    while (i < len) {
+        uint32_t c = text[i];
+        i += m_unicodeMode ? decodeUTF8(text + i, len - i, &c) : 1;
+        width += glyphAdvance(c);
+    }
+
+    return width;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 float SurfaceImpl::WidthChar(Font& font_, char ch) {
-    return s_imFont->IndexXAdvance[ch];
+    (void)font_;
+    return glyphAdvance((unsigned char)ch);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -553,17 +763,9 @@ float SurfaceImpl::AverageCharWidth(Font& font_) {
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void SurfaceImpl::SetClip(PRectangle rc) {
-    float xt = rc.left;
-    float yt = rc.top;
-    float width = rc.right - rc.left;
-    float height = rc.bottom - rc.top;
-
-    (void)xt;
-    (void)yt;
-    (void)width;
-    (void)height;
-
-    //bgfx::setScissor((uint16_t)x, (uint16_t)y, (uint16_t)width, (uint16_t)height);
+    // Only recorded here, see s_clipRect
+    s_clipRect = ImVec4(rc.left + s_pos.x, rc.top + s_pos.y, rc.right + s_pos.x, rc.bottom + s_pos.y);
+    s_hasClip = true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -580,7 +782,7 @@ void SurfaceImpl::SetDBCSMode(int codePage) {
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void SurfaceImpl::SetUnicodeMode(bool unicodeMode) {
-    (void)unicodeMode;
+    m_unicodeMode = unicodeMode;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -25,5 +25,10 @@ bool IsActiveWindow(ImGuiWindow* window);
 ImVec2 GetRelativeMousePos();
 ImScEditor* ScInputText(const char* label, float xSize, float ySize, void (* callback)(void*), void* userData);
 
+// Texture contents can change without the draw lists changing so anything that creates or updates a
+// texture has to mark it for the renderer to not skip the next frame
+void MarkTexturesChanged();
+unsigned int GetTextureChangeCount();
+
 }
 
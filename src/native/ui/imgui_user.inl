@@ -171,6 +171,22 @@ ImScEditor* ScInputText(const char* label, float xSize, float ySize, void (*call
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+static unsigned int s_textureChangeCount;
+
+void MarkTexturesChanged()
+{
+	s_textureChangeCount++;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned int GetTextureChangeCount()
+{
+	return s_textureChangeCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 
 }
 
@@ -83,15 +83,14 @@ static void destroyInstance(void* user_data) {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static void updateCondition(Breakpoint* bp, PDReader* reader) {
-    const char* condition;
-
-    bp->condition = 0;
+static void updateCondition(BreakpointsData* data, Breakpoint* bp, PDReader* reader) {
+    const char* condition = 0;
 
     PDRead_find_string(reader, &condition, "condition", 0);
 
-    if (condition)
-        bp->condition = strdup(condition);
+    if (condition) {
+        strncpy(bp->condition, condition, data->maxPath - 1);
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -126,7 +125,7 @@ void toogleBreakpointFileLine(BreakpointsData* data, PDReader* reader) {
 
     strcpy(breakpoint->location.filename, fileLine);
 
-    updateCondition(breakpoint, reader);
+    updateCondition(data, breakpoint, reader);
 
     data->breakpoints.push_back(breakpoint);
 }
@@ -152,7 +151,7 @@ void toggleBreakpointAddress(BreakpointsData* data, PDReader* reader) {
 
     strcpy(breakpoint->location.address, address);
 
-    updateCondition(breakpoint, reader);
+    updateCondition(data, breakpoint, reader);
 
     data->breakpoints.push_back(breakpoint);
 }
@@ -232,21 +231,21 @@ static int update(void* user_data, PDUI* uiFuncs, PDReader* inEvents, PDWriter*
         uiFuncs->text("");
         uiFuncs->next_column();
 
-        uiFuncs->text(""); // no condition for now
+        // The backend compiles the condition when it gets it so it's only sent when editing is done
 
-        //if (uiFuncs->input_text("##condition", bp->condition, (int)data->maxPath, PDInputTextFlags_EnterReturnsTrue, 0, 0))
-        //	needUpdate = true;
+        if (uiFuncs->input_text("##condition", bp->condition, (int)data->maxPath, PDUIInputTextFlags_EnterReturnsTrue, 0, 0))
+            needUpdate = true;
 
         uiFuncs->next_column();
 
-        if (needUpdate) {
+        if (needUpdate && !bp->location.filename) {
             // TODO: Add support for file/line
 
             PDWrite_event_begin(writer, PDEventType_SetBreakpoint);
             PDWrite_u64(writer, "address", (uint64_t)strtol(bp->location.address, 0, 16));
 
-            //if (bp->condition[0] != 0)
-            //	PDWrite_string(writer, "condition", bp->condition);
+            if (bp->condition[0] != 0)
+                PDWrite_string(writer, "condition", bp->condition);
 
             if (bp->id != -1)
                 PDWrite_u32(writer, "id", (uint32_t)bp->id);
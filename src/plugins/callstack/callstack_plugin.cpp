@@ -1,5 +1,6 @@
 #include "pd_view.h"
 #include "pd_backend.h"
+#include "pd_symbols.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -18,6 +19,7 @@ struct CallstackEntry {
 
 struct CallstackData {
     std::vector<CallstackEntry> callstack;
+    PDSymbolFuncs* symbolFuncs;
     uint64_t location;
     char filename[4096];
     int line;
@@ -29,9 +31,10 @@ struct CallstackData {
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static void* createInstance(PDUI* uiFuncs, ServiceFunc* serviceFunc) {
-    (void)serviceFunc;
     CallstackData* user_data = new CallstackData;
 
+    user_data->symbolFuncs = (PDSymbolFuncs*)serviceFunc(PDSYMBOLFUNCS_GLOBAL);
+
     memset(user_data->filename, 0, sizeof(user_data->filename));
     user_data->line = -1;
 
@@ -40,7 +43,6 @@ static void* createInstance(PDUI* uiFuncs, ServiceFunc* serviceFunc) {
     user_data->selectedFrame = 0;
 
     (void)uiFuncs;
-    (void)serviceFunc;
 
     return user_data;
 }
@@ -54,8 +56,9 @@ static void destroyInstance(void* user_data) {
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // TODO: Support floats
 
-static void getAddressString(char* value, PDReader* reader, PDReaderIterator it) {
-    uint64_t regValue;
+static void getAddressString(char* value, int valueSize, PDSymbolFuncs* symbolFuncs, PDReader* reader,
+                             PDReaderIterator it) {
+    uint64_t regValue = 0;
     uint32_t type = PDRead_find_u64(reader, &regValue, "address", it);
 
     switch (type & PDReadStatus_TypeMask) {
@@ -76,6 +79,19 @@ static void getAddressString(char* value, PDReader* reader, PDReaderIterator it)
         case PDReadType_S64:
             sprintf(value, "0x%014llx", (int64_t)regValue); break;
     }
+
+    // Append symbol+offset if any of the backends has symbols for the address
+
+    if (!symbolFuncs)
+        return;
+
+    int len = (int)strlen(value);
+
+    if (len + 2 >= valueSize)
+        return;
+
+    if (symbolFuncs->format_address(regValue, &value[len + 1], valueSize - (len + 1)) > 0)
+        value[len] = ' ';
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -112,12 +128,12 @@ static void updateCallstack(CallstackData* data, PDReader* reader) {
     while (PDRead_get_next_entry(reader, &it)) {
         const char* filename = "";
         const char* module = "";
-        char address[64] = { 0 };
+        char address[256] = { 0 };
         uint32_t line = (uint32_t) ~0;
 
         CallstackEntry entry = { 0 };
 
-        getAddressString(address, reader, it);
+        getAddressString(address, (int)sizeof(address), data->symbolFuncs, reader, it);
 
         PDRead_find_string(reader, &filename, "filename", it);
         PDRead_find_string(reader, &module, "module_name", it);
@@ -1,13 +1,27 @@
 #[macro_use]
 extern crate prodbg_api;
 
+mod line_store;
+
 use prodbg_api::*;
+use line_store::{Line, LineStore, LINE_FLAG_FUNCTION_START, LINE_FLAG_JUMP_TARGET};
 
-struct Line {
-    opcode: String,
-    regs_write: String,
-    regs_read: String,
-    address: u64,
+// Number of instructions that is requested when prefetching before/after the lines we have
+const PAGE_SIZE: usize = 64;
+// Max number of lines to keep around. Lines furthest away from the cursor are dropped first
+const MAX_LINES: usize = PAGE_SIZE * 16;
+
+// Colors used to highlight the registers used by the instruction at the pc
+const REG_COLORS: [u32; 8] = [0x00b27474, 0x00b28050, 0x00a9b250, 0x0060b250, 0x004fb292,
+                              0x004f71b2, 0x008850b2, 0x00b25091];
+
+///
+/// Position of a register highlight within the visible lines
+///
+struct Highlight {
+    line: usize,
+    x: f32,
+    color: u32,
 }
 
 ///
@@ -30,47 +44,112 @@ struct Breakpoint {
 //
 
 
+///
+/// Outstanding disassembly request. Only one request is in flight at the time so holding down
+/// page up/down doesn't flood the backend with requests for the same range.
+///
+#[derive(Clone, Copy, PartialEq)]
+enum Request {
+    Around(u64),
+    Before(u64),
+    After(u64),
+}
+
 struct DisassemblyView {
     exception_location: u64,
     has_made_step: bool,
     cursor: u64,
+    top_address: u64,
     breakpoint_radius: f32,
     breakpoint_spacing: f32,
     address_size: u8,
     reset_to_center: bool,
-    lines: Vec<Line>,
+    /// Sorted and contiguous range of lines
+    lines: LineStore,
+    /// Reused when reading new lines from the backend
+    new_lines: Vec<Line>,
+    /// Register highlights for the visible lines and the (top, bottom, register mask, lines
+    /// version) they were calculated for
+    highlights: Vec<Highlight>,
+    highlights_key: (usize, usize, u64, u64),
+    lines_version: u64,
+    pending_request: Option<Request>,
+    /// Set when the backend couldn't give us more lines before/after the given address
+    start_reached: Option<u64>,
+    end_reached: Option<u64>,
     breakpoints: Vec<Breakpoint>,
+    symbols: Option<Symbols>,
 }
 
 impl DisassemblyView {
     fn set_disassembly(&mut self, reader: &mut Reader) {
-        self.lines.clear();
-
-        for entry in reader.find_array("disassembly").unwrap() {
-            let address = entry.find_u64("address").unwrap();
-            let line = entry.find_string("line").unwrap();
-            let mut regs_read = String::new();
-            let mut regs_write = String::new();
-
-            entry.find_string("registers_read")
-                .map(|regs| {
-                    regs_read = regs.to_owned();
-                })
-                .ok();
-
-            entry.find_string("registers_write")
-                .map(|regs| {
-                    regs_write = regs.to_owned();
-                })
-                .ok();
-
-            self.lines.push(Line {
-                opcode: line.to_owned(),
-                regs_read: regs_read,
-                regs_write: regs_write,
-                address: address,
-            });
+        // Any reply (also an empty one when the backend failed) completes the request
+        let request = self.pending_request.take();
+
+        self.new_lines.clear();
+
+        if let Ok(entries) = reader.find_array("disassembly") {
+            for entry in entries {
+                let address = entry.find_u64("address").unwrap();
+                let line = entry.find_string("line").unwrap();
+                let regs_read = entry.find_string("registers_read").unwrap_or("");
+                let regs_write = entry.find_string("registers_write").unwrap_or("");
+                let flags = entry.find_u8("flags").unwrap_or(0);
+
+                let line = self.lines.make_line(address, line, regs_read, regs_write, flags);
+                self.new_lines.push(line);
+            }
+        }
+
+        let old_first = self.lines.first_address();
+        let old_last = self.lines.last_address();
+
+        if !self.lines.merge(&self.new_lines) {
+            self.start_reached = None;
+            self.end_reached = None;
+        }
+
+        self.trim_lines();
+        self.lines_version += 1;
+
+        // If we didn't get anything new the backend is at the start/end of what it can disassemble
+        // so stop asking for more in that direction
+
+        match request {
+            Some(Request::Before(address)) => {
+                if self.lines.first_address() == old_first {
+                    self.start_reached = Some(address);
+                }
+            }
+            Some(Request::After(address)) => {
+                if self.lines.last_address() == old_last {
+                    self.end_reached = Some(address);
+                }
+            }
+            _ => (),
+        }
+    }
+
+    ///
+    /// Drop lines furthest away from the cursor if we have more than MAX_LINES
+    ///
+    fn trim_lines(&mut self) {
+        if self.lines.len() <= MAX_LINES {
+            return;
         }
+
+        let cursor = self.lines.find(self.cursor).unwrap_or(0);
+        let start = cursor.saturating_sub(MAX_LINES / 2).min(self.lines.len() - MAX_LINES);
+
+        if start > 0 {
+            self.start_reached = None;
+        }
+
+        if start + MAX_LINES < self.lines.len() {
+            self.end_reached = None;
+        }
+
+        self.lines.retain_range(start, MAX_LINES);
     }
 
     ///
@@ -86,53 +165,92 @@ impl DisassemblyView {
     }
 
     fn request_disassembly(&mut self, ui: &mut Ui, location: u64, writer: &mut Writer) {
-        let visible_lines = Self::get_visible_lines_count(ui) as u64;
-
         // check if we have the the location within all lines, then we don't need to request more
-        for line in &self.lines {
-            if line.address == location {
-                return;
-            }
+        if self.lines.find(location).is_some() {
+            return;
         }
 
+        let visible_lines = Self::get_visible_lines_count(ui) as u32;
+
         self.reset_to_center = true;
+        self.pending_request = Some(Request::Around(location));
+
         writer.event_begin(EVENT_GET_DISASSEMBLY as u16);
-        writer.write_u64("address_start", location - (visible_lines * 4));
-        writer.write_u32("instruction_count", (visible_lines * 4) as u32);
+        writer.write_u64("address_start", location);
+        writer.write_u32("instructions_before", visible_lines);
+        writer.write_u32("instruction_count", visible_lines * 2);
         writer.event_end();
-        println!("requsted {}", visible_lines * 10);
     }
 
-    fn color_text_reg_selection(ui: &Ui, regs_use: &Vec<&str>, line: &Line, text_height: f32) {
-        let cy = ui.get_cursor_screen_pos().y;
-        let mut color_index = 0;
-        // TODO: Allocs memory, fix
-        let line_text = format!("   0x{:x} {}", line.address, line.opcode);
+    ///
+    /// Request the page before/after the lines we have if the cursor gets close to either end.
+    ///
+    fn prefetch_disassembly(&mut self, ui: &Ui, writer: &mut Writer) {
+        if self.pending_request.is_some() || self.lines.len() == 0 {
+            return;
+        }
+
+        let cursor = match self.lines.find(self.cursor) {
+            Some(index) => index,
+            None => return,
+        };
+
+        let margin = Self::get_visible_lines_count(ui) + PAGE_SIZE / 2;
+        let first = self.lines.first_address().unwrap();
+        let last = self.lines.last_address().unwrap();
+
+        if cursor < margin && self.start_reached != Some(first) {
+            self.pending_request = Some(Request::Before(first));
+            writer.event_begin(EVENT_GET_DISASSEMBLY as u16);
+            writer.write_u64("address_start", first);
+            writer.write_u32("instructions_before", PAGE_SIZE as u32);
+            writer.write_u32("instruction_count", 1);
+            writer.event_end();
+        } else if self.lines.len() - cursor < margin && self.end_reached != Some(last) {
+            self.pending_request = Some(Request::After(last));
+            writer.event_begin(EVENT_GET_DISASSEMBLY as u16);
+            writer.write_u64("address_start", last);
+            writer.write_u32("instruction_count", PAGE_SIZE as u32 + 1);
+            writer.event_end();
+        }
+    }
+
+    ///
+    /// Calculate where to highlight the registers (in reg_mask) for the visible lines. This is only
+    /// done when the visible lines or the registers change and not every frame.
+    ///
+    fn update_highlights(&mut self, ui: &Ui, top: usize, bottom: usize, reg_mask: u64) {
+        let key = (top, bottom, reg_mask, self.lines_version);
+
+        if self.highlights_key == key {
+            return;
+        }
 
-        let colors = [0x00b27474, 0x00b28050, 0x00a9b250, 0x0060b250, 0x004fb292, 0x004f71b2,
-                      0x008850b2, 0x00b25091];
+        self.highlights_key = key;
+        self.highlights.clear();
 
-        // let mut color_index = 0;
+        for (index, line) in self.lines.lines()[top..bottom].iter().enumerate() {
+            let text = self.lines.text(line);
+            let opcode_offset = self.lines.opcode_offset(line);
+            let mut color_index = 0;
 
-        // let font_size = 14.0;
-        // TODO: Offset here is hardcoded with given hex size, this should be fixed
-        // let start_offset = font_size * 11.0; // 0x00000000 "
+            for reg in 0..64 {
+                if reg_mask & (1 << reg) == 0 {
+                    continue;
+                }
 
-        for reg in regs_use {
-            let color = colors[color_index & 7];
-            line_text.find(reg).map(|offset| {
-                let tx = ui.calc_text_size(&line_text, offset).x;
-                ui.fill_rect(0.0 + tx,
-                             cy,
-                             22.0,
-                             text_height,
-                             Color::from_au32(200, color));
-            });
+                let color = REG_COLORS[color_index & 7];
+                color_index += 1;
 
-            color_index += 1;
+                if let Some(offset) = text[opcode_offset..].find(self.lines.reg_name(reg)) {
+                    self.highlights.push(Highlight {
+                        line: index + top,
+                        x: ui.calc_text_size(text, opcode_offset + offset).x,
+                        color: color,
+                    });
+                }
+            }
         }
-
-        ui.text(&line_text);
     }
 
     fn toggle_breakpoint(&mut self, writer: &mut Writer) {
@@ -178,28 +296,41 @@ impl DisassemblyView {
     // return;
     // }
     //
-    // self.cursor = self.lines[pos as usize].address;
+    // self.cursor = self.lines.lines()[pos as usize].address;
     // }
     //
 
     fn scroll_cursor(&mut self, steps: i32) {
-        for (i, line) in self.lines.iter().enumerate() {
-            if line.address == self.cursor {
-                let pos = (i as i32) + steps;
-                // if we don'n have enough lines we need to fetch more
-                if pos < 0 {
-                    return;
-                }
-
-                // need to fetch more data here also
-                if pos >= self.lines.len() as i32 {
-                    return;
-                }
+        if let Some(i) = self.lines.find(self.cursor) {
+            // Clamp to the lines we have. More lines are prefetched when getting close to the ends
+            let pos = ((i as i32) + steps).max(0).min(self.lines.len() as i32 - 1);
+            self.cursor = self.lines.lines()[pos as usize].address;
+        }
+    }
 
-                self.cursor = self.lines[pos as usize].address;
-                return;
-            }
+    ///
+    /// Returns the index of the first line to show so that the cursor stays within the view
+    ///
+    fn update_top_line(&mut self, visible_lines: usize) -> usize {
+        let cursor = match self.lines.find(self.cursor) {
+            Some(index) => index,
+            None => return self.lines.find(self.top_address).unwrap_or(0),
+        };
+
+        let mut top = self.lines.find(self.top_address).unwrap_or(cursor);
+        let outside = cursor < top || cursor >= top + visible_lines;
+
+        if outside && (self.reset_to_center || self.has_made_step) {
+            top = cursor.saturating_sub(visible_lines / 2);
+            self.reset_to_center = false;
+        } else if cursor < top {
+            top = cursor;
+        } else if cursor >= top + visible_lines {
+            top = cursor + 1 - visible_lines;
         }
+
+        self.top_address = self.lines.lines()[top].address;
+        top
     }
 
     fn render_arrow(ui: &Ui, pos_x: f32, pos_y: f32, scale: f32) {
@@ -226,53 +357,30 @@ impl DisassemblyView {
 
         let size = ui.get_window_size();
         let text_height = ui.get_text_line_height_with_spacing();
-        let mut regs = String::new();
-        let mut regs_pc_use = Vec::new();
-        // let font_size = ui.get_font_size();
 
-        // find registerss for pc
+        // find registers for pc
 
-        for line in &self.lines {
-            if line.address == self.exception_location {
-                if line.regs_read.len() > 1 || line.regs_write.len() > 1 {
-                    if line.regs_read.len() > 0 {
-                        regs.push_str(&line.regs_read);
-                    }
-                    if line.regs_write.len() > 0 {
-                        regs.push(' ');
-                        regs.push_str(&line.regs_write);
-                    }
+        let reg_mask = self.lines
+            .find(self.exception_location)
+            .map(|index| {
+                let line = &self.lines.lines()[index];
+                line.regs_read | line.regs_write
+            })
+            .unwrap_or(0);
 
-                    let t = regs.trim_left();
-                    regs_pc_use = t.split(' ').collect();
-                    break;
-                }
-            }
-        }
+        let visible_lines = Self::get_visible_lines_count(ui);
+        let top = self.update_top_line(visible_lines);
+        let bottom = (top + visible_lines).min(self.lines.len());
+
+        self.update_highlights(ui, top, bottom, reg_mask);
+
+        let mut highlight = 0;
 
-        for line in &self.lines {
+        for (index, line) in self.lines.lines()[top..bottom].iter().enumerate() {
             let cy = ui.get_cursor_screen_pos().y;
             let bp_radius = self.breakpoint_radius;
 
             if line.address == self.cursor {
-                if (cy - text_height) < 0.0 {
-                    if self.reset_to_center || self.has_made_step {
-                        ui.set_scroll_here(0.5);
-                        self.reset_to_center = false;
-                    } else {
-                        ui.set_scroll_from_pos_y(cy - text_height, 0.0);
-                    }
-                }
-
-                if cy > (size.y - text_height) {
-                    if self.reset_to_center || self.has_made_step {
-                        ui.set_scroll_here(0.5);
-                        self.reset_to_center = false;
-                    } else {
-                        ui.set_scroll_from_pos_y(cy + text_height, 1.0);
-                    }
-                }
-
                 ui.fill_rect(0.0,
                              cy,
                              size.x,
@@ -280,10 +388,35 @@ impl DisassemblyView {
                              Color::from_argb(200, 0, 0, 127));
             }
 
-            if regs_pc_use.len() > 0 {
-                Self::color_text_reg_selection(ui, &regs_pc_use, &line, text_height);
-            } else {
-                ui.text_fmt(format_args!("   0x{:x} {}", line.address, line.opcode));
+            // Separate functions with a line and mark lines that are jumped to
+
+            if (line.flags & LINE_FLAG_FUNCTION_START) != 0 {
+                ui.fill_rect(0.0, cy, size.x, 1.0, Color::from_argb(255, 128, 128, 128));
+            }
+
+            if (line.flags & LINE_FLAG_JUMP_TARGET) != 0 {
+                ui.fill_rect(0.0, cy, 3.0, text_height, Color::from_argb(255, 200, 200, 80));
+            }
+
+            while highlight < self.highlights.len() && self.highlights[highlight].line == index + top {
+                let h = &self.highlights[highlight];
+                ui.fill_rect(h.x, cy, 22.0, text_height, Color::from_au32(200, h.color));
+                highlight += 1;
+            }
+
+            ui.text(self.lines.text(line));
+
+            // Lines that a symbol starts at are labeled with its name. This is looked up here (the
+            // lookup doesn't allocate) so labels follow the symbols as modules are loaded.
+
+            if let Some(ref symbols) = self.symbols {
+                match symbols.lookup(line.address) {
+                    Some(ref info) if info.offset == 0 => {
+                        ui.same_line(0, -1);
+                        ui.text_colored(Color::from_argb(255, 120, 200, 120), info.name);
+                    }
+                    _ => (),
+                }
             }
 
             if self.has_breakpoint(line.address) {
@@ -297,8 +430,6 @@ impl DisassemblyView {
                                false);
             }
 
-            // println!("draw arrow {} {}", line.address, self.exception_location);
-
             if line.address == self.exception_location {
                 Self::render_arrow(ui, 0.0, cy + 2.0, self.breakpoint_radius * 2.0);
             }
@@ -309,7 +440,7 @@ impl DisassemblyView {
 }
 
 impl View for DisassemblyView {
-    fn new(_: &Ui, _: &Service) -> Self {
+    fn new(_: &Ui, service: &Service) -> Self {
         DisassemblyView {
             exception_location: u64::max_value(),
             cursor: 0xe003, // u64::max_value(),
@@ -317,8 +448,17 @@ impl View for DisassemblyView {
             breakpoint_spacing: 6.0,
             address_size: 4,
             has_made_step: false,
-            lines: Vec::new(),
+            top_address: 0,
+            lines: LineStore::new(),
+            new_lines: Vec::new(),
+            highlights: Vec::new(),
+            highlights_key: (0, 0, 0, u64::max_value()),
+            lines_version: 0,
+            pending_request: None,
+            start_reached: None,
+            end_reached: None,
             breakpoints: Vec::new(),
+            symbols: service.get_symbols(),
             reset_to_center: false,
         }
     }
@@ -369,6 +509,14 @@ impl View for DisassemblyView {
             self.scroll_cursor(-8);
         }
 
+        let wheel = ui.get_mouse_wheel();
+
+        if wheel != 0.0 {
+            self.scroll_cursor((wheel * -3.0) as i32);
+        }
+
+        self.prefetch_disassembly(ui, writer);
+
         self.render_ui(ui);
     }
 }
@@ -0,0 +1,238 @@
+use std::fmt::Write;
+
+// Line is the first instruction of a function
+pub const LINE_FLAG_FUNCTION_START: u8 = 1;
+// Something branches or jumps to this line
+pub const LINE_FLAG_JUMP_TARGET: u8 = 2;
+
+///
+/// A line of disassembly. The text lives in the arena of the LineStore that created the line and
+/// registers are stored as bitmasks with one bit per register name in the store.
+///
+#[derive(Clone, Copy)]
+pub struct Line {
+    pub address: u64,
+    pub regs_read: u64,
+    pub regs_write: u64,
+    /// LINE_FLAG_* sent by the backend
+    pub flags: u8,
+    text_start: u32,
+    text_end: u32,
+    // offset within the text where the opcode starts (after the address)
+    opcode_offset: u16,
+}
+
+///
+/// Stores all lines in one sorted Vec and the (preformatted) text for them in a single string
+/// arena. Merging ranges only moves the small Line entries around and the arena is compacted
+/// when most of it is unused.
+///
+pub struct LineStore {
+    lines: Vec<Line>,
+    text: String,
+    /// Maps bit index in the register masks to names. Names past 64 can't be tracked and end up
+    /// without any highlighting.
+    reg_names: Vec<String>,
+}
+
+impl LineStore {
+    pub fn new() -> LineStore {
+        LineStore {
+            lines: Vec::new(),
+            text: String::new(),
+            reg_names: Vec::new(),
+        }
+    }
+
+    #[inline]
+    pub fn len(&self) -> usize {
+        self.lines.len()
+    }
+
+    #[inline]
+    pub fn lines(&self) -> &[Line] {
+        &self.lines
+    }
+
+    #[inline]
+    pub fn first_address(&self) -> Option<u64> {
+        self.lines.first().map(|line| line.address)
+    }
+
+    #[inline]
+    pub fn last_address(&self) -> Option<u64> {
+        self.lines.last().map(|line| line.address)
+    }
+
+    pub fn find(&self, address: u64) -> Option<usize> {
+        self.lines.binary_search_by(|line| line.address.cmp(&address)).ok()
+    }
+
+    ///
+    /// Full text for the line as it's shown in the view
+    ///
+    #[inline]
+    pub fn text(&self, line: &Line) -> &str {
+        &self.text[line.text_start as usize..line.text_end as usize]
+    }
+
+    ///
+    /// Offset into the line text where the opcode (and operands) starts
+    ///
+    #[inline]
+    pub fn opcode_offset(&self, line: &Line) -> usize {
+        line.opcode_offset as usize
+    }
+
+    #[inline]
+    pub fn reg_name(&self, index: usize) -> &str {
+        &self.reg_names[index]
+    }
+
+    ///
+    /// Formats the line into the arena and returns the new entry. The line isn't part of the
+    /// store until it's been passed to merge.
+    ///
+    pub fn make_line(&mut self,
+                     address: u64,
+                     opcode: &str,
+                     regs_read: &str,
+                     regs_write: &str,
+                     flags: u8)
+                     -> Line {
+        let text_start = self.text.len();
+        write!(&mut self.text, "   0x{:x} ", address).unwrap();
+        let opcode_offset = self.text.len() - text_start;
+        self.text.push_str(opcode);
+
+        Line {
+            address: address,
+            regs_read: self.reg_mask(regs_read),
+            regs_write: self.reg_mask(regs_write),
+            flags: flags,
+            text_start: text_start as u32,
+            text_end: self.text.len() as u32,
+            opcode_offset: opcode_offset as u16,
+        }
+    }
+
+    fn reg_mask(&mut self, regs: &str) -> u64 {
+        let mut mask = 0;
+
+        for reg in regs.split(' ').filter(|reg| reg.len() > 0) {
+            let index = match self.reg_names.iter().position(|name| name == reg) {
+                Some(index) => index,
+                None => {
+                    self.reg_names.push(reg.to_owned());
+                    self.reg_names.len() - 1
+                }
+            };
+
+            if index < 64 {
+                mask |= 1 << index;
+            }
+        }
+
+        mask
+    }
+
+    ///
+    /// Merge a sorted range of lines into the current ones. If the new range doesn't overlap the
+    /// current one it replaces all lines instead. Returns true if the lines were merged.
+    ///
+    pub fn merge(&mut self, new_lines: &[Line]) -> bool {
+        if new_lines.len() == 0 {
+            return true;
+        }
+
+        let new_first = new_lines[0].address;
+        let new_last = new_lines[new_lines.len() - 1].address;
+
+        let overlaps = match (self.first_address(), self.last_address()) {
+            (Some(first), Some(last)) => new_first <= last && new_last >= first,
+            _ => false,
+        };
+
+        if !overlaps {
+            self.lines.clear();
+            self.lines.extend_from_slice(new_lines);
+        } else {
+            let head = self.lines.iter().position(|line| line.address >= new_first).unwrap_or(self.lines.len());
+            let tail = self.lines.iter().position(|line| line.address > new_last).unwrap_or(self.lines.len());
+            self.lines.splice(head..tail, new_lines.iter().cloned());
+        }
+
+        self.compact();
+
+        overlaps
+    }
+
+    ///
+    /// Keep count lines starting at start and drop the rest
+    ///
+    pub fn retain_range(&mut self, start: usize, count: usize) {
+        self.lines.truncate(start + count);
+        self.lines.drain(..start);
+        self.compact();
+    }
+
+    ///
+    /// Rebuild the arena if less than half of it is used by the current lines
+    ///
+    fn compact(&mut self) {
+        let used = self.lines.iter().fold(0, |acc, line| acc + (line.text_end - line.text_start) as usize);
+
+        if used * 2 >= self.text.len() {
+            return;
+        }
+
+        let mut text = String::with_capacity(used);
+
+        for line in &mut self.lines {
+            let start = text.len();
+            text.push_str(&self.text[line.text_start as usize..line.text_end as usize]);
+            line.text_start = start as u32;
+            line.text_end = text.len() as u32;
+        }
+
+        self.text = text;
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn add_range(store: &mut LineStore, start: u64, count: u64) -> bool {
+        let lines: Vec<Line> = (0..count).map(|i| store.make_line(start + i * 2, "nop", "", "", 0)).collect();
+        store.merge(&lines)
+    }
+
+    #[test]
+    fn test_merge() {
+        let mut store = LineStore::new();
+        assert_eq!(add_range(&mut store, 0x100, 8), false);
+        assert_eq!(add_range(&mut store, 0x10e, 8), true);
+        assert_eq!(add_range(&mut store, 0xf0, 9), true);
+        assert_eq!(store.len(), 8 + 7 + 8);
+        assert_eq!(store.first_address(), Some(0xf0));
+        assert_eq!(store.last_address(), Some(0x11c));
+        assert_eq!(store.find(0x10e), Some(15));
+
+        let line = store.lines()[15];
+        assert_eq!(store.text(&line), "   0x10e nop");
+        assert_eq!(&store.text(&line)[store.opcode_offset(&line)..], "nop");
+
+        assert_eq!(add_range(&mut store, 0x1000, 4), false);
+        assert_eq!(store.len(), 4);
+    }
+
+    #[test]
+    fn test_reg_mask() {
+        let mut store = LineStore::new();
+        let line = store.make_line(0x100, "move.l d0, a1", "d0", "a1 d0", 0);
+        assert_eq!(line.regs_read, 1);
+        assert_eq!(line.regs_write, 3);
+        assert_eq!(store.reg_name(1), "a1");
+    }
+}
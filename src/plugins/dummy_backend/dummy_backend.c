@@ -11,6 +11,9 @@
 
 #define sizeof_array(t) (sizeof(t) / sizeof(t[0]))
 
+// Number of registers (from the start of the register list) that can be used in expressions
+#define EXPRESSION_REG_COUNT 8
+
 typedef struct DisasmData {
     uint16_t address;
     const char* string;
@@ -409,6 +412,17 @@ double get_reg_for_expression(const Register* reg) {
     return t;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Conditions are compiled when the breakpoint is set (or the condition changes) and only evaluated when the
+// breakpoint is hit
+
+typedef struct Breakpoint {
+    uint32_t id;
+    uint64_t address;
+    char* condition;
+    te_expr* expr;
+} Breakpoint;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 typedef struct DummyPlugin {
@@ -421,6 +435,20 @@ typedef struct DummyPlugin {
     int register_type;
     Register *registers;
     int registers_count;
+
+    // Compiled expressions are bound to these so the register values only need to be copied before evaluating
+    double expression_values[EXPRESSION_REG_COUNT];
+    te_variable expression_vars[EXPRESSION_REG_COUNT];
+
+    // Sorted on address
+    Breakpoint* breakpoints;
+    int breakpoints_count;
+    int breakpoints_capacity;
+    uint32_t next_breakpoint_id;
+
+    // Last expression evaluated from RequestEvalExpression (the same one is usually requested every update)
+    char* eval_text;
+    te_expr* eval_expr;
 } DummyPlugin;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -505,12 +533,32 @@ void* create_instance(ServiceFunc* serviceFunc) {
     fill_register(&plugin->registers[reg_counter++], "mxcsr", 4, (unsigned char[]){0x00, 0x00, 0x1F, 0x80}, 0);
     plugin->registers_count = reg_counter;
 
+    for (i = 0; i < EXPRESSION_REG_COUNT; ++i) {
+        plugin->expression_vars[i].name = plugin->registers[i].name;
+        plugin->expression_vars[i].address = &plugin->expression_values[i];
+        plugin->expression_vars[i].type = TE_VARIABLE;
+        plugin->expression_vars[i].context = 0;
+    }
+
+    plugin->next_breakpoint_id = 1;
+
     return plugin;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void destroy_instance(void* user_data) {
+    int i;
+    DummyPlugin* plugin = (DummyPlugin*)user_data;
+
+    for (i = 0; i < plugin->breakpoints_count; ++i) {
+        te_free(plugin->breakpoints[i].expr);
+        free(plugin->breakpoints[i].condition);
+    }
+
+    te_free(plugin->eval_expr);
+    free(plugin->eval_text);
+    free(plugin->breakpoints);
     free(user_data);
 }
 
@@ -736,6 +784,7 @@ static int find_instruction_index(uint64_t address) {
 static void get_disassembly(PDReader* reader, PDWriter* writer) {
     uint64_t address_start = 0;
     uint32_t instruction_count = 0;
+    uint32_t instructions_before = 0;
     uint32_t i = 0;
     int index;
     int total_instruction_count = 0;
@@ -744,6 +793,7 @@ static void get_disassembly(PDReader* reader, PDWriter* writer) {
 
     PDRead_find_u64(reader, &address_start, "address_start", 0);
     PDRead_find_u32(reader, &instruction_count, "instruction_count", 0);
+    PDRead_find_u32(reader, &instructions_before, "instructions_before", 0);
 
     index = find_instruction_index(address_start);
 
@@ -751,6 +801,16 @@ static void get_disassembly(PDReader* reader, PDWriter* writer) {
         index = 0;
     }
 
+    // Lines before address_start are included in the reply (all instructions are known here)
+
+    if ((uint32_t)index < instructions_before) {
+        instruction_count += (uint32_t)index;
+        index = 0;
+    } else {
+        instruction_count += instructions_before;
+        index -= (int)instructions_before;
+    }
+
     PDWrite_event_begin(writer, PDEventType_SetDisassembly);
     PDWrite_array_begin(writer, "disassembly");
 
@@ -782,15 +842,34 @@ static void get_disassembly(PDReader* reader, PDWriter* writer) {
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Copies the current register values to the ones the compiled expressions are bound to
 
-void eval_expression(DummyPlugin* data, PDReader* reader, PDWriter* writer) {
+static void update_expression_values(DummyPlugin* data) {
     int i;
-    int err;
+
+    for (i = 0; i < EXPRESSION_REG_COUNT; ++i) {
+        data->expression_values[i] = get_reg_for_expression(&data->registers[i]);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static te_expr* compile_expression(DummyPlugin* data, const char* expression) {
+    int err = 0;
+    te_expr* expr = te_compile(expression, data->expression_vars, EXPRESSION_REG_COUNT, &err);
+
+    if (!expr) {
+        printf("Unable to compile expression \"%s\" (error at %d)\n", expression, err);
+    }
+
+    return expr;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void eval_expression(DummyPlugin* data, PDReader* reader, PDWriter* writer) {
     uint64_t request_id;
     const char* expression;
-    te_expr* expr = 0;
-    (void)reader;
-    (void)writer;
 
     if (PDRead_find_u64(reader, &request_id, "_request_id", 0) == PDReadStatus_NotFound) {
         printf("Unable to find _request_id in expression request\n");
@@ -802,36 +881,244 @@ void eval_expression(DummyPlugin* data, PDReader* reader, PDWriter* writer) {
         return;
     }
 
-    double temp_regs[8];
-    te_variable vars[8];
-
-    // Use just the 8 first registers for expressions.
+    // Only compile again if the expression changed
 
-    for (i = 0; i < 8; ++i) {
-        temp_regs[i] = get_reg_for_expression(data->registers[i].data);
-        vars[i].name = data->registers[i].name;
-        vars[i].address = &temp_regs; 
-        vars[i].type = TE_VARIABLE; 
-        vars[i].context = 0; 
+    if (!data->eval_text || strcmp(data->eval_text, expression) != 0) {
+        te_free(data->eval_expr);
+        free(data->eval_text);
+        data->eval_text = strdup(expression);
+        data->eval_expr = compile_expression(data, expression);
     }
 
     PDWrite_event_begin(writer, PDEventType_ReplyEvalExpression);
-    PDWrite_u64(writer, "_reply_request", request_id); 
+    PDWrite_u64(writer, "_reply_request", request_id);
 
-    expr = te_compile(expression, vars, 8, &err);
-
-    if (expr) {
-        double ret = te_eval(expr);
-        PDWrite_u64(writer, "result", (uint64_t)ret);
+    if (data->eval_expr) {
+        update_expression_values(data);
+        PDWrite_u64(writer, "result", (uint64_t)te_eval(data->eval_expr));
     } else {
-        PDWrite_string(writer, "error", expression); 
+        PDWrite_string(writer, "error", expression);
+    }
+
+    PDWrite_event_end(writer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Returns the index of the first breakpoint at address or where it should be inserted
+
+static int find_breakpoint_index(DummyPlugin* data, uint64_t address) {
+    int low = 0;
+    int high = data->breakpoints_count;
+
+    while (low < high) {
+        int mid = (low + high) / 2;
+
+        if (data->breakpoints[mid].address < address) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static Breakpoint* find_breakpoint_by_id(DummyPlugin* data, uint32_t id) {
+    int i;
+
+    for (i = 0; i < data->breakpoints_count; ++i) {
+        if (data->breakpoints[i].id == id) {
+            return &data->breakpoints[i];
+        }
+    }
+
+    return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void set_breakpoint_condition(DummyPlugin* data, Breakpoint* bp, const char* condition) {
+    if (condition && condition[0] == 0) {
+        condition = NULL;
+    }
+
+    if (!condition && !bp->condition) {
+        return;
+    }
+
+    if (condition && bp->condition && !strcmp(condition, bp->condition)) {
+        return;
+    }
+
+    te_free(bp->expr);
+    free(bp->condition);
+
+    bp->condition = condition ? strdup(condition) : NULL;
+    bp->expr = condition ? compile_expression(data, condition) : NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void remove_breakpoint(DummyPlugin* data, Breakpoint* bp) {
+    int index = (int)(bp - data->breakpoints);
+
+    te_free(bp->expr);
+    free(bp->condition);
+
+    memmove(bp, bp + 1, (size_t)(data->breakpoints_count - index - 1) * sizeof(Breakpoint));
+    data->breakpoints_count--;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static Breakpoint* add_breakpoint(DummyPlugin* data, uint64_t address) {
+    int index;
+    Breakpoint* bp;
+
+    if (data->breakpoints_count == data->breakpoints_capacity) {
+        data->breakpoints_capacity = data->breakpoints_capacity ? data->breakpoints_capacity * 2 : 16;
+        data->breakpoints = realloc(data->breakpoints, (size_t)data->breakpoints_capacity * sizeof(Breakpoint));
+    }
+
+    index = find_breakpoint_index(data, address);
+    bp = &data->breakpoints[index];
+
+    memmove(bp + 1, bp, (size_t)(data->breakpoints_count - index) * sizeof(Breakpoint));
+    data->breakpoints_count++;
+
+    memset(bp, 0, sizeof(Breakpoint));
+    bp->id = data->next_breakpoint_id++;
+    bp->address = address;
+
+    return bp;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// A breakpoint with an id already set is updated (its condition only gets compiled again if it changed)
+
+static void set_breakpoint(DummyPlugin* data, PDReader* reader, PDWriter* writer) {
+    uint64_t address = 0;
+    uint32_t id = 0;
+    const char* condition = NULL;
+    Breakpoint* bp = NULL;
+
+    if (PDRead_find_u64(reader, &address, "address", 0) == PDReadStatus_NotFound) {
+        printf("Unable to find address in SetBreakpoint request\n");
+        return;
+    }
+
+    PDRead_find_string(reader, &condition, "condition", 0);
+
+    if (PDRead_find_u32(reader, &id, "id", 0) != PDReadStatus_NotFound) {
+        bp = find_breakpoint_by_id(data, id);
     }
 
+    if (bp && bp->address != address) {
+        char* old_condition = bp->condition;
+        te_expr* old_expr = bp->expr;
+
+        // Keep the compiled condition when only moving the breakpoint
+
+        bp->condition = NULL;
+        bp->expr = NULL;
+        remove_breakpoint(data, bp);
+
+        bp = add_breakpoint(data, address);
+        bp->id = id;
+        bp->condition = old_condition;
+        bp->expr = old_expr;
+    } else if (!bp) {
+        bp = add_breakpoint(data, address);
+    }
+
+    set_breakpoint_condition(data, bp, condition);
+
+    PDWrite_event_begin(writer, PDEventType_ReplyBreakpoint);
+    PDWrite_u64(writer, "address", address);
+    PDWrite_u32(writer, "id", bp->id);
     PDWrite_event_end(writer);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+static void delete_breakpoint(DummyPlugin* data, PDReader* reader) {
+    uint32_t id = 0;
+    Breakpoint* bp;
+
+    PDRead_find_u32(reader, &id, "id", 0);
+
+    if ((bp = find_breakpoint_by_id(data, id))) {
+        remove_breakpoint(data, bp);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Returns 1 if there is a breakpoint at address with no condition or a condition that is true. Called for every
+// executed instruction so it only evaluates the pre-compiled conditions
+
+static int should_break(DummyPlugin* data, uint64_t address) {
+    int i = find_breakpoint_index(data, address);
+    int values_updated = 0;
+
+    for (; i < data->breakpoints_count && data->breakpoints[i].address == address; ++i) {
+        const Breakpoint* bp = &data->breakpoints[i];
+        double value;
+
+        if (!bp->condition) {
+            return 1;
+        }
+
+        // Conditions that failed to compile never break
+
+        if (!bp->expr) {
+            continue;
+        }
+
+        if (!values_updated) {
+            update_expression_values(data);
+            values_updated = 1;
+        }
+
+        // Not written as != 0.0 as that is a -Wfloat-equal error with -Weverything on Mac
+
+        value = te_eval(bp->expr);
+
+        if (value < 0.0 || value > 0.0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Runs one lap of the program at most and stops at the first breakpoint hit
+
+static void run_to_breakpoint(DummyPlugin* data) {
+    int i;
+    int index;
+    const int count = (int)sizeof_array(s_disasm_data);
+
+    if (data->breakpoints_count == 0) {
+        return;
+    }
+
+    index = find_instruction_index((uint64_t)data->exception_location);
+
+    for (i = 0; i < count; ++i) {
+        index = index + 1 < count ? index + 1 : 0;
+
+        if (should_break(data, s_disasm_data[index].address)) {
+            data->exception_location = s_disasm_data[index].address;
+            return;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 static PDDebugState update(void* user_data,
                            PDAction action,
                            PDReader* reader,
@@ -846,6 +1133,12 @@ static PDDebugState update(void* user_data,
             break;
         }
 
+        case PDAction_Run:
+        {
+            run_to_breakpoint(data);
+            break;
+        }
+
         case PDAction_StepOut:
         {
 
@@ -908,6 +1201,18 @@ static PDDebugState update(void* user_data,
                 eval_expression(data, reader, writer);
                 break;
             }
+
+            case PDEventType_SetBreakpoint:
+            {
+                set_breakpoint(data, reader, writer);
+                break;
+            }
+
+            case PDEventType_DeleteBreakpoint:
+            {
+                delete_breakpoint(data, reader);
+                break;
+            }
         }
     }
 
@@ -2,6 +2,7 @@
 
 #include "pd_backend.h"
 #include "pd_host.h"
+#include "pd_debug_info.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -19,6 +20,11 @@
 #include <LLDB/SBCommandInterpreter.h>
 #include <LLDB/SBCommandReturnObject.h>
 #include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iterator>
 
 //static PDMessageFuncs* s_messageFuncs;
 
@@ -45,6 +51,17 @@ typedef struct LLDBPlugin
 	std::map<lldb::tid_t, uint32_t> frameSelection;
 	std::vector<Breakpoint> breakpoints;
 
+	// Line info and symbols of the executable are read by the host (ELF only) as LLDB is slow to
+	// look up lines in large binaries. 0 if not loaded and LLDB is used instead
+	PDDebugInfoFuncs* debugInfoFuncs;
+	uint32_t debugInfo;
+	// Handle of the info while the host is still loading it (0 if nothing is loading)
+	uint32_t debugInfoLoading;
+
+	// Source files sent to the host and the module count they were collected for
+	std::set<std::string> sourceFiles;
+	uint32_t sourceFilesModuleCount;
+
 } LLDBPlugin;
 
 
@@ -63,6 +80,10 @@ void* createInstance(ServiceFunc* serviceFunc)
     plugin->listener = plugin->debugger.GetListener();
     plugin->hasValidTarget = false;
     plugin->selectedThreadId = 0;
+    plugin->debugInfoFuncs = (PDDebugInfoFuncs*)serviceFunc(PDDEBUGINFOFUNCS_GLOBAL);
+    plugin->debugInfo = 0;
+    plugin->debugInfoLoading = 0;
+    plugin->sourceFilesModuleCount = 0;
 
     return plugin;
 }
@@ -86,6 +107,13 @@ static uint32_t getThreadFrame(LLDBPlugin* plugin, lldb::tid_t threadId)
 void destroyInstance(void* user_data)
 {
 	LLDBPlugin* plugin = (LLDBPlugin*)user_data;
+
+	if (plugin->debugInfo)
+		plugin->debugInfoFuncs->unload(plugin->debugInfo);
+
+	if (plugin->debugInfoLoading)
+		plugin->debugInfoFuncs->unload(plugin->debugInfoLoading);
+
 	delete plugin;
 }
 
@@ -93,6 +121,74 @@ void destroyInstance(void* user_data)
 
 const bool m_verbose = true;
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// The debug info is loaded with the addresses in the file. Once the process is running the executable may have been
+// relocated (PIE) so the difference is updated to match where the header got loaded
+
+static void updateLoadBias(LLDBPlugin* plugin)
+{
+	if (!plugin->debugInfo || !plugin->process.IsValid())
+		return;
+
+	lldb::SBModule module(plugin->target.FindModule(plugin->target.GetExecutable()));
+	lldb::SBAddress header(module.GetObjectFileHeaderAddress());
+
+	uint64_t loadAddress = header.GetLoadAddress(plugin->target);
+
+	if (loadAddress == LLDB_INVALID_ADDRESS)
+		return;
+
+	plugin->debugInfoFuncs->set_load_bias(plugin->debugInfo, loadAddress - header.GetFileAddress());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Gets the file and line of the address from the host debug info and falls back to LLDB for code outside the
+// executable (shared libraries) or if the info couldn't be loaded
+
+static uint32_t getFileLine(LLDBPlugin* plugin, lldb::SBFrame& frame, char* filename, int filenameSize)
+{
+	uint32_t line = 0;
+
+	filename[0] = 0;
+
+	if (plugin->debugInfo)
+	{
+		if (plugin->debugInfoFuncs->resolve_address(plugin->debugInfo, frame.GetPC(), filename, filenameSize, &line))
+			return line;
+	}
+
+	lldb::SBCompileUnit compileUnit = frame.GetCompileUnit();
+
+	if (compileUnit.GetNumSupportFiles() > 0)
+	{
+		lldb::SBFileSpec fileSpec = compileUnit.GetSupportFileAtIndex(0);
+		fileSpec.GetPath(filename, (size_t)filenameSize);
+	}
+
+	lldb::SBSymbolContext context(frame.GetSymbolContext(lldb::eSymbolContextEverything));
+	lldb::SBLineEntry entry(context.GetLineEntry());
+
+	return entry.GetLine();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sets a breakpoint at the address the host debug info has for the line. Address breakpoints are set at load
+// addresses so before the process is running (where the executable may still be relocated) LLDB has to find the
+// location itself
+
+static lldb::SBBreakpoint createBreakpoint(LLDBPlugin* plugin, const char* filename, uint32_t line)
+{
+	uint64_t address = 0;
+
+	if (plugin->debugInfo && plugin->process.IsValid() &&
+		plugin->debugInfoFuncs->resolve_file_line(plugin->debugInfo, filename, line, &address))
+	{
+		return plugin->target.BreakpointCreateByAddress(address);
+	}
+
+	return plugin->target.BreakpointCreateByLocation(filename, line);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static void onStop(LLDBPlugin* plugin)
@@ -177,6 +273,8 @@ void onRun(LLDBPlugin* plugin)
         plugin->state = PDDebugState_Running;
         plugin->hasValidTarget = true;
 
+        updateLoadBias(plugin);
+
         return;
     }
 
@@ -207,29 +305,26 @@ static void setCallstack(LLDBPlugin* plugin, PDWriter* writer)
         char fileLine[2048];
         char moduleName[2048];
 
+        char filename[2048];
+
         lldb::SBFrame frame = thread.GetFrameAtIndex((uint32_t)i);
         lldb::SBModule module = frame.GetModule();
-        lldb::SBCompileUnit compileUnit = frame.GetCompileUnit();
-        lldb::SBSymbolContext context(frame.GetSymbolContext(0x0000006e));
-        lldb::SBLineEntry entry(context.GetLineEntry());
 
         uint64_t address = (uint64_t)frame.GetPC();
+        uint32_t line = getFileLine(plugin, frame, filename, (int)sizeof(filename));
 
         module.GetFileSpec().GetPath(moduleName, sizeof(moduleName));
 
         PDWrite_array_entry_begin(writer);
 
-        if (compileUnit.GetNumSupportFiles() > 0)
+        if (filename[0] != 0)
         {
-            char filename[2048];
-            lldb::SBFileSpec fileSpec = compileUnit.GetSupportFileAtIndex(0);
-            fileSpec.GetPath(filename, sizeof(filename));
-            sprintf(fileLine, "%s:%d", filename, entry.GetLine());
+            sprintf(fileLine, "%s:%d", filename, line);
 
-            printf("callstack %s:%d\n", fileLine, entry.GetLine());
+            printf("callstack %s\n", fileLine);
 
             PDWrite_string(writer, "filename", filename);
-            PDWrite_u32(writer, "line", entry.GetLine());
+            PDWrite_u32(writer, "line", line);
         }
 
         PDWrite_string(writer, "module_name", moduleName);
@@ -257,18 +352,8 @@ static void setExceptionLocation(LLDBPlugin* plugin, PDWriter* writer)
     uint32_t frameIndex = getThreadFrame(plugin, plugin->selectedThreadId);
 
     lldb::SBFrame frame(thread.GetFrameAtIndex(frameIndex));
-    lldb::SBCompileUnit compileUnit = frame.GetCompileUnit();
-    lldb::SBFileSpec filespec(plugin->process.GetTarget().GetExecutable());
-
-    if (compileUnit.GetNumSupportFiles() > 0)
-    {
-        lldb::SBFileSpec fileSpec = compileUnit.GetSupportFileAtIndex(0);
-        fileSpec.GetPath(filename, sizeof(filename));
-    }
 
-    lldb::SBSymbolContext context(frame.GetSymbolContext(lldb::eSymbolContextEverything));
-    lldb::SBLineEntry entry(context.GetLineEntry());
-    uint32_t line = entry.GetLine();
+    uint32_t line = getFileLine(plugin, frame, filename, (int)sizeof(filename));
 
     PDWrite_event_begin(writer, PDEventType_SetExceptionLocation);
     PDWrite_string(writer, "filename", filename);
@@ -316,9 +401,20 @@ static void setExecutable(LLDBPlugin* plugin, PDReader* reader)
         printf("Unable to create valid target (%s)\n", filename);
 	}
 
+	if (plugin->debugInfo)
+		plugin->debugInfoFuncs->unload(plugin->debugInfo);
+
+	if (plugin->debugInfoLoading)
+		plugin->debugInfoFuncs->unload(plugin->debugInfoLoading);
+
+	// LLDB is used for lines and breakpoints until the host is done loading (see updateDebugInfo)
+
+	plugin->debugInfo = 0;
+	plugin->debugInfoLoading = plugin->debugInfoFuncs ? plugin->debugInfoFuncs->load(filename, 0) : 0;
+
 	for (Breakpoint& bp : plugin->breakpoints)
 	{
-		lldb::SBBreakpoint breakpoint = plugin->target.BreakpointCreateByLocation(bp.filename, (uint32_t)bp.line);
+		lldb::SBBreakpoint breakpoint = createBreakpoint(plugin, bp.filename, (uint32_t)bp.line);
 
 		if (!breakpoint.IsValid())
 		{
@@ -430,7 +526,7 @@ static void setBreakpoint(LLDBPlugin* plugin, PDReader* reader, PDWriter* writer
 
     // TODO: Handle failure here
 
-    lldb::SBBreakpoint breakpoint = plugin->target.BreakpointCreateByLocation(filename, line);
+    lldb::SBBreakpoint breakpoint = createBreakpoint(plugin, filename, line);
     if (!breakpoint.IsValid())
     {
 		printf("adding breakpoints to breakpoint list %s:%d\n", filename, line);
@@ -546,21 +642,40 @@ static void selectFrame(LLDBPlugin* plugin, PDReader* reader, PDWriter* writer)
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Adds the source files of all modules. Files of the executable are taken from the host debug info when it has been
+// loaded
 
-static void setSourceFiles(LLDBPlugin* plugin, PDWriter* writer)
+static void getSourceFiles(LLDBPlugin* plugin, std::set<std::string>& files)
 {
-	if (!plugin->hasValidTarget)
-		return;
+	char executable[4096];
+	executable[0] = 0;
 
-    PDWrite_event_begin(writer, PDEventType_SetSourceFiles);
-    PDWrite_array_begin(writer, "files");
+	if (plugin->debugInfo)
+	{
+		const char* file;
+		uint32_t i = 0;
+
+		for (; (file = plugin->debugInfoFuncs->source_file(plugin->debugInfo, i)); ++i)
+			files.insert(file);
+
+		if (i > 0)
+			plugin->target.GetExecutable().GetPath(executable, sizeof(executable));
+	}
 
     const uint32_t moduleCount = plugin->target.GetNumModules();
 
     for (uint32_t im = 0; im < moduleCount; ++im)
 	{
+		char modulePath[4096];
+
 		lldb::SBModule module(plugin->target.GetModuleAtIndex(im));
 
+		modulePath[0] = 0;
+		module.GetFileSpec().GetPath(modulePath, sizeof(modulePath));
+
+		if (executable[0] != 0 && !strcmp(modulePath, executable))
+			continue;
+
     	const uint32_t compileUnitCount = module.GetNumCompileUnits();
 
 		for (uint32_t ic = 0; ic < compileUnitCount; ++ic)
@@ -579,17 +694,82 @@ static void setSourceFiles(LLDBPlugin* plugin, PDWriter* writer)
 
         		fileSpec.GetPath(filename, sizeof(filename));
 
-        		if (filename[0] == 0)
-        			continue;
-
-				PDWrite_array_entry_begin(writer);
-				PDWrite_string(writer, "file", filename);
-				PDWrite_entry_end(writer);
+        		if (filename[0] != 0)
+        			files.insert(filename);
 			}
 		}
 	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template <typename T> static void writeFileArray(PDWriter* writer, const char* name, const T& files)
+{
+    PDWrite_array_begin(writer, name);
+
+	for (const std::string& file : files)
+	{
+		PDWrite_array_entry_begin(writer);
+		PDWrite_string(writer, "file", file.c_str());
+		PDWrite_entry_end(writer);
+	}
 
     PDWrite_array_end(writer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// The host asks for the files when it has no list so the full list is sent here
+
+static void setSourceFiles(LLDBPlugin* plugin, PDWriter* writer)
+{
+	plugin->sourceFiles.clear();
+	plugin->sourceFilesModuleCount = 0;
+
+	if (!plugin->hasValidTarget)
+		return;
+
+	getSourceFiles(plugin, plugin->sourceFiles);
+	plugin->sourceFilesModuleCount = plugin->target.GetNumModules();
+
+    PDWrite_event_begin(writer, PDEventType_SetSourceFiles);
+    writeFileArray(writer, "files", plugin->sourceFiles);
+    PDWrite_event_end(writer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sends the files that have been added or removed since the files were last sent. The list only changes when modules
+// are loaded or unloaded so it's only rebuilt when the module count changes
+
+static void updateSourceFiles(LLDBPlugin* plugin, PDWriter* writer)
+{
+	if (!plugin->hasValidTarget)
+		return;
+
+	const uint32_t moduleCount = plugin->target.GetNumModules();
+
+	if (moduleCount == plugin->sourceFilesModuleCount)
+		return;
+
+	std::set<std::string> files;
+	std::vector<std::string> added;
+	std::vector<std::string> removed;
+
+	getSourceFiles(plugin, files);
+
+	std::set_difference(files.begin(), files.end(), plugin->sourceFiles.begin(), plugin->sourceFiles.end(),
+						std::back_inserter(added));
+	std::set_difference(plugin->sourceFiles.begin(), plugin->sourceFiles.end(), files.begin(), files.end(),
+						std::back_inserter(removed));
+
+	plugin->sourceFiles.swap(files);
+	plugin->sourceFilesModuleCount = moduleCount;
+
+	if (added.empty() && removed.empty())
+		return;
+
+    PDWrite_event_begin(writer, PDEventType_SetSourceFiles);
+    writeFileArray(writer, "removed", removed);
+    writeFileArray(writer, "added", added);
     PDWrite_event_end(writer);
 }
 
@@ -675,6 +855,9 @@ static void updateLLDBEvent(LLDBPlugin* plugin, PDWriter* writer)
         case lldb::eStateStopped:
         case lldb::eStateSuspended:
         {
+            updateLoadBias(plugin);
+            updateSourceFiles(plugin, writer);
+
             //call_test_step = true;
             bool fatal = false;
             bool selected_thread = false;
@@ -781,6 +964,36 @@ static void updateLLDBEvent(LLDBPlugin* plugin, PDWriter* writer)
 
 
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Checks if the host is done loading the debug info. Once it is the load bias is set (the process may already be
+// running) and the source files are sent again as the files of the executable are now taken from the debug info
+
+static void updateDebugInfo(LLDBPlugin* plugin, PDWriter* writer)
+{
+	if (!plugin->debugInfoLoading)
+		return;
+
+	const int state = plugin->debugInfoFuncs->poll(plugin->debugInfoLoading);
+
+	if (state == PDDebugInfoState_Loading)
+		return;
+
+	if (state == PDDebugInfoState_Loaded)
+	{
+		plugin->debugInfo = plugin->debugInfoLoading;
+		updateLoadBias(plugin);
+
+		plugin->sourceFilesModuleCount = 0;
+		updateSourceFiles(plugin, writer);
+	}
+	else
+	{
+		plugin->debugInfoFuncs->unload(plugin->debugInfoLoading);
+	}
+
+	plugin->debugInfoLoading = 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static PDDebugState update(void* user_data, PDAction action, PDReader* reader, PDWriter* writer)
@@ -789,6 +1002,8 @@ static PDDebugState update(void* user_data, PDAction action, PDReader* reader, P
 
     processEvents(plugin, reader, writer);
 
+    updateDebugInfo(plugin, writer);
+
     doAction(plugin, action);
 
     if (plugin->state == PDDebugState_Running)
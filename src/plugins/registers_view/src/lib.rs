@@ -14,7 +14,7 @@ extern crate combo;
 
 use prodbg_api::{View, Ui, Service, Reader, Writer, PluginHandler, CViewCallbacks, ReadStatus,
                  EventType, PDUIWindowFlags_, ImGuiStyleVar, Vec2, StateSaver, StateLoader,
-                 LoadResult, PDUIInputTextFlags_, ImGuiCol, Color};
+                 LoadResult, PDUIInputTextFlags_, ImGuiCol, Color, RegisterFile};
 use number_view::*;
 use char_editor::{CharEditor, NextPosition, get_text_cursor_index};
 use combo::combo;
@@ -23,11 +23,14 @@ use combo::combo;
 const CHANGED_DATA_COLOR: u32 = 0xff0000ff;
 
 
-#[derive(Debug, Clone)]
-struct Register {
-    name: String,
+///
+/// A register while rendering. The value points into the storage of the RegisterFile.
+///
+struct Register<'a> {
+    name: &'a str,
     read_only: bool,
-    value: Vec<u8>,
+    value: &'a mut [u8],
+    prev_value: &'a [u8],
 }
 
 #[derive(Debug, Clone, Copy, PartialEq)]
@@ -200,7 +203,6 @@ impl RegistersSettings {
     fn render_register_data(&self,
                             ui: &mut Ui,
                             register: &mut Register,
-                            prev_register: Option<&Register>,
                             view: NumberView,
                             single_bar_width: usize,
                             cursor: &mut Option<EditingCursor>,
@@ -220,7 +222,8 @@ impl RegistersSettings {
         let chunks_count = register.value.len() / view.size.byte_count();
         let mut register_is_changed = false;
         const SPACES: &'static str = "                                                            ";
-        ui.push_id_str(&register.name);
+        ui.push_id_str(register.name);
+        let prev_value = register.prev_value;
         for (i, bytes) in register.value
             .chunks_mut(view.size.byte_count())
             .enumerate() {
@@ -238,19 +241,14 @@ impl RegistersSettings {
                 ui.text(" ");
             }
             ui.same_line(0, 0);
-            let is_marked = match prev_register {
-                Some(reg) => {
-                    &reg.value[i * bytes.len() .. (i + 1) * bytes.len()] != bytes
-                },
-                None => false,
-            };
+            let is_marked = &prev_value[i * bytes.len()..(i + 1) * bytes.len()] != bytes;
             let (next_pos, is_changed) =
-                Self::render_chunk(ui, &register.name, view, i, bytes, is_marked, cursor);
+                Self::render_chunk(ui, register.name, view, i, bytes, is_marked, cursor);
             if !register.read_only {
                 match next_pos {
                     NextPosition::Left if i > 0 => {
                         res = Some(EditingCursor {
-                            register_name: register.name.clone(),
+                            register_name: register.name.to_string(),
                             view: view,
                             chunk: i - 1,
                             editor: CharEditor::new(view.maximum_chars_needed() - 1),
@@ -258,7 +256,7 @@ impl RegistersSettings {
                     }
                     NextPosition::Right if i < chunks_count - 1 => {
                         res = Some(EditingCursor {
-                            register_name: register.name.clone(),
+                            register_name: register.name.to_string(),
                             view: view,
                             chunk: i + 1,
                             editor: CharEditor::new(0),
@@ -271,7 +269,7 @@ impl RegistersSettings {
         }
         ui.pop_id();
         if register_is_changed {
-            RegistersView::set_register(register, writer);
+            RegistersView::set_register(register.name, register.value, writer);
         }
         res
     }
@@ -339,7 +337,6 @@ impl RegistersSettings {
                        ui: &mut Ui,
                        width: usize,
                        register: &mut Register,
-                       prev_register: Option<&Register>,
                        shown_views: &mut Vec<bool>,
                        cursor: &mut Option<EditingCursor>,
                        writer: &mut Writer)
@@ -374,7 +371,6 @@ impl RegistersSettings {
                 ui.same_line(0, 0);
                 return self.render_register_data(ui,
                                                  register,
-                                                 prev_register,
                                                  default_view,
                                                  column_width,
                                                  cursor,
@@ -392,7 +388,6 @@ impl RegistersSettings {
                             .exec(|ui, is_expanded| {
                                 let mut res = self.render_register_data(ui,
                                                                         register,
-                                                                        prev_register,
                                                                         group[0].1,
                                                                         column_width,
                                                                         cursor,
@@ -405,7 +400,6 @@ impl RegistersSettings {
                                                          Self::get_view_short_name(view)));
                                         res = res.or(self.render_register_data(ui,
                                                                                register,
-                                                                               prev_register,
                                                                                view,
                                                                                column_width,
                                                                                cursor,
@@ -420,7 +414,6 @@ impl RegistersSettings {
                                          Self::get_view_short_name(group[0].1)));
                         res = res.or(self.render_register_data(ui,
                                                                register,
-                                                               prev_register,
                                                                group[0].1,
                                                                column_width,
                                                                cursor,
@@ -433,7 +426,6 @@ impl RegistersSettings {
                     ui.text(&format!("{1:>0$}  ", format_width, format_names[i]));
                     res = res.or(self.render_register_data(ui,
                                                            register,
-                                                           prev_register,
                                                            views[i],
                                                            column_width,
                                                            cursor,
@@ -446,8 +438,7 @@ impl RegistersSettings {
 }
 
 struct RegistersView {
-    registers: Vec<Register>,
-    prev_registers: Vec<Register>,
+    registers: RegisterFile,
     shown_register_views: Vec<Vec<bool>>,
     settings: RegistersSettings,
     cursor: Option<EditingCursor>,
@@ -456,23 +447,10 @@ struct RegistersView {
 
 impl RegistersView {
     fn update_registers(&mut self, reader: &mut Reader) -> Result<(), ReadStatus> {
-        // TODO: reuse old structures to prevent memory distortion
-        let mut new_registers = Vec::new();
-        for reg_data in try!(reader.find_array("registers")) {
-            let name = try!(reg_data.find_string("name")).to_string();
-            let read_only = reg_data.find_u8("read_only").unwrap_or(0) != 0;
-            let register = try!(reg_data.find_data("register"));
-            let mut data = Vec::new();
-            data.extend_from_slice(register);
-            new_registers.push(Register {
-                name: name,
-                read_only: read_only,
-                value: data,
-            });
-        }
-        self.registers = new_registers;
-        if self.prev_registers.is_empty() {
-            self.prev_registers = self.registers.clone();
+        // Registers are updated in place. If we got changes for a schema we don't have (such as
+        // when the view was opened after the backend sent it) the full set is requested again.
+        if !try!(self.registers.read(reader)) {
+            self.should_update = true;
         }
         Ok(())
     }
@@ -481,7 +459,6 @@ impl RegistersView {
         for event_type in reader.get_events() {
             match event_type {
                 et if et == EventType::SetRegisters as i32 => {
-                    std::mem::swap(&mut self.registers, &mut self.prev_registers);
                     if let Err(e) = self.update_registers(reader) {
                         panic!("Could not update registers: {:?}", e);
                     }
@@ -507,21 +484,23 @@ impl RegistersView {
     pub fn render(&mut self, ui: &mut Ui, writer: &mut Writer) {
         self.render_header(ui);
         let register_name_width =
-            self.registers.iter().map(|r| r.name.len()).max().unwrap_or(0usize);
+            self.registers.infos().iter().map(|r| r.name.len()).max().unwrap_or(0usize);
         ui.begin_child("##body", None, false, PDUIWindowFlags_::empty());
         ui.push_style_var_vec(ImGuiStyleVar::FramePadding, Vec2::new(0.0, 0.0));
         ui.push_style_var_vec(ImGuiStyleVar::ItemSpacing, Vec2 { x: 0.0, y: 0.0 });
         let mut cursor = None;
         self.shown_register_views.resize(self.registers.len(), Vec::new());
-        for (register, shown_views) in self.registers
-            .iter_mut()
-            .zip(self.shown_register_views.iter_mut()) {
-
-            let prev_register = self.prev_registers.iter().find(|reg| reg.name == register.name);
+        for (index, shown_views) in self.shown_register_views.iter_mut().enumerate() {
+            let (info, value, prev_value) = self.registers.get_mut(index);
+            let mut register = Register {
+                name: &info.name,
+                read_only: info.read_only,
+                value: value,
+                prev_value: prev_value,
+            };
             cursor = cursor.or(self.settings.render_register(ui,
                                                              register_name_width,
-                                                             register,
-                                                             prev_register,
+                                                             &mut register,
                                                              shown_views,
                                                              &mut self.cursor,
                                                              writer));
@@ -533,15 +512,19 @@ impl RegistersView {
         ui.end_child();
     }
 
-    pub fn set_register(register: &Register, writer: &mut Writer) {
+    pub fn set_register(name: &str, value: &[u8], writer: &mut Writer) {
         writer.event_begin(EventType::UpdateRegister as u16);
-        writer.write_string("name", &register.name);
-        writer.write_data("data", &register.value);
+        writer.write_string("name", name);
+        writer.write_data("data", value);
         writer.event_end();
     }
 
     pub fn request_registers(&mut self, writer: &mut Writer) {
         writer.event_begin(EventType::GetRegisters as u16);
+        // Lets the backend only send changes if we already have its register schema
+        if let Some(schema_id) = self.registers.schema_id() {
+            writer.write_u32("schema_id", schema_id);
+        }
         writer.event_end();
         self.should_update = false;
     }
@@ -550,8 +533,7 @@ impl RegistersView {
 impl View for RegistersView {
     fn new(_: &Ui, _: &Service) -> Self {
         RegistersView {
-            registers: Vec::new(),
-            prev_registers: Vec::new(),
+            registers: RegisterFile::new(),
             shown_register_views: Vec::new(),
             settings: RegistersSettings {
                 column_byte_count: None,
@@ -0,0 +1,113 @@
+use std::fs;
+use std::io::Result;
+use std::path::Path;
+use std::time::SystemTime;
+
+use prodbg_api::scintilla::Scintilla;
+use prodbg_api::MappedFile;
+
+// TODO: Move to scintilla.rs (by using rustbind-gen)
+const SCI_ADDTEXT: u32 = 2001;
+const SCI_EMPTYUNDOBUFFER: u32 = 2175;
+const SCI_SETSAVEPOINT: u32 = 2014;
+const SCI_SETDOCPOINTER: u32 = 2358;
+const SCI_CREATEDOCUMENT: u32 = 2375;
+const SCI_RELEASEDOCUMENT: u32 = 2377;
+
+struct Document {
+    filename: String,
+    modified: Option<SystemTime>,
+    // Scintilla document pointer. We hold one reference to it.
+    doc: u64,
+    last_used: u64,
+}
+
+///
+/// Keeps the most recently shown source files loaded as Scintilla documents. Switching to a file
+/// that is in the cache only swaps the document pointer so the text doesn't need to be loaded and
+/// lexed again. Files are reloaded if their modification time has changed.
+///
+pub struct DocumentCache {
+    documents: Vec<Document>,
+    capacity: usize,
+    tick: u64,
+    // Document currently set in the editor (0 if none of ours)
+    shown: u64,
+}
+
+impl DocumentCache {
+    pub fn new(capacity: usize) -> DocumentCache {
+        DocumentCache {
+            documents: Vec::new(),
+            capacity: capacity,
+            tick: 0,
+            shown: 0,
+        }
+    }
+
+    ///
+    /// Shows filename in the editor. Returns true if the file had to be (re)loaded.
+    ///
+    pub fn show(&mut self, sc: &Scintilla, filename: &str) -> Result<bool> {
+        let modified = try!(fs::metadata(filename)).modified().ok();
+
+        self.tick += 1;
+
+        if let Some(index) = self.documents.iter().position(|d| d.filename == filename) {
+            if self.documents[index].modified == modified && modified.is_some() {
+                let doc = self.documents[index].doc;
+                self.documents[index].last_used = self.tick;
+
+                // Setting the same document again would reset caret, scroll position and layout
+                if self.shown != doc {
+                    sc.send_command(SCI_SETDOCPOINTER, 0, doc);
+                    self.shown = doc;
+                }
+
+                return Ok(false);
+            }
+
+            // File has changed on disk
+            let doc = self.documents.swap_remove(index);
+            sc.send_command(SCI_RELEASEDOCUMENT, 0, doc.doc);
+        }
+
+        let file = try!(MappedFile::open(Path::new(filename)));
+        let data = file.data();
+
+        let doc = sc.send_command(SCI_CREATEDOCUMENT, 0, 0);
+        sc.send_command(SCI_SETDOCPOINTER, 0, doc);
+        self.shown = doc;
+        sc.send_command(SCI_ADDTEXT, data.len() as u64, data.as_ptr() as u64);
+        sc.send_command(SCI_EMPTYUNDOBUFFER, 0, 0);
+        sc.send_command(SCI_SETSAVEPOINT, 0, 0);
+
+        self.documents.push(Document {
+            filename: filename.to_owned(),
+            modified: modified,
+            doc: doc,
+            last_used: self.tick,
+        });
+
+        while self.documents.len() > self.capacity {
+            let index = self.lru_index();
+            // If the editor still shows the document it keeps its own reference to it
+            let doc = self.documents.swap_remove(index);
+            sc.send_command(SCI_RELEASEDOCUMENT, 0, doc.doc);
+        }
+
+        Ok(true)
+    }
+
+    fn lru_index(&self) -> usize {
+        let mut index = 0;
+
+        for (i, doc) in self.documents.iter().enumerate() {
+            if doc.last_used < self.documents[index].last_used {
+                index = i;
+            }
+        }
+
+        index
+    }
+}
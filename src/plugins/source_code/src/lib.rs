@@ -1,26 +1,41 @@
 #[macro_use]
 extern crate prodbg_api;
 
+mod document_cache;
+
 // TODO: Move to scintilla.rs (by using rustbind-gen) 
-const SCI_CLEARALL: u32 = 2004;
-const SCI_ADDTEXT: u32 = 2001;
 const SCN_TOGGLE_BREAKPOINT: u32 = 4431;
 const SCN_GETCURRENT_LINE: u32 = 4432;
 const SCI_GOTOLINE: u32 = 2024;
+const SCN_SETLEXTIMESLICE: u32 = 4433;
+const SCN_GETLEXSTATS: u32 = 4434;
 
 use prodbg_api::{View, Ui, Reader, Writer, StateSaver, StateLoader, LoadResult,
                  PluginHandler, Service, CViewCallbacks};
 
 use prodbg_api::scintilla::Scintilla;
 use prodbg_api::events::*;
-use std::io::Result;
-use std::fs::File;
-use std::io::Read;
+use document_cache::DocumentCache;
+
+// Number of source files to keep loaded
+const DOCUMENT_CACHE_SIZE: usize = 16;
+// Time per frame the editor may spend styling parts of the file that isn't visible
+const LEX_TIME_SLICE_US: u64 = 2000;
+
+#[repr(C)]
+#[derive(Default)]
+struct LexStats {
+    frame_micros: u64,
+    total_micros: u64,
+    end_styled: i32,
+    length: i32,
+}
 
 struct SourceCodeView {
     filename: String,
     line: u32,
     update_after_load: bool,
+    documents: DocumentCache,
 }
 
 impl SourceCodeView {
@@ -35,16 +50,19 @@ impl SourceCodeView {
         writer.event_end();
     }
 
-    fn update_file_data(sc: &Scintilla, filename: &str) -> Result<()> {
-        let mut file_data = "".to_owned();
-
-        let mut file = try!(File::open(filename));
-        let _ = try!(file.read_to_string(&mut file_data));
-
-        sc.send_command(SCI_CLEARALL, 0, 0);
-        sc.send_command_str(SCI_ADDTEXT, &file_data);
-
-        Ok(())
+    ///
+    /// Shows how far the background styling has come and what it costs while it's running
+    ///
+    fn show_lex_stats(sc: &Scintilla, ui: &Ui) {
+        let mut stats = LexStats::default();
+        sc.send_command(SCN_GETLEXSTATS, 0, &mut stats as *mut LexStats as u64);
+
+        if stats.end_styled < stats.length {
+            ui.text(&format!("Styling {}% ({:.2} ms last frame, {:.2} ms total)",
+                             stats.end_styled as u64 * 100 / stats.length as u64,
+                             stats.frame_micros as f32 / 1000.0,
+                             stats.total_micros as f32 / 1000.0));
+        }
     }
 
     // Calculate if we need to change the scroll based on where the cursor is
@@ -73,11 +91,12 @@ impl SourceCodeView {
     fn set_source_file(&mut self, sc: &Scintilla, filename: &str, line: u32) {
         self.line = line;
 
+        // Switches document if the file is cached and reloads it only if it changed on disk
+        if let Err(e) = self.documents.show(sc, filename) {
+            println!("Unable to update source view with {} err {:?}", filename, e);
+        }
+
         if self.filename != filename {
-            if let Err(e) = Self::update_file_data(sc, filename) { 
-                println!("Unable to update source view with {} err {:?}", filename, e);
-            }
-        
             self.filename = filename.to_owned();
         }
     }
@@ -97,14 +116,18 @@ impl View for SourceCodeView {
             filename: "".to_owned(),
             line: 1, 
             update_after_load: false,
+            documents: DocumentCache::new(DOCUMENT_CACHE_SIZE),
         }
     }
 
     fn update(&mut self, ui: &mut Ui, reader: &mut Reader, writer: &mut Writer) {
         let sc_text = ui.sc_input_text("test", 800, 700);
 
+        sc_text.send_command(SCN_SETLEXTIMESLICE, LEX_TIME_SLICE_US, 0);
+        Self::show_lex_stats(&sc_text, ui);
+
         if self.update_after_load {
-            if Self::update_file_data(&sc_text, &self.filename).is_err() {
+            if self.documents.show(&sc_text, &self.filename).is_err() {
                 println!("Unable to restore file {}", self.filename);
             }
 
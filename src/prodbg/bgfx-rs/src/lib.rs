@@ -620,6 +620,64 @@ impl Drop for VertexBuffer {
     }
 }
 
+/// Index buffer that can be updated after creation.
+pub struct DynamicIndexBuffer {
+    handle: bgfx_sys::bgfx_dynamic_index_buffer_handle_t,
+}
+
+impl DynamicIndexBuffer {
+    /// Creates a new dynamic index buffer with room for `count` indices.
+    #[inline]
+    pub fn new(count: u32, flags: BufferFlags) -> DynamicIndexBuffer {
+        unsafe {
+            let handle = bgfx_sys::bgfx_create_dynamic_index_buffer(count, flags.bits());
+            DynamicIndexBuffer { handle: handle }
+        }
+    }
+
+    /// Updates the buffer starting at index `start`.
+    #[inline]
+    pub fn update(&self, start: u32, indices: Memory) {
+        unsafe { bgfx_sys::bgfx_update_dynamic_index_buffer(self.handle, start, indices.handle) }
+    }
+}
+
+impl Drop for DynamicIndexBuffer {
+    #[inline]
+    fn drop(&mut self) {
+        unsafe { bgfx_sys::bgfx_destroy_dynamic_index_buffer(self.handle) }
+    }
+}
+
+/// Vertex buffer that can be updated after creation.
+pub struct DynamicVertexBuffer {
+    handle: bgfx_sys::bgfx_dynamic_vertex_buffer_handle_t,
+}
+
+impl DynamicVertexBuffer {
+    /// Creates a new dynamic vertex buffer with room for `count` vertices.
+    #[inline]
+    pub fn new(count: u32, decl: &VertexDecl, flags: BufferFlags) -> DynamicVertexBuffer {
+        unsafe {
+            let handle = bgfx_sys::bgfx_create_dynamic_vertex_buffer(count, &decl.decl, flags.bits());
+            DynamicVertexBuffer { handle: handle }
+        }
+    }
+
+    /// Updates the buffer starting at vertex `start`.
+    #[inline]
+    pub fn update(&self, start: u32, verts: Memory) {
+        unsafe { bgfx_sys::bgfx_update_dynamic_vertex_buffer(self.handle, start, verts.handle) }
+    }
+}
+
+impl Drop for DynamicVertexBuffer {
+    #[inline]
+    fn drop(&mut self) {
+        unsafe { bgfx_sys::bgfx_destroy_dynamic_vertex_buffer(self.handle) }
+    }
+}
+
 /// Describes the structure of a vertex.
 pub struct VertexDecl {
     decl: bgfx_sys::bgfx_vertex_decl_t,
@@ -818,6 +876,24 @@ impl Bgfx {
         }
     }
 
+    /// Sets the dynamic vertex buffer to use for rendering.
+    #[inline]
+    pub fn set_dynamic_vertex_buffer(dvb: &DynamicVertexBuffer, count: u32) {
+        unsafe { bgfx_sys::bgfx_set_dynamic_vertex_buffer(dvb.handle, count) }
+    }
+
+    /// Sets the range of the dynamic index buffer to use for rendering.
+    #[inline]
+    pub fn set_dynamic_index_buffer(dib: &DynamicIndexBuffer, offset: u32, count: u32) {
+        unsafe { bgfx_sys::bgfx_set_dynamic_index_buffer(dib.handle, offset, count) }
+    }
+
+    /// Sets the scissor rect for the next draw.
+    #[inline]
+    pub fn set_scissor(x: u16, y: u16, width: u16, height: u16) -> u16 {
+        unsafe { bgfx_sys::bgfx_set_scissor(x, y, width, height) }
+    }
+
     /// Sets the transient vertex buffer to use for rendering.
     #[inline]
     pub fn set_transient_index_buffer(tib: &TransientIndexBuffer, offset: u32, count: u32) {
@@ -0,0 +1,328 @@
+//! Debug Info Service 1
+//!
+//! Loads symbols and line info from ELF files for backends that don't have a fast way to get
+//! them from the target (such as LLDB on Linux which re-queries debug info at every stop). The
+//! symbols are added to the Symbols Service so all views can use them and the line info is
+//! resolved here. Parsed files are cached on disk by build-id.
+//!
+//! Parsing a big file takes seconds so load only starts it on a thread and the backend polls
+//! for the result (the other functions act as if there is no info until it's done).
+
+use std::env;
+use std::ffi::CString;
+use std::io;
+use std::os::raw::{c_char, c_int, c_void};
+use std::path::{Path, PathBuf};
+use std::ptr;
+use std::slice;
+use std::sync::{Mutex, Once, ONCE_INIT};
+use std::sync::mpsc::{channel, Receiver, TryRecvError};
+use std::thread;
+use elf_debug_info::DebugInfo;
+use symbols;
+
+struct LoadedFile {
+    name: String,
+    info: DebugInfo,
+    /// Where the file is loaded in the target compared to the addresses in the file
+    load_bias: u64,
+    symbol_module: u32,
+    /// Zero terminated copies of the file names for source_file
+    source_files: Vec<CString>,
+}
+
+impl LoadedFile {
+    ///
+    /// Adds the symbols at the current load bias. Replaces the ones added before.
+    ///
+    fn register_symbols(&mut self) {
+        let mut table = symbols::table().lock().unwrap();
+        let (start, end) = self.info.code_range.unwrap_or((0, 0));
+        let bias = self.load_bias;
+
+        self.symbol_module = table.add_module(&self.name, start.wrapping_add(bias), end - start);
+
+        for symbol in &self.info.symbols {
+            table.add_symbol(self.symbol_module, &symbol.name, symbol.address.wrapping_add(bias), symbol.size);
+        }
+    }
+}
+
+// Matches PDDebugInfoState in pd_debug_info.h
+const STATE_LOADING: c_int = 0;
+const STATE_LOADED: c_int = 1;
+const STATE_FAILED: c_int = 2;
+
+///
+/// A file being parsed on a background thread
+///
+struct LoadJob {
+    name: String,
+    /// Set if the bias is changed before the file is done
+    load_bias: u64,
+    receiver: Receiver<io::Result<DebugInfo>>,
+}
+
+enum Slot {
+    Loading(LoadJob),
+    Loaded(LoadedFile),
+    Failed,
+}
+
+///
+/// Handles are the index + 1 so 0 can be used for failure
+///
+struct LoadedFiles {
+    files: Vec<Option<Slot>>,
+}
+
+impl LoadedFiles {
+    fn slot(&mut self, handle: u32) -> Option<&mut Slot> {
+        match handle {
+            0 => None,
+            _ => self.files.get_mut(handle as usize - 1).and_then(|f| f.as_mut()),
+        }
+    }
+
+    ///
+    /// The file of the handle if it has been loaded
+    ///
+    fn get(&mut self, handle: u32) -> Option<&mut LoadedFile> {
+        match self.slot(handle) {
+            Some(&mut Slot::Loaded(ref mut file)) => Some(file),
+            _ => None,
+        }
+    }
+}
+
+static INIT: Once = ONCE_INIT;
+static mut FILES: *const Mutex<LoadedFiles> = 0 as *const Mutex<LoadedFiles>;
+
+fn files() -> &'static Mutex<LoadedFiles> {
+    unsafe {
+        INIT.call_once(|| {
+            FILES = Box::into_raw(Box::new(Mutex::new(LoadedFiles { files: Vec::new() })));
+        });
+        &*FILES
+    }
+}
+
+///
+/// $XDG_CACHE_HOME/prodbg/debug_info (or ~/.cache/prodbg/debug_info)
+///
+fn cache_dir() -> PathBuf {
+    let base = env::var_os("XDG_CACHE_HOME")
+        .map(PathBuf::from)
+        .or_else(|| env::var_os("HOME").map(|home| Path::new(&home).join(".cache")))
+        .unwrap_or_else(env::temp_dir);
+
+    base.join("prodbg").join("debug_info")
+}
+
+unsafe fn c_str<'a>(s: *const c_char) -> &'a str {
+    if s.is_null() {
+        ""
+    } else {
+        ::std::ffi::CStr::from_ptr(s).to_str().unwrap_or("")
+    }
+}
+
+extern "C" fn load(filename: *const c_char, load_bias: u64) -> u32 {
+    let name = unsafe { c_str(filename) }.to_owned();
+    let path = PathBuf::from(&name);
+    let (sender, receiver) = channel();
+
+    thread::spawn(move || {
+        sender.send(DebugInfo::load(&path, Some(&cache_dir()))).ok();
+    });
+
+    let job = LoadJob {
+        name: name,
+        load_bias: load_bias,
+        receiver: receiver,
+    };
+
+    let mut loaded = files().lock().unwrap();
+
+    match loaded.files.iter().position(|f| f.is_none()) {
+        Some(index) => {
+            loaded.files[index] = Some(Slot::Loading(job));
+            index as u32 + 1
+        }
+        None => {
+            loaded.files.push(Some(Slot::Loading(job)));
+            loaded.files.len() as u32
+        }
+    }
+}
+
+extern "C" fn poll(handle: u32) -> c_int {
+    let mut loaded = files().lock().unwrap();
+
+    let slot = match loaded.slot(handle) {
+        Some(slot) => slot,
+        None => return STATE_FAILED,
+    };
+
+    let (result, load_bias, name) = match *slot {
+        Slot::Loading(ref job) => {
+            let result = match job.receiver.try_recv() {
+                Ok(result) => result,
+                Err(TryRecvError::Empty) => return STATE_LOADING,
+                Err(TryRecvError::Disconnected) => {
+                    Err(io::Error::new(io::ErrorKind::Other, "the load thread stopped"))
+                }
+            };
+            (result, job.load_bias, job.name.clone())
+        }
+        Slot::Loaded(_) => return STATE_LOADED,
+        Slot::Failed => return STATE_FAILED,
+    };
+
+    let info = match result {
+        Ok(info) => info,
+        Err(e) => {
+            println!("Unable to load debug info from {} - {}", name, e);
+            *slot = Slot::Failed;
+            return STATE_FAILED;
+        }
+    };
+
+    let source_files = info.lines
+        .files()
+        .iter()
+        .filter(|f| !f.is_empty())
+        .filter_map(|f| CString::new(f.as_str()).ok())
+        .collect();
+
+    let mut file = LoadedFile {
+        name: name,
+        info: info,
+        load_bias: load_bias,
+        symbol_module: 0,
+        source_files: source_files,
+    };
+
+    file.register_symbols();
+
+    *slot = Slot::Loaded(file);
+    STATE_LOADED
+}
+
+extern "C" fn unload(handle: u32) {
+    let mut loaded = files().lock().unwrap();
+
+    if loaded.slot(handle).is_none() {
+        return;
+    }
+
+    // A file that is still loading is dropped when the thread is done with it
+    if let Some(Slot::Loaded(file)) = loaded.files[handle as usize - 1].take() {
+        symbols::table().lock().unwrap().remove_module(file.symbol_module);
+    }
+}
+
+extern "C" fn set_load_bias(handle: u32, load_bias: u64) {
+    match files().lock().unwrap().slot(handle) {
+        Some(&mut Slot::Loading(ref mut job)) => job.load_bias = load_bias,
+        Some(&mut Slot::Loaded(ref mut file)) => {
+            if file.load_bias != load_bias {
+                file.load_bias = load_bias;
+                file.register_symbols();
+            }
+        }
+        _ => (),
+    }
+}
+
+extern "C" fn resolve_address(handle: u32,
+                              address: u64,
+                              filename: *mut c_char,
+                              filename_size: c_int,
+                              line: *mut u32)
+                              -> c_int {
+    let mut loaded = files().lock().unwrap();
+
+    let file = match loaded.get(handle) {
+        Some(file) => file,
+        None => return 0,
+    };
+
+    let (name, found_line) = match file.info.lines.resolve_address(address.wrapping_sub(file.load_bias)) {
+        Some(res) => res,
+        None => return 0,
+    };
+
+    if !filename.is_null() && filename_size > 0 {
+        let dest = unsafe { slice::from_raw_parts_mut(filename as *mut u8, filename_size as usize) };
+        let len = name.len().min(dest.len() - 1);
+        dest[..len].copy_from_slice(&name.as_bytes()[..len]);
+        dest[len] = 0;
+    }
+
+    if !line.is_null() {
+        unsafe { *line = found_line };
+    }
+
+    1
+}
+
+extern "C" fn resolve_file_line(handle: u32, filename: *const c_char, line: u32, address: *mut u64) -> c_int {
+    let name = unsafe { c_str(filename) };
+    let mut loaded = files().lock().unwrap();
+
+    let file = match loaded.get(handle) {
+        Some(file) => file,
+        None => return 0,
+    };
+
+    match file.info.lines.find_address(name, line) {
+        Some(found) => {
+            if !address.is_null() {
+                unsafe { *address = found.wrapping_add(file.load_bias) };
+            }
+            1
+        }
+        None => 0,
+    }
+}
+
+extern "C" fn source_file(handle: u32, index: u32) -> *const c_char {
+    let mut loaded = files().lock().unwrap();
+
+    loaded.get(handle)
+        .and_then(|file| file.source_files.get(index as usize))
+        .map(|name| name.as_ptr())
+        .unwrap_or(ptr::null())
+}
+
+#[repr(C)]
+struct CDebugInfoFuncs1 {
+    load: extern "C" fn(filename: *const c_char, load_bias: u64) -> u32,
+    poll: extern "C" fn(handle: u32) -> c_int,
+    unload: extern "C" fn(handle: u32),
+    set_load_bias: extern "C" fn(handle: u32, load_bias: u64),
+    resolve_address: extern "C" fn(handle: u32,
+                                   address: u64,
+                                   filename: *mut c_char,
+                                   filename_size: c_int,
+                                   line: *mut u32)
+                                   -> c_int,
+    resolve_file_line: extern "C" fn(handle: u32, filename: *const c_char, line: u32, address: *mut u64)
+                                     -> c_int,
+    source_file: extern "C" fn(handle: u32, index: u32) -> *const c_char,
+}
+
+static DEBUG_INFO_FUNCS: CDebugInfoFuncs1 = CDebugInfoFuncs1 {
+    load: load,
+    poll: poll,
+    unload: unload,
+    set_load_bias: set_load_bias,
+    resolve_address: resolve_address,
+    resolve_file_line: resolve_file_line,
+    source_file: source_file,
+};
+
+pub fn get_debug_info_funcs() -> *mut c_void {
+    &DEBUG_INFO_FUNCS as *const CDebugInfoFuncs1 as *mut c_void
+}
@@ -2,10 +2,13 @@ extern crate minifb;
 extern crate notify;
 extern crate dynamic_reload;
 extern crate prodbg_api;
+extern crate elf_debug_info;
 
 pub mod menus;
 
 mod services;
+mod symbols;
+mod debug_info;
 
 pub mod plugins;
 pub mod plugin;
@@ -14,5 +17,6 @@ pub mod backend_plugin;
 pub mod reader_wrapper;
 pub mod session;
 pub mod plugin_io;
+pub mod source_catalog;
 
 pub use dynamic_reload::*;
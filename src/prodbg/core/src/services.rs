@@ -2,6 +2,8 @@ use std::os::raw::{c_void, c_char, c_uchar};
 use std::ffi::CStr;
 use std::ptr;
 use prodbg_api::id_register;
+use symbols;
+use debug_info;
 
 pub extern "C" fn get_services(type_name: *const c_uchar) -> *mut c_void {
     unsafe {
@@ -9,7 +11,10 @@ pub extern "C" fn get_services(type_name: *const c_uchar) -> *mut c_void {
 
         match name {
             "Capstone Service 1" => get_capstone_service_1(),
+            "Capstone Service 2" => get_capstone_service_2(),
             "IdFuncs 1" => id_register::get_id_register_funcs(),
+            "Symbols Service 1" => symbols::get_symbol_funcs(),
+            "Debug Info Service 1" => debug_info::get_debug_info_funcs(),
             _ => ptr::null_mut(),
         }
     }
@@ -17,4 +22,5 @@ pub extern "C" fn get_services(type_name: *const c_uchar) -> *mut c_void {
 
 extern "C" {
     fn get_capstone_service_1() -> *mut c_void;
+    fn get_capstone_service_2() -> *mut c_void;
 }
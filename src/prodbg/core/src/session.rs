@@ -3,6 +3,7 @@ use prodbg_api::backend::CBackendCallbacks;
 use plugins::PluginHandler;
 use reader_wrapper::{ReaderWrapper, WriterWrapper};
 use backend_plugin::{BackendHandle, BackendPlugins};
+use source_catalog::SourceCatalog;
 use std::os::raw::c_void;
 use prodbg_api::events::*;
 
@@ -26,6 +27,10 @@ pub struct Session {
     pub backend: Option<BackendHandle>,
     pub handle: SessionHandle,
     pub reader: Reader,
+    /// Source files reported by the backend
+    pub source_files: SourceCatalog,
+    /// Set if there were any events (from the backend or views) to process in the current update
+    has_events: bool,
 
     current_writer: usize,
     writers: [Writer; 2],
@@ -44,6 +49,8 @@ impl Session {
             handle: handle,
             writers: [WriterWrapper::create_writer(), WriterWrapper::create_writer()],
             reader: ReaderWrapper::create_reader(),
+            source_files: SourceCatalog::new(),
+            has_events: false,
             action: 0,
             current_writer: 0,
             backend: None,
@@ -60,7 +67,34 @@ impl Session {
 
     pub fn set_backend(&mut self, backend: Option<BackendHandle>) {
         // TODO: Make sure to close down current backend
-        self.backend = backend
+        self.backend = backend;
+        self.source_files.clear();
+
+        let writer = self.get_current_writer();
+        writer.event_begin(EVENT_GET_SOURCE_FILES as u16);
+        writer.event_end();
+    }
+
+    ///
+    /// Picks up events that the host itself keeps state for
+    ///
+    fn process_host_events(&mut self) {
+        self.has_events = false;
+
+        for event in self.reader.get_events() {
+            self.has_events = true;
+
+            if event == EVENT_SET_SOURCE_FILES {
+                self.source_files.update_from_reader(&self.reader);
+            }
+        }
+
+        ReaderWrapper::reset_reader(&mut self.reader);
+    }
+
+    #[inline]
+    pub fn has_events(&self) -> bool {
+        self.has_events
     }
 
     pub fn action_step(&mut self) {
@@ -111,6 +145,8 @@ impl Session {
         ReaderWrapper::init_from_writer(&mut self.reader, &self.writers[c_writer]);
         ReaderWrapper::reset_writer(&mut self.writers[n_writer]);
 
+        self.process_host_events();
+
         if let Some(backend) = backend_plugins.get_backend(self.backend) {
             unsafe {
                 let plugin_funcs = backend.plugin_type.plugin_funcs as *mut CBackendCallbacks;
@@ -162,6 +198,13 @@ impl Sessions {
         }
     }
 
+    ///
+    /// Returns true if any session has events that views needs to see this update
+    ///
+    pub fn has_events(&self) -> bool {
+        self.instances.iter().any(|session| session.has_events())
+    }
+
     pub fn get_current(&mut self) -> &mut Session {
         let current = self.current;
         &mut self.instances[current]
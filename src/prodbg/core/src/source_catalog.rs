@@ -0,0 +1,432 @@
+//! Catalog of the source files the backend knows about.
+//!
+//! Backends send their files with SetSourceFiles, either as a full list ("files") or as changes
+//! to what they sent before ("added" / "removed"). The catalog keeps a trigram index over the
+//! lower case paths (built on a few worker threads for large lists) which is used to find files
+//! containing the query directly. Paths that only match as a fuzzy sub-sequence are found by
+//! scanning with a per path character mask to skip most of them cheaply.
+
+use std::collections::HashMap;
+use std::sync::Arc;
+use std::thread;
+use std::cmp;
+use prodbg_api::read_write::Reader;
+
+// Below this many files the index is built on the calling thread
+const PARALLEL_BUILD_THRESHOLD: usize = 4096;
+const MAX_BUILD_THREADS: usize = 8;
+
+struct SourceFile {
+    path: String,
+    lower: String,
+    // Offset in lower where the file name starts
+    name_start: usize,
+    char_mask: u64,
+}
+
+pub struct SourceCatalog {
+    // Removed files are kept as None so ids stay stable for the index
+    files: Vec<Option<SourceFile>>,
+    ids: HashMap<String, u32>,
+    trigrams: HashMap<u32, Vec<u32>>,
+    count: usize,
+    version: u64,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Match {
+    pub id: u32,
+    pub score: i32,
+}
+
+#[inline]
+fn char_bit(c: u8) -> u64 {
+    match c {
+        b'a'...b'z' => 1 << (c - b'a'),
+        b'0'...b'9' => 1 << (26 + c - b'0'),
+        b'_' => 1 << 36,
+        b'.' => 1 << 37,
+        b'-' => 1 << 38,
+        b'/' | b'\\' => 1 << 39,
+        _ => 1 << 40,
+    }
+}
+
+fn char_mask(s: &[u8]) -> u64 {
+    s.iter().fold(0, |mask, c| mask | char_bit(*c))
+}
+
+#[inline]
+fn trigram(s: &[u8]) -> u32 {
+    ((s[0] as u32) << 16) | ((s[1] as u32) << 8) | s[2] as u32
+}
+
+fn trigrams(s: &[u8]) -> Vec<u32> {
+    let mut res: Vec<u32> = s.windows(3).map(trigram).collect();
+    res.sort();
+    res.dedup();
+    res
+}
+
+fn is_separator(c: u8) -> bool {
+    c == b'/' || c == b'\\' || c == b'_' || c == b'-' || c == b'.' || c == b' '
+}
+
+///
+/// Scores query (lower case) as a sub-sequence of path. Matches at the start of words,
+/// consecutive matches and matches in the file name scores higher. Returns None if the query
+/// isn't a sub-sequence of the path.
+///
+pub fn fuzzy_score(query: &[u8], lower: &[u8], name_start: usize) -> Option<i32> {
+    if query.is_empty() {
+        return Some(0);
+    }
+
+    // Prefer matching within the file name only if possible
+    let (start, name_bonus) = if is_subsequence(query, &lower[name_start..]) {
+        (name_start, 100)
+    } else {
+        (0, 0)
+    };
+
+    let mut score = name_bonus;
+    let mut qi = 0;
+    let mut prev_match = None;
+
+    for i in start..lower.len() {
+        if qi == query.len() {
+            break;
+        }
+
+        if lower[i] != query[qi] {
+            continue;
+        }
+
+        score += 16;
+
+        if i == 0 || is_separator(lower[i - 1]) {
+            score += 12;
+        }
+
+        if prev_match == Some(i.wrapping_sub(1)) {
+            score += 15;
+        }
+
+        prev_match = Some(i);
+        qi += 1;
+    }
+
+    if qi != query.len() {
+        return None;
+    }
+
+    // Exact file name (with or without extension) and substring matches goes first
+    let name = &lower[name_start..];
+    let stem = &name[..name.iter().rposition(|c| *c == b'.').unwrap_or(name.len())];
+
+    if name == query || stem == query {
+        score += 200;
+    } else if contains(lower, query) {
+        score += 50;
+    }
+
+    // Shorter paths wins ties
+    Some(score * 16 - cmp::min(lower.len(), 255) as i32)
+}
+
+fn is_subsequence(query: &[u8], s: &[u8]) -> bool {
+    let mut qi = 0;
+    for c in s {
+        if qi < query.len() && *c == query[qi] {
+            qi += 1;
+        }
+    }
+    qi == query.len()
+}
+
+fn contains(s: &[u8], sub: &[u8]) -> bool {
+    sub.len() <= s.len() && s.windows(sub.len()).any(|w| w == sub)
+}
+
+fn build_index(files: &[(u32, String)]) -> HashMap<u32, Vec<u32>> {
+    let mut index: HashMap<u32, Vec<u32>> = HashMap::new();
+
+    for &(id, ref lower) in files {
+        for t in trigrams(lower.as_bytes()) {
+            index.entry(t).or_insert_with(Vec::new).push(id);
+        }
+    }
+
+    index
+}
+
+impl SourceCatalog {
+    pub fn new() -> SourceCatalog {
+        SourceCatalog {
+            files: Vec::new(),
+            ids: HashMap::new(),
+            trigrams: HashMap::new(),
+            count: 0,
+            version: 0,
+        }
+    }
+
+    #[inline]
+    pub fn len(&self) -> usize {
+        self.count
+    }
+
+    ///
+    /// Bumped every time the set of files changes
+    ///
+    #[inline]
+    pub fn version(&self) -> u64 {
+        self.version
+    }
+
+    pub fn path(&self, id: u32) -> Option<&str> {
+        self.files.get(id as usize).and_then(|f| f.as_ref()).map(|f| f.path.as_str())
+    }
+
+    pub fn clear(&mut self) {
+        *self = SourceCatalog { version: self.version + 1, ..SourceCatalog::new() };
+    }
+
+    ///
+    /// Replaces all files
+    ///
+    pub fn set_files<'a, I: Iterator<Item = &'a str>>(&mut self, paths: I) {
+        self.clear();
+        self.add_files(paths);
+    }
+
+    ///
+    /// Adds files that aren't already in the catalog. Large batches are indexed in parallel.
+    ///
+    pub fn add_files<'a, I: Iterator<Item = &'a str>>(&mut self, paths: I) {
+        let mut new_files = Vec::new();
+
+        for path in paths {
+            if self.ids.contains_key(path) {
+                continue;
+            }
+
+            let id = self.files.len() as u32;
+            let lower = path.to_lowercase();
+            let name_start = lower.rfind(|c| c == '/' || c == '\\').map(|p| p + 1).unwrap_or(0);
+
+            self.files.push(Some(SourceFile {
+                path: path.to_owned(),
+                char_mask: char_mask(lower.as_bytes()),
+                lower: lower.clone(),
+                name_start: name_start,
+            }));
+
+            self.ids.insert(path.to_owned(), id);
+            new_files.push((id, lower));
+        }
+
+        if new_files.is_empty() {
+            return;
+        }
+
+        self.count += new_files.len();
+        self.version += 1;
+
+        let partial = if new_files.len() < PARALLEL_BUILD_THRESHOLD {
+            vec![build_index(&new_files)]
+        } else {
+            Self::build_index_parallel(new_files)
+        };
+
+        // ids are added in increasing order so the posting lists stay sorted
+        for index in partial {
+            for (t, ids) in index {
+                self.trigrams.entry(t).or_insert_with(Vec::new).extend(ids);
+            }
+        }
+    }
+
+    fn build_index_parallel(files: Vec<(u32, String)>) -> Vec<HashMap<u32, Vec<u32>>> {
+        let threads = cmp::min(MAX_BUILD_THREADS, files.len() / (PARALLEL_BUILD_THRESHOLD / 2));
+        let chunk_size = (files.len() + threads - 1) / threads;
+        let files = Arc::new(files);
+
+        let workers: Vec<_> = (0..threads)
+            .map(|i| {
+                let files = files.clone();
+                thread::spawn(move || {
+                    let start = i * chunk_size;
+                    let end = cmp::min(start + chunk_size, files.len());
+                    build_index(&files[start..end])
+                })
+            })
+            .collect();
+
+        // Joining in order keeps the ids sorted when merging
+        workers.into_iter().map(|w| w.join().unwrap_or_else(|_| HashMap::new())).collect()
+    }
+
+    pub fn remove_files<'a, I: Iterator<Item = &'a str>>(&mut self, paths: I) {
+        for path in paths {
+            let id = match self.ids.remove(path) {
+                Some(id) => id,
+                None => continue,
+            };
+
+            if let Some(file) = self.files[id as usize].take() {
+                for t in trigrams(file.lower.as_bytes()) {
+                    if let Some(ids) = self.trigrams.get_mut(&t) {
+                        if let Ok(pos) = ids.binary_search(&id) {
+                            ids.remove(pos);
+                        }
+                    }
+                }
+            }
+
+            self.count -= 1;
+            self.version += 1;
+        }
+    }
+
+    ///
+    /// Ids of all files that contains the query (at least 3 chars, lower case) as a substring
+    ///
+    fn substring_candidates(&self, query: &[u8]) -> Vec<u32> {
+        let mut lists: Vec<&Vec<u32>> = Vec::new();
+
+        for t in trigrams(query) {
+            match self.trigrams.get(&t) {
+                Some(ids) => lists.push(ids),
+                None => return Vec::new(),
+            }
+        }
+
+        lists.sort_by_key(|ids| ids.len());
+
+        let mut res = lists[0].clone();
+
+        for ids in &lists[1..] {
+            res.retain(|id| ids.binary_search(id).is_ok());
+        }
+
+        res
+    }
+
+    ///
+    /// Returns the best (at most max_count) fuzzy matches for query sorted by score
+    ///
+    pub fn search(&self, query: &str, max_count: usize) -> Vec<Match> {
+        let query = query.trim().to_lowercase();
+        let query = query.as_bytes();
+        let mut matches = Vec::new();
+
+        if query.len() >= 3 {
+            for id in self.substring_candidates(query) {
+                let file = self.files[id as usize].as_ref().unwrap();
+                if let Some(score) = fuzzy_score(query, file.lower.as_bytes(), file.name_start) {
+                    matches.push(Match { id: id, score: score });
+                }
+            }
+        }
+
+        // Not enough direct hits so look for fuzzy matches as well
+        if matches.len() < max_count {
+            let mask = char_mask(query);
+
+            for (id, file) in self.files.iter().enumerate() {
+                let file = match *file {
+                    Some(ref file) if file.char_mask & mask == mask => file,
+                    _ => continue,
+                };
+
+                if query.len() >= 3 && contains(file.lower.as_bytes(), query) {
+                    // Already found through the index
+                    continue;
+                }
+
+                if let Some(score) = fuzzy_score(query, file.lower.as_bytes(), file.name_start) {
+                    matches.push(Match { id: id as u32, score: score });
+                }
+            }
+        }
+
+        matches.sort_by(|a, b| b.score.cmp(&a.score).then(a.id.cmp(&b.id)));
+        matches.truncate(max_count);
+        matches
+    }
+
+    ///
+    /// Updates the catalog from a SetSourceFiles event
+    ///
+    pub fn update_from_reader(&mut self, reader: &Reader) {
+        if let Ok(files) = reader.find_array("files") {
+            let entries: Vec<Reader> = files.collect();
+            self.set_files(entries.iter().filter_map(|e| e.find_string("file").ok()));
+            return;
+        }
+
+        if let Ok(removed) = reader.find_array("removed") {
+            let entries: Vec<Reader> = removed.collect();
+            self.remove_files(entries.iter().filter_map(|e| e.find_string("file").ok()));
+        }
+
+        if let Ok(added) = reader.find_array("added") {
+            let entries: Vec<Reader> = added.collect();
+            self.add_files(entries.iter().filter_map(|e| e.find_string("file").ok()));
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn paths(catalog: &SourceCatalog, matches: &[Match]) -> Vec<String> {
+        matches.iter().map(|m| catalog.path(m.id).unwrap().to_owned()).collect()
+    }
+
+    #[test]
+    fn test_search_ranking() {
+        let mut catalog = SourceCatalog::new();
+        let files = ["src/core/session.rs",
+                     "src/core/source_catalog.rs",
+                     "src/plugins/source_code/src/lib.rs",
+                     "docs/sessions.md"];
+        catalog.set_files(files.iter().cloned());
+
+        let res = catalog.search("session", 10);
+        assert_eq!(paths(&catalog, &res), vec!["src/core/session.rs", "docs/sessions.md"]);
+
+        let res = catalog.search("srccat", 10);
+        assert_eq!(paths(&catalog, &res)[0], "src/core/source_catalog.rs");
+
+        assert_eq!(catalog.search("xyz", 10).len(), 0);
+    }
+
+    #[test]
+    fn test_diff_updates() {
+        let mut catalog = SourceCatalog::new();
+        catalog.add_files(["a/main.c", "a/util.c"].iter().cloned());
+        catalog.add_files(["a/main.c"].iter().cloned());
+        assert_eq!(catalog.len(), 2);
+
+        catalog.remove_files(["a/main.c"].iter().cloned());
+        assert_eq!(catalog.len(), 1);
+        assert_eq!(catalog.search("main", 10).len(), 0);
+        assert_eq!(catalog.search("util", 10).len(), 1);
+    }
+
+    #[test]
+    fn test_parallel_build() {
+        let names: Vec<String> = (0..PARALLEL_BUILD_THRESHOLD * 3)
+            .map(|i| format!("src/module{}/file{}.c", i % 100, i))
+            .collect();
+        let mut catalog = SourceCatalog::new();
+        catalog.set_files(names.iter().map(|s| s.as_str()));
+
+        let res = catalog.search("file12001.c", 1);
+        assert_eq!(paths(&catalog, &res), vec!["src/module1/file12001.c"]);
+        assert!(paths(&catalog, &catalog.search("module7/", 1))[0].starts_with("src/module7/"));
+    }
+}
@@ -0,0 +1,487 @@
+//! Symbols Service 1
+//!
+//! Backends register the symbols of the modules they load and any plugin can look up which
+//! symbol an address is in. Symbols may overlap (a local label inside a function for example)
+//! in which case the one that starts closest before the address wins (the smallest one if several
+//! start at the same address). When symbols change the
+//! ranges are flattened into a sorted list of non-overlapping intervals, each pointing at the
+//! innermost symbol covering it, so a lookup is a single binary search without any allocation.
+//!
+//! Names are stored zero terminated in one buffer so a lookup can hand out pointers to them.
+//! These stay valid until the symbols are changed.
+
+use std::cmp::{self, Reverse};
+use std::collections::BTreeMap;
+use std::io::{Cursor, Write};
+use std::os::raw::{c_char, c_int, c_void};
+use std::ffi::CStr;
+use std::slice;
+use std::str;
+use std::sync::{Mutex, Once, ONCE_INIT};
+use prodbg_api::symbols::{CSymbolFuncs1, CSymbolInfo};
+
+struct Module {
+    name: u32,
+    base: u64,
+    size: u64,
+    symbols: Vec<Symbol>,
+    /// Bytes used in the name buffer by the module and its symbols
+    name_bytes: usize,
+}
+
+#[derive(Clone, Copy)]
+struct Symbol {
+    start: u64,
+    /// 0 means it ends where the next symbol in the module starts
+    size: u64,
+    name: u32,
+}
+
+///
+/// A piece of the address space covered by a single (innermost) symbol
+///
+#[derive(Clone, Copy, Debug)]
+struct Interval {
+    start: u64,
+    end: u64,
+    module: u32,
+    symbol: u32,
+}
+
+pub struct SymbolLookup<'a> {
+    pub name: &'a str,
+    pub module: &'a str,
+    pub start: u64,
+    pub size: u64,
+    pub offset: u64,
+}
+
+pub struct SymbolTable {
+    /// Removed modules are None so the ids of the others stay the same
+    modules: Vec<Option<Module>>,
+    /// Zero terminated names
+    names: Vec<u8>,
+    /// Bytes in names used by removed modules
+    unused_name_bytes: usize,
+    index: Vec<Interval>,
+    dirty: bool,
+}
+
+impl SymbolTable {
+    pub fn new() -> SymbolTable {
+        SymbolTable {
+            modules: Vec::new(),
+            names: Vec::new(),
+            unused_name_bytes: 0,
+            index: Vec::new(),
+            dirty: false,
+        }
+    }
+
+    ///
+    /// Adds a module covering base..base + size. A module with the same name is replaced.
+    /// Returns the id used when adding symbols to it.
+    ///
+    pub fn add_module(&mut self, name: &str, base: u64, size: u64) -> u32 {
+        let existing = self.modules
+            .iter()
+            .position(|m| m.as_ref().map(|m| self.name(m.name) == name).unwrap_or(false));
+
+        if let Some(id) = existing {
+            self.remove_module(id as u32);
+        }
+
+        let module = Module {
+            name: self.add_name(name),
+            base: base,
+            size: size,
+            symbols: Vec::new(),
+            name_bytes: name.len() + 1,
+        };
+
+        self.dirty = true;
+
+        match existing.or_else(|| self.modules.iter().position(|m| m.is_none())) {
+            Some(id) => {
+                self.modules[id] = Some(module);
+                id as u32
+            }
+            None => {
+                self.modules.push(Some(module));
+                (self.modules.len() - 1) as u32
+            }
+        }
+    }
+
+    pub fn remove_module(&mut self, id: u32) {
+        if let Some(module) = self.modules.get_mut(id as usize) {
+            if let Some(module) = module.take() {
+                self.unused_name_bytes += module.name_bytes;
+                self.dirty = true;
+            }
+        }
+    }
+
+    ///
+    /// Adds a symbol at address. A size of 0 makes it end where the next symbol (or the module)
+    /// ends.
+    ///
+    pub fn add_symbol(&mut self, module: u32, name: &str, address: u64, size: u64) {
+        let name_offset = self.names.len() as u32;
+
+        match self.modules.get_mut(module as usize) {
+            Some(&mut Some(ref mut module)) => {
+                module.symbols.push(Symbol {
+                    start: address,
+                    size: size,
+                    name: name_offset,
+                });
+                module.name_bytes += name.len() + 1;
+            }
+            _ => return,
+        }
+
+        self.add_name(name);
+        self.dirty = true;
+    }
+
+    fn add_name(&mut self, name: &str) -> u32 {
+        let offset = self.names.len() as u32;
+        self.names.extend_from_slice(name.as_bytes());
+        self.names.push(0);
+        offset
+    }
+
+    ///
+    /// Drops the names of removed modules once they use more than half of the buffer
+    ///
+    fn compact_names(&mut self) {
+        if self.unused_name_bytes * 2 <= self.names.len() {
+            return;
+        }
+
+        let mut names = Vec::with_capacity(self.names.len() - self.unused_name_bytes);
+
+        for module in self.modules.iter_mut().filter_map(|m| m.as_mut()) {
+            for offset in Some(&mut module.name).into_iter().chain(module.symbols.iter_mut().map(|s| &mut s.name)) {
+                let start = *offset as usize;
+                let len = self.names[start..].iter().position(|&c| c == 0).unwrap();
+                *offset = names.len() as u32;
+                names.extend_from_slice(&self.names[start..start + len + 1]);
+            }
+        }
+
+        self.names = names;
+        self.unused_name_bytes = 0;
+    }
+
+    pub fn symbol_count(&self) -> usize {
+        self.modules.iter().filter_map(|m| m.as_ref()).map(|m| m.symbols.len()).sum()
+    }
+
+    fn name(&self, offset: u32) -> &str {
+        let bytes = &self.names[offset as usize..];
+        let len = bytes.iter().position(|&c| c == 0).unwrap_or(bytes.len());
+        // Only added from &str
+        unsafe { str::from_utf8_unchecked(&bytes[..len]) }
+    }
+
+    ///
+    /// Sorts the symbols and rebuilds the interval index. Called on the first lookup after
+    /// symbols have changed.
+    ///
+    fn build_index(&mut self) {
+        self.dirty = false;
+        self.index.clear();
+        self.compact_names();
+
+        // (start, end, module, symbol) for all symbols
+        let mut ranges = Vec::with_capacity(self.symbol_count());
+
+        for (module_id, module) in self.modules.iter_mut().enumerate() {
+            let module = match *module {
+                Some(ref mut module) => module,
+                None => continue,
+            };
+
+            module.symbols.sort_by(|a, b| a.start.cmp(&b.start));
+
+            let module_end = if module.size == 0 { u64::max_value() } else { module.base + module.size };
+
+            for i in 0..module.symbols.len() {
+                let symbol = module.symbols[i];
+
+                let end = if symbol.size != 0 {
+                    symbol.start.saturating_add(symbol.size)
+                } else {
+                    module.symbols[i + 1..]
+                        .iter()
+                        .map(|s| s.start)
+                        .find(|&start| start > symbol.start)
+                        .unwrap_or(module_end)
+                };
+
+                if end > symbol.start {
+                    ranges.push((symbol.start, end, module_id as u32, i as u32));
+                }
+            }
+        }
+
+        ranges.sort_by(|a, b| a.0.cmp(&b.0));
+
+        // Sweep over the start and end points. The active symbols are keyed on (start, end
+        // reversed, order) so the innermost (latest starting and for the same start the earliest
+        // ending) one is the last entry.
+        let mut ends = ranges.iter().enumerate().map(|(i, r)| (r.1, i)).collect::<Vec<_>>();
+        ends.sort();
+
+        let mut active = BTreeMap::new();
+        let mut next_start = 0;
+        let mut next_end = 0;
+        let mut pos = 0;
+
+        while next_start < ranges.len() || next_end < ends.len() {
+            let point = match (ranges.get(next_start), ends.get(next_end)) {
+                (Some(r), Some(e)) => cmp::min(r.0, e.0),
+                (Some(r), None) => r.0,
+                (None, Some(e)) => e.0,
+                (None, None) => break,
+            };
+
+            if let Some((_, &i)) = active.iter().next_back() {
+                let r: &(u64, u64, u32, u32) = &ranges[i];
+                self.push_interval(pos, point, r.2, r.3);
+            }
+
+            while next_end < ends.len() && ends[next_end].0 == point {
+                let i = ends[next_end].1;
+                active.remove(&(ranges[i].0, Reverse(ranges[i].1), i));
+                next_end += 1;
+            }
+
+            while next_start < ranges.len() && ranges[next_start].0 == point {
+                active.insert((point, Reverse(ranges[next_start].1), next_start), next_start);
+                next_start += 1;
+            }
+
+            pos = point;
+        }
+    }
+
+    fn push_interval(&mut self, start: u64, end: u64, module: u32, symbol: u32) {
+        if start >= end {
+            return;
+        }
+
+        // Merge with the previous piece if it's the same symbol
+        if let Some(last) = self.index.last_mut() {
+            if last.end == start && last.module == module && last.symbol == symbol {
+                last.end = end;
+                return;
+            }
+        }
+
+        self.index.push(Interval {
+            start: start,
+            end: end,
+            module: module,
+            symbol: symbol,
+        });
+    }
+
+    pub fn lookup(&mut self, address: u64) -> Option<SymbolLookup> {
+        if self.dirty {
+            self.build_index();
+        }
+
+        let index = match self.index.binary_search_by(|i| i.start.cmp(&address)) {
+            Ok(index) => index,
+            Err(0) => return None,
+            Err(index) => index - 1,
+        };
+
+        let interval = self.index[index];
+
+        if address >= interval.end {
+            return None;
+        }
+
+        let module = self.modules[interval.module as usize].as_ref().unwrap();
+        let symbol = module.symbols[interval.symbol as usize];
+
+        Some(SymbolLookup {
+            name: self.name(symbol.name),
+            module: self.name(module.name),
+            start: symbol.start,
+            size: symbol.size,
+            offset: address - symbol.start,
+        })
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// C interface
+
+static INIT: Once = ONCE_INIT;
+static mut TABLE: *const Mutex<SymbolTable> = 0 as *const Mutex<SymbolTable>;
+
+pub fn table() -> &'static Mutex<SymbolTable> {
+    unsafe {
+        INIT.call_once(|| {
+            TABLE = Box::into_raw(Box::new(Mutex::new(SymbolTable::new())));
+        });
+        &*TABLE
+    }
+}
+
+unsafe fn c_str<'a>(s: *const c_char) -> &'a str {
+    if s.is_null() {
+        ""
+    } else {
+        CStr::from_ptr(s).to_str().unwrap_or("")
+    }
+}
+
+extern "C" fn add_module(name: *const c_char, base: u64, size: u64) -> u32 {
+    let name = unsafe { c_str(name) };
+    table().lock().unwrap().add_module(name, base, size)
+}
+
+extern "C" fn remove_module(module: u32) {
+    table().lock().unwrap().remove_module(module)
+}
+
+extern "C" fn add_symbol(module: u32, name: *const c_char, address: u64, size: u64) {
+    let name = unsafe { c_str(name) };
+    table().lock().unwrap().add_symbol(module, name, address, size)
+}
+
+extern "C" fn lookup(address: u64, info: *mut CSymbolInfo) -> c_int {
+    let mut table = table().lock().unwrap();
+
+    match table.lookup(address) {
+        Some(symbol) => {
+            if !info.is_null() {
+                unsafe {
+                    // Names are zero terminated in the table so the pointers can be used directly
+                    (*info).name = symbol.name.as_ptr() as *const c_char;
+                    (*info).module = symbol.module.as_ptr() as *const c_char;
+                    (*info).start = symbol.start;
+                    (*info).size = symbol.size;
+                    (*info).offset = symbol.offset;
+                }
+            }
+            1
+        }
+        None => 0,
+    }
+}
+
+extern "C" fn format_address(address: u64, buffer: *mut c_char, buffer_size: c_int) -> c_int {
+    if buffer.is_null() || buffer_size <= 0 {
+        return 0;
+    }
+
+    let mut table = table().lock().unwrap();
+
+    let symbol = match table.lookup(address) {
+        Some(symbol) => symbol,
+        None => return 0,
+    };
+
+    let dest = unsafe { slice::from_raw_parts_mut(buffer as *mut u8, buffer_size as usize) };
+    let mut cursor = Cursor::new(&mut dest[..buffer_size as usize - 1]);
+
+    // Truncated if it doesn't fit
+    let _ = if symbol.offset == 0 {
+        write!(cursor, "{}", symbol.name)
+    } else {
+        write!(cursor, "{}+0x{:x}", symbol.name, symbol.offset)
+    };
+
+    let len = cursor.position() as usize;
+    dest[len] = 0;
+    len as c_int
+}
+
+static SYMBOL_FUNCS: CSymbolFuncs1 = CSymbolFuncs1 {
+    add_module: add_module,
+    remove_module: remove_module,
+    add_symbol: add_symbol,
+    lookup: lookup,
+    format_address: format_address,
+};
+
+pub fn get_symbol_funcs() -> *mut c_void {
+    &SYMBOL_FUNCS as *const CSymbolFuncs1 as *mut c_void
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_nested_symbols() {
+        let mut table = SymbolTable::new();
+        let code = table.add_module("code", 0x1000, 0x1000);
+
+        table.add_symbol(code, "main", 0x1000, 0);
+        table.add_symbol(code, "helper", 0x1100, 0x80);
+        table.add_symbol(code, ".loop", 0x1110, 0x10);
+        table.add_symbol(code, "tail", 0x1800, 0);
+
+        assert!(table.lookup(0xfff).is_none());
+        assert_eq!(table.lookup(0x1000).unwrap().name, "main");
+        assert_eq!(table.lookup(0x1114).unwrap().name, ".loop");
+        assert_eq!(table.lookup(0x1114).unwrap().offset, 4);
+        assert_eq!(table.lookup(0x1120).unwrap().name, "helper");
+        // main has no size so it ends at the next symbol
+        assert!(table.lookup(0x1180).is_none());
+        assert_eq!(table.lookup(0x1fff).unwrap().name, "tail");
+        assert!(table.lookup(0x2000).is_none());
+
+        // Replacing the module drops the old symbols
+        let code = table.add_module("code", 0x1000, 0x1000);
+        table.add_symbol(code, "start", 0x1000, 4);
+        assert_eq!(table.lookup(0x1000).unwrap().name, "start");
+        assert_eq!(table.lookup(0x1000).unwrap().module, "code");
+        assert!(table.lookup(0x1004).is_none());
+
+        table.remove_module(code);
+        assert!(table.lookup(0x1000).is_none());
+    }
+
+    #[test]
+    fn test_same_start() {
+        let mut table = SymbolTable::new();
+        let code = table.add_module("code", 0, 0x100);
+
+        // The inner symbol wins no matter which one is added first
+        table.add_symbol(code, "inner", 0, 4);
+        table.add_symbol(code, "outer", 0, 0x80);
+
+        assert_eq!(table.lookup(2).unwrap().name, "inner");
+        assert_eq!(table.lookup(4).unwrap().name, "outer");
+        assert_eq!(table.lookup(4).unwrap().offset, 4);
+
+        let data = table.add_module("data", 0x100, 0x100);
+        table.add_symbol(data, "outer", 0x100, 0x80);
+        table.add_symbol(data, "inner", 0x100, 4);
+
+        assert_eq!(table.lookup(0x102).unwrap().name, "inner");
+        assert_eq!(table.lookup(0x17f).unwrap().name, "outer");
+    }
+
+    #[test]
+    fn test_many_symbols() {
+        let mut table = SymbolTable::new();
+        let module = table.add_module("big", 0, 0);
+
+        for i in 0..150_000u64 {
+            table.add_symbol(module, &format!("sym_{}", i), i * 16, 0);
+        }
+
+        assert_eq!(table.lookup(16 * 12345 + 3).unwrap().name, "sym_12345");
+        assert_eq!(table.lookup(16 * 149_999 + 100).unwrap().name, "sym_149999");
+    }
+}
@@ -365,6 +365,14 @@ impl Imgui {
         }
     }
 
+    ///
+    /// Bumped every time a texture is created or its contents updated
+    ///
+    #[inline]
+    pub fn texture_change_count() -> u32 {
+        unsafe { imgui_get_texture_change_count() }
+    }
+
     #[inline]
     pub fn pre_update(delta_time: f32) {
         unsafe { imgui_pre_update(delta_time) }
@@ -415,6 +423,7 @@ extern "C" {
     fn imgui_setup(filename: *const c_char, size: f32, width: u32, height: u32);
     fn imgui_get_font_tex_data() -> ImFontTextData;
     fn imgui_get_draw_data() -> *const ImDrawData;
+    fn imgui_get_texture_change_count() -> u32;
     fn imgui_pre_update(delta_time: f32);
     fn imgui_update_size(width: u16, height: u16);
     fn imgui_post_update();
@@ -15,6 +15,7 @@ pub const MENU_DEBUG_STEP_IN: usize = 103;
 pub const MENU_DEBUG_STEP_OVER: usize = 104;
 pub const MENU_DEBUG_TOGGLE_BREAKPOINT: usize = 105;
 pub const MENU_DEBUG_STOP: usize = 106;
+pub const MENU_FILE_QUICK_OPEN_SOURCE: usize = 200;
 
 pub struct Menu {
     pub file_menu: MinifbMenu,
@@ -40,6 +41,10 @@ impl Menu {
             .shortcut(Key::O, MENU_KEY_CTRL)
             .build();
 
+        menu.add_item("Quick Open Source...", MENU_FILE_QUICK_OPEN_SOURCE)
+            .shortcut(Key::P, MENU_KEY_CTRL)
+            .build();
+
         menu.add_item("Start new backend...", MENU_FILE_START_NEW_BACKEND)
             .shortcut(Key::N, MENU_KEY_CTRL)
             .build();
@@ -3,14 +3,20 @@
 use imgui_sys::Imgui;
 use prodbg_api::ui_ffi::ImguiKey;
 use minifb::{InputCallback, Key};
+use std::rc::Rc;
+use std::cell::Cell;
 
 
 /// Passes input characters from Minifb to ImGui
-pub struct KeyCharCallback;
+pub struct KeyCharCallback {
+    /// Set when a character has been received so the window knows that it has input
+    pub received: Rc<Cell<bool>>,
+}
 
 impl InputCallback for KeyCharCallback {
     fn add_char(&mut self, key: u32) {
         Imgui::add_input_character(key as u16);
+        self.received.set(true);
     }
 }
 
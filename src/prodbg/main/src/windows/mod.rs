@@ -15,10 +15,15 @@ use self::window::Window;
 use self::keys::KeyCharCallback;
 use menu::{MENU_FILE_BACKEND_START, MENU_FILE_BACKEND_END};
 use project::Project;
+use std::time::{Duration, Instant};
 
 const WIDTH: i32 = 1280;
 const HEIGHT: i32 = 800;
 
+/// When nothing is going on (no input, no events and the output hasn't changed) frames are only
+/// built at this interval so views that change by themselves still gets updated.
+const IDLE_FRAME_INTERVAL_MS: u64 = 250;
+
 /// ! Windows keeps track of all different windows that are present with in the application
 /// ! There are several ways windows can be created:
 /// !
@@ -31,6 +36,8 @@ pub struct Windows {
     windows: Vec<Window>,
     current: usize,
     renderer: Renderer,
+    /// Time when the last frame was built
+    last_frame: Instant,
 }
 
 impl Windows {
@@ -39,6 +46,7 @@ impl Windows {
             windows: Vec::new(),
             renderer: Renderer::new(),
             current: 0,
+            last_frame: Instant::now(),
         }
     }
 
@@ -74,7 +82,8 @@ impl Windows {
 
         let mut window = try!(self.create_window(width, height));
 
-        window.win.set_input_callback(Box::new(KeyCharCallback {}));
+        let char_callback = KeyCharCallback { received: window.char_received.clone() };
+        window.win.set_input_callback(Box::new(char_callback));
 
         Self::add_backend_menus(&mut window, backend_plugins);
 
@@ -89,6 +98,19 @@ impl Windows {
                   sessions: &mut Sessions,
                   view_plugins: &mut ViewPlugins,
                   backend_plugins: &mut BackendPlugins) {
+        // Window events are processed once per loop (also for skipped frames to find out when
+        // something happens). Doing it here means that key presses that made us build the frame
+        // are still reported as pressed while it's built.
+        for win in &mut self.windows {
+            win.win.update();
+        }
+
+        if self.can_skip_frame(sessions) {
+            return;
+        }
+
+        self.last_frame = Instant::now();
+
         for win in &mut self.windows {
             win.pre_update();
         }
@@ -112,6 +134,19 @@ impl Windows {
         self.renderer.post_update();
     }
 
+    /// Checks if building the next frame can be skipped as it would look the same as the current one
+    fn can_skip_frame(&mut self, sessions: &Sessions) -> bool {
+        // All windows has to be checked as they keep track of the previous input state
+        let mut has_input = false;
+
+        for win in &mut self.windows {
+            has_input |= win.has_input_activity();
+        }
+
+        !has_input && !sessions.has_events() && self.renderer.is_idle() &&
+        self.last_frame.elapsed() < Duration::from_millis(IDLE_FRAME_INTERVAL_MS)
+    }
+
     pub fn get_current(&mut self) -> &mut Window {
         let current = self.current;
         &mut self.windows[current]
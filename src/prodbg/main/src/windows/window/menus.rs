@@ -57,6 +57,7 @@ impl Window {
             MENU_DEBUG_STOP => current_session.action_stop(),
             MENU_DEBUG_START => current_session.action_run(),
             MENU_FILE_OPEN_SOURCE => self.browse_source_file(view_plugins, current_session),
+            MENU_FILE_QUICK_OPEN_SOURCE => self.show_quick_open(),
             MENU_DEBUG_TOGGLE_BREAKPOINT => {
                 let writer = current_session.get_current_writer();
                 writer.event_begin(events::EVENT_TOGGLE_BREAKPOINT_CURRENT_LINE as u16);
@@ -21,9 +21,11 @@ use std::collections::VecDeque;
 use statusbar::Statusbar;
 use prodbg_api::{events, Vec2};
 use self::mouse::MouseState;
-use self::popup::ViewRenameState;
+use self::popup::{QuickOpenState, ViewRenameState};
 use self::layout::{PluginInstanceInfo, WindowLayout};
 use std::collections::HashMap;
+use std::rc::Rc;
+use std::cell::Cell;
 
 const OVERLAY_COLOR: u32 = 0x8000FF00;
 const WORKSPACE_UNDO_LIMIT: usize = 10;
@@ -85,6 +87,15 @@ pub struct Window {
 
     /// View currently being renamed
     view_rename_state: ViewRenameState,
+
+    /// State of the quick open popup if it's being shown
+    quick_open: Option<QuickOpenState>,
+
+    /// Mouse position and window size when input activity was last checked
+    last_mouse_pos: (f32, f32),
+    last_size: (usize, usize),
+    /// Set by the input callback when characters have been typed since input was last checked
+    pub char_received: Rc<Cell<bool>>,
 }
 
 
@@ -114,6 +125,10 @@ impl Window {
             custom_menu_height: 0.0,
             config_backend: None,
             view_rename_state: ViewRenameState::None,
+            quick_open: None,
+            last_mouse_pos: (0.0, 0.0),
+            last_size: (0, 0),
+            char_received: Rc::new(Cell::new(false)),
         };
 
         res.initialize_workspace_state();
@@ -130,10 +145,6 @@ impl Window {
                   sessions: &mut Sessions,
                   view_plugins: &mut ViewPlugins,
                   backend_plugins: &mut BackendPlugins) {
-
-        // Update minifb window to get current window size
-        self.win.update();
-
         // Update menus first to find out size of self-drawn menus (if any)
         self.update_menus(view_plugins, sessions, backend_plugins);
 
@@ -183,6 +194,7 @@ impl Window {
         // if now plugin has showed a menu we do it here
         // TODO: Handle diffrent cases when attach menu on to plugin menu or not
         self.render_popup(show_context_menu && has_shown_menu == 0, view_plugins);
+        self.render_quick_open(view_plugins, sessions.get_current());
 
         // If we have a backend configuration running
         self.update_backend_configure(sessions, backend_plugins);
@@ -45,6 +45,28 @@ impl Window {
         self.win.get_mouse_pos(MouseMode::Clamp).unwrap_or((0.0, 0.0))
     }
 
+    /// Returns true if there has been any mouse or keyboard input, or the window has been resized
+    /// or closed, since the last call.
+    pub fn has_input_activity(&mut self) -> bool {
+        let mouse = self.get_mouse_pos();
+        let size = self.win.get_size();
+        let has_chars = self.char_received.get();
+
+        let active = has_chars || mouse != self.last_mouse_pos || size != self.last_size ||
+                     !self.win.is_open() ||
+                     self.win.get_mouse_down(MouseButton::Left) ||
+                     self.win.get_mouse_down(MouseButton::Right) ||
+                     self.win.get_mouse_down(MouseButton::Middle) ||
+                     self.win.get_scroll_wheel().is_some() ||
+                     self.win.get_keys().map_or(false, |keys| !keys.is_empty());
+
+        self.last_mouse_pos = mouse;
+        self.last_size = size;
+        self.char_received.set(false);
+
+        active
+    }
+
     /// Sends current mouse keys and scroll state to ImGui
     pub fn update_imgui_mouse(&self) {
         Imgui::set_mouse_pos(self.get_mouse_pos());
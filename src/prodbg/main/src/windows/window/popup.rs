@@ -2,10 +2,15 @@
 
 use super::Window;
 use core::view_plugins::{ViewHandle, ViewPlugins};
-use core::session::SessionHandle;
+use core::session::{Session, SessionHandle};
+use core::source_catalog::Match;
 use super::super::viewdock::{Direction, DockHandle};
 use imgui_sys::Imgui;
 use prodbg_api::{PDUIINPUTTEXTFLAGS_AUTOSELECTALL, PDUIINPUTTEXTFLAGS_ENTERRETURNSTRUE, Ui};
+use prodbg_api::{Key, Vec2};
+use prodbg_api::ui_ffi::PDUISelectableFlags__;
+
+const QUICK_OPEN_MAX_RESULTS: usize = 50;
 
 /// Current state of "Rename view" popup
 pub enum ViewRenameState {
@@ -14,6 +19,35 @@ pub enum ViewRenameState {
     Showing(DockHandle, Box<[u8; 100]>),
 }
 
+/// Current state of "Quick Open Source" popup
+pub struct QuickOpenState {
+    query: Box<[u8; 256]>,
+    set_focus: bool,
+    // Query and catalog version the results were searched for
+    last_query: String,
+    last_version: u64,
+    results: Vec<Match>,
+    selected: usize,
+}
+
+impl QuickOpenState {
+    fn new() -> QuickOpenState {
+        QuickOpenState {
+            query: Box::new([0; 256]),
+            set_focus: true,
+            last_query: String::new(),
+            last_version: u64::max_value(),
+            results: Vec::new(),
+            selected: 0,
+        }
+    }
+
+    fn query(&self) -> &str {
+        let null_index = self.query.iter().position(|c| *c == 0).unwrap_or(self.query.len());
+        ::std::str::from_utf8(&self.query[..null_index]).unwrap_or("")
+    }
+}
+
 enum ViewRenameRenderResult {
     Showing,
     Accepted,
@@ -185,4 +219,90 @@ impl Window {
             self.view_rename_state = val
         }
     }
+
+    pub fn show_quick_open(&mut self) {
+        self.quick_open = Some(QuickOpenState::new());
+    }
+
+    ///
+    /// Shows a popup that searches the source files reported by the backend of the session and
+    /// opens the selected one
+    ///
+    pub fn render_quick_open(&mut self, view_plugins: &mut ViewPlugins, session: &mut Session) {
+        let mut open_file = None;
+        let mut close = false;
+
+        if let Some(ref mut state) = self.quick_open {
+            let ui = Imgui::get_ui();
+
+            if state.set_focus {
+                ui.open_popup("##quick_open_popup");
+            }
+
+            if ui.begin_popup("##quick_open_popup") {
+                if state.set_focus {
+                    ui.set_keyboard_focus_here(0);
+                    state.set_focus = false;
+                }
+
+                let accepted = ui.input_text("##quick_open_input",
+                                             state.query.as_mut(),
+                                             PDUIINPUTTEXTFLAGS_ENTERRETURNSTRUE,
+                                             None);
+
+                // Only search again when the query or the catalog has changed
+                let version = session.source_files.version();
+                if state.query() != state.last_query || version != state.last_version {
+                    state.last_query = state.query().to_owned();
+                    state.last_version = version;
+                    state.results = session.source_files.search(&state.last_query, QUICK_OPEN_MAX_RESULTS);
+                    state.selected = 0;
+                }
+
+                if ui.is_key_pressed(Key::Down, true) && state.selected + 1 < state.results.len() {
+                    state.selected += 1;
+                }
+
+                if ui.is_key_pressed(Key::Up, true) && state.selected > 0 {
+                    state.selected -= 1;
+                }
+
+                if session.source_files.len() == 0 {
+                    ui.text("No source files reported by the backend");
+                }
+
+                for (i, m) in state.results.iter().enumerate() {
+                    if let Some(path) = session.source_files.path(m.id) {
+                        if ui.selectable(path, i == state.selected, PDUISelectableFlags__::empty(), Vec2::new(0.0, 0.0)) {
+                            open_file = Some(path.to_owned());
+                        }
+                    }
+                }
+
+                if accepted && open_file.is_none() {
+                    open_file = state.results
+                        .get(state.selected)
+                        .and_then(|m| session.source_files.path(m.id))
+                        .map(|path| path.to_owned());
+                }
+
+                if accepted || open_file.is_some() || ui.is_key_pressed(Key::Escape, false) {
+                    ui.close_current_popup();
+                    close = true;
+                }
+
+                ui.end_popup();
+            } else {
+                close = true;
+            }
+        }
+
+        if close {
+            self.quick_open = None;
+        }
+
+        if let Some(file) = open_file {
+            self.open_source_file(&file, view_plugins, session);
+        }
+    }
 }
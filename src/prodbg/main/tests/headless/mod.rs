@@ -0,0 +1,98 @@
+//! Builds imgui frames on one of the headless renderer backends so UI performance can be tested
+//! without a GPU or a window (such as on CI). bgfx can only be initialized once per process so
+//! each backend has its own test file.
+
+use std::env;
+use std::path::Path;
+use std::time::Duration;
+use imgui_sys::Imgui;
+use renderer::{Backend, FrameStats, Renderer};
+
+pub const WIDTH: u16 = 1280;
+pub const HEIGHT: u16 = 800;
+
+// Very generous as debug builds on shared CI machines can be slow. It's here to catch frames that
+// suddenly take orders of magnitude longer.
+const MAX_FRAME_TIME_MS: u64 = 100;
+const BENCH_FRAMES: u32 = 200;
+
+fn build_frame(renderer: &mut Renderer, lines: usize) -> FrameStats {
+    renderer.pre_update();
+
+    let ui = Imgui::get_ui();
+
+    Imgui::set_window_pos(0.0, 0.0);
+    Imgui::set_window_size(WIDTH as f32, HEIGHT as f32);
+    Imgui::begin_window("Headless", true);
+
+    for i in 0..lines {
+        ui.text(&format!("0x{:08x} move.l d0,(a0)+", i * 2));
+    }
+
+    Imgui::end_window();
+
+    renderer.post_update();
+    renderer.frame_stats()
+}
+
+///
+/// Sets up the renderer and checks the stats for new, unchanged and changed frames. Returns the
+/// renderer so the caller can check backend specific parts.
+///
+pub fn run(backend: Backend) -> Renderer {
+    // Shaders and fonts are loaded relative to the root of the repo
+    env::set_current_dir(Path::new(env!("CARGO_MANIFEST_DIR")).join("../../..")).unwrap();
+
+    let mut renderer = Renderer::with_backend(backend);
+    renderer.setup_headless(WIDTH, HEIGHT).unwrap();
+
+    let first = build_frame(&mut renderer, 20);
+
+    assert!(!first.skipped);
+    assert!(first.draw_calls > 0);
+    assert!(first.vertices > 0 && first.indices > 0);
+    assert_eq!(first.vertices_uploaded, first.vertices);
+    assert!(first.frame_time < Duration::from_millis(MAX_FRAME_TIME_MS));
+
+    // Once imgui has settled the same UI gives the same output which isn't submitted again
+    for _ in 0..10 {
+        if renderer.is_idle() {
+            break;
+        }
+        build_frame(&mut renderer, 20);
+    }
+
+    assert!(renderer.is_idle());
+
+    let same = build_frame(&mut renderer, 20);
+    assert!(same.skipped);
+    assert_eq!(same.draw_calls, 0);
+    assert_eq!(same.vertices_uploaded, 0);
+
+    let changed = build_frame(&mut renderer, 30);
+    assert!(!changed.skipped);
+    assert!(changed.draw_calls > 0);
+    assert!(changed.vertices > same.vertices);
+
+    // Frame time with the output changing every frame
+    let mut total = Duration::from_secs(0);
+
+    for frame in 0..BENCH_FRAMES {
+        let stats = build_frame(&mut renderer, 20 + (frame as usize % 2) * 10);
+        assert!(!stats.skipped);
+        total += stats.frame_time;
+    }
+
+    let average = total / BENCH_FRAMES;
+    let micros = average.as_secs() * 1_000_000 + average.subsec_nanos() as u64 / 1000;
+
+    println!("{:?}: {} us/frame, {} draw calls, {} vertices",
+             backend,
+             micros,
+             changed.draw_calls,
+             changed.vertices);
+
+    assert!(average < Duration::from_millis(MAX_FRAME_TIME_MS));
+
+    renderer
+}
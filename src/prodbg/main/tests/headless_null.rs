@@ -0,0 +1,14 @@
+extern crate imgui_sys;
+extern crate renderer;
+
+mod headless;
+
+use renderer::Backend;
+
+#[test]
+fn test_null_renderer_frames() {
+    let renderer = headless::run(Backend::Null);
+
+    assert_eq!(renderer.backend(), Backend::Null);
+    assert!(renderer.software_image().is_none());
+}
@@ -0,0 +1,19 @@
+extern crate imgui_sys;
+extern crate renderer;
+
+mod headless;
+
+use renderer::Backend;
+
+#[test]
+fn test_software_renderer_frames() {
+    let renderer = headless::run(Backend::Software);
+
+    let (pixels, width, height) = renderer.software_image().unwrap();
+
+    assert_eq!((width, height), (headless::WIDTH as usize, headless::HEIGHT as usize));
+    assert_eq!(pixels.len(), width * height);
+
+    // Something besides the clear color has to have been drawn
+    assert!(pixels.iter().any(|p| *p != pixels[0]));
+}
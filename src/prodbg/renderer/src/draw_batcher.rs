@@ -0,0 +1,405 @@
+//! Keeps the imgui geometry in persistent GPU buffers.
+//!
+//! All draw lists are stored after each other in one vertex and one index buffer. Lists are
+//! hashed every frame and only lists that has changed (or moved because a list before them
+//! changed size) are uploaded again. The buffers grow geometrically so they are only recreated a
+//! few times. As all lists share the buffers commands with the same texture and clip rect are
+//! merged into one submit even across lists.
+
+use std::mem;
+use std::slice;
+use std::os::raw::c_void;
+use imgui_sys::{ImDrawCmd, ImDrawIdx, ImDrawVert, ImDrawList};
+
+///
+/// Storage the batcher uploads to. Implemented on top of bgfx dynamic buffers by the renderer.
+///
+pub trait GeometryBuffers {
+    /// Recreate the buffers with (at least) the given capacity. Old content is lost.
+    fn resize(&mut self, vertex_count: usize, index_count: usize);
+    fn update_vertices(&mut self, start: usize, vertices: &[ImDrawVert]);
+    fn update_indices(&mut self, start: usize, indices: &[u32]);
+}
+
+///
+/// Geometry of one imgui draw list
+///
+pub struct DrawListData<'a> {
+    pub cmds: &'a [ImDrawCmd],
+    pub indices: &'a [ImDrawIdx],
+    pub vertices: &'a [ImDrawVert],
+}
+
+impl<'a> DrawListData<'a> {
+    pub unsafe fn from_draw_list(list: *const ImDrawList) -> DrawListData<'a> {
+        DrawListData {
+            cmds: (*list).cmd_buffer.as_slice(),
+            indices: (*list).idx_buffer.as_slice(),
+            vertices: (*list).vtx_buffer.as_slice(),
+        }
+    }
+}
+
+///
+/// Range of indices that can be drawn with one submit
+///
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct Batch {
+    pub texture_id: *mut c_void,
+    /// x0, y0, x1, y1
+    pub clip_rect: [f32; 4],
+    pub index_start: u32,
+    pub index_count: u32,
+}
+
+#[derive(Default, Clone, Copy)]
+struct ListInfo {
+    hash: u64,
+    vertex_start: usize,
+    index_start: usize,
+}
+
+#[derive(Default, Debug, Clone, Copy)]
+pub struct BatchStats {
+    pub lists_uploaded: usize,
+    pub vertices_uploaded: usize,
+    pub indices_uploaded: usize,
+}
+
+pub struct DrawBatcher {
+    lists: Vec<ListInfo>,
+    batches: Vec<Batch>,
+    // Indices rebased to the start of the list in the shared vertex buffer
+    indices: Vec<u32>,
+    vertex_capacity: usize,
+    index_capacity: usize,
+    vertex_count: usize,
+    frame_hash: u64,
+    stats: BatchStats,
+}
+
+#[inline]
+fn hash_u64(hash: u64, value: u64) -> u64 {
+    (hash.rotate_left(5) ^ value).wrapping_mul(0x517cc1b727220a95)
+}
+
+fn hash_slice<T>(mut hash: u64, data: &[T]) -> u64 {
+    let len = data.len() * mem::size_of::<T>();
+    let bytes = unsafe { slice::from_raw_parts(data.as_ptr() as *const u8, len) };
+
+    hash = hash_u64(hash, len as u64);
+
+    for chunk in bytes.chunks(8) {
+        let mut value = 0u64;
+        for &b in chunk {
+            value = (value << 8) | b as u64;
+        }
+        hash = hash_u64(hash, value);
+    }
+
+    hash
+}
+
+fn hash_list(list: &DrawListData) -> u64 {
+    let mut hash = 0;
+
+    for cmd in list.cmds {
+        hash = hash_u64(hash, cmd.elem_count as u64);
+        hash = hash_u64(hash, cmd.texture_id as u64);
+        hash = hash_slice(hash, &[cmd.clip_rect.x, cmd.clip_rect.y, cmd.clip_rect.z, cmd.clip_rect.w]);
+    }
+
+    hash = hash_slice(hash, list.indices);
+    hash_slice(hash, list.vertices)
+}
+
+impl DrawBatcher {
+    pub fn new() -> DrawBatcher {
+        DrawBatcher {
+            lists: Vec::new(),
+            batches: Vec::new(),
+            indices: Vec::new(),
+            vertex_capacity: 0,
+            index_capacity: 0,
+            vertex_count: 0,
+            frame_hash: 0,
+            stats: BatchStats::default(),
+        }
+    }
+
+    ///
+    /// Batches to submit for the last prepared frame
+    ///
+    #[inline]
+    pub fn batches(&self) -> &[Batch] {
+        &self.batches
+    }
+
+    ///
+    /// Number of vertices used by the last prepared frame
+    ///
+    #[inline]
+    pub fn vertex_count(&self) -> usize {
+        self.vertex_count
+    }
+
+    ///
+    /// Hash of everything in the last prepared frame. Same hash means the frame looks the same.
+    ///
+    #[inline]
+    pub fn frame_hash(&self) -> u64 {
+        self.frame_hash
+    }
+
+    #[inline]
+    pub fn stats(&self) -> BatchStats {
+        self.stats
+    }
+
+    ///
+    /// Uploads the changed parts of the draw lists to buffers and builds the batches to submit
+    ///
+    pub fn prepare<B: GeometryBuffers>(&mut self, lists: &[DrawListData], buffers: &mut B) {
+        let vertex_total = lists.iter().fold(0, |acc, list| acc + list.vertices.len());
+        let index_total = lists.iter().fold(0, |acc, list| acc + list.indices.len());
+        let mut all_dirty = false;
+
+        self.stats = BatchStats::default();
+
+        if vertex_total > self.vertex_capacity || index_total > self.index_capacity {
+            self.vertex_capacity = cmp_max(vertex_total, self.vertex_capacity * 2, 4096);
+            self.index_capacity = cmp_max(index_total, self.index_capacity * 2, 8192);
+            buffers.resize(self.vertex_capacity, self.index_capacity);
+            all_dirty = true;
+        }
+
+        self.lists.resize(lists.len(), ListInfo::default());
+        self.batches.clear();
+        self.frame_hash = 0;
+
+        let mut vertex_start = 0;
+        let mut index_start = 0;
+
+        for (list, info) in lists.iter().zip(self.lists.iter_mut()) {
+            let hash = hash_list(list);
+
+            self.frame_hash = hash_u64(self.frame_hash, hash);
+
+            if all_dirty || hash != info.hash || vertex_start != info.vertex_start ||
+               index_start != info.index_start {
+                self.indices.clear();
+                self.indices.extend(list.indices.iter().map(|&i| i as u32 + vertex_start as u32));
+
+                buffers.update_vertices(vertex_start, list.vertices);
+                buffers.update_indices(index_start, &self.indices);
+
+                self.stats.lists_uploaded += 1;
+                self.stats.vertices_uploaded += list.vertices.len();
+                self.stats.indices_uploaded += list.indices.len();
+
+                info.hash = hash;
+                info.vertex_start = vertex_start;
+                info.index_start = index_start;
+            }
+
+            let mut offset = index_start as u32;
+
+            for cmd in list.cmds {
+                if cmd.elem_count == 0 {
+                    continue;
+                }
+
+                let clip_rect = [cmd.clip_rect.x, cmd.clip_rect.y, cmd.clip_rect.z, cmd.clip_rect.w];
+
+                let start = offset;
+                offset += cmd.elem_count;
+
+                // Commands are always after each other in the index buffer so only state matters
+                if let Some(batch) = self.batches.last_mut() {
+                    if batch.texture_id == cmd.texture_id && batch.clip_rect == clip_rect {
+                        batch.index_count += cmd.elem_count;
+                        continue;
+                    }
+                }
+
+                self.batches.push(Batch {
+                    texture_id: cmd.texture_id,
+                    clip_rect: clip_rect,
+                    index_start: start,
+                    index_count: cmd.elem_count,
+                });
+            }
+
+            vertex_start += list.vertices.len();
+            index_start += list.indices.len();
+        }
+
+        self.vertex_count = vertex_start;
+    }
+}
+
+#[inline]
+fn cmp_max(a: usize, b: usize, c: usize) -> usize {
+    ::std::cmp::max(a, ::std::cmp::max(b, c))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::ptr;
+    use std::time::Instant;
+    use imgui_sys::{ImDrawCmd, ImDrawVert, ImVec2, ImVec4};
+
+    struct CpuBuffers {
+        vertices: Vec<ImDrawVert>,
+        indices: Vec<u32>,
+    }
+
+    impl GeometryBuffers for CpuBuffers {
+        fn resize(&mut self, vertex_count: usize, index_count: usize) {
+            self.vertices = vec![ImDrawVert::default(); vertex_count];
+            self.indices = vec![0; index_count];
+        }
+
+        fn update_vertices(&mut self, start: usize, vertices: &[ImDrawVert]) {
+            self.vertices[start..start + vertices.len()].copy_from_slice(vertices);
+        }
+
+        fn update_indices(&mut self, start: usize, indices: &[u32]) {
+            self.indices[start..start + indices.len()].copy_from_slice(indices);
+        }
+    }
+
+    struct TestList {
+        cmds: Vec<ImDrawCmd>,
+        indices: Vec<u16>,
+        vertices: Vec<ImDrawVert>,
+    }
+
+    fn cmd(count: u32, texture: usize, clip: f32) -> ImDrawCmd {
+        ImDrawCmd {
+            elem_count: count,
+            clip_rect: ImVec4 { x: 0.0, y: 0.0, z: clip, w: clip },
+            texture_id: texture as *mut _,
+            user_callback: None,
+            user_callback_data: ptr::null_mut(),
+        }
+    }
+
+    // Roughly what a view full of text looks like: quads with one command per clip rect
+    fn make_list(quads: usize, seed: u32, cmds: Vec<ImDrawCmd>) -> TestList {
+        let mut vertices = Vec::with_capacity(quads * 4);
+        let mut indices = Vec::with_capacity(quads * 6);
+
+        for q in 0..quads {
+            let base = (q * 4) as u16;
+            for v in 0..4 {
+                vertices.push(ImDrawVert {
+                    pos: ImVec2 { x: (q * 8 + v) as f32, y: seed as f32 },
+                    uv: ImVec2 { x: 0.0, y: 0.0 },
+                    col: seed,
+                });
+            }
+            indices.extend_from_slice(&[base, base + 1, base + 2, base, base + 2, base + 3]);
+        }
+
+        TestList {
+            cmds: cmds,
+            indices: indices,
+            vertices: vertices,
+        }
+    }
+
+    fn data(lists: &[TestList]) -> Vec<DrawListData> {
+        lists.iter()
+            .map(|l| {
+                DrawListData {
+                    cmds: &l.cmds,
+                    indices: &l.indices,
+                    vertices: &l.vertices,
+                }
+            })
+            .collect()
+    }
+
+    fn new_buffers() -> CpuBuffers {
+        CpuBuffers {
+            vertices: Vec::new(),
+            indices: Vec::new(),
+        }
+    }
+
+    #[test]
+    fn test_upload_and_merge() {
+        let mut batcher = DrawBatcher::new();
+        let mut buffers = new_buffers();
+
+        let mut lists = vec![make_list(2, 1, vec![cmd(6, 0, 100.0), cmd(6, 0, 100.0)]),
+                             make_list(1, 2, vec![cmd(6, 0, 100.0)]),
+                             make_list(1, 3, vec![cmd(6, 5, 100.0)])];
+
+        batcher.prepare(&data(&lists), &mut buffers);
+
+        assert_eq!(batcher.stats().lists_uploaded, 3);
+        assert_eq!(batcher.batches().len(), 2);
+        assert_eq!(batcher.batches()[0].index_count, 18);
+        assert_eq!(batcher.batches()[1].index_start, 18);
+        // indices of the second list points to its vertices in the shared buffer
+        assert_eq!(buffers.indices[12], 8);
+
+        let hash = batcher.frame_hash();
+        batcher.prepare(&data(&lists), &mut buffers);
+        assert_eq!(batcher.stats().lists_uploaded, 0);
+        assert_eq!(batcher.frame_hash(), hash);
+
+        lists[2].vertices[0].col = 7;
+        batcher.prepare(&data(&lists), &mut buffers);
+        assert_eq!(batcher.stats().lists_uploaded, 1);
+        assert!(batcher.frame_hash() != hash);
+        assert_eq!(buffers.vertices[12].col, 7);
+
+        // growing the first list moves the others
+        lists[0] = make_list(3, 1, vec![cmd(18, 0, 100.0)]);
+        batcher.prepare(&data(&lists), &mut buffers);
+        assert_eq!(batcher.stats().lists_uploaded, 3);
+        assert_eq!(buffers.indices[18], 12);
+    }
+
+    ///
+    /// Frame time for a layout with 20 views where one view changes each frame. Run with
+    /// cargo test --release -- --ignored --nocapture
+    ///
+    #[test]
+    #[ignore]
+    fn bench_20_views() {
+        const FRAMES: usize = 1000;
+
+        let mut lists: Vec<TestList> = (0..20)
+            .map(|i| make_list(2000, i, (0..40).map(|_| cmd(300, 0, 100.0 + i as f32)).collect()))
+            .collect();
+
+        let mut batcher = DrawBatcher::new();
+        let mut buffers = new_buffers();
+        let mut uploaded = 0;
+        let mut batches = 0;
+
+        let start = Instant::now();
+
+        for frame in 0..FRAMES {
+            lists[frame % 20].vertices[0].col = frame as u32;
+            batcher.prepare(&data(&lists), &mut buffers);
+            uploaded += batcher.stats().vertices_uploaded;
+            batches += batcher.batches().len();
+        }
+
+        let elapsed = start.elapsed();
+        let micros = elapsed.as_secs() * 1_000_000 + elapsed.subsec_nanos() as u64 / 1000;
+
+        println!("20 views: {} us/frame, {} vertices uploaded/frame (of {}), {} submits/frame (of {} commands)",
+                 micros / FRAMES as u64,
+                 uploaded / FRAMES,
+                 batcher.vertex_count(),
+                 batches / FRAMES,
+                 20 * 40);
+    }
+}
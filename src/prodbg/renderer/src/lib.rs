@@ -1,12 +1,67 @@
 extern crate bgfx;
 extern crate imgui_sys;
 
+pub mod draw_batcher;
+pub mod soft_raster;
+
 use std::io;
 use std::io::Read;
 use std::fs::File;
 use std::os::raw::c_void;
-use bgfx::{Bgfx, BgfxError, Program, Uniform, TransientIndexBuffer, TransientVertexBuffer};
-use imgui_sys::Imgui;
+use std::env;
+use std::time::{Duration, Instant};
+use bgfx::{Bgfx, BgfxError, Program, Uniform, DynamicIndexBuffer, DynamicVertexBuffer};
+use imgui_sys::{Imgui, ImDrawVert};
+use draw_batcher::{DrawBatcher, DrawListData, GeometryBuffers};
+use soft_raster::{CpuGeometry, SoftRasterizer};
+
+// While the output is unchanged presenting is skipped, but every this many frames it's presented
+// anyway in case the window system has thrown away the contents of the window.
+const MAX_SKIPPED_PRESENTS: u32 = 30;
+
+// Number of frames in a row with the same output before the renderer is considered idle
+const IDLE_FRAME_COUNT: u32 = 2;
+
+///
+/// Selects how the UI is rendered. Set with the PRODBG_RENDERER environment variable
+/// ("null" or "software") to run without a GPU, such as when running UI benchmarks on CI.
+///
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum Backend {
+    /// Regular GPU rendering using the default bgfx renderer for the platform
+    Default,
+    /// bgfx null renderer. Everything is built and submitted but nothing is drawn.
+    Null,
+    /// bgfx null renderer with the UI rasterized on the CPU to an in-memory image
+    Software,
+}
+
+impl Backend {
+    pub fn from_env() -> Backend {
+        match env::var("PRODBG_RENDERER") {
+            Ok(ref name) if name == "null" => Backend::Null,
+            Ok(ref name) if name == "software" => Backend::Software,
+            _ => Backend::Default,
+        }
+    }
+}
+
+///
+/// Numbers for the last frame, used for UI performance tests
+///
+#[derive(Debug, Default, Clone, Copy)]
+pub struct FrameStats {
+    /// Number of submitted draw calls
+    pub draw_calls: usize,
+    pub vertices: usize,
+    pub indices: usize,
+    /// Number of vertices uploaded this frame (only changed draw lists are uploaded)
+    pub vertices_uploaded: usize,
+    /// Time spent from imgui rendering until the frame was submitted
+    pub frame_time: Duration,
+    /// The frame was the same as the previous one and wasn't submitted
+    pub skipped: bool,
+}
 
 #[repr(C)]
 struct UiVertex {
@@ -40,27 +95,88 @@ impl UiVertex {
     }
 }
 
+///
+/// bgfx dynamic buffers that holds the geometry of all imgui draw lists
+///
+struct UiBuffers {
+    vertex_decl: bgfx::VertexDecl,
+    vertices: Option<DynamicVertexBuffer>,
+    indices: Option<DynamicIndexBuffer>,
+}
+
+impl GeometryBuffers for UiBuffers {
+    fn resize(&mut self, vertex_count: usize, index_count: usize) {
+        // Drop the old buffers first so both aren't alive at the same time
+        self.vertices = None;
+        self.indices = None;
+        self.vertices = Some(DynamicVertexBuffer::new(vertex_count as u32,
+                                                      &self.vertex_decl,
+                                                      bgfx::BUFFER_NONE));
+        self.indices = Some(DynamicIndexBuffer::new(index_count as u32, bgfx::BUFFER_INDEX32));
+    }
+
+    fn update_vertices(&mut self, start: usize, vertices: &[ImDrawVert]) {
+        if let Some(ref buffer) = self.vertices {
+            buffer.update(start as u32, bgfx::Memory::copy(vertices));
+        }
+    }
+
+    fn update_indices(&mut self, start: usize, indices: &[u32]) {
+        if let Some(ref buffer) = self.indices {
+            buffer.update(start as u32, bgfx::Memory::copy(indices));
+        }
+    }
+}
+
 pub struct Renderer {
     pub bgfx: Box<Bgfx>,
+    backend: Backend,
     // TODO: I guess these needs to be moved when we support more than one window.
     pub width: u16,
     pub height: u16,
     tex_uniform: Option<bgfx::Uniform>,
     ui_shaders: Option<bgfx::Program>,
     texture: Option<bgfx::Texture>,
-    ui_vertex_decl: bgfx::VertexDecl,
+    ui_buffers: UiBuffers,
+    batcher: DrawBatcher,
+    soft_geometry: CpuGeometry,
+    soft_raster: Option<SoftRasterizer>,
+    stats: FrameStats,
+    /// Hash of the draw data that was last rendered and how many frames in a row it has been the same
+    last_frame_hash: u64,
+    unchanged_frames: u32,
+    size_changed: bool,
+    /// Texture updates don't change the draw data so they are tracked separately
+    last_texture_changes: u32,
 }
 
 impl Renderer {
     pub fn new() -> Renderer {
+        Self::with_backend(Backend::from_env())
+    }
+
+    pub fn with_backend(backend: Backend) -> Renderer {
         Renderer {
             bgfx: Box::new(Bgfx::new()),
+            backend: backend,
             width: 0,
             height: 0,
             tex_uniform: None,
             ui_shaders: None,
             texture: None,
-            ui_vertex_decl: UiVertex::build_decl(),
+            ui_buffers: UiBuffers {
+                vertex_decl: UiVertex::build_decl(),
+                vertices: None,
+                indices: None,
+            },
+            batcher: DrawBatcher::new(),
+            soft_geometry: CpuGeometry::new(),
+            soft_raster: None,
+            stats: FrameStats::default(),
+            last_frame_hash: 0,
+            unchanged_frames: 0,
+            size_changed: true,
+            last_texture_changes: 0,
         }
     }
 
@@ -69,6 +185,10 @@ impl Renderer {
                         width: u16,
                         height: u16)
                         -> Result<(), BgfxError> {
+        if self.backend != Backend::Default {
+            return self.setup_headless(width, height);
+        }
+
         try!(bgfx::PlatformData::new()
             .context(std::ptr::null_mut())
             .display(get_display_server())
@@ -77,6 +197,31 @@ impl Renderer {
 
         try!(Bgfx::init(bgfx::RendererType::Default, None, None));
 
+        self.setup_ui(width, height);
+
+        Ok(())
+    }
+
+    ///
+    /// Sets up rendering without a window using the bgfx null renderer. With the software backend
+    /// the UI is also rasterized to an image that can be fetched with software_image.
+    ///
+    pub fn setup_headless(&mut self, width: u16, height: u16) -> Result<(), BgfxError> {
+        try!(Bgfx::init(bgfx::RendererType::Null, None, None));
+
+        self.setup_ui(width, height);
+
+        if self.backend == Backend::Software {
+            let font = Imgui::get_font_tex_data();
+            let mut raster = SoftRasterizer::new(width as usize, height as usize);
+            raster.set_font_texture(font.width as usize, font.height as usize, font.data);
+            self.soft_raster = Some(raster);
+        }
+
+        Ok(())
+    }
+
+    fn setup_ui(&mut self, width: u16, height: u16) {
         Imgui::setup(Some("data/font/source_code_pro/SourceCodePro-Medium.ttf"),
                      20.0,
                      width as u32,
@@ -104,8 +249,23 @@ impl Renderer {
 
         self.width = width;
         self.height = height;
+    }
 
-        Ok(())
+    #[inline]
+    pub fn backend(&self) -> Backend {
+        self.backend
+    }
+
+    #[inline]
+    pub fn frame_stats(&self) -> FrameStats {
+        self.stats
+    }
+
+    ///
+    /// Last rendered frame as RGBA8 pixels together with width and height (software backend only)
+    ///
+    pub fn software_image(&self) -> Option<(&[u32], usize, usize)> {
+        self.soft_raster.as_ref().map(|r| (&r.pixels[..], r.width, r.height))
     }
 
     pub fn pre_update(&self) {
@@ -126,63 +286,136 @@ impl Renderer {
             self.height = size.1 as u16;
             Imgui::resize(self.width, self.height);
             Bgfx::reset(self.width, self.height, bgfx::RESET_VSYNC);
+            self.size_changed = true;
+
+            if let Some(ref mut raster) = self.soft_raster {
+                raster.resize(self.width as usize, self.height as usize);
+            }
+        }
+    }
+
+    ///
+    /// Returns true if the last frames rendered the same output. Together with no input or events
+    /// this means that building new frames can be skipped.
+    ///
+    #[inline]
+    pub fn is_idle(&self) -> bool {
+        self.unchanged_frames >= IDLE_FRAME_COUNT
+    }
+
+    fn render_software(&mut self) {
+        if let Some(ref mut raster) = self.soft_raster {
+            raster.clear(0xff101010);
+            raster.draw(self.batcher.batches(), &self.soft_geometry);
         }
     }
 
-    fn render_imgui(&self) {
-        let draw_lists = Imgui::get_draw_data();
+    ///
+    /// Submits the batches and returns the number of draw calls
+    ///
+    fn render_imgui(&self) -> usize {
         let view = mtx_ortho(0.0, self.width as f32, self.height as f32, 0.0, -1.0, 0.0);
+        let vertex_count = self.batcher.vertex_count() as u32;
+
+        let (vertices, indices) = match (&self.ui_buffers.vertices, &self.ui_buffers.indices) {
+            (&Some(ref vertices), &Some(ref indices)) => (vertices, indices),
+            _ => return 0,
+        };
+        let mut draw_calls = 0;
 
         Bgfx::set_view_transform(0, &view);
-        Bgfx::set_texture(0,
-                          self.tex_uniform.as_ref().unwrap(),
-                          self.texture.as_ref().unwrap(),
-                          None);
-
-        for &list in draw_lists {
-            let cmd_buffer = unsafe { (*list).cmd_buffer.as_slice() };
-            let idx_buffer = unsafe { (*list).idx_buffer.as_slice() };
-            let vtx_buffer = unsafe { (*list).vtx_buffer.as_slice() };
-
-            let mut tib = TransientIndexBuffer::new(idx_buffer.len());
-            let mut tvb = TransientVertexBuffer::new(vtx_buffer.len(), &self.ui_vertex_decl);
-
-            tib.update(&idx_buffer);
-            tvb.update(&vtx_buffer);
-
-            let mut offset = 0;
-
-            for cmd in cmd_buffer {
-                if cmd.texture_id != std::ptr::null_mut() {
-                    let texture = bgfx::Texture::new_from_handle_ptr(cmd.texture_id);
-                    Bgfx::set_texture(0, self.tex_uniform.as_ref().unwrap(), &texture, None);
-                } else {
-                    Bgfx::set_texture(0,
-                                      self.tex_uniform.as_ref().unwrap(),
-                                      self.texture.as_ref().unwrap(),
-                                      None);
-                }
-
-                if cmd.elem_count > 0 {
-                    Bgfx::set_transient_vertex_buffer(&tvb, 0, vtx_buffer.len() as u32);
-                    Bgfx::set_transient_index_buffer(&tib, offset, cmd.elem_count);
-                    Bgfx::set_state(bgfx::STATE_RGB_WRITE | bgfx::STATE_ALPHA_WRITE |
-                                    bgfx::STATE_BLEND_ALPHA,
-                                    None);
-                    Bgfx::submit(0, self.ui_shaders.as_ref().unwrap());
-
-                    offset += cmd.elem_count;
-                }
+
+        for batch in self.batcher.batches() {
+            if batch.texture_id != std::ptr::null_mut() {
+                let texture = bgfx::Texture::new_from_handle_ptr(batch.texture_id);
+                Bgfx::set_texture(0, self.tex_uniform.as_ref().unwrap(), &texture, None);
+            } else {
+                Bgfx::set_texture(0,
+                                  self.tex_uniform.as_ref().unwrap(),
+                                  self.texture.as_ref().unwrap(),
+                                  None);
+            }
+
+            let x0 = batch.clip_rect[0].max(0.0);
+            let y0 = batch.clip_rect[1].max(0.0);
+            let x1 = batch.clip_rect[2].min(self.width as f32);
+            let y1 = batch.clip_rect[3].min(self.height as f32);
+
+            if x1 <= x0 || y1 <= y0 {
+                continue;
             }
+
+            Bgfx::set_scissor(x0 as u16, y0 as u16, (x1 - x0) as u16, (y1 - y0) as u16);
+            Bgfx::set_dynamic_vertex_buffer(vertices, vertex_count);
+            Bgfx::set_dynamic_index_buffer(indices, batch.index_start, batch.index_count);
+            Bgfx::set_state(bgfx::STATE_RGB_WRITE | bgfx::STATE_ALPHA_WRITE |
+                            bgfx::STATE_BLEND_ALPHA,
+                            None);
+            Bgfx::submit(0, self.ui_shaders.as_ref().unwrap());
+            draw_calls += 1;
         }
+
+        draw_calls
     }
 
-    pub fn post_update(&self) {
+    pub fn post_update(&mut self) {
+        let start = Instant::now();
+
         Imgui::post_update();
 
-        self.render_imgui();
+        let lists: Vec<DrawListData> = Imgui::get_draw_data()
+            .iter()
+            .map(|&list| unsafe { DrawListData::from_draw_list(list) })
+            .collect();
+
+        // Only draw lists that has changed since last frame are uploaded
+        if self.soft_raster.is_some() {
+            self.batcher.prepare(&lists, &mut self.soft_geometry);
+        } else {
+            self.batcher.prepare(&lists, &mut self.ui_buffers);
+        }
+
+        let hash = self.batcher.frame_hash();
+        let texture_changes = Imgui::texture_change_count();
+        let batch_stats = self.batcher.stats();
+
+        self.stats = FrameStats {
+            draw_calls: 0,
+            vertices: self.batcher.vertex_count(),
+            indices: lists.iter().fold(0, |acc, list| acc + list.indices.len()),
+            vertices_uploaded: batch_stats.vertices_uploaded,
+            frame_time: Duration::from_secs(0),
+            skipped: true,
+        };
+
+        // If the frame looks exactly like the previous one the window already shows it
+        if hash == self.last_frame_hash && texture_changes == self.last_texture_changes &&
+           !self.size_changed {
+            self.unchanged_frames += 1;
+
+            if self.unchanged_frames % MAX_SKIPPED_PRESENTS != 0 {
+                self.stats.frame_time = start.elapsed();
+                return;
+            }
+        } else {
+            self.unchanged_frames = 0;
+        }
+
+        self.last_frame_hash = hash;
+        self.last_texture_changes = texture_changes;
+        self.size_changed = false;
+
+        self.stats.draw_calls = if self.soft_raster.is_some() {
+            self.render_software();
+            self.batcher.batches().len()
+        } else {
+            self.render_imgui()
+        };
 
         Bgfx::frame();
+
+        self.stats.frame_time = start.elapsed();
+        self.stats.skipped = false;
     }
 
     #[cfg(target_family="unix")]
@@ -0,0 +1,253 @@
+//! CPU rasterizer for the imgui geometry.
+//!
+//! Used by the software backend so the UI can be rendered (and inspected or compared) on machines
+//! without a GPU. It keeps its own copy of the geometry uploaded by the draw batcher and draws the
+//! batches into an RGBA8 image with the same layout as imgui colors (red in the lowest byte).
+//! Only the font texture is known on the CPU side so other textures are drawn as white.
+
+use std::os::raw::c_void;
+use imgui_sys::ImDrawVert;
+use draw_batcher::{Batch, GeometryBuffers};
+
+///
+/// CPU side copy of the geometry buffers
+///
+pub struct CpuGeometry {
+    pub vertices: Vec<ImDrawVert>,
+    pub indices: Vec<u32>,
+}
+
+impl CpuGeometry {
+    pub fn new() -> CpuGeometry {
+        CpuGeometry {
+            vertices: Vec::new(),
+            indices: Vec::new(),
+        }
+    }
+}
+
+impl GeometryBuffers for CpuGeometry {
+    fn resize(&mut self, vertex_count: usize, index_count: usize) {
+        self.vertices = vec![ImDrawVert::default(); vertex_count];
+        self.indices = vec![0; index_count];
+    }
+
+    fn update_vertices(&mut self, start: usize, vertices: &[ImDrawVert]) {
+        self.vertices[start..start + vertices.len()].copy_from_slice(vertices);
+    }
+
+    fn update_indices(&mut self, start: usize, indices: &[u32]) {
+        self.indices[start..start + indices.len()].copy_from_slice(indices);
+    }
+}
+
+struct SoftTexture {
+    width: usize,
+    height: usize,
+    data: Vec<u8>,
+}
+
+pub struct SoftRasterizer {
+    pub width: usize,
+    pub height: usize,
+    /// RGBA8 pixels, width * height
+    pub pixels: Vec<u32>,
+    font: Option<SoftTexture>,
+}
+
+#[inline]
+fn channel(color: u32, shift: u32) -> f32 {
+    ((color >> shift) & 0xff) as f32 * (1.0 / 255.0)
+}
+
+#[inline]
+fn edge(ax: f32, ay: f32, bx: f32, by: f32, px: f32, py: f32) -> f32 {
+    (bx - ax) * (py - ay) - (by - ay) * (px - ax)
+}
+
+impl SoftRasterizer {
+    pub fn new(width: usize, height: usize) -> SoftRasterizer {
+        SoftRasterizer {
+            width: width,
+            height: height,
+            pixels: vec![0; width * height],
+            font: None,
+        }
+    }
+
+    pub fn resize(&mut self, width: usize, height: usize) {
+        self.width = width;
+        self.height = height;
+        self.pixels = vec![0; width * height];
+    }
+
+    ///
+    /// Sets the texture used for batches with a null texture id. data is RGBA8.
+    ///
+    pub fn set_font_texture(&mut self, width: usize, height: usize, data: &[u8]) {
+        self.font = Some(SoftTexture {
+            width: width,
+            height: height,
+            data: data.to_vec(),
+        });
+    }
+
+    pub fn clear(&mut self, color: u32) {
+        for p in self.pixels.iter_mut() {
+            *p = color;
+        }
+    }
+
+    pub fn draw(&mut self, batches: &[Batch], geometry: &CpuGeometry) {
+        for batch in batches {
+            let start = batch.index_start as usize;
+            let end = start + batch.index_count as usize;
+
+            for tri in geometry.indices[start..end].chunks(3) {
+                if tri.len() != 3 {
+                    break;
+                }
+
+                self.draw_triangle(&geometry.vertices[tri[0] as usize],
+                                   &geometry.vertices[tri[1] as usize],
+                                   &geometry.vertices[tri[2] as usize],
+                                   batch.texture_id,
+                                   &batch.clip_rect);
+            }
+        }
+    }
+
+    fn sample(&self, texture_id: *mut c_void, u: f32, v: f32) -> [f32; 4] {
+        match self.font {
+            Some(ref tex) if texture_id.is_null() && tex.width > 0 && tex.height > 0 => {
+                let x = ((u * tex.width as f32) as isize).max(0).min(tex.width as isize - 1);
+                let y = ((v * tex.height as f32) as isize).max(0).min(tex.height as isize - 1);
+                let offset = (y as usize * tex.width + x as usize) * 4;
+                let t = &tex.data[offset..offset + 4];
+                [t[0] as f32 * (1.0 / 255.0),
+                 t[1] as f32 * (1.0 / 255.0),
+                 t[2] as f32 * (1.0 / 255.0),
+                 t[3] as f32 * (1.0 / 255.0)]
+            }
+            _ => [1.0, 1.0, 1.0, 1.0],
+        }
+    }
+
+    fn draw_triangle(&mut self,
+                     v0: &ImDrawVert,
+                     v1: &ImDrawVert,
+                     v2: &ImDrawVert,
+                     texture_id: *mut c_void,
+                     clip_rect: &[f32; 4]) {
+        let area = edge(v0.pos.x, v0.pos.y, v1.pos.x, v1.pos.y, v2.pos.x, v2.pos.y);
+
+        if area == 0.0 {
+            return;
+        }
+
+        let min_x = v0.pos.x.min(v1.pos.x).min(v2.pos.x).max(clip_rect[0]).max(0.0);
+        let min_y = v0.pos.y.min(v1.pos.y).min(v2.pos.y).max(clip_rect[1]).max(0.0);
+        let max_x = v0.pos.x.max(v1.pos.x).max(v2.pos.x).min(clip_rect[2]).min(self.width as f32);
+        let max_y = v0.pos.y.max(v1.pos.y).max(v2.pos.y).min(clip_rect[3]).min(self.height as f32);
+
+        if max_x <= min_x || max_y <= min_y {
+            return;
+        }
+
+        let inv_area = 1.0 / area;
+
+        for y in (min_y.floor() as usize)..(max_y.ceil() as usize) {
+            let py = y as f32 + 0.5;
+
+            for x in (min_x.floor() as usize)..(max_x.ceil() as usize) {
+                let px = x as f32 + 0.5;
+
+                // Barycentric weights, all the same sign as the area when the pixel is inside
+                let w0 = edge(v1.pos.x, v1.pos.y, v2.pos.x, v2.pos.y, px, py) * inv_area;
+                let w1 = edge(v2.pos.x, v2.pos.y, v0.pos.x, v0.pos.y, px, py) * inv_area;
+                let w2 = 1.0 - w0 - w1;
+
+                if w0 < 0.0 || w1 < 0.0 || w2 < 0.0 {
+                    continue;
+                }
+
+                let u = v0.uv.x * w0 + v1.uv.x * w1 + v2.uv.x * w2;
+                let v = v0.uv.y * w0 + v1.uv.y * w1 + v2.uv.y * w2;
+                let texel = self.sample(texture_id, u, v);
+
+                let mut src = [0.0; 4];
+
+                for c in 0..4 {
+                    let shift = c as u32 * 8;
+                    src[c] = (channel(v0.col, shift) * w0 + channel(v1.col, shift) * w1 +
+                              channel(v2.col, shift) * w2) * texel[c];
+                }
+
+                let pixel = &mut self.pixels[y * self.width + x];
+                let alpha = src[3];
+                let mut out = 0u32;
+
+                for c in 0..4 {
+                    let shift = c as u32 * 8;
+                    let dst = channel(*pixel, shift);
+                    let value = if c == 3 {
+                        alpha + dst * (1.0 - alpha)
+                    } else {
+                        src[c] * alpha + dst * (1.0 - alpha)
+                    };
+                    out |= ((value.max(0.0).min(1.0) * 255.0 + 0.5) as u32) << shift;
+                }
+
+                *pixel = out;
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::ptr;
+    use draw_batcher::Batch;
+    use imgui_sys::{ImDrawVert, ImVec2};
+
+    fn vert(x: f32, y: f32, col: u32) -> ImDrawVert {
+        ImDrawVert {
+            pos: ImVec2 { x: x, y: y },
+            uv: ImVec2 { x: 0.0, y: 0.0 },
+            col: col,
+        }
+    }
+
+    #[test]
+    fn test_draw_clipped_quad() {
+        let mut geometry = CpuGeometry::new();
+        geometry.resize(4, 6);
+        geometry.update_vertices(0,
+                                 &[vert(2.0, 2.0, 0xff0000ff),
+                                   vert(6.0, 2.0, 0xff0000ff),
+                                   vert(6.0, 6.0, 0xff0000ff),
+                                   vert(2.0, 6.0, 0xff0000ff)]);
+        geometry.update_indices(0, &[0, 1, 2, 0, 2, 3]);
+
+        let batch = Batch {
+            texture_id: ptr::null_mut(),
+            clip_rect: [0.0, 0.0, 4.0, 8.0],
+            index_start: 0,
+            index_count: 6,
+        };
+
+        let mut raster = SoftRasterizer::new(8, 8);
+        raster.clear(0xff000000);
+        raster.draw(&[batch], &geometry);
+
+        // No font texture set so it's drawn untextured
+        assert_eq!(raster.pixels[2 * 8 + 2], 0xff0000ff);
+        assert_eq!(raster.pixels[5 * 8 + 3], 0xff0000ff);
+        // Clipped
+        assert_eq!(raster.pixels[5 * 8 + 4], 0xff000000);
+        // Outside the quad
+        assert_eq!(raster.pixels[1 * 8 + 2], 0xff000000);
+        assert_eq!(raster.pixels[6 * 8 + 2], 0xff000000);
+    }
+}
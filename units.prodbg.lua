@@ -113,6 +113,7 @@ RustCrate  {
 	CargoConfig = "src/prodbg/core/Cargo.toml",
 	Sources = {
 		get_rs_src("src/prodbg/core"),
+		get_rs_src("src/crates/elf_debug_info"),
 		"src/prodbg/build.rs",
 	},
 }
@@ -198,6 +198,19 @@ RustProgram {
 
 -----------------------------------------------------------------------------------------------------------------------
 
+RustProgram {
+    Name = "uae_gdb_stub",
+    CargoConfig = "src/crates/uae_gdb_stub/Cargo.toml",
+    Sources = {
+        "src/crates/uae_gdb_stub/src/lib.rs",
+        "src/crates/uae_gdb_stub/src/main.rs",
+        "src/crates/uae_gdb_stub/src/session.rs",
+        "src/crates/uae_gdb_stub/src/target.rs",
+    },
+}
+
+-----------------------------------------------------------------------------------------------------------------------
+
 -- Default "bgfx_shaderc"
 Default "api_gen"
 